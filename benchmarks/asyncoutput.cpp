@@ -0,0 +1,309 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of Collabora OLE Automation Translator.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+// How long traced threads spend producing trace output. Compares the synchronous AddTimeStamp in
+// injecteddll.cpp, which formats the timestamp and writes and flushes each line to the sink with
+// a lock held, with AsyncOutput, which puts the line in a queue for a writer thread that writes
+// batches.
+//
+// AsyncOutput.cpp uses Win32 threads, events and Interlocked functions, so both are modelled here
+// with the same algorithms using std::thread and std::atomic. The sink writes each sputn() to a
+// file with write(), like an unbuffered console or pipe handle. Run it in a directory on a local
+// disk.
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const int NTHREADS = 4;
+static const int NLINES = 50000;
+
+static const char sLine[]
+    = "Word.Documents<000000001234ABCD>.Add(<I4>-5,<BSTR>\"Normal\",<BOOL>True) -> "
+      "<DISPATCH>0000000000ABCDEF\n";
+
+class FileSink : public std::streambuf
+{
+public:
+    explicit FileSink(int nFd)
+        : mnFd(nFd)
+    {
+    }
+
+protected:
+    std::streamsize xsputn(const char* pChars, std::streamsize nCount) override
+    {
+        return write(mnFd, pChars, (size_t)nCount);
+    }
+
+private:
+    int mnFd;
+};
+
+static std::string timeStamp(std::chrono::system_clock::time_point aTime)
+{
+    const std::time_t nTime = std::chrono::system_clock::to_time_t(aTime);
+    std::stringstream s;
+    s << std::put_time(std::localtime(&nTime), "%F:%T") << "." << std::setw(3)
+      << std::setfill('0')
+      << (std::chrono::duration_cast<std::chrono::milliseconds>(aTime.time_since_epoch()).count()
+          % 1000);
+    return s.str();
+}
+
+// Like AddTimeStamp::writeLine()
+class SyncOutput
+{
+public:
+    explicit SyncOutput(std::streambuf* pSink)
+        : mpSink(pSink)
+    {
+    }
+
+    void writeLine(const char* pLine, size_t nLength, unsigned nThreadId)
+    {
+        std::lock_guard<std::mutex> aGuard(maLock);
+        std::string sText = timeStamp(std::chrono::system_clock::now()) + ":"
+                            + std::to_string(nThreadId) + ":";
+        sText.append(pLine, nLength);
+        mpSink->sputn(sText.data(), (std::streamsize)sText.size());
+        mpSink->pubsync();
+    }
+
+private:
+    std::streambuf* mpSink;
+    std::mutex maLock;
+};
+
+// Like the queue in AsyncOutput.cpp, without the overflow to separately allocated strings and the
+// dropping of lines, which don't happen here.
+class QueuedOutput
+{
+public:
+    static const long NSLOTS = 4096;
+    static const size_t NSLOTTEXT = 240;
+
+    explicit QueuedOutput(std::streambuf* pSink)
+        : mpSink(pSink)
+        , mnEnqueuePos(0)
+        , mnDequeuePos(0)
+        , mbWriterSleeping(false)
+        , mbStopping(false)
+    {
+        for (long i = 0; i < NSLOTS; ++i)
+            maSlots[i].mnSequence = i;
+        maWriter = std::thread(&QueuedOutput::writerThread, this);
+    }
+
+    ~QueuedOutput()
+    {
+        mbStopping = true;
+        wakeWriter();
+        maWriter.join();
+        consume();
+    }
+
+    void writeLine(const char* pLine, size_t nLength, unsigned nThreadId)
+    {
+        const auto aTime = std::chrono::system_clock::now();
+        for (;;)
+        {
+            long nPos = mnEnqueuePos;
+            Slot& rSlot = maSlots[nPos & (NSLOTS - 1)];
+            const long nDiff = rSlot.mnSequence - nPos;
+
+            if (nDiff == 0)
+            {
+                if (!mnEnqueuePos.compare_exchange_weak(nPos, nPos + 1))
+                    continue;
+                rSlot.maTime = aTime;
+                rSlot.mnThreadId = nThreadId;
+                std::memcpy(rSlot.maText, pLine, nLength);
+                rSlot.mnLength = (unsigned)nLength;
+                rSlot.mnSequence = nPos + 1;
+                wakeWriter();
+                return;
+            }
+            else if (nDiff < 0)
+            {
+                wakeWriter();
+                std::this_thread::yield();
+            }
+        }
+    }
+
+private:
+    struct Slot
+    {
+        std::atomic<long> mnSequence;
+        unsigned mnLength;
+        std::chrono::system_clock::time_point maTime;
+        unsigned mnThreadId;
+        char maText[NSLOTTEXT];
+    };
+
+    void wakeWriter()
+    {
+        if (mbWriterSleeping && mbWriterSleeping.exchange(false))
+        {
+            std::lock_guard<std::mutex> aGuard(maWakeLock);
+            maWake.notify_one();
+        }
+    }
+
+    bool isLineReady()
+    {
+        return maSlots[mnDequeuePos & (NSLOTS - 1)].mnSequence == mnDequeuePos + 1;
+    }
+
+    // The timestamp is cached per second like TimeStampCache does.
+    bool consume()
+    {
+        maBatch.clear();
+        long nPos = mnDequeuePos;
+        while (maSlots[nPos & (NSLOTS - 1)].mnSequence == nPos + 1)
+        {
+            const Slot& rSlot = maSlots[nPos & (NSLOTS - 1)];
+            const std::time_t nSecond = std::chrono::system_clock::to_time_t(rSlot.maTime);
+            if (nSecond != mnCachedSecond)
+            {
+                msCachedStamp = timeStamp(rSlot.maTime).substr(0, 19);
+                mnCachedSecond = nSecond;
+            }
+            const unsigned nFraction
+                = (unsigned)(std::chrono::duration_cast<std::chrono::milliseconds>(
+                                 rSlot.maTime.time_since_epoch())
+                                 .count()
+                             % 1000);
+            maBatch += msCachedStamp;
+            maBatch += '.';
+            maBatch += (char)('0' + nFraction / 100);
+            maBatch += (char)('0' + nFraction / 10 % 10);
+            maBatch += (char)('0' + nFraction % 10);
+            maBatch += ':';
+            maBatch += std::to_string(rSlot.mnThreadId);
+            maBatch += ':';
+            maBatch.append(rSlot.maText, rSlot.mnLength);
+            nPos++;
+        }
+        if (maBatch.empty())
+            return false;
+
+        mpSink->sputn(maBatch.data(), (std::streamsize)maBatch.size());
+        mpSink->pubsync();
+        for (long i = mnDequeuePos; i != nPos; ++i)
+            maSlots[i & (NSLOTS - 1)].mnSequence = i + NSLOTS;
+        mnDequeuePos = nPos;
+        return true;
+    }
+
+    void writerThread()
+    {
+        while (!mbStopping)
+        {
+            if (consume())
+                continue;
+
+            std::unique_lock<std::mutex> aGuard(maWakeLock);
+            mbWriterSleeping = true;
+            if (isLineReady() || mbStopping)
+            {
+                mbWriterSleeping = false;
+                continue;
+            }
+            maWake.wait_for(aGuard, std::chrono::milliseconds(100));
+            mbWriterSleeping = false;
+        }
+    }
+
+    std::streambuf* mpSink;
+    Slot maSlots[NSLOTS];
+    std::atomic<long> mnEnqueuePos;
+    long mnDequeuePos;
+    std::atomic<bool> mbWriterSleeping;
+    std::atomic<bool> mbStopping;
+    std::mutex maWakeLock;
+    std::condition_variable maWake;
+    std::thread maWriter;
+    std::string maBatch;
+    std::time_t mnCachedSecond = -1;
+    std::string msCachedStamp;
+};
+
+// Returns the time the producing threads took, and in rTotal the time until all was written
+template <typename Output>
+static double produce(std::streambuf* pSink, double& rTotal)
+{
+    const auto aStart = std::chrono::steady_clock::now();
+    std::atomic<long long> nProducerNanoseconds(0);
+    {
+        Output aOutput(pSink);
+        std::vector<std::thread> aThreads;
+        for (int t = 0; t < NTHREADS; ++t)
+            aThreads.emplace_back([&aOutput, &nProducerNanoseconds, t]() {
+                const auto aThreadStart = std::chrono::steady_clock::now();
+                for (int i = 0; i < NLINES; ++i)
+                    aOutput.writeLine(sLine, sizeof(sLine) - 1, 1000 + (unsigned)t);
+                nProducerNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                            std::chrono::steady_clock::now() - aThreadStart)
+                                            .count();
+            });
+        for (auto& rThread : aThreads)
+            rThread.join();
+    }
+    rTotal = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - aStart)
+                 .count();
+    return (double)nProducerNanoseconds / NTHREADS / 1e6;
+}
+
+int main()
+{
+    static const char sFileName[] = "asyncoutput-benchmark.txt";
+    const int nFd = open(sFileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (nFd == -1)
+    {
+        std::cerr << "Could not create " << sFileName << "\n";
+        return 1;
+    }
+    FileSink aSink(nFd);
+
+    double fSyncTotal, fAsyncTotal;
+    const double fSync = produce<SyncOutput>(&aSink, fSyncTotal);
+    const off_t nSyncSize = lseek(nFd, 0, SEEK_CUR);
+    const double fAsync = produce<QueuedOutput>(&aSink, fAsyncTotal);
+    const off_t nAsyncSize = lseek(nFd, 0, SEEK_CUR) - nSyncSize;
+
+    close(nFd);
+    unlink(sFileName);
+
+    std::cout << NTHREADS << " threads writing " << NLINES << " lines each to a file:\n"
+              << "  synchronous:  " << fSync << " ms per thread, " << fSyncTotal
+              << " ms until written\n"
+              << "  queued:       " << fAsync << " ms per thread, " << fAsyncTotal
+              << " ms until written\n";
+    if (nAsyncSize != nSyncSize)
+        std::cout << "But the queued output is " << nAsyncSize << " bytes, not " << nSyncSize
+                  << "!\n";
+    return nAsyncSize == nSyncSize ? 0 : 1;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab cinoptions=b1,g0,N-s cinkeys+=0=break: */
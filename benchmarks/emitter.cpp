@@ -0,0 +1,153 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of Collabora OLE Automation Translator.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+// How long genproxy's change detection takes when a regeneration changes nothing, which is the
+// common case, for a set of files the size of the output for Word, Excel and Office. Compares
+// what OutputFile used to do, write a .temp file and read it back together with the old file, with
+// what the Emitter does, hash the text and look at the manifest and the file's size and time.
+//
+// Run it in a directory on the disk where the generated files would be.
+
+#include <sys/stat.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+static const int NFILES = 2000;
+static const size_t NFILESIZE = 24 * 1024;
+
+// Same as stableHash() in genproxy.cpp
+static uint64_t stableHash(const std::string& rText)
+{
+    uint64_t nHash = 14695981039346656037ULL;
+    for (char c : rText)
+    {
+        nHash ^= (unsigned char)c;
+        nHash *= 1099511628211ULL;
+    }
+    return nHash;
+}
+
+struct Stamp
+{
+    uint64_t mnHash;
+    uint64_t mnSize;
+    int64_t mnWriteTime;
+};
+
+static bool getStamp(const std::string& rFilename, uint64_t& rSize, int64_t& rWriteTime)
+{
+    struct stat aStat;
+    if (stat(rFilename.c_str(), &aStat) != 0)
+        return false;
+    rSize = (uint64_t)aStat.st_size;
+    rWriteTime = (int64_t)aStat.st_mtime;
+    return true;
+}
+
+static std::string readFile(const std::string& rFilename)
+{
+    std::ifstream aFile(rFilename, std::ios::binary);
+    std::ostringstream aContents;
+    aContents << aFile.rdbuf();
+    return aContents.str();
+}
+
+static void writeFile(const std::string& rFilename, const std::string& rContents)
+{
+    std::ofstream aFile(rFilename, std::ios::binary);
+    aFile << rContents;
+}
+
+// Like OutputFile::close() before the Emitter
+static bool unchangedByTempFile(const std::string& rFilename, const std::string& rContents)
+{
+    const std::string sTemp = rFilename + ".temp";
+    writeFile(sTemp, rContents);
+    const bool bSame = (readFile(sTemp) == readFile(rFilename));
+    if (bSame)
+        std::remove(sTemp.c_str());
+    else
+        std::rename(sTemp.c_str(), rFilename.c_str());
+    return bSame;
+}
+
+// Like Emitter::isUnchanged()
+static bool unchangedByManifest(const std::string& rFilename, const std::string& rContents,
+                                const std::map<std::string, Stamp>& rManifest)
+{
+    const uint64_t nHash = stableHash(rContents);
+    uint64_t nSize;
+    int64_t nWriteTime;
+    if (!getStamp(rFilename, nSize, nWriteTime))
+        return false;
+    auto p = rManifest.find(rFilename);
+    if (p != rManifest.end() && p->second.mnSize == nSize && p->second.mnWriteTime == nWriteTime)
+        return p->second.mnHash == nHash;
+    return readFile(rFilename) == rContents;
+}
+
+template <typename F> static double millisecondsFor(F aFunction)
+{
+    const auto aStart = std::chrono::steady_clock::now();
+    aFunction();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - aStart)
+        .count();
+}
+
+int main()
+{
+    // Generated code is repetitive text, but that does not matter for any of this.
+    std::mt19937 aRandom(1);
+    std::vector<std::string> aContents(NFILES);
+    std::vector<std::string> aFilenames(NFILES);
+    std::map<std::string, Stamp> aManifest;
+    for (int i = 0; i < NFILES; ++i)
+    {
+        aFilenames[i] = "emitter-benchmark-" + std::to_string(i) + ".cxx";
+        aContents[i].resize(NFILESIZE);
+        for (char& c : aContents[i])
+            c = (char)(' ' + aRandom() % 95);
+        writeFile(aFilenames[i], aContents[i]);
+
+        Stamp aStamp{ stableHash(aContents[i]), 0, 0 };
+        getStamp(aFilenames[i], aStamp.mnSize, aStamp.mnWriteTime);
+        aManifest[aFilenames[i]] = aStamp;
+    }
+
+    int nUnchanged = 0;
+    const double fTempFile = millisecondsFor([&]() {
+        for (int i = 0; i < NFILES; ++i)
+            nUnchanged += unchangedByTempFile(aFilenames[i], aContents[i]);
+    });
+    const double fManifest = millisecondsFor([&]() {
+        for (int i = 0; i < NFILES; ++i)
+            nUnchanged += unchangedByManifest(aFilenames[i], aContents[i], aManifest);
+    });
+
+    for (const std::string& rFilename : aFilenames)
+        std::remove(rFilename.c_str());
+
+    std::cout << NFILES << " unchanged files of " << NFILESIZE / 1024 << " KiB, one thread:\n"
+              << "  .temp file and byte compare: " << fTempFile << " ms\n"
+              << "  hash and manifest:           " << fManifest << " ms\n";
+    if (nUnchanged != 2 * NFILES)
+        std::cout << "But only " << nUnchanged << " were found unchanged!\n";
+    return nUnchanged == 2 * NFILES ? 0 : 1;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab cinoptions=b1,g0,N-s cinkeys+=0=break: */
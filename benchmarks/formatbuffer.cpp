@@ -0,0 +1,258 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of Collabora OLE Automation Translator.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+// How long it takes to print the arguments of a typical traced call. Compares the operator<< for
+// VARIANT as it was before FormatBuffer, which built std::strings for the type names and hex
+// numbers and wrote strings to the stream a character at a time, with formatting into a
+// FormatBuffer on the stack and one write() of it, as utils.hpp does now.
+//
+// The stream is unbuffered and just counts what it gets, like the AddTimeStamp streambuf that the
+// trace output goes through, which sees each character separately. The VARIANT is a stand-in with
+// the members that are printed.
+
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <streambuf>
+#include <string>
+
+#include "formatbuffer.hpp"
+
+static const int NCALLS = 1000000;
+
+static const uint16_t VT_I4 = 3;
+static const uint16_t VT_R8 = 5;
+static const uint16_t VT_BSTR = 8;
+static const uint16_t VT_DISPATCH = 9;
+static const uint16_t VT_BOOL = 11;
+
+struct MockVariant
+{
+    uint16_t vt;
+    union {
+        int32_t lVal;
+        double dblVal;
+        const char16_t* bstrVal;
+        int16_t boolVal;
+        void* pdispVal;
+    };
+};
+
+class CountingStreamBuf : public std::streambuf
+{
+public:
+    CountingStreamBuf()
+        : mnCount(0)
+    {
+    }
+
+    size_t mnCount;
+
+protected:
+    int_type overflow(int_type c) override
+    {
+        mnCount++;
+        return traits_type::not_eof(c);
+    }
+
+    std::streamsize xsputn(const char*, std::streamsize nCount) override
+    {
+        mnCount += (size_t)nCount;
+        return nCount;
+    }
+};
+
+static size_t length(const char16_t* pChars)
+{
+    size_t n = 0;
+    while (pChars[n] != 0)
+        n++;
+    return n;
+}
+
+// The old to_uhex() and VARTYPE_to_string(), for the types used here
+
+static std::string oldHex(uint32_t n, int w = 0)
+{
+    std::stringstream aStringStream;
+    aStringStream << std::setfill('0') << std::setw(w) << std::uppercase << std::hex << n;
+    return aStringStream.str();
+}
+
+static std::string oldVartype(uint16_t nVt)
+{
+    std::string sResult;
+    switch (nVt)
+    {
+        case VT_I4:
+            sResult += "I4";
+            break;
+        case VT_R8:
+            sResult += "R8";
+            break;
+        case VT_BSTR:
+            sResult += "BSTR";
+            break;
+        case VT_DISPATCH:
+            sResult += "DISPATCH";
+            break;
+        case VT_BOOL:
+            sResult += "BOOL";
+            break;
+        default:
+            sResult += "?(" + std::to_string(nVt) + ")";
+            break;
+    }
+    return sResult;
+}
+
+// The old outputWcharString(), without the surrogate pair handling, which these strings don't need
+static void oldString(const char16_t* pChars, size_t nLength, std::ostream& rStream)
+{
+    rStream << "\"";
+    if (nLength > 100)
+        nLength = 100;
+    for (size_t i = 0; i < nLength; i++)
+    {
+        if (pChars[i] == '"' || pChars[i] == '\\')
+            rStream << '\\' << (char)pChars[i];
+        else if (pChars[i] == '\n')
+            rStream << "\\n";
+        else if (pChars[i] == '\r')
+            rStream << "\\r";
+        else if (pChars[i] >= ' ' && pChars[i] <= '~')
+            rStream << (char)pChars[i];
+        else
+            rStream << "\\u{" << oldHex((uint32_t)pChars[i]) << "}";
+    }
+    rStream << "\"";
+}
+
+static void oldVariant(const MockVariant& rVariant, std::ostream& rStream)
+{
+    rStream << "<" << oldVartype(rVariant.vt) << ">";
+    switch (rVariant.vt)
+    {
+        case VT_I4:
+            rStream << rVariant.lVal;
+            break;
+        case VT_R8:
+            rStream << rVariant.dblVal;
+            break;
+        case VT_BSTR:
+            oldString(rVariant.bstrVal, length(rVariant.bstrVal), rStream);
+            break;
+        case VT_DISPATCH:
+            rStream << rVariant.pdispVal;
+            break;
+        case VT_BOOL:
+            rStream << (rVariant.boolVal ? "True" : "False");
+            break;
+    }
+}
+
+// Like formatVARIANT() in utils.hpp
+static void newVariant(const MockVariant& rVariant, FormatBuffer& rBuffer)
+{
+    rBuffer.append('<');
+    formatVartype(rBuffer, rVariant.vt);
+    rBuffer.append('>');
+    switch (rVariant.vt)
+    {
+        case VT_I4:
+            rBuffer.appendSigned(rVariant.lVal);
+            break;
+        case VT_R8:
+            rBuffer.appendDouble(rVariant.dblVal);
+            break;
+        case VT_BSTR:
+        {
+            const size_t nLength = length(rVariant.bstrVal);
+            rBuffer.appendQuotedUTF16(rVariant.bstrVal,
+                                      formatTruncatedUTF16Length(rVariant.bstrVal, nLength));
+            break;
+        }
+        case VT_DISPATCH:
+            rBuffer.appendPointer(reinterpret_cast<uintptr_t>(rVariant.pdispVal), sizeof(void*));
+            break;
+        case VT_BOOL:
+            rBuffer.append(rVariant.boolVal ? "True" : "False");
+            break;
+    }
+}
+
+template <typename F> static double millisecondsFor(F aFunction)
+{
+    const auto aStart = std::chrono::steady_clock::now();
+    aFunction();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - aStart)
+        .count();
+}
+
+int main()
+{
+    static const int NARGS = 5;
+    MockVariant aArgs[NARGS];
+    aArgs[0].vt = VT_I4;
+    aArgs[0].lVal = -12345;
+    aArgs[1].vt = VT_R8;
+    aArgs[1].dblVal = 72.5;
+    aArgs[2].vt = VT_BSTR;
+    aArgs[2].bstrVal = u"The quick brown fox jumps over the \"lazy\" dog\n";
+    aArgs[3].vt = VT_BOOL;
+    aArgs[3].boolVal = -1;
+    aArgs[4].vt = VT_DISPATCH;
+    aArgs[4].pdispVal = reinterpret_cast<void*>((uintptr_t)0x1234ABCD);
+
+    CountingStreamBuf aOldSink;
+    std::ostream aOldStream(&aOldSink);
+    const double fOld = millisecondsFor([&]() {
+        for (int i = 0; i < NCALLS; ++i)
+        {
+            aOldStream << "(";
+            for (int n = 0; n < NARGS; ++n)
+            {
+                if (n > 0)
+                    aOldStream << ",";
+                oldVariant(aArgs[n], aOldStream);
+            }
+            aOldStream << ")";
+        }
+    });
+
+    CountingStreamBuf aNewSink;
+    std::ostream aNewStream(&aNewSink);
+    const double fNew = millisecondsFor([&]() {
+        for (int i = 0; i < NCALLS; ++i)
+        {
+            char aBuffer[1024];
+            FormatBuffer aFormat(aBuffer, sizeof(aBuffer));
+            aFormat.append('(');
+            for (int n = 0; n < NARGS; ++n)
+            {
+                if (n > 0)
+                    aFormat.append(',');
+                newVariant(aArgs[n], aFormat);
+            }
+            aFormat.append(')');
+            aNewStream.write(aFormat.data(), (std::streamsize)aFormat.size());
+        }
+    });
+
+    std::cout << NCALLS << " calls with I4, R8, BSTR, BOOL and DISPATCH arguments:\n"
+              << "  iostream:      " << fOld << " ms, " << aOldSink.mnCount / NCALLS
+              << " characters per call\n"
+              << "  FormatBuffer:  " << fNew << " ms, " << aNewSink.mnCount / NCALLS
+              << " characters per call\n";
+    return 0;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab cinoptions=b1,g0,N-s cinkeys+=0=break: */
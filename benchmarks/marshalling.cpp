@@ -0,0 +1,175 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of Collabora OLE Automation Translator.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+// How long a generated proxy method takes to put its parameters into the form genericInvoke()
+// passes in DISPPARAMS. Compares what the generated code used to do, fill a std::vector<VARIANT>,
+// copy it reversed into a second vector and pass that, with what it does now, fill a std::array
+// on the stack from the end backwards and pass a pointer and count.
+//
+// The VARIANT here is a stand-in of the same size as the real one on x64. The call to the mock
+// genericInvoke() is not inlined, so that the parameters really have to be stored.
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+static const int NCALLS = 10000000;
+
+struct MockVariant
+{
+    uint16_t vt;
+    uint16_t wReserved1, wReserved2, wReserved3;
+    union {
+        int32_t lVal;
+        double dblVal;
+        void* byref;
+    };
+    void* pRecInfo;
+};
+
+static const uint16_t VT_EMPTY = 0;
+static const uint16_t VT_I4 = 3;
+static const uint16_t VT_R8 = 5;
+static const uint16_t VT_BSTR = 8;
+
+static void VariantInit(MockVariant* pVariant)
+{
+    pVariant->vt = VT_EMPTY;
+}
+
+static long nChecksum = 0;
+
+// Like CProxiedDispatch::genericInvoke() before, which took the vector by reference
+__attribute__((noinline)) static long oldInvoke(std::vector<MockVariant>& rParameters)
+{
+    long nResult = (long)rParameters.size();
+    for (const MockVariant& rParam : rParameters)
+        nResult += rParam.vt;
+    return nResult;
+}
+
+// Like CProxiedDispatch::genericInvoke() now
+__attribute__((noinline)) static long newInvoke(MockVariant* pParameters, unsigned nParameters)
+{
+    long nResult = (long)nParameters;
+    for (unsigned i = 0; i < nParameters; ++i)
+        nResult += pParameters[i].vt;
+    return nResult;
+}
+
+// What a generated method with four parameters, the last one optional and missing, used to do
+static void oldMethod(int32_t nCount, double fWidth, void* pName, const MockVariant& rOptional)
+{
+    std::vector<MockVariant> vParams(4);
+    unsigned nActualParams = 0;
+
+    VariantInit(&vParams[0]);
+    vParams[nActualParams].vt = VT_I4;
+    vParams[nActualParams].lVal = nCount;
+    nActualParams++;
+
+    VariantInit(&vParams[1]);
+    vParams[nActualParams].vt = VT_R8;
+    vParams[nActualParams].dblVal = fWidth;
+    nActualParams++;
+
+    VariantInit(&vParams[2]);
+    vParams[nActualParams].vt = VT_BSTR;
+    vParams[nActualParams].byref = pName;
+    nActualParams++;
+
+    vParams[nActualParams] = rOptional;
+    nActualParams++;
+
+    std::vector<MockVariant> vReverseParams;
+    while (nActualParams > 0 && vParams[nActualParams - 1].vt == VT_EMPTY)
+        nActualParams--;
+    vParams.resize(nActualParams);
+    for (auto i = vParams.rbegin(); i != vParams.rend(); ++i)
+        vReverseParams.push_back(*i);
+
+    nChecksum += oldInvoke(vReverseParams);
+}
+
+// The same method as generated now
+static void newMethod(int32_t nCount, double fWidth, void* pName, const MockVariant& rOptional)
+{
+    std::array<MockVariant, 4> aParams;
+    constexpr unsigned nLastParam = 3;
+    unsigned nActualParams = 0;
+
+    {
+        MockVariant& rArg = aParams[nLastParam - nActualParams];
+        VariantInit(&rArg);
+        rArg.vt = VT_I4;
+        rArg.lVal = nCount;
+        nActualParams++;
+    }
+    {
+        MockVariant& rArg = aParams[nLastParam - nActualParams];
+        VariantInit(&rArg);
+        rArg.vt = VT_R8;
+        rArg.dblVal = fWidth;
+        nActualParams++;
+    }
+    {
+        MockVariant& rArg = aParams[nLastParam - nActualParams];
+        VariantInit(&rArg);
+        rArg.vt = VT_BSTR;
+        rArg.byref = pName;
+        nActualParams++;
+    }
+    {
+        MockVariant& rArg = aParams[nLastParam - nActualParams];
+        rArg = rOptional;
+        nActualParams++;
+    }
+
+    while (nActualParams > 0 && aParams[nLastParam - (nActualParams - 1)].vt == VT_EMPTY)
+        nActualParams--;
+
+    nChecksum += newInvoke(aParams.data() + nLastParam + 1 - nActualParams, nActualParams);
+}
+
+template <typename F> static double millisecondsFor(F aFunction)
+{
+    const auto aStart = std::chrono::steady_clock::now();
+    aFunction();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - aStart)
+        .count();
+}
+
+int main()
+{
+    MockVariant aMissing;
+    VariantInit(&aMissing);
+    char aName[] = "name";
+
+    const double fOld = millisecondsFor([&]() {
+        for (int i = 0; i < NCALLS; ++i)
+            oldMethod(i, 1.5, aName, aMissing);
+    });
+    const long nOldChecksum = nChecksum;
+    nChecksum = 0;
+    const double fNew = millisecondsFor([&]() {
+        for (int i = 0; i < NCALLS; ++i)
+            newMethod(i, 1.5, aName, aMissing);
+    });
+
+    std::cout << NCALLS << " calls of a method with three parameters and a missing optional one:\n"
+              << "  two vectors:  " << fOld << " ms\n"
+              << "  stack array:  " << fNew << " ms\n";
+    if (nChecksum != nOldChecksum)
+        std::cout << "But the parameters passed differ!\n";
+    return nChecksum == nOldChecksum ? 0 : 1;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab cinoptions=b1,g0,N-s cinkeys+=0=break: */
@@ -0,0 +1,207 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of Collabora OLE Automation Translator.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+// How long it takes to create and release a proxy for each item of a collection with a million
+// items, like a client walking the paragraphs of a large document does. Compares allocating each
+// proxy with new and delete, as before ProxyPool, with ProxyPool's slabs and free lists.
+//
+// ProxyPool.cpp uses SRWLOCK, so its allocate() and deallocate() are copied here with a std::mutex
+// instead, and without the statistics.
+
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <new>
+#include <string>
+#include <vector>
+
+static const int NITEMS = 1000000;
+
+// About the size of a generated proxy for a dual interface on x64
+static const size_t NPROXYSIZE = 96;
+
+// The client keeps the last few items around, as it would when it looks at neighbouring
+// paragraphs, so proxies are not simply freed in the order they were created.
+static const int NWINDOW = 8;
+
+namespace ProxyPool
+{
+static const size_t NGRANULE = 16;
+static const size_t NSIZECLASSES = 32;
+static const size_t NSLAB = 64 * 1024;
+
+static const size_t NOSIZECLASS = (size_t)-1;
+
+union BlockHeader
+{
+    size_t mnSizeClass;
+    char maPadding[NGRANULE];
+};
+
+struct FreeBlock
+{
+    FreeBlock* mpNext;
+};
+
+struct SizeClass
+{
+    std::mutex maLock;
+    FreeBlock* mpFreeList;
+    char* mpSlabRover;
+    char* mpSlabEnd;
+};
+
+static SizeClass aSizeClasses[NSIZECLASSES];
+
+static void* allocate(size_t nSize)
+{
+    const size_t nGranules = (nSize + NGRANULE - 1) / NGRANULE;
+
+    if (nGranules == 0 || nGranules > NSIZECLASSES)
+    {
+        BlockHeader* pHeader
+            = static_cast<BlockHeader*>(::operator new(sizeof(BlockHeader) + nSize));
+        pHeader->mnSizeClass = NOSIZECLASS;
+        return pHeader + 1;
+    }
+
+    const size_t nSizeClass = nGranules - 1;
+    const size_t nBlockSize = sizeof(BlockHeader) + nGranules * NGRANULE;
+    SizeClass& rClass = aSizeClasses[nSizeClass];
+    BlockHeader* pHeader;
+
+    rClass.maLock.lock();
+
+    if (rClass.mpFreeList != nullptr)
+    {
+        pHeader = reinterpret_cast<BlockHeader*>(rClass.mpFreeList);
+        rClass.mpFreeList = rClass.mpFreeList->mpNext;
+    }
+    else
+    {
+        if (rClass.mpSlabRover == nullptr
+            || rClass.mpSlabEnd - rClass.mpSlabRover < (ptrdiff_t)nBlockSize)
+        {
+            rClass.mpSlabRover = static_cast<char*>(::operator new(NSLAB));
+            rClass.mpSlabEnd = rClass.mpSlabRover + NSLAB;
+        }
+        pHeader = reinterpret_cast<BlockHeader*>(rClass.mpSlabRover);
+        rClass.mpSlabRover += nBlockSize;
+    }
+
+    rClass.maLock.unlock();
+
+    pHeader->mnSizeClass = nSizeClass;
+    return pHeader + 1;
+}
+
+static void deallocate(void* pObject)
+{
+    if (pObject == nullptr)
+        return;
+
+    BlockHeader* pHeader = static_cast<BlockHeader*>(pObject) - 1;
+
+    if (pHeader->mnSizeClass == NOSIZECLASS)
+    {
+        ::operator delete(pHeader);
+        return;
+    }
+
+    SizeClass& rClass = aSizeClasses[pHeader->mnSizeClass];
+
+    rClass.maLock.lock();
+
+    FreeBlock* pBlock = reinterpret_cast<FreeBlock*>(pHeader);
+    pBlock->mpNext = rClass.mpFreeList;
+    rClass.mpFreeList = pBlock;
+
+    rClass.maLock.unlock();
+}
+} // namespace ProxyPool
+
+static void* heapAllocate(size_t nSize) { return ::operator new(nSize); }
+
+static void heapDeallocate(void* pObject) { ::operator delete(pObject); }
+
+// Each item also gets some other short-lived heap allocations, like the BSTR of its text and the
+// strings the tracing output is built from, which is what fragments the heap in a real client.
+template <typename Allocate, typename Deallocate>
+static double walkCollection(Allocate pAllocate, Deallocate pDeallocate, size_t& rChecksum)
+{
+    std::vector<void*> aWindow(NWINDOW, nullptr);
+
+    const auto aStart = std::chrono::steady_clock::now();
+    for (int i = 0; i < NITEMS; ++i)
+    {
+        void*& rSlot = aWindow[(size_t)i % NWINDOW];
+        pDeallocate(rSlot);
+        rSlot = pAllocate(NPROXYSIZE);
+        std::memset(rSlot, 0, NPROXYSIZE);
+
+        std::string sText = "Paragraph " + std::to_string(i) + " of a large document";
+        rChecksum += sText.size() + (reinterpret_cast<size_t>(rSlot) & 0xFF);
+    }
+    for (void* pObject : aWindow)
+        pDeallocate(pObject);
+
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - aStart)
+        .count();
+}
+
+// A client that collects all the items first, and then lets go of them.
+template <typename Allocate, typename Deallocate>
+static double holdCollection(Allocate pAllocate, Deallocate pDeallocate, size_t& rChecksum)
+{
+    std::vector<void*> aProxies((size_t)NITEMS);
+
+    const auto aStart = std::chrono::steady_clock::now();
+    for (void*& rProxy : aProxies)
+    {
+        rProxy = pAllocate(NPROXYSIZE);
+        std::memset(rProxy, 0, NPROXYSIZE);
+        rChecksum += reinterpret_cast<size_t>(rProxy) & 0xFF;
+    }
+    for (void* pProxy : aProxies)
+        pDeallocate(pProxy);
+
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - aStart)
+        .count();
+}
+
+int main()
+{
+    size_t nChecksum = 0;
+
+    // The pool is run twice for the second collection, as the first run only fills the slabs and
+    // a client that walks a collection once typically does it again.
+    const double fHeapWalk = walkCollection(heapAllocate, heapDeallocate, nChecksum);
+    const double fPoolWalk
+        = walkCollection(ProxyPool::allocate, ProxyPool::deallocate, nChecksum);
+    const double fHeapHold = holdCollection(heapAllocate, heapDeallocate, nChecksum);
+    const double fPoolHoldFirst
+        = holdCollection(ProxyPool::allocate, ProxyPool::deallocate, nChecksum);
+    const double fPoolHoldAgain
+        = holdCollection(ProxyPool::allocate, ProxyPool::deallocate, nChecksum);
+
+    std::cout << NITEMS << " proxies of " << NPROXYSIZE << " bytes, one thread:\n"
+              << "  walking, " << NWINDOW << " live at a time:\n"
+              << "    new and delete:  " << fHeapWalk << " ms\n"
+              << "    ProxyPool:       " << fPoolWalk << " ms\n"
+              << "  all live at once:\n"
+              << "    new and delete:  " << fHeapHold << " ms\n"
+              << "    ProxyPool:       " << fPoolHoldFirst << " ms, then " << fPoolHoldAgain
+              << " ms when the slabs are there\n";
+    // Just so that nothing is optimised away
+    return nChecksum == 0 ? 1 : 0;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab cinoptions=b1,g0,N-s cinkeys+=0=break: */
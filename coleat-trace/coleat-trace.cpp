@@ -0,0 +1,518 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of Collabora OLE Automation Translator.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+// Prints a binary trace file written when running coleat with the -b option in the same format as
+// the -t option would have, or as Chrome trace events. Unlike the rest of COLEAT this program does
+// not use any Windows API and builds also on Linux, see BUILD.txt.
+
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable : 4668 4820 4917)
+#endif
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+
+#include "chrometrace.hpp"
+#include "formatbuffer.hpp"
+#include "tracerecord.hpp"
+
+static std::vector<char> aData;
+static const TraceFileHeader* pHeader;
+
+// For the -j option
+static ChromeTraceWriter* pChromeTrace;
+
+// Like CProxiedUnknown::mbIsAtBeginningOfLine
+static bool bIsAtBeginningOfLine = true;
+
+// The timestamp and thread of the record being printed
+static uint64_t nCurrentTicks;
+static uint32_t nCurrentThreadId;
+
+// The thread whose call the current line is about
+static uint32_t nLineThreadId;
+
+// Prefixes lines with the time and thread id like the AddTimeStamp class in injecteddll.cpp does,
+// but using the timestamps and threads of the records instead of the current ones.
+
+class AddTimeStamp : public std::streambuf
+{
+public:
+    AddTimeStamp(std::basic_ios<char>& rStream)
+        : mrStream(rStream)
+        , mpSink(rStream.rdbuf(this))
+        , mbNewline(true)
+    {
+    }
+
+    ~AddTimeStamp() { mrStream.rdbuf(mpSink); }
+
+    AddTimeStamp(const AddTimeStamp&) = delete;
+    AddTimeStamp& operator=(const AddTimeStamp&) = delete;
+
+protected:
+    int_type overflow(int_type c) override
+    {
+        if (traits_type::eq_int_type(c, traits_type::eof()))
+            return mpSink->pubsync() == -1 ? c : traits_type::not_eof(c);
+        if (mbNewline)
+        {
+            std::ostream aSink(mpSink);
+            if (!(aSink << getTimeStamp() << ":" << nCurrentThreadId << ":"))
+                return traits_type::eof();
+        }
+        mbNewline = traits_type::to_char_type(c) == '\n';
+        return mpSink->sputc(traits_type::to_char_type(c));
+    }
+
+    int sync() override { return mpSink->pubsync(); }
+
+private:
+    static std::string getTimeStamp()
+    {
+        uint64_t nTicks = nCurrentTicks > pHeader->mnStartTicks
+                              ? nCurrentTicks - pHeader->mnStartTicks
+                              : 0;
+        const uint64_t nPerSecond = pHeader->mnTicksPerSecond ? pHeader->mnTicksPerSecond : 1;
+        const uint64_t nMilliseconds = pHeader->mnStartMilliseconds + nTicks / nPerSecond * 1000
+                                       + nTicks % nPerSecond * 1000 / nPerSecond;
+
+        std::time_t nTime
+            = (std::time_t)(nMilliseconds / 1000) + (std::time_t)pHeader->mnLocalTimeOffsetSeconds;
+        std::stringstream s;
+
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable : 4996)
+#endif
+        s << std::put_time(std::gmtime(&nTime), "%F:%T") << "." << std::setw(3)
+          << std::setfill('0') << nMilliseconds % 1000;
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+
+        return s.str();
+    }
+
+    std::basic_ios<char>& mrStream;
+    std::streambuf* mpSink;
+    bool mbNewline;
+};
+
+static void Usage(char** argv)
+{
+    std::cerr << "Usage: " << argv[0]
+              << " [-j] file\n"
+                 "\n"
+                 "  Prints a binary trace file written by coleat -b like coleat -t would have.\n"
+                 "\n"
+                 "  Options:\n"
+                 "    -j          print Chrome trace event JSON instead, for chrome://tracing or\n"
+                 "                https://ui.perfetto.dev\n";
+    std::exit(1);
+}
+
+static std::string nameString(TraceNameId nId)
+{
+    if (nId == 0 || nId + sizeof(TraceNameRecord) > pHeader->mnNamesCapacity)
+        return "?";
+
+    const char* pRecord = aData.data() + pHeader->mnNamesOffset + nId;
+    TraceNameRecord aName;
+    std::memcpy(&aName, pRecord, sizeof(aName));
+    if (aName.maHeader.mnMagic != TRACE_RECORD_MAGIC || aName.maHeader.mnType != TRACE_NAME
+        || nId + sizeof(TraceNameRecord) + aName.mnLength > pHeader->mnNamesCapacity)
+        return "?";
+
+    return std::string(pRecord + sizeof(aName), aName.mnLength);
+}
+
+// Formats an argument like formatVARIANT() in utils.hpp. Returns the number of bytes it occupies
+// in the record, or zero if it doesn't fit in what is left.
+static size_t formatArg(const char* pArgData, size_t nLeft, FormatBuffer& rBuffer)
+{
+    if (nLeft < sizeof(TraceArg))
+        return 0;
+
+    TraceArg aArg;
+    std::memcpy(&aArg, pArgData, sizeof(aArg));
+    const char* pPayload = pArgData + sizeof(aArg);
+
+    size_t nPayload = 0;
+    if (aArg.mnKind == TRACE_VALUE_WSTRING)
+        nPayload = traceAlign(aArg.mnLength * 2);
+    else if (aArg.mnKind == TRACE_VALUE_STRING)
+        nPayload = traceAlign(aArg.mnLength);
+    if (nLeft < sizeof(TraceArg) + nPayload)
+        return 0;
+
+    if (aArg.mnFlags & TRACE_ARG_OUT)
+    {
+        rBuffer.append("<OUT>");
+        return sizeof(TraceArg) + nPayload;
+    }
+
+    if (aArg.mnFlags & TRACE_ARG_NAMED)
+    {
+        rBuffer.append(nameString(aArg.mnArgName));
+        rBuffer.append(":=");
+    }
+
+    rBuffer.append('<');
+    if (aArg.mnVt & (TRACE_VT_VECTOR | TRACE_VT_ARRAY | TRACE_VT_BYREF))
+        formatVartype(rBuffer, aArg.mnVt);
+    else
+        formatVartype(rBuffer, (uint16_t)(aArg.mnVt & TRACE_VT_TYPEMASK));
+    rBuffer.append('>');
+
+    switch (aArg.mnKind)
+    {
+        case TRACE_VALUE_NONE:
+            break;
+        case TRACE_VALUE_SIGNED:
+            rBuffer.appendSigned((int64_t)aArg.mnValue);
+            break;
+        case TRACE_VALUE_UNSIGNED:
+            rBuffer.appendUnsigned(aArg.mnValue);
+            break;
+        case TRACE_VALUE_DOUBLE:
+        {
+            double fValue;
+            std::memcpy(&fValue, &aArg.mnValue, sizeof(fValue));
+            rBuffer.appendDouble(fValue);
+            break;
+        }
+        case TRACE_VALUE_BOOL:
+            rBuffer.append(aArg.mnValue ? "True" : "False");
+            break;
+        case TRACE_VALUE_POINTER:
+            rBuffer.appendPointer(aArg.mnValue, pHeader->mnPointerSize);
+            break;
+        case TRACE_VALUE_NAME:
+            rBuffer.append(nameString((TraceNameId)aArg.mnValue));
+            break;
+        case TRACE_VALUE_WSTRING:
+        {
+            // The string has already been truncated.
+            std::vector<uint16_t> aWchars(aArg.mnLength);
+            std::memcpy(aWchars.data(), pPayload, aArg.mnLength * 2);
+            rBuffer.appendQuotedUTF16(aWchars.data(), aArg.mnLength);
+            break;
+        }
+        case TRACE_VALUE_STRING:
+            rBuffer.appendQuoted(pPayload, aArg.mnLength);
+            break;
+        case TRACE_VALUE_NULLSTRING:
+            rBuffer.append("(null)");
+            break;
+        case TRACE_VALUE_DECIMAL:
+            rBuffer.appendHex(aArg.mnLength, 8);
+            rBuffer.appendHex(aArg.mnValue, 16);
+            break;
+        default:
+            rBuffer.append("?(");
+            rBuffer.appendUnsigned(aArg.mnValue);
+            rBuffer.append(')');
+            break;
+    }
+
+    return sizeof(TraceArg) + nPayload;
+}
+
+// The parenthesised arguments of a call record
+static void formatArgs(const char* pRecord, size_t nSize, uint16_t nArgs, FormatBuffer& rBuffer)
+{
+    rBuffer.append('(');
+    size_t nOffset = sizeof(TraceCallRecord);
+    for (uint16_t n = 0; n < nArgs; ++n)
+    {
+        if (n > 0)
+            rBuffer.append(',');
+        const size_t nArgSize = formatArg(pRecord + nOffset, nSize - nOffset, rBuffer);
+        if (nArgSize == 0)
+            break;
+        nOffset += nArgSize;
+    }
+    rBuffer.append(')');
+}
+
+// What follows the call in the -t output, without the newline
+static void formatReturn(const char* pRecord, size_t nSize, const TraceReturnRecord& rReturn,
+                         FormatBuffer& rBuffer)
+{
+    switch (rReturn.maHeader.mnFlags)
+    {
+        case TRACE_RETURN_RESULT:
+            rBuffer.append(" -> ");
+            if (rReturn.mnResultTypeName != 0)
+            {
+                rBuffer.append(nameString(rReturn.mnResultTypeName));
+                rBuffer.append('<');
+            }
+            formatArg(pRecord + sizeof(rReturn), nSize - sizeof(rReturn), rBuffer);
+            if (rReturn.mnResultTypeName != 0)
+                rBuffer.append('>');
+            break;
+        case TRACE_RETURN_ASSIGNED:
+            rBuffer.append(" = ");
+            formatArg(pRecord + sizeof(rReturn), nSize - sizeof(rReturn), rBuffer);
+            break;
+        case TRACE_RETURN_ERROR:
+            rBuffer.append(": ");
+            rBuffer.append(nameString(rReturn.mnErrorString));
+            break;
+    }
+}
+
+// Time since the start of the trace
+static double microseconds(uint64_t nTicks)
+{
+    const uint64_t nPerSecond = pHeader->mnTicksPerSecond ? pHeader->mnTicksPerSecond : 1;
+    const uint64_t nSinceStart
+        = nTicks > pHeader->mnStartTicks ? nTicks - pHeader->mnStartTicks : 0;
+    return (double)nSinceStart * 1e6 / (double)nPerSecond;
+}
+
+static bool isPlausibleRecord(const TraceRecordHeader& rHeader, size_t nLeft)
+{
+    if (rHeader.mnMagic != TRACE_RECORD_MAGIC || rHeader.mnSize < sizeof(TraceRecordHeader)
+        || rHeader.mnSize % 8 != 0 || rHeader.mnSize > nLeft)
+        return false;
+
+    switch (rHeader.mnType)
+    {
+        case TRACE_PADDING:
+            return true;
+        case TRACE_CALL:
+            return rHeader.mnSize >= sizeof(TraceCallRecord);
+        case TRACE_RETURN:
+            return rHeader.mnSize >= sizeof(TraceReturnRecord)
+                   && rHeader.mnFlags <= TRACE_RETURN_ERROR;
+        default:
+            return false;
+    }
+}
+
+// The same output as the -t code in CProxiedDispatch::Invoke().
+
+// Records of threads making calls at the same time are interleaved, start a new line for the other
+// thread like the output in the traced process does.
+static void breakLineOfOtherThread()
+{
+    if (!bIsAtBeginningOfLine && nLineThreadId != nCurrentThreadId)
+    {
+        std::cout << std::endl;
+        bIsAtBeginningOfLine = true;
+    }
+}
+
+static void outputCall(const char* pRecord, size_t nSize)
+{
+    TraceCallRecord aCall;
+    std::memcpy(&aCall, pRecord, sizeof(aCall));
+    nCurrentTicks = aCall.mnTicks;
+    nCurrentThreadId = aCall.mnThreadId;
+
+    char aBuffer[16384];
+    FormatBuffer aFormat(aBuffer, sizeof(aBuffer));
+
+    if (pChromeTrace != nullptr)
+    {
+        // Each call on a thread nests in the previous one until that returns, so just begin and
+        // end events are needed.
+        if (aCall.maHeader.mnFlags & TRACE_CALL_PARENTHESES)
+            formatArgs(pRecord, nSize, aCall.mnArgs, aFormat);
+        pChromeTrace->begin(aCall.mnThreadId, microseconds(aCall.mnTicks),
+                            nameString(aCall.mnLibName) + "." + nameString(aCall.mnTypeName) + "."
+                                + nameString(aCall.mnMemberName),
+                            nameString(aCall.mnLibName),
+                            std::string(aFormat.data(), aFormat.size()));
+        return;
+    }
+
+    breakLineOfOtherThread();
+
+    aFormat.append(nameString(aCall.mnLibName));
+    aFormat.append('.');
+    aFormat.append(nameString(aCall.mnTypeName));
+    aFormat.append('<');
+    aFormat.appendPointer(aCall.mnProxy, pHeader->mnPointerSize);
+    aFormat.append(">.");
+    aFormat.append(nameString(aCall.mnMemberName));
+
+    if (aCall.maHeader.mnFlags & TRACE_CALL_PARENTHESES)
+        formatArgs(pRecord, nSize, aCall.mnArgs, aFormat);
+
+    std::cout.write(aFormat.data(), (std::streamsize)aFormat.size());
+    bIsAtBeginningOfLine = false;
+    nLineThreadId = aCall.mnThreadId;
+}
+
+static void outputReturn(const char* pRecord, size_t nSize)
+{
+    TraceReturnRecord aReturn;
+    std::memcpy(&aReturn, pRecord, sizeof(aReturn));
+    nCurrentTicks = aReturn.mnTicks;
+    nCurrentThreadId = aReturn.mnThreadId;
+
+    char aBuffer[4096];
+    FormatBuffer aFormat(aBuffer, sizeof(aBuffer));
+    formatReturn(pRecord, nSize, aReturn, aFormat);
+
+    if (pChromeTrace != nullptr)
+    {
+        // Without the " -> ", " = " or ": " that formatReturn() puts first
+        static const char* const aPrefixes[] = { " -> ", " = ", ": " };
+        std::string sResult(aFormat.data(), aFormat.size());
+        for (const char* pPrefix : aPrefixes)
+        {
+            const size_t nLength = std::strlen(pPrefix);
+            if (sResult.compare(0, nLength, pPrefix) == 0)
+            {
+                sResult.erase(0, nLength);
+                break;
+            }
+        }
+        pChromeTrace->end(aReturn.mnThreadId, microseconds(aReturn.mnTicks), sResult);
+        return;
+    }
+
+    breakLineOfOtherThread();
+
+    std::cout.write(aFormat.data(), (std::streamsize)aFormat.size());
+    if (aFormat.size() > 0)
+        bIsAtBeginningOfLine = false;
+
+    if (!bIsAtBeginningOfLine)
+    {
+        std::cout << std::endl;
+        bIsAtBeginningOfLine = true;
+    }
+}
+
+// Prints the records in [nBegin, nEnd) of the ring. Where there is garbage, like at the start of
+// the oldest data after the ring has wrapped, skip to the next thing that looks like a record.
+
+static void outputRecords(uint64_t nBegin, uint64_t nEnd)
+{
+    const char* const pRing = aData.data() + pHeader->mnRingOffset;
+
+    uint64_t nPos = nBegin;
+    while (nPos + sizeof(TraceRecordHeader) <= nEnd)
+    {
+        TraceRecordHeader aHeader;
+        std::memcpy(&aHeader, pRing + nPos, sizeof(aHeader));
+
+        if (!isPlausibleRecord(aHeader, (size_t)(nEnd - nPos)))
+        {
+            nPos += 8;
+            continue;
+        }
+
+        if (aHeader.mnType == TRACE_CALL)
+            outputCall(pRing + nPos, aHeader.mnSize);
+        else if (aHeader.mnType == TRACE_RETURN)
+            outputReturn(pRing + nPos, aHeader.mnSize);
+
+        nPos += aHeader.mnSize;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    bool bChromeTrace = false;
+    int argi = 1;
+    if (argi < argc && std::strcmp(argv[argi], "-j") == 0)
+    {
+        bChromeTrace = true;
+        argi++;
+    }
+
+    if (argc != argi + 1 || argv[argi][0] == '-')
+        Usage(argv);
+
+    const char* pFileName = argv[argi];
+
+    std::ifstream aFile(pFileName, std::ios::binary);
+    if (!aFile)
+    {
+        std::cerr << "Could not open " << pFileName << "\n";
+        std::exit(1);
+    }
+    aData.assign(std::istreambuf_iterator<char>(aFile), std::istreambuf_iterator<char>());
+
+    pHeader = reinterpret_cast<const TraceFileHeader*>(aData.data());
+    if (aData.size() < sizeof(TraceFileHeader)
+        || std::memcmp(pHeader->maMagic, TRACE_FILE_MAGIC, sizeof(TRACE_FILE_MAGIC)) != 0)
+    {
+        std::cerr << pFileName << " is not a COLEAT binary trace file\n";
+        std::exit(1);
+    }
+    if (pHeader->mnVersion != TRACE_FILE_VERSION)
+    {
+        std::cerr << pFileName << " is of version " << pHeader->mnVersion << ", expected version "
+                  << TRACE_FILE_VERSION << "\n";
+        std::exit(1);
+    }
+    if (pHeader->mnNamesOffset + pHeader->mnNamesCapacity > aData.size()
+        || pHeader->mnRingOffset + pHeader->mnRingCapacity > aData.size()
+        || pHeader->mnRingCapacity == 0)
+    {
+        std::cerr << pFileName << " is truncated\n";
+        std::exit(1);
+    }
+
+    std::unique_ptr<ChromeTraceWriter> pWriter;
+    std::unique_ptr<AddTimeStamp> pAddTimeStamp;
+    if (bChromeTrace)
+    {
+        pWriter.reset(new ChromeTraceWriter(std::cout));
+        pChromeTrace = pWriter.get();
+    }
+    else
+        pAddTimeStamp.reset(new AddTimeStamp(std::cout));
+
+    const uint64_t nCapacity = pHeader->mnRingCapacity;
+    const uint64_t nHead = pHeader->mnRingHead;
+
+    if (nHead <= nCapacity)
+        outputRecords(0, nHead);
+    else
+    {
+        std::cerr << "The trace has wrapped around, the oldest "
+                  << nHead - nCapacity << " bytes of it are lost\n";
+        outputRecords(nHead % nCapacity, nCapacity);
+        outputRecords(0, nHead % nCapacity);
+    }
+
+    if (pChromeTrace != nullptr)
+        pChromeTrace->finish();
+    else if (!bIsAtBeginningOfLine)
+        std::cout << std::endl;
+
+    return 0;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab cinoptions=b1,g0,N-s cinkeys+=0=break: */
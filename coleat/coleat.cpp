@@ -30,6 +30,7 @@
 
 #include "coleat-version.h"
 #include "coleat-git-version.h"
+#include "controlblock.hpp"
 #include "exewrapper.hpp"
 #include "utils.hpp"
 
@@ -39,29 +40,207 @@
 static bool bDebug = false;
 static bool bDidAllocConsole;
 
+static void exitWithError()
+{
+    if (bDidAllocConsole)
+        waitForAnyKey();
+    std::exit(1);
+}
+
 static void Usage(wchar_t** argv)
 {
     tryToEnsureStdHandlesOpen(bDidAllocConsole);
 
     std::cout << "Usage: " << convertUTF16ToUTF8(programName(argv[0]))
               << " [options] program [arguments...]\n"
+                 "       "
+              << convertUTF16ToUTF8(programName(argv[0]))
+              << " -P pid [setting=value...]\n"
                  "\n"
                  "  Options:\n"
+                 "    -b file                      binary trace output file, to be decoded with "
+                 "coleat-trace\n"
+                 "    -c file                      call counts and timings output file, JSON if it "
+                 "ends with\n"
+                 "                                 .json, otherwise CSV\n"
+                 "    -f rules                     which calls to trace, see the README\n"
+                 "    -i file                      file to keep interface names in between runs\n"
                  "    -n                           no redirection to replacement app\n"
                  "    -o file                      output file (default: stdout, in new console if "
                  "necessary)\n"
+                 "    -s                           write output synchronously (slower, but nothing "
+                 "is lost\n"
+                 "                                 if the program crashes)\n"
                  "    -t                           terse trace output\n"
                  "    -v                           verbose logging of internal operation\n"
-                 "    -V                           print COLEAT version information\n";
-    if (bDidAllocConsole)
-        waitForAnyKey();
-    std::exit(1);
+                 "    -V                           print COLEAT version information\n"
+                 "\n"
+                 "  With -P, change the settings of the process with that id, which runs wrapped "
+                 "by COLEAT,\n"
+                 "  or without any settings, show how many calls it makes until it exits. The "
+                 "settings are:\n"
+                 "    trace=on|off                 trace output\n"
+                 "    verbose=on|off               verbose logging\n"
+                 "    stats=on|off                 call counts and timings, if started with -c\n"
+                 "    filter=rules                 which calls to trace, empty for all\n";
+    exitWithError();
+}
+
+static bool parseOnOff(const wchar_t* pValue, int& rResult)
+{
+    if (std::wcscmp(pValue, L"on") == 0)
+        rResult = 1;
+    else if (std::wcscmp(pValue, L"off") == 0)
+        rResult = 0;
+    else
+        return false;
+    return true;
+}
+
+static const char* onOff(uint8_t b) { return b ? "on" : "off"; }
+
+// Handles "coleat -P pid [setting=value...]", talking to the injected DLL in a running wrapped
+// process through its control block.
+static void control(int argc, wchar_t** argv)
+{
+    if (argc < 3)
+        Usage(argv);
+
+    wchar_t* pEnd;
+    const DWORD nProcessId = (DWORD)std::wcstoul(argv[2], &pEnd, 10);
+    if (*pEnd != L'\0' || nProcessId == 0)
+        Usage(argv);
+
+    // Check all settings before changing any. -1 means unchanged.
+    int nTrace = -1;
+    int nVerbose = -1;
+    int nCallStatistics = -1;
+    bool bFilter = false;
+    std::string sFilter;
+    for (int argi = 3; argi < argc; ++argi)
+    {
+        const wchar_t* pEquals = std::wcschr(argv[argi], L'=');
+        if (pEquals == nullptr)
+            Usage(argv);
+
+        const std::wstring sName(argv[argi], (std::size_t)(pEquals - argv[argi]));
+        const wchar_t* pValue = pEquals + 1;
+        bool bOK = true;
+        if (sName == L"trace")
+            bOK = parseOnOff(pValue, nTrace);
+        else if (sName == L"verbose")
+            bOK = parseOnOff(pValue, nVerbose);
+        else if (sName == L"stats")
+            bOK = parseOnOff(pValue, nCallStatistics);
+        else if (sName == L"filter")
+        {
+            bFilter = true;
+            sFilter = convertUTF16ToUTF8(pValue);
+            bOK = (sFilter.size() < ControlSettings::NTRACEFILTER);
+        }
+        else
+            bOK = false;
+
+        if (!bOK)
+        {
+            std::cout << "Bad setting '" << convertUTF16ToUTF8(argv[argi]) << "'\n";
+            exitWithError();
+        }
+    }
+
+    // The handle and the view are closed when we exit.
+    HANDLE hMapping
+        = OpenFileMappingW(FILE_MAP_WRITE, FALSE, ControlBlock::name(nProcessId).c_str());
+    if (hMapping == NULL)
+    {
+        std::cout << "Process " << nProcessId << " does not seem to be wrapped by COLEAT: "
+                  << WindowsErrorString(GetLastError()) << "\n";
+        exitWithError();
+    }
+
+    void* pView = MapViewOfFile(hMapping, FILE_MAP_WRITE, 0, 0, sizeof(ControlBlock));
+    ControlBlock* pBlock
+        = (pView == NULL ? nullptr : ControlBlock::attach(pView, sizeof(ControlBlock)));
+    if (pBlock == nullptr)
+    {
+        std::cout << "The control block of process " << nProcessId
+                  << " is not from this version of COLEAT\n";
+        exitWithError();
+    }
+
+    if (argc == 3)
+    {
+        HANDLE hProcess = OpenProcess(SYNCHRONIZE, FALSE, nProcessId);
+        if (hProcess == NULL)
+        {
+            std::cout << "OpenProcess failed: " << WindowsErrorString(GetLastError()) << "\n";
+            exitWithError();
+        }
+
+        uint64_t nLastCalls = pBlock->mnCalls.load(std::memory_order_relaxed);
+        while (WaitForSingleObject(hProcess, 1000) == WAIT_TIMEOUT)
+        {
+            const uint64_t nCalls = pBlock->mnCalls.load(std::memory_order_relaxed);
+            std::cout << "Calls/s: " << (nCalls - nLastCalls) << ", calls: " << nCalls
+                      << ", proxies alive: " << pBlock->proxiesAlive() << std::endl;
+            nLastCalls = nCalls;
+        }
+        std::cout << "Process " << nProcessId << " has exited\n";
+        std::exit(0);
+    }
+
+    ControlSettings* pSettings = pBlock->beginUpdate();
+    if (pSettings == nullptr)
+    {
+        std::cout << "The control block of process " << nProcessId << " seems stuck\n";
+        exitWithError();
+    }
+    if (nTrace != -1)
+        pSettings->mbTrace = (uint8_t)nTrace;
+    if (nVerbose != -1)
+        pSettings->mbVerbose = (uint8_t)nVerbose;
+    if (nCallStatistics != -1)
+        pSettings->mbCallStatistics = (uint8_t)nCallStatistics;
+    if (bFilter)
+        strcpy_s(pSettings->msTraceFilter, ControlSettings::NTRACEFILTER, sFilter.c_str());
+    pBlock->endUpdate();
+    const uint32_t nWritten = pBlock->settingsSequence();
+
+    HANDLE hChanged = OpenEventW(EVENT_MODIFY_STATE, FALSE,
+                                 ControlBlock::changedEventName(nProcessId).c_str());
+    if (hChanged == NULL || !SetEvent(hChanged))
+    {
+        std::cout << "Could not notify process " << nProcessId << ": "
+                  << WindowsErrorString(GetLastError()) << "\n";
+        exitWithError();
+    }
+
+    // Settings the process could not apply are put back, so show what it ended up with.
+    if (!pBlock->waitUntilApplied(nWritten, 5000))
+    {
+        std::cout << "Process " << nProcessId << " did not apply the settings in time\n";
+        exitWithError();
+    }
+    ControlSettings aSettings;
+    uint32_t nSequence;
+    if (pBlock->readSettings(aSettings, nSequence))
+        std::cout << "Process " << nProcessId << ": trace=" << onOff(aSettings.mbTrace)
+                  << " verbose=" << onOff(aSettings.mbVerbose)
+                  << " stats=" << onOff(aSettings.mbCallStatistics) << " filter=\""
+                  << aSettings.msTraceFilter << "\"\n";
+    std::exit(0);
 }
 
 int wmain(int argc, wchar_t** argv)
 {
     wchar_t* pOutputFile = nullptr;
 
+    if (argc >= 2 && std::wcscmp(argv[1], L"-P") == 0)
+    {
+        tryToEnsureStdHandlesOpen(bDidAllocConsole);
+        control(argc, argv);
+    }
+
     int argi = 1;
 
     // Just ensure syntax is right, we don't need to actualy handle the arguments in this program,
@@ -70,12 +249,40 @@ int wmain(int argc, wchar_t** argv)
     {
         switch (argv[argi][1])
         {
+            case L'b':
+            {
+                if (argi + 1 >= argc)
+                    Usage(argv);
+                argi++;
+                break;
+            }
+            case L'c':
+            {
+                if (argi + 1 >= argc)
+                    Usage(argv);
+                argi++;
+                break;
+            }
             case L'd':
             {
                 // secret debug switch
                 bDebug = true;
                 break;
             }
+            case L'f':
+            {
+                if (argi + 1 >= argc)
+                    Usage(argv);
+                argi++;
+                break;
+            }
+            case L'i':
+            {
+                if (argi + 1 >= argc)
+                    Usage(argv);
+                argi++;
+                break;
+            }
             case L'n':
                 break;
             case L'o':
@@ -86,6 +293,8 @@ int wmain(int argc, wchar_t** argv)
                 argi++;
                 break;
             }
+            case L's':
+                break;
             case L't':
                 break;
             case L'v':
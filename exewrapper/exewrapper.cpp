@@ -123,18 +123,47 @@ int wmain(int argc, wchar_t** argv)
 
     bool bDebug = false;
     bool bNoReplacement = false;
+    bool bSynchronousOutput = false;
     bool bTrace = false;
     bool bVerbose = false;
+    const wchar_t* pBinaryTraceFile = nullptr;
+    const wchar_t* pCallStatisticsFile = nullptr;
+    const wchar_t* pIIDNameCacheFile = nullptr;
+    const wchar_t* pTraceFilter = nullptr;
 
     while (argi < argc && argv[argi][0] == L'-')
     {
         switch (argv[argi][1])
         {
+            case L'b':
+                if (argi + 1 >= argc)
+                    Usage(argv);
+                pBinaryTraceFile = argv[argi + 1];
+                argi++;
+                break;
+            case L'c':
+                if (argi + 1 >= argc)
+                    Usage(argv);
+                pCallStatisticsFile = argv[argi + 1];
+                argi++;
+                break;
             case L'd':
             {
                 bDebug = true;
                 break;
             }
+            case L'f':
+                if (argi + 1 >= argc)
+                    Usage(argv);
+                pTraceFilter = argv[argi + 1];
+                argi++;
+                break;
+            case L'i':
+                if (argi + 1 >= argc)
+                    Usage(argv);
+                pIIDNameCacheFile = argv[argi + 1];
+                argi++;
+                break;
             case L'n':
                 bNoReplacement = true;
                 break;
@@ -142,6 +171,9 @@ int wmain(int argc, wchar_t** argv)
                 // Handled by coleat.exe
                 argi++;
                 break;
+            case L's':
+                bSynchronousOutput = true;
+                break;
             case L't':
                 bTrace = true;
                 break;
@@ -267,6 +299,7 @@ int wmain(int argc, wchar_t** argv)
     aParam.mpGetLastError.pVoid = GetProcAddress(hKernel32, "GetLastError");
     aParam.mpGetProcAddress.pVoid = GetProcAddress(hKernel32, "GetProcAddress");
     aParam.mbNoReplacement = bNoReplacement;
+    aParam.mbSynchronousOutput = bSynchronousOutput;
     aParam.mbTrace = bTrace;
     aParam.mbVerbose = bVerbose;
 
@@ -274,6 +307,61 @@ int wmain(int argc, wchar_t** argv)
              "InjectedDllMainFunction");
     wcscpy_s(aParam.msFileName, ThreadProcParam::NFILENAME, sDllFileName);
 
+    // The wrapped program might change its current directory before the file gets opened.
+    if (pBinaryTraceFile != nullptr
+        && GetFullPathNameW(pBinaryTraceFile, ThreadProcParam::NFILENAME,
+                            aParam.msBinaryTraceFileName, NULL)
+               >= (DWORD)ThreadProcParam::NFILENAME)
+    {
+        tryToEnsureStdHandlesOpen(bDidAllocConsole);
+
+        std::cout << "Pathname of binary trace file ridiculously long\n";
+        TerminateProcess(hWrappedProcess, 1);
+        WaitForSingleObject(hWrappedProcess, INFINITE);
+        std::exit(1);
+    }
+
+    if (pIIDNameCacheFile != nullptr
+        && GetFullPathNameW(pIIDNameCacheFile, ThreadProcParam::NFILENAME,
+                            aParam.msIIDNameCacheFileName, NULL)
+               >= (DWORD)ThreadProcParam::NFILENAME)
+    {
+        tryToEnsureStdHandlesOpen(bDidAllocConsole);
+
+        std::cout << "Pathname of interface name file ridiculously long\n";
+        TerminateProcess(hWrappedProcess, 1);
+        WaitForSingleObject(hWrappedProcess, INFINITE);
+        std::exit(1);
+    }
+
+    if (pCallStatisticsFile != nullptr
+        && GetFullPathNameW(pCallStatisticsFile, ThreadProcParam::NFILENAME,
+                            aParam.msCallStatisticsFileName, NULL)
+               >= (DWORD)ThreadProcParam::NFILENAME)
+    {
+        tryToEnsureStdHandlesOpen(bDidAllocConsole);
+
+        std::cout << "Pathname of call statistics file ridiculously long\n";
+        TerminateProcess(hWrappedProcess, 1);
+        WaitForSingleObject(hWrappedProcess, INFINITE);
+        std::exit(1);
+    }
+
+    if (pTraceFilter != nullptr)
+    {
+        const std::string sTraceFilter = convertUTF16ToUTF8(pTraceFilter);
+        if (sTraceFilter.size() >= (size_t)ThreadProcParam::NTRACEFILTER)
+        {
+            tryToEnsureStdHandlesOpen(bDidAllocConsole);
+
+            std::cout << "Trace filter rules ridiculously long\n";
+            TerminateProcess(hWrappedProcess, 1);
+            WaitForSingleObject(hWrappedProcess, INFINITE);
+            std::exit(1);
+        }
+        strcpy_s(aParam.msTraceFilter, ThreadProcParam::NTRACEFILTER, sTraceFilter.data());
+    }
+
     void* pParamRemote
         = VirtualAllocEx(hWrappedProcess, NULL, sizeof(aParam), MEM_COMMIT, PAGE_READWRITE);
     if (pParamRemote == NULL)
@@ -7,13 +7,17 @@
  * file, You can obtain one at http://mozilla.org/MPL/2.0/.
  */
 
+#ifdef _MSC_VER
 #pragma warning(push)
 #pragma warning(disable : 4365 4571 4625 4668 4774 4820 4917 5026 5039 5045)
+#endif
 
 #include <cassert>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cwchar>
+#include <deque>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
@@ -23,13 +27,24 @@
 #include <string>
 #include <vector>
 
+#ifdef _WIN32
 #include <Windows.h>
+#endif
 
+#ifdef _MSC_VER
 #pragma warning(pop)
+#endif
+
+#ifdef _WIN32
+#include "utils.hpp"
+#else
+#include "nonwindows.hpp"
+#endif
 
 #include "interfacemap.hpp"
 #include "outgoingmap.hpp"
-#include "utils.hpp"
+
+#include "snapshottypelib.hpp"
 
 struct FuncTableEntry
 {
@@ -46,6 +61,14 @@ struct Interface
 
 static std::string sOutputFolder = "generated";
 
+// For the -D and -S options
+static const wchar_t* pDumpFileName = nullptr;
+static TypeLibSnapshot* pSnapshot = nullptr;
+
+// For the -U option
+static unsigned nUnityChunks = 0;
+static std::vector<std::string> aCodeFiles;
+
 static std::set<IID> aAlreadyHandledIIDs;
 static std::set<std::string> aOnlyTheseInterfaces;
 
@@ -62,79 +85,286 @@ inline bool operator<(const Interface& a, const Interface& b)
     return ((a.msLibName < b.msLibName) || ((a.msLibName == b.msLibName) && (a.msName < b.msName)));
 }
 
-class OutputFile : public std::ofstream
+// FNV-1a, for hashes that must stay the same between runs, which std::hash does not promise.
+static uint64_t stableHash(const std::string& rText)
 {
-private:
-    const std::string msFilename;
-
-    std::string readAll(const std::string& sFilename, std::ifstream& rStream)
+    uint64_t nHash = 14695981039346656037ULL;
+    for (char c : rText)
     {
-        rStream.seekg(0, std::ios::end);
-        std::size_t nLength = (std::size_t)rStream.tellg();
-        rStream.seekg(0, std::ios::beg);
-        std::vector<char> vBuf(nLength + 1);
-        rStream.read(vBuf.data(), (std::streamsize)nLength);
-        vBuf[nLength] = '\0';
-        rStream.close();
-        if (!rStream.good())
-        {
-            std::cerr << "Could not read from '" << sFilename << "'\n";
-            std::exit(1);
-        }
-        return std::string(vBuf.data());
+        nHash ^= (unsigned char)c;
+        nHash *= 1099511628211ULL;
     }
+    return nHash;
+}
 
+// The emission pass. Generating the code walks the type information, which belongs to the main
+// thread, so it stays there and just collects the text of each file in an OutputFile. A pool of
+// threads then compares the files with what is already on disk and writes those that changed, so
+// that unchanged ones keep their timestamp and don't get recompiled.
+//
+// The comparison is by a hash of the contents, kept in a manifest in the output folder, so the old
+// files don't need to be read. The manifest also has the size and last write time each file had
+// after genproxy wrote it, so that a file edited or replaced since is not trusted to match its
+// hash. Such files, and files that are not in the manifest, are compared byte by byte.
+class Emitter
+{
 public:
-    OutputFile(const std::string& sFilename)
-        : std::ofstream(sFilename + ".temp")
-        , msFilename(sFilename)
+    static void start()
     {
-        if (!good())
+        InitializeSRWLock(&maLock);
+        InitializeConditionVariable(&maWakeUp);
+
+        readManifest();
+
+        SYSTEM_INFO aSystemInfo;
+        GetSystemInfo(&aSystemInfo);
+        DWORD nThreads = aSystemInfo.dwNumberOfProcessors;
+        if (nThreads < 1)
+            nThreads = 1;
+        if (nThreads > MAXIMUM_WAIT_OBJECTS)
+            nThreads = MAXIMUM_WAIT_OBJECTS;
+
+        for (DWORD i = 0; i < nThreads; ++i)
         {
-            std::cerr << "Could not open '" << sFilename << ".temp' for writing\n";
-            std::exit(1);
+            HANDLE hThread = CreateThread(NULL, 0, emitterThread, nullptr, 0, NULL);
+            if (hThread == NULL)
+            {
+                std::cerr << "CreateThread failed: " << WindowsErrorString(GetLastError()) << "\n";
+                std::exit(1);
+            }
+            maThreads.push_back(hThread);
         }
     }
 
-    OutputFile(const OutputFile&) = delete;
+    static void add(const std::string& rFilename, std::string sContents)
+    {
+        AcquireSRWLockExclusive(&maLock);
+        maQueue.push_back({ rFilename, std::move(sContents) });
+        ReleaseSRWLockExclusive(&maLock);
+        WakeConditionVariable(&maWakeUp);
+    }
 
-    ~OutputFile() { close(); }
+    // Waits for all files to be written, and writes the manifest.
+    static void finish()
+    {
+        AcquireSRWLockExclusive(&maLock);
+        mbFinishing = true;
+        ReleaseSRWLockExclusive(&maLock);
+        WakeAllConditionVariable(&maWakeUp);
 
-    void close()
+        WaitForMultipleObjects((DWORD)maThreads.size(), maThreads.data(), TRUE, INFINITE);
+        for (HANDLE hThread : maThreads)
+            CloseHandle(hThread);
+        maThreads.clear();
+
+        writeManifest();
+    }
+
+private:
+    struct File
+    {
+        std::string msFilename;
+        std::string msContents;
+    };
+
+    struct ManifestEntry
     {
-        if (!is_open())
+        std::string msHash;
+        uint64_t mnSize;
+        uint64_t mnWriteTime;
+    };
+
+    static SRWLOCK maLock;
+    static CONDITION_VARIABLE maWakeUp;
+    static bool mbFinishing;
+    static std::vector<HANDLE> maThreads;
+    static std::deque<File> maQueue;
+
+    // Read by the threads without locking, as it does not change while they run
+    static std::map<std::string, ManifestEntry> maOldManifest;
+
+    // Protected by maLock. Starts as a copy of maOldManifest, so that the manifest still covers the
+    // files not generated in a run with -i or -I.
+    static std::map<std::string, ManifestEntry> maNewManifest;
+
+    static std::string manifestFilename() { return sOutputFolder + "/genproxy.manifest"; }
+
+    static std::string hash(const std::string& rContents)
+    {
+        std::ostringstream aResult;
+        aResult << std::hex << std::setw(16) << std::setfill('0') << stableHash(rContents);
+        return aResult.str();
+    }
+
+    static bool getStamp(const std::string& rFilename, uint64_t& rSize, uint64_t& rWriteTime)
+    {
+        WIN32_FILE_ATTRIBUTE_DATA aData;
+        if (!GetFileAttributesExA(rFilename.c_str(), GetFileExInfoStandard, &aData))
+            return false;
+        rSize = ((uint64_t)aData.nFileSizeHigh << 32) | aData.nFileSizeLow;
+        rWriteTime = ((uint64_t)aData.ftLastWriteTime.dwHighDateTime << 32)
+                     | aData.ftLastWriteTime.dwLowDateTime;
+        return true;
+    }
+
+    // Lines are "hash size writetime filename". Lines in another format, like those of the
+    // manifests from before the size and time were added, are ignored, which just means that the
+    // files are compared byte by byte once more.
+    static void readManifest()
+    {
+        std::ifstream aManifest(manifestFilename());
+        if (!aManifest.good())
             return;
 
-        std::ofstream::close();
-        if (!good())
+        std::string sLine;
+        while (std::getline(aManifest, sLine))
+        {
+            if (sLine.length() == 0 || sLine[0] == '#')
+                continue;
+
+            std::istringstream aLine(sLine);
+            ManifestEntry aEntry;
+            std::string sFilename;
+            if (!(aLine >> aEntry.msHash >> aEntry.mnSize >> aEntry.mnWriteTime)
+                || aLine.get() != ' ' || !std::getline(aLine, sFilename) || sFilename.empty())
+                continue;
+            maOldManifest[sFilename] = aEntry;
+        }
+        maNewManifest = maOldManifest;
+    }
+
+    static void writeManifest()
+    {
+        const std::string sManifest = manifestFilename();
+        std::ofstream aManifest(sManifest);
+        aManifest << "# Generated file. Do not edit. Hashes, sizes and write times of the files "
+                     "genproxy wrote here.\n";
+        for (const auto& rEntry : maNewManifest)
+            aManifest << rEntry.second.msHash << " " << rEntry.second.mnSize << " "
+                      << rEntry.second.mnWriteTime << " " << rEntry.first << "\n";
+        aManifest.close();
+        if (!aManifest.good())
         {
-            std::cerr << "Problems writing to '" << msFilename << ".temp'\n";
+            std::cerr << "Could not write '" << sManifest << "'\n";
             std::exit(1);
         }
+    }
 
-        const std::string sTempFilename = msFilename + ".temp";
-        std::ifstream aJustWritten(sTempFilename, std::ios::binary);
-        if (aJustWritten.good())
+    static bool isUnchanged(const File& rFile, const std::string& rHash)
+    {
+        uint64_t nSize, nWriteTime;
+        if (!getStamp(rFile.msFilename, nSize, nWriteTime))
+            return false;
+
+        auto p = maOldManifest.find(rFile.msFilename);
+        if (p != maOldManifest.end() && p->second.mnSize == nSize
+            && p->second.mnWriteTime == nWriteTime)
+            return p->second.msHash == rHash;
+
+        std::ifstream aOld(rFile.msFilename, std::ios::binary);
+        if (!aOld.good())
+            return false;
+        std::ostringstream aOldContents;
+        aOldContents << aOld.rdbuf();
+        return aOldContents.str() == rFile.msContents;
+    }
+
+    static void emit(const File& rFile)
+    {
+        const std::string sHash = hash(rFile.msContents);
+
+        if (!isUnchanged(rFile, sHash))
         {
-            std::string sJustWritten = readAll(sTempFilename, aJustWritten);
-            std::ifstream aOld(msFilename, std::ios::binary);
-            if (aOld.good())
+            const std::string sTempFilename = rFile.msFilename + ".temp";
+            std::ofstream aTemp(sTempFilename, std::ios::binary);
+            if (!aTemp.good())
             {
-                std::string sOld = readAll(msFilename, aOld);
-                if (sJustWritten == sOld)
-                {
-                    if (std::remove(sTempFilename.c_str()) != 0)
-                        std::cerr << "Could not remove '" << sTempFilename << "'\n";
-                    return;
-                }
+                std::cerr << "Could not open '" << sTempFilename << "' for writing\n";
+                std::exit(1);
+            }
+            aTemp << rFile.msContents;
+            aTemp.close();
+            if (!aTemp.good())
+            {
+                std::cerr << "Problems writing to '" << sTempFilename << "'\n";
+                std::exit(1);
+            }
+
+            std::remove(rFile.msFilename.c_str());
+            if (std::rename(sTempFilename.c_str(), rFile.msFilename.c_str()) != 0)
+            {
+                std::cerr << "Could not rename '" << sTempFilename << "' to '"
+                          << rFile.msFilename << "'\n";
+                std::exit(1);
             }
         }
-        std::remove(msFilename.c_str());
-        if (std::rename(sTempFilename.c_str(), msFilename.c_str()) != 0)
+
+        ManifestEntry aEntry{ sHash, 0, 0 };
+        if (!getStamp(rFile.msFilename, aEntry.mnSize, aEntry.mnWriteTime))
         {
-            std::cerr << "Could not rename '" << sTempFilename << "' to '" << msFilename << "'\n";
+            std::cerr << "Could not get the size and time of '" << rFile.msFilename << "'\n";
             std::exit(1);
         }
+
+        AcquireSRWLockExclusive(&maLock);
+        maNewManifest[rFile.msFilename] = aEntry;
+        ReleaseSRWLockExclusive(&maLock);
+    }
+
+    static DWORD WINAPI emitterThread(LPVOID) noexcept
+    {
+        while (true)
+        {
+            AcquireSRWLockExclusive(&maLock);
+            while (maQueue.empty() && !mbFinishing)
+                SleepConditionVariableSRW(&maWakeUp, &maLock, INFINITE, 0);
+            if (maQueue.empty())
+            {
+                ReleaseSRWLockExclusive(&maLock);
+                return 0;
+            }
+            File aFile = std::move(maQueue.front());
+            maQueue.pop_front();
+            ReleaseSRWLockExclusive(&maLock);
+
+            emit(aFile);
+        }
+    }
+};
+
+SRWLOCK Emitter::maLock;
+CONDITION_VARIABLE Emitter::maWakeUp;
+bool Emitter::mbFinishing = false;
+std::vector<HANDLE> Emitter::maThreads;
+std::deque<Emitter::File> Emitter::maQueue;
+std::map<std::string, Emitter::ManifestEntry> Emitter::maOldManifest;
+std::map<std::string, Emitter::ManifestEntry> Emitter::maNewManifest;
+
+// Collects the text of a generated file, which is handed to the Emitter when closed.
+class OutputFile : public std::ostringstream
+{
+private:
+    const std::string msFilename;
+    bool mbClosed;
+
+public:
+    OutputFile(const std::string& sFilename)
+        : msFilename(sFilename)
+        , mbClosed(false)
+    {
+    }
+
+    OutputFile(const OutputFile&) = delete;
+
+    ~OutputFile() { close(); }
+
+    void close()
+    {
+        if (mbClosed)
+            return;
+        mbClosed = true;
+
+        Emitter::add(msFilename, str());
     }
 };
 
@@ -496,6 +726,7 @@ static void GenerateSink(const std::string& sLibName, ITypeInfo* const pTypeInfo
 
     const std::string sCode = sOutputFolder + "/" + sClass + ".cxx";
     OutputFile aCode(sCode);
+    aCodeFiles.push_back(sClass + ".cxx");
 
     aHeader << "// Generated file. Do not edit.\n";
     aHeader << "\n";
@@ -511,10 +742,12 @@ static void GenerateSink(const std::string& sLibName, ITypeInfo* const pTypeInfo
     aCode << "// Generated file. Do not edit.\n";
     aCode << "\n";
 
+    aCode << "#include <algorithm>\n";
     aCode << "#include <cstdlib>\n";
     aCode << "#include <iostream>\n";
     aCode << "\n";
     aCode << "#include \"CProxiedUnknown.hpp\"\n";
+    aCode << "#include \"TraceFilter.hpp\"\n";
     aCode << "\n";
     aCode << "#include \"" << sClass << ".hxx\"\n";
     aCode << "\n";
@@ -525,17 +758,13 @@ static void GenerateSink(const std::string& sLibName, ITypeInfo* const pTypeInfo
              "UINT* puArgErr)\n";
     aCode << "{\n";
 
-    aCode << "    if (CProxiedUnknown::getParam()->mbVerbose || "
-             "CProxiedUnknown::getParam()->mbTrace)\n";
-    aCode << "    {\n";
-    aCode << "        if (!CProxiedUnknown::mbIsAtBeginningOfLine)\n";
-    aCode << "            std::cout << \"\\n\" << CProxiedUnknown::indent();\n";
-    aCode << "        std::cout << \"" << sLibName << "." << convertUTF16ToUTF8(sName) << ".\";\n";
-    aCode << "    }\n";
+    aCode << "    static const IID aIID = " << IID_initializer(pTypeAttr->guid) << ";\n";
 
     aCode << "    HRESULT nResult;\n";
     aCode << "    DISPPARAMS aLocalDispParams = *pDispParams;\n";
     aCode << "    aLocalDispParams.rgvarg = new VARIANTARG[aLocalDispParams.cArgs];\n";
+    aCode << "    std::copy(pDispParams->rgvarg, pDispParams->rgvarg + pDispParams->cArgs,\n";
+    aCode << "              aLocalDispParams.rgvarg);\n";
 
     aCode << "    switch (dispIdMember)\n";
     aCode << "    {\n";
@@ -586,10 +815,16 @@ static void GenerateSink(const std::string& sLibName, ITypeInfo* const pTypeInfo
         aCode << "        case " << pFuncDesc->memid << ": // " << convertUTF16ToUTF8(sFuncName)
               << "\n";
         aCode << "            {\n";
-        aCode << "                if (CProxiedUnknown::getParam()->mbVerbose || "
-                 "CProxiedUnknown::getParam()->mbTrace)\n";
+        aCode << "                if (CProxiedUnknown::getParam()->mbVerbose\n";
+        aCode << "                    || (CProxiedUnknown::getParam()->mbTrace\n";
+        aCode << "                        && TraceFilter::accept(aIID, " << pFuncDesc->memid
+              << ", true, \"" << sLibName << "\", \"" << convertUTF16ToUTF8(sName) << "\", \""
+              << convertUTF16ToUTF8(sFuncName) << "\")))\n";
         aCode << "                {\n";
-        aCode << "                    std::cout << \"" << convertUTF16ToUTF8(sFuncName)
+        aCode << "                    if (!CProxiedUnknown::mbIsAtBeginningOfLine)\n";
+        aCode << "                        std::cout << \"\\n\" << CProxiedUnknown::indent();\n";
+        aCode << "                    std::cout << \"" << sLibName << "."
+              << convertUTF16ToUTF8(sName) << "." << convertUTF16ToUTF8(sFuncName)
               << "\" << std::endl;\n";
         aCode << "                    CProxiedUnknown::mbIsAtBeginningOfLine = true;\n";
         aCode << "                }\n";
@@ -684,6 +919,16 @@ static void GenerateSink(const std::string& sLibName, ITypeInfo* const pTypeInfo
     aCode << "    nResult = pDispatchToProxy->Invoke(dispIdMember, riid, lcid, wFlags,\n";
     aCode << "        &aLocalDispParams, pVarResult, pExcepInfo, puArgErr);\n";
 
+    // The proxies for the parameters hold no reference to the objects, the caller of the event
+    // has those. If the sink wanted to keep one, it called AddRef() on the proxy.
+    aCode << "\n";
+    aCode << "    for (UINT i = 0; i < pDispParams->cArgs; ++i)\n";
+    aCode << "    {\n";
+    aCode << "        IDispatch* pParam = aLocalDispParams.rgvarg[i].pdispVal;\n";
+    aCode << "        if (pParam != pDispParams->rgvarg[i].pdispVal)\n";
+    aCode << "            reinterpret_cast<CProxiedUnknown*>(pParam)->releaseUnowned();\n";
+    aCode << "    }\n";
+    aCode << "\n";
     aCode << "    delete[] aLocalDispParams.rgvarg;\n";
     aCode << "\n";
     aCode << "    return nResult;\n";
@@ -1139,6 +1384,7 @@ static void GenerateDispatch(const std::string& sLibName, const std::string& sTy
 
     const std::string sCode = sOutputFolder + "/C" + sClass + ".cxx";
     OutputFile aCode(sCode);
+    aCodeFiles.push_back("C" + sClass + ".cxx");
 
     aHeader << "// Generated file. Do not edit.\n";
     aHeader << "\n";
@@ -1157,8 +1403,10 @@ static void GenerateDispatch(const std::string& sLibName, const std::string& sTy
     aCode << "\n";
     aCode << "#include \"C" << sClass << ".hxx\"\n";
     aCode << "\n";
+    aCode << "#include <array>\n";
     aCode << "#include <iostream>\n";
-    aCode << "#include <vector>\n";
+    aCode << "\n";
+    aCode << "#include \"TraceFilter.hpp\"\n";
     aCode << "\n";
 
     // Then the interesting bits. We loop over the functions twice, firt outputting to the code
@@ -1209,6 +1457,39 @@ static void GenerateDispatch(const std::string& sLibName, const std::string& sTy
     aCode << "}\n";
     aCode << "\n";
 
+    // Then the table of member names passed to genericInvoke(), and the slots for the MEMBERIDs
+    // they have in the replacement app. A property getter and setter share the same slot.
+
+    std::map<std::wstring, size_t> aMemberNameIndex;
+    std::vector<std::wstring> vMemberNames;
+    for (UINT nFunc = 0; nFunc < pVtblTypeAttr->cFuncs; ++nFunc)
+    {
+        const std::wstring sName(vVtblFuncTable[nFunc].mvNames[0]);
+        if (!aMemberNameIndex.count(sName))
+        {
+            aMemberNameIndex[sName] = vMemberNames.size();
+            vMemberNames.push_back(sName);
+        }
+    }
+
+    // Named after the class, so that the generated files can be compiled together in one unity
+    // translation unit.
+    const std::string sMemberNames = "a" + sClass + "MemberNames";
+    const std::string sMemberIds = "a" + sClass + "MemberIds";
+
+    if (vMemberNames.size() > 0)
+    {
+        aCode << "static constexpr const wchar_t* " << sMemberNames << "[] = {\n";
+        for (size_t i = 0; i < vMemberNames.size(); ++i)
+            aCode << "    L\"" << convertUTF16ToUTF8(vMemberNames[i].c_str()) << "\", // " << i
+                  << "\n";
+        aCode << "};\n";
+        aCode << "\n";
+        aCode << "static CProxiedDispatch::MemberIdSlot " << sMemberIds << "["
+              << vMemberNames.size() << "];\n";
+        aCode << "\n";
+    }
+
     // Then the interface member functions
 
     for (UINT nFunc = 0; nFunc < pVtblTypeAttr->cFuncs; ++nFunc)
@@ -1295,7 +1576,15 @@ static void GenerateDispatch(const std::string& sLibName, const std::string& sTy
 
         aCode << "{\n";
 
-        aCode << "    if (getParam()->mbTrace || getParam()->mbVerbose)\n";
+        // Not maIID1, which is IID_IDispatch unless this is a coclass's default interface
+        aCode << "    static const IID aIID = " << IID_initializer(pVtblTypeAttr->guid) << ";\n";
+        aCode << "    const bool bTrace = getParam()->mbVerbose\n";
+        aCode << "                        || (getParam()->mbTrace\n";
+        aCode << "                            && TraceFilter::accept(aIID, "
+              << rFunc.mpFuncDesc->memid << ", true, msLibName, \"" << sTypeName << "\", \""
+              << convertUTF16ToUTF8(rFunc.mvNames[0]) << "\"));\n";
+
+        aCode << "    if (bTrace)\n";
         aCode << "    {\n";
         aCode << "        std::cout << indent() << \"" << sLibName << "." << sTypeName
               << "<\" << (mpBaseClassUnknown ? mpBaseClassUnknown : this) << \">."
@@ -1315,16 +1604,18 @@ static void GenerateDispatch(const std::string& sLibName, const std::string& sTy
         aCode << "        mbIsAtBeginningOfLine = false;\n";
         aCode << "    }\n";
 
-        aCode << "    std::vector<VARIANT> vParams(" << rFunc.mpFuncDesc->cParams << ");\n";
+        // The parameters are stored from the end of the array backwards, so that they end up in
+        // the reverse order that DISPPARAMS wants without any copying.
         if (rFunc.mpFuncDesc->cParams > 0)
         {
+            aCode << "    std::array<VARIANTARG, " << rFunc.mpFuncDesc->cParams << "> aParams;\n";
+            aCode << "    constexpr UINT nLastParam = " << rFunc.mpFuncDesc->cParams - 1 << ";\n";
             aCode << "    UINT nActualParams = 0;\n";
             aCode << "    bool bGotAll = false;\n";
             aCode << "    (void) bGotAll;\n";
         }
 
         bool bHadOptional = false;
-        bool bHadSomeJustDeclaredAsOptional = false;
         std::string sRetvalName = "nullptr";
         int nRetvalParam = -1;
         for (int nParam = 0; nParam < rFunc.mpFuncDesc->cParams; ++nParam)
@@ -1356,9 +1647,6 @@ static void GenerateDispatch(const std::string& sLibName, const std::string& sTy
             if ((rParam.paramdesc.wParamFlags & PARAMFLAG_FOPT) && rParam.tdesc.vt != VT_VARIANT)
                 bHadOptional = true;
 
-            if (rParam.paramdesc.wParamFlags & PARAMFLAG_FOPT)
-                bHadSomeJustDeclaredAsOptional = true;
-
             if (rParam.paramdesc.wParamFlags & PARAMFLAG_FRETVAL)
             {
                 if (sRetvalName != "nullptr")
@@ -1381,7 +1669,7 @@ static void GenerateDispatch(const std::string& sLibName, const std::string& sTy
             {
                 aCode << "    (void) " << convertUTF16ToUTF8(rFunc.mvNames[nParam + 1u]) << ";\n";
 
-                aCode << "    if (!bGotAll && (getParam()->mbTrace || getParam()->mbVerbose))\n";
+                aCode << "    if (!bGotAll && bTrace)\n";
                 aCode << "        std::cout";
                 if (nParam > 0)
                     aCode << " << \",\"";
@@ -1402,156 +1690,156 @@ static void GenerateDispatch(const std::string& sLibName, const std::string& sTy
 
             aCode << "    if (!bGotAll)\n";
             aCode << "    {\n";
+            aCode << "        VARIANTARG& rArg = aParams[nLastParam - nActualParams];\n";
             switch (rParam.tdesc.vt)
             {
                 case VT_I2:
-                    aCode << "        VariantInit(&vParams[" << nParam << "]);\n";
-                    aCode << "        vParams[nActualParams].vt = VT_I2;\n";
-                    aCode << "        vParams[nActualParams].iVal = " << sParamName << ";\n";
+                    aCode << "        VariantInit(&rArg);\n";
+                    aCode << "        rArg.vt = VT_I2;\n";
+                    aCode << "        rArg.iVal = " << sParamName << ";\n";
                     aCode << "        nActualParams++;\n";
                     break;
                 case VT_I4:
-                    aCode << "        VariantInit(&vParams[" << nParam << "]);\n";
-                    aCode << "        vParams[nActualParams].vt = VT_I4;\n";
-                    aCode << "        vParams[nActualParams].lVal = " << sParamName << ";\n";
+                    aCode << "        VariantInit(&rArg);\n";
+                    aCode << "        rArg.vt = VT_I4;\n";
+                    aCode << "        rArg.lVal = " << sParamName << ";\n";
                     aCode << "        nActualParams++;\n";
                     break;
                 case VT_R4:
-                    aCode << "        VariantInit(&vParams[" << nParam << "]);\n";
-                    aCode << "        vParams[nActualParams].vt = VT_R4;\n";
-                    aCode << "        vParams[nActualParams].fltVal = " << sParamName << ";\n";
+                    aCode << "        VariantInit(&rArg);\n";
+                    aCode << "        rArg.vt = VT_R4;\n";
+                    aCode << "        rArg.fltVal = " << sParamName << ";\n";
                     aCode << "        nActualParams++;\n";
                     break;
                 case VT_R8:
-                    aCode << "        VariantInit(&vParams[" << nParam << "]);\n";
-                    aCode << "        vParams[nActualParams].vt = VT_R8;\n";
-                    aCode << "        vParams[nActualParams].dblVal = " << sParamName << ";\n";
+                    aCode << "        VariantInit(&rArg);\n";
+                    aCode << "        rArg.vt = VT_R8;\n";
+                    aCode << "        rArg.dblVal = " << sParamName << ";\n";
                     aCode << "        nActualParams++;\n";
                     break;
                 case VT_BSTR:
-                    aCode << "        VariantInit(&vParams[" << nParam << "]);\n";
-                    aCode << "        vParams[nActualParams].vt = VT_BSTR;\n";
-                    aCode << "        vParams[nActualParams].bstrVal = " << sParamName << ";\n";
+                    aCode << "        VariantInit(&rArg);\n";
+                    aCode << "        rArg.vt = VT_BSTR;\n";
+                    aCode << "        rArg.bstrVal = " << sParamName << ";\n";
                     aCode << "        nActualParams++;\n";
                     break;
                 case VT_DISPATCH:
-                    aCode << "        VariantInit(&vParams[" << nParam << "]);\n";
-                    aCode << "        vParams[nActualParams].vt = VT_DISPATCH;\n";
-                    aCode << "        vParams[nActualParams].pdispVal = " << sParamName << ";\n";
+                    aCode << "        VariantInit(&rArg);\n";
+                    aCode << "        rArg.vt = VT_DISPATCH;\n";
+                    aCode << "        rArg.pdispVal = " << sParamName << ";\n";
                     aCode << "        nActualParams++;\n";
                     break;
                 case VT_BOOL:
-                    aCode << "        VariantInit(&vParams[" << nParam << "]);\n";
-                    aCode << "        vParams[nActualParams].vt = VT_BOOL;\n";
-                    aCode << "        vParams[nActualParams].boolVal = " << sParamName << ";\n";
+                    aCode << "        VariantInit(&rArg);\n";
+                    aCode << "        rArg.vt = VT_BOOL;\n";
+                    aCode << "        rArg.boolVal = " << sParamName << ";\n";
                     aCode << "        nActualParams++;\n";
                     break;
                 case VT_VARIANT:
                     // FIXME: Is this correct? Experimentation will show.
-                    aCode << "        vParams[nActualParams] = " << sParamName << ";\n";
-                    aCode << "        if (vParams[nActualParams].vt == VT_ILLEGAL\n";
-                    aCode << "            || (vParams[nActualParams].vt == VT_ERROR\n";
-                    aCode << "                && vParams[nActualParams].scode == "
-                             "DISP_E_PARAMNOTFOUND))\n";
-                    aCode << "            VariantInit(&vParams[nActualParams]);\n";
+                    aCode << "        rArg = " << sParamName << ";\n";
+                    aCode << "        if (rArg.vt == VT_ILLEGAL\n";
+                    aCode << "            || (rArg.vt == VT_ERROR\n";
+                    aCode << "                && rArg.scode == DISP_E_PARAMNOTFOUND))\n";
+                    aCode << "            VariantInit(&rArg);\n";
                     aCode << "        nActualParams++;\n";
                     break;
                 case VT_UI2:
-                    aCode << "        VariantInit(&vParams[" << nParam << "]);\n";
-                    aCode << "        vParams[nActualParams].vt = VT_UI2;\n";
-                    aCode << "        vParams[nActualParams].iVal = " << sParamName << ";\n";
+                    aCode << "        VariantInit(&rArg);\n";
+                    aCode << "        rArg.vt = VT_UI2;\n";
+                    aCode << "        rArg.iVal = " << sParamName << ";\n";
                     aCode << "        nActualParams++;\n";
                     break;
                 case VT_UI4:
-                    aCode << "        VariantInit(&vParams[" << nParam << "]);\n";
-                    aCode << "        vParams[nActualParams].vt = VT_UI4;\n";
-                    aCode << "        vParams[nActualParams].lVal = " << sParamName << ";\n";
+                    aCode << "        VariantInit(&rArg);\n";
+                    aCode << "        rArg.vt = VT_UI4;\n";
+                    aCode << "        rArg.lVal = " << sParamName << ";\n";
                     aCode << "        nActualParams++;\n";
                     break;
                 case VT_I8:
-                    aCode << "        VariantInit(&vParams[" << nParam << "]);\n";
-                    aCode << "        vParams[nActualParams].vt = VT_I8;\n";
-                    aCode << "        vParams[nActualParams].llVal = " << sParamName << ";\n";
+                    aCode << "        VariantInit(&rArg);\n";
+                    aCode << "        rArg.vt = VT_I8;\n";
+                    aCode << "        rArg.llVal = " << sParamName << ";\n";
                     aCode << "        nActualParams++;\n";
                     break;
                 case VT_UI8:
-                    aCode << "        VariantInit(&vParams[" << nParam << "]);\n";
-                    aCode << "        vParams[nActualParams].vt = VT_UI8;\n";
-                    aCode << "        vParams[nActualParams].llVal = " << sParamName << ";\n";
+                    aCode << "        VariantInit(&rArg);\n";
+                    aCode << "        rArg.vt = VT_UI8;\n";
+                    aCode << "        rArg.llVal = " << sParamName << ";\n";
                     aCode << "        nActualParams++;\n";
                     break;
                 case VT_INT:
-                    aCode << "        VariantInit(&vParams[" << nParam << "]);\n";
-                    aCode << "        vParams[nActualParams].vt = VT_INT;\n";
-                    aCode << "        vParams[nActualParams].lVal = " << sParamName << ";\n";
+                    aCode << "        VariantInit(&rArg);\n";
+                    aCode << "        rArg.vt = VT_INT;\n";
+                    aCode << "        rArg.lVal = " << sParamName << ";\n";
                     aCode << "        nActualParams++;\n";
                     break;
                 case VT_UINT:
-                    aCode << "        VariantInit(&vParams[" << nParam << "]);\n";
-                    aCode << "        vParams[nActualParams].vt = VT_UINT;\n";
-                    aCode << "        vParams[nActualParams].lVal = " << sParamName << ";\n";
+                    aCode << "        VariantInit(&rArg);\n";
+                    aCode << "        rArg.vt = VT_UINT;\n";
+                    aCode << "        rArg.lVal = " << sParamName << ";\n";
                     aCode << "        nActualParams++;\n";
                     break;
                 case VT_INT_PTR:
-                    aCode << "        VariantInit(&vParams[" << nParam << "]);\n";
-                    aCode << "        vParams[nActualParams].vt = VT_INT_PTR;\n";
-                    aCode << "        vParams[nActualParams].plVal = " << sParamName << ";\n";
+                    aCode << "        VariantInit(&rArg);\n";
+                    aCode << "        rArg.vt = VT_INT_PTR;\n";
+                    aCode << "        rArg.plVal = " << sParamName << ";\n";
                     aCode << "        nActualParams++;\n";
                     break;
                 case VT_UINT_PTR:
-                    aCode << "        VariantInit(&vParams[" << nParam << "]);\n";
-                    aCode << "        vParams[nActualParams].vt = VT_UINT_PTR;\n";
-                    aCode << "        vParams[nActualParams].plVal = " << sParamName << ";\n";
+                    aCode << "        VariantInit(&rArg);\n";
+                    aCode << "        rArg.vt = VT_UINT_PTR;\n";
+                    aCode << "        rArg.plVal = " << sParamName << ";\n";
                     aCode << "        nActualParams++;\n";
                     break;
                 case VT_PTR:
                     if (rFunc.mpFuncDesc->lprgelemdescParam[nParam].tdesc.lptdesc->vt == VT_VARIANT)
                     {
-                        aCode << "        vParams[nActualParams] = *" << sParamName << ";\n";
+                        aCode << "        rArg = *" << sParamName << ";\n";
                         aCode << "        nActualParams++;\n";
                     }
                     else
                     {
                         // FIXME: Probably wrong for instance for SAFEARRAY(BSTR)* parameters
-                        aCode << "        VariantInit(&vParams[" << nParam << "]);\n";
-                        aCode << "        vParams[nActualParams].vt = VT_PTR;\n";
-                        aCode << "        vParams[nActualParams].byref = " << sParamName << ";\n";
+                        aCode << "        VariantInit(&rArg);\n";
+                        aCode << "        rArg.vt = VT_PTR;\n";
+                        aCode << "        rArg.byref = " << sParamName << ";\n";
                         aCode << "        nActualParams++;\n";
                     }
                     break;
                 case VT_USERDEFINED:
-                    aCode << "        VariantInit(&vParams[" << nParam << "]);\n";
+                    aCode << "        VariantInit(&rArg);\n";
                     if (vEnumParamVarTypes[(unsigned)nParam] != VT_EMPTY)
                     {
-                        aCode << "        vParams[nActualParams].vt = "
+                        aCode << "        rArg.vt = "
                               << VarTypeAsString(vEnumParamVarTypes[(unsigned)nParam]) << ";\n";
-                        aCode << "        vParams[nActualParams].llVal = " << sParamName << ";\n";
+                        aCode << "        rArg.llVal = " << sParamName << ";\n";
                     }
                     else
                     {
-                        aCode << "        vParams[nActualParams].vt = VT_USERDEFINED;\n";
-                        aCode << "        vParams[nActualParams].byref = " << sParamName << ";\n";
+                        aCode << "        rArg.vt = VT_USERDEFINED;\n";
+                        aCode << "        rArg.byref = " << sParamName << ";\n";
                     }
                     aCode << "        nActualParams++;\n";
                     break;
                 case VT_LPSTR:
-                    aCode << "        VariantInit(&vParams[" << nParam << "]);\n";
-                    aCode << "        vParams[nActualParams].vt = VT_LPSTR;\n";
-                    aCode << "        vParams[nActualParams].byref = " << sParamName << ";\n";
+                    aCode << "        VariantInit(&rArg);\n";
+                    aCode << "        rArg.vt = VT_LPSTR;\n";
+                    aCode << "        rArg.byref = " << sParamName << ";\n";
                     aCode << "        nActualParams++;\n";
                     break;
                 case VT_LPWSTR:
-                    aCode << "        VariantInit(&vParams[" << nParam << "]);\n";
-                    aCode << "        vParams[nActualParams].vt = VT_LPWSTR;\n";
-                    aCode << "        vParams[nActualParams].byref = " << sParamName << ";\n";
+                    aCode << "        VariantInit(&rArg);\n";
+                    aCode << "        rArg.vt = VT_LPWSTR;\n";
+                    aCode << "        rArg.byref = " << sParamName << ";\n";
                     aCode << "        nActualParams++;\n";
                     break;
                 default:
                     if (rParam.tdesc.vt & VT_BYREF)
                     {
-                        aCode << "        VariantInit(&vParams[nActualParams]);\n";
-                        aCode << "        vParams[nActualParams].vt = " << rParam.tdesc.vt << ";\n";
-                        aCode << "        vParams[nActualParams].byref = " << sParamName << ";";
+                        aCode << "        VariantInit(&rArg);\n";
+                        aCode << "        rArg.vt = " << rParam.tdesc.vt << ";\n";
+                        aCode << "        rArg.byref = " << sParamName << ";";
                         aCode << "        nActualParams++;\n";
                     }
                     else
@@ -1567,7 +1855,7 @@ static void GenerateDispatch(const std::string& sLibName, const std::string& sTy
                    || rFunc.mpFuncDesc->invkind == INVOKE_PROPERTYPUTREF)
                   && nParam == rFunc.mpFuncDesc->cParams - 1))
             {
-                aCode << "    if (!bGotAll && (getParam()->mbTrace || getParam()->mbVerbose))\n";
+                aCode << "    if (!bGotAll && bTrace)\n";
                 aCode << "    {\n";
                 aCode << "        std::cout";
                 if (nParam > 0)
@@ -1640,7 +1928,7 @@ static void GenerateDispatch(const std::string& sLibName, const std::string& sTy
                 && rFunc.mpFuncDesc->cParams > 1)
             || (rFunc.mpFuncDesc->invkind == INVOKE_PROPERTYGET && rFunc.mpFuncDesc->cParams > 1))
         {
-            aCode << "    if (getParam()->mbTrace || getParam()->mbVerbose)\n";
+            aCode << "    if (bTrace)\n";
             aCode << "        std::cout << \")";
             aCode << "\";\n";
         }
@@ -1656,7 +1944,7 @@ static void GenerateDispatch(const std::string& sLibName, const std::string& sTy
                 sParamName = convertUTF16ToUTF8(rFunc.mvNames[(size_t)nParam + 1u]);
             else
                 sParamName = "p" + std::to_string(nParam);
-            aCode << "    if (getParam()->mbTrace || getParam()->mbVerbose)\n";
+            aCode << "    if (bTrace)\n";
             aCode << "        std::cout << \" = \"";
             switch (rParam.tdesc.vt)
             {
@@ -1715,28 +2003,24 @@ static void GenerateDispatch(const std::string& sLibName, const std::string& sTy
                     break;
             }
         }
-        aCode << "    std::vector<VARIANT> vReverseParams;\n";
-
         if (rFunc.mpFuncDesc->cParams > 0)
         {
             // Drop trailing empty parameters
-            aCode << "    while (nActualParams > 0 && vParams[nActualParams-1].vt == VT_EMPTY)\n";
-            aCode << "      nActualParams--;\n";
-
-            // Resize the vParams to match the number of actual ones we have. FIXME: Make it correct
-            // size from the start.
-            aCode << "    vParams.resize(nActualParams);\n";
-
-            // Reverse the order of parameters. Just create another vector.
-            aCode << "    for (auto i = vParams.rbegin(); i != vParams.rend(); ++i)\n";
-            aCode << "        vReverseParams.push_back(*i);\n";
+            aCode << "    while (nActualParams > 0\n";
+            aCode << "           && aParams[nLastParam - (nActualParams - 1)].vt == VT_EMPTY)\n";
+            aCode << "        nActualParams--;\n";
         }
 
         // Call CProxiedDispatch::genericInvoke()
         aCode << "    increaseIndent();\n";
-        aCode << "    HRESULT nResult = genericInvoke(\"" << convertUTF16ToUTF8(rFunc.mvNames[0])
-              << "\", " << rFunc.mpFuncDesc->invkind << ", "
-              << "vReverseParams, " << sRetvalName << ");\n";
+        const size_t nMemberName = aMemberNameIndex[rFunc.mvNames[0]];
+        aCode << "    HRESULT nResult = genericInvoke(\"" << sTypeName << "\", " << sMemberNames
+              << "[" << nMemberName << "], " << rFunc.mpFuncDesc->invkind << ", ";
+        if (rFunc.mpFuncDesc->cParams > 0)
+            aCode << "aParams.data() + nLastParam + 1 - nActualParams, nActualParams, ";
+        else
+            aCode << "nullptr, 0, ";
+        aCode << sRetvalName << ", " << sMemberIds << "[" << nMemberName << "]);\n";
         aCode << "    decreaseIndent();\n";
         if (nRetvalParam >= 0)
         {
@@ -1766,7 +2050,7 @@ static void GenerateDispatch(const std::string& sLibName, const std::string& sTy
                     if (rFunc.mpFuncDesc->invkind == INVOKE_PROPERTYGET
                         || rFunc.mpFuncDesc->invkind == INVOKE_FUNC)
                     {
-                        aCode << "        if (getParam()->mbTrace || getParam()->mbVerbose)\n";
+                        aCode << "        if (bTrace)\n";
                         aCode << "            std::cout << *"
                               << convertUTF16ToUTF8(rFunc.mvNames[nRetvalParam + 1u]) << ";\n";
                     }
@@ -1818,7 +2102,7 @@ static void GenerateDispatch(const std::string& sLibName, const std::string& sTy
                             if (rFunc.mpFuncDesc->invkind == INVOKE_PROPERTYGET
                                 || rFunc.mpFuncDesc->invkind == INVOKE_FUNC)
                             {
-                                aCode << "    if (getParam()->mbTrace || getParam()->mbVerbose)\n";
+                                aCode << "    if (bTrace)\n";
                                 aCode << "    {\n";
                                 aCode << "        if (nResult == S_OK)\n";
                                 aCode << "            std::cout << \" -> \" << *"
@@ -1847,7 +2131,7 @@ static void GenerateDispatch(const std::string& sLibName, const std::string& sTy
                               << convertUTF16ToUTF8(rFunc.mvNames[nRetvalParam + 1u]) << ", \""
                               << sLibName << "\");\n";
 
-                        aCode << "    if (getParam()->mbTrace || getParam()->mbVerbose)\n";
+                        aCode << "    if (bTrace)\n";
                         aCode << "    {\n";
                         aCode << "        if (nResult == S_OK)\n";
                         aCode << "            std::cout << *"
@@ -1868,7 +2152,7 @@ static void GenerateDispatch(const std::string& sLibName, const std::string& sTy
                               << convertUTF16ToUTF8(rFunc.mvNames[nRetvalParam + 1u]) << ", \""
                               << sLibName << "\", \"" << convertUTF16ToUTF8(rFunc.mvNames[0])
                               << "\"));\n";
-                        aCode << "    if (getParam()->mbTrace || getParam()->mbVerbose)\n";
+                        aCode << "    if (bTrace)\n";
                         aCode << "    {\n";
                         aCode << "        if (nResult == S_OK)\n";
                         aCode << "            std::cout << \" -> \" << *"
@@ -1886,7 +2170,7 @@ static void GenerateDispatch(const std::string& sLibName, const std::string& sTy
                         if (rFunc.mpFuncDesc->invkind == INVOKE_PROPERTYGET
                             || rFunc.mpFuncDesc->invkind == INVOKE_FUNC)
                         {
-                            aCode << "    if (getParam()->mbTrace || getParam()->mbVerbose)\n";
+                            aCode << "    if (bTrace)\n";
                             aCode << "    {\n";
                             aCode << "        if (nResult == S_OK)\n";
                             aCode << "            std::cout << \" -> \" << *"
@@ -1902,7 +2186,7 @@ static void GenerateDispatch(const std::string& sLibName, const std::string& sTy
                     }
                     else
                     {
-                        aCode << "    if (getParam()->mbTrace || getParam()->mbVerbose)\n";
+                        aCode << "    if (bTrace)\n";
                         aCode << "    {\n";
                         aCode << "        if (nResult == S_OK)\n";
                         aCode << "            std::cout << \"?\\n\";\n";
@@ -1921,7 +2205,7 @@ static void GenerateDispatch(const std::string& sLibName, const std::string& sTy
         }
         else
         {
-            aCode << "    if (getParam()->mbTrace && !getParam()->mbVerbose)\n";
+            aCode << "    if (bTrace && !getParam()->mbVerbose)\n";
             aCode << "    {\n";
             aCode << "        std::cout << std::endl;\n";
             aCode << "        mbIsAtBeginningOfLine = true;\n";
@@ -2240,6 +2524,63 @@ static void GenerateProxyCreator()
     if (aDispatches.size() == 0)
         return;
 
+    // The same interface can come from more than one type library. Proxy it as the first one, as
+    // lookup is by IID only, and two equal IIDs would collide for every seed below.
+    std::vector<Interface> vDispatches;
+    std::set<IID> aProxiedIIDs;
+    for (const auto& rDispatch : aDispatches)
+    {
+        if (aProxiedIIDs.insert(rDispatch.maIID).second)
+            vDispatches.push_back(rDispatch);
+        else
+            std::cerr << "Ignoring duplicate " << rDispatch.msLibName << "." << rDispatch.msName
+                      << " " << IID_to_string(rDispatch.maIID) << "\n";
+    }
+
+    // Find a seed for hashIID() that gives no collisions between the known interfaces, in a table
+    // at least twice the number of them. Growing the table past NMAXHASHSIZE would mean that
+    // 100000 seeds per size were not enough, i.e. that the hash is broken, so give up then.
+    const size_t NMAXHASHSIZE = 64 * 1024;
+
+    size_t nHashSize = 1;
+    while (nHashSize < 2 * vDispatches.size())
+        nHashSize *= 2;
+
+    unsigned nHashSeed = 0;
+    std::vector<int> vHashTable;
+    while (true)
+    {
+        bool bFound = false;
+        for (nHashSeed = 0; nHashSeed < 100000; ++nHashSeed)
+        {
+            vHashTable.assign(nHashSize, -1);
+            bool bCollision = false;
+            for (size_t i = 0; i < vDispatches.size(); ++i)
+            {
+                const size_t nSlot = hashIID(vDispatches[i].maIID, nHashSeed) & (nHashSize - 1);
+                if (vHashTable[nSlot] != -1)
+                {
+                    bCollision = true;
+                    break;
+                }
+                vHashTable[nSlot] = (int)i;
+            }
+            if (!bCollision)
+            {
+                bFound = true;
+                break;
+            }
+        }
+        if (bFound)
+            break;
+        nHashSize *= 2;
+        if (nHashSize > NMAXHASHSIZE)
+        {
+            std::cerr << "No perfect hash found for " << vDispatches.size() << " interfaces\n";
+            std::exit(1);
+        }
+    }
+
     const std::string sHeader = sOutputFolder + "/ProxyCreator.hxx";
     OutputFile aHeader(sHeader);
 
@@ -2248,65 +2589,173 @@ static void GenerateProxyCreator()
     aHeader << "#ifndef INCLUDED_ProxyCreator_HXX\n";
     aHeader << "#define INCLUDED_ProxyCreator_HXX\n";
     aHeader << "\n";
+    aHeader << "#include <map>\n";
+    aHeader << "\n";
 
-    for (const auto i : aDispatches)
+    for (const auto& i : vDispatches)
     {
         aHeader << "#include \"C" << i.msLibName << "_" << i.msName << ".hxx\"\n";
     }
 
     aHeader << "\n";
 
+    // The known interfaces, and a perfect hash table of indexes into them.
+
+    aHeader << "static const IID aProxyCreatorIIDs[] = {\n";
+    for (size_t i = 0; i < vDispatches.size(); ++i)
+        aHeader << "    " << IID_initializer(vDispatches[i].maIID) << ", // " << i << ": "
+                << vDispatches[i].msLibName << "." << vDispatches[i].msName << "\n";
+    aHeader << "};\n";
+    aHeader << "\n";
+    aHeader << "static const unsigned nProxyCreatorHashSeed = " << nHashSeed << ";\n";
+    aHeader << "static const unsigned nProxyCreatorHashMask = " << nHashSize - 1 << ";\n";
+    aHeader << "static const int aProxyCreatorHash[] = {";
+    for (size_t i = 0; i < nHashSize; ++i)
+    {
+        if (i % 16 == 0)
+            aHeader << "\n   ";
+        aHeader << " " << vHashTable[i] << ",";
+    }
+    aHeader << "\n};\n";
+    aHeader << "\n";
+
+    // The slow path: Check that the object matches exactly one of the interfaces we know.
+
+    aHeader << "static int ProxyCreatorIndexByProbing(IDispatch* pDispatchToProxy)\n";
+    aHeader << "{\n";
+    aHeader << "    int nIndex = -1;\n";
+    aHeader << "    for (int i = 0; i < " << vDispatches.size() << "; ++i)\n";
+    aHeader << "    {\n";
+    aHeader << "        IUnknown* pUnknown;\n";
+    aHeader << "        if (pDispatchToProxy->QueryInterface(aProxyCreatorIIDs[i],\n";
+    aHeader << "                                             (void**)&pUnknown) == S_OK)\n";
+    aHeader << "        {\n";
+    aHeader << "            pUnknown->Release();\n";
+    aHeader << "            if (nIndex != -1)\n";
+    // Multiple matches.
+    aHeader << "                return -1;\n";
+    aHeader << "            nIndex = i;\n";
+    aHeader << "        }\n";
+    aHeader << "    }\n";
+    aHeader << "    return nIndex;\n";
+    aHeader << "}\n";
+    aHeader << "\n";
+
     aHeader << "static IDispatch* "
             << "ProxyCreator(IDispatch* pDispatchToProxy, std::string& sPrettyTypeName)\n";
     aHeader << "{\n";
-    aHeader << "    HRESULT nResult;\n";
-    aHeader << "    bool bFoundOne = false;\n";
-    aHeader << "    IUnknown* pUnknown;\n";
+    aHeader << "    // Results of probing, for types that aren't one of the known interfaces.\n";
+    aHeader << "    static std::map<IID, int> aProbedTypes;\n";
+    aHeader << "    static SRWLOCK aProbedTypesLock = SRWLOCK_INIT;\n";
     aHeader << "\n";
     aHeader << "    sPrettyTypeName = \"\";\n";
     aHeader << "\n";
+    aHeader << "    IID aTypeIID = IID_NULL;\n";
+    aHeader << "    ITypeInfo* pTI;\n";
+    aHeader << "    if (pDispatchToProxy->GetTypeInfo(0, LOCALE_USER_DEFAULT, &pTI) == S_OK)\n";
+    aHeader << "    {\n";
+    aHeader << "        TYPEATTR* pTA;\n";
+    aHeader << "        if (pTI->GetTypeAttr(&pTA) == S_OK)\n";
+    aHeader << "        {\n";
+    aHeader << "            aTypeIID = pTA->guid;\n";
+    aHeader << "            pTI->ReleaseTypeAttr(pTA);\n";
+    aHeader << "        }\n";
+    aHeader << "        pTI->Release();\n";
+    aHeader << "    }\n";
+    aHeader << "\n";
+    aHeader << "    int nIndex = -1;\n";
+    aHeader << "    bool bKnown = false;\n";
+    aHeader << "    if (aTypeIID != IID_NULL)\n";
+    aHeader << "    {\n";
+    aHeader << "        const unsigned nSlot\n";
+    aHeader << "            = hashIID(aTypeIID, nProxyCreatorHashSeed) & nProxyCreatorHashMask;\n";
+    aHeader << "        const int nCandidate = aProxyCreatorHash[nSlot];\n";
+    aHeader << "        if (nCandidate != -1 && aProxyCreatorIIDs[nCandidate] == aTypeIID)\n";
+    aHeader << "        {\n";
+    aHeader << "            nIndex = nCandidate;\n";
+    aHeader << "            bKnown = true;\n";
+    aHeader << "        }\n";
+    aHeader << "        else\n";
+    aHeader << "        {\n";
+    aHeader << "            AcquireSRWLockShared(&aProbedTypesLock);\n";
+    aHeader << "            auto p = aProbedTypes.find(aTypeIID);\n";
+    aHeader << "            if (p != aProbedTypes.end())\n";
+    aHeader << "            {\n";
+    aHeader << "                nIndex = p->second;\n";
+    aHeader << "                bKnown = true;\n";
+    aHeader << "            }\n";
+    aHeader << "            ReleaseSRWLockShared(&aProbedTypesLock);\n";
+    aHeader << "        }\n";
+    aHeader << "    }\n";
+    aHeader << "\n";
+    aHeader << "    if (!bKnown)\n";
+    aHeader << "    {\n";
+    aHeader << "        nIndex = ProxyCreatorIndexByProbing(pDispatchToProxy);\n";
+    aHeader << "        if (aTypeIID != IID_NULL)\n";
+    aHeader << "        {\n";
+    aHeader << "            AcquireSRWLockExclusive(&aProbedTypesLock);\n";
+    aHeader << "            aProbedTypes[aTypeIID] = nIndex;\n";
+    aHeader << "            ReleaseSRWLockExclusive(&aProbedTypesLock);\n";
+    aHeader << "        }\n";
+    aHeader << "    }\n";
+    aHeader << "\n";
 
-    // First check that the object matches at most one of the interfaces we know.
-    for (const auto i : aDispatches)
+    // Then create the proxy
+    aHeader << "    switch (nIndex)\n";
+    aHeader << "    {\n";
+    for (size_t i = 0; i < vDispatches.size(); ++i)
     {
-        aHeader << "    const IID aIID_" << i.msLibName << "_" << i.msName << " = "
-                << IID_initializer(i.maIID) << ";\n";
-        aHeader << "    nResult = pDispatchToProxy->QueryInterface(aIID_" << i.msLibName << "_"
-                << i.msName << ", (void**)&pUnknown);\n";
-        aHeader << "    if (nResult == S_OK)\n";
-        aHeader << "    {\n";
-        aHeader << "        pUnknown->Release();\n";
-        aHeader << "        if (bFoundOne)\n";
-        // Multiple matches.
-        aHeader << "            return pDispatchToProxy;\n";
-        aHeader << "        bFoundOne = true;\n";
-        aHeader << "    }\n";
-        aHeader << "\n";
+        const Interface& rDispatch = vDispatches[i];
+        aHeader << "        case " << i << ":\n";
+        aHeader << "            sPrettyTypeName = \"" << rDispatch.msLibName << "."
+                << rDispatch.msName << "\";\n";
+        aHeader << "            return reinterpret_cast<IDispatch*>(C" << rDispatch.msLibName << "_"
+                << rDispatch.msName << "::get(nullptr, pDispatchToProxy));\n";
     }
+    aHeader << "        default:\n";
+    aHeader << "            return pDispatchToProxy;\n";
+    aHeader << "    }\n";
+    aHeader << "};\n";
+    aHeader << "\n";
+    aHeader << "#endif // INCLUDED_ProxyCreator_HXX\n";
+}
 
-    aHeader << "    if (!bFoundOne)\n";
-    aHeader << "        return pDispatchToProxy;\n";
+static void GenerateIIDNames()
+{
+    if (aDispatches.size() == 0 && aCallbacks.size() == 0)
+        return;
+
+    const std::string sHeader = sOutputFolder + "/IIDNames.hxx";
+    OutputFile aHeader(sHeader);
+
+    aHeader << "// Generated file. Do not edit.\n";
+    aHeader << "\n";
+    aHeader << "#ifndef INCLUDED_IIDNames_HXX\n";
+    aHeader << "#define INCLUDED_IIDNames_HXX\n";
+    aHeader << "\n";
+    aHeader << "#include \"proxyruntime.hpp\"\n";
     aHeader << "\n";
 
-    // Next create the proxy
-    for (const auto i : aDispatches)
+    // The same names as the Registry has for the interfaces, so the output is the same whether
+    // IIDNameCache finds an IID here or in the Registry.
+    aHeader << "const static IIDNameSeed aGeneratedIIDNames[] =\n";
+    aHeader << "{\n";
+
+    std::map<IID, std::string> aNames;
+    for (const auto& i : aDispatches)
+        aNames.insert({ i.maIID, i.msName });
+    for (const auto& i : aCallbacks)
+        aNames.insert({ i.maIID, i.msName });
+
+    for (const auto& i : aNames)
     {
-        aHeader << "    nResult = pDispatchToProxy->QueryInterface(aIID_" << i.msLibName << "_"
-                << i.msName << ", (void**)&pUnknown);\n";
-        aHeader << "    if (nResult == S_OK)\n";
-        aHeader << "    {\n";
-        aHeader << "        pUnknown->Release();\n";
-        aHeader << "        sPrettyTypeName = \"" << i.msLibName << "." << i.msName << "\";\n";
-        aHeader << "        return reinterpret_cast<IDispatch*>(C" << i.msLibName << "_" << i.msName
-                << "::get(nullptr, pDispatchToProxy));\n";
-        aHeader << "    }\n";
-        aHeader << "\n";
+        aHeader << "    { " << IID_initializer(i.first) << ",\n"
+                << "      \"IID_" << i.second << "\" },\n";
     }
 
-    aHeader << "    return pDispatchToProxy;\n";
     aHeader << "};\n";
     aHeader << "\n";
-    aHeader << "#endif // INCLUDED_ProxyCreator_HXX\n";
+    aHeader << "#endif // INCLUDED_IIDNames_HXX\n";
 }
 
 static void GenerateInterfaceMapping()
@@ -2342,6 +2791,60 @@ static void GenerateInterfaceMapping()
     aHeader << "#endif // INCLUDED_InterfaceMapping_HXX\n";
 }
 
+// For -U: a precompiled header with what all the generated code includes, and the unity
+// translation units that each include a share of the generated .cxx files. A file goes to the
+// chunk its name hashes to, so that adding or removing an interface changes just that chunk.
+static void GenerateUnityBuild()
+{
+    const std::string sPchHeader = sOutputFolder + "/ProxiesPch.hxx";
+    OutputFile aPchHeader(sPchHeader);
+
+    aPchHeader << "// Generated file. Do not edit.\n";
+    aPchHeader << "\n";
+    aPchHeader << "#ifndef INCLUDED_ProxiesPch_HXX\n";
+    aPchHeader << "#define INCLUDED_ProxiesPch_HXX\n";
+    aPchHeader << "\n";
+    aPchHeader << "#pragma warning(push)\n";
+    aPchHeader << "#pragma warning(disable: 4668 4820 4917 5039)\n";
+    aPchHeader << "#include <array>\n";
+    aPchHeader << "#include <cstdlib>\n";
+    aPchHeader << "#include <iostream>\n";
+    aPchHeader << "#include <Windows.h>\n";
+    aPchHeader << "#pragma warning(pop)\n";
+    aPchHeader << "\n";
+    aPchHeader << "#include \"CProxiedDispatch.hpp\"\n";
+    aPchHeader << "#include \"CProxiedEnumVARIANT.hpp\"\n";
+    aPchHeader << "#include \"CProxiedUnknown.hpp\"\n";
+    aPchHeader << "#include \"TraceFilter.hpp\"\n";
+    aPchHeader << "\n";
+    aPchHeader << "#endif // INCLUDED_ProxiesPch_HXX\n";
+
+    const std::string sPchCode = sOutputFolder + "/ProxiesPch.cxx";
+    OutputFile aPchCode(sPchCode);
+
+    aPchCode << "// Generated file. Do not edit.\n";
+    aPchCode << "\n";
+    aPchCode << "#include \"ProxiesPch.hxx\"\n";
+
+    std::vector<std::set<std::string>> aChunks(nUnityChunks);
+    for (const auto& i : aCodeFiles)
+        aChunks[stableHash(i) % nUnityChunks].insert(i);
+
+    for (unsigned nChunk = 0; nChunk < nUnityChunks; ++nChunk)
+    {
+        const std::string sChunk
+            = sOutputFolder + "/ProxiesUnity" + std::to_string(nChunk + 1) + ".cxx";
+        OutputFile aChunk(sChunk);
+
+        aChunk << "// Generated file. Do not edit.\n";
+        aChunk << "\n";
+        aChunk << "#include \"ProxiesPch.hxx\"\n";
+        aChunk << "\n";
+        for (const auto& i : aChunks[nChunk])
+            aChunk << "#include \"" << i << "\"\n";
+    }
+}
+
 static void Usage(wchar_t** argv)
 {
     std::cerr << "Usage: " << convertUTF16ToUTF8(programName(argv[0]))
@@ -2350,6 +2853,8 @@ static void Usage(wchar_t** argv)
                  "  Options:\n"
                  "    -d directory                 Directory where to write generated files.\n"
                  "                                 Default: \"generated\".\n"
+                 "    -D file                      Instead of generating code, write a snapshot\n"
+                 "                                 of the type libraries to file\n"
                  "    -i app.iface,app.iface,...   Only output code for those interfaces\n"
                  "    -I file                      Only output code for interfaces listed in file\n"
                  "    -M file                      file contains interface mappings\n"
@@ -2357,6 +2862,11 @@ static void Usage(wchar_t** argv)
                  "interface IIDs\n"
                  "                                 and the proxied application's source interface "
                  "IIDs in file\n"
+                 "    -S file                      Read the type libraries from a snapshot\n"
+                 "                                 written with -D instead of from the files\n"
+                 "    -U n                         Also write n unity translation units that\n"
+                 "                                 together include all generated .cxx files, and\n"
+                 "                                 the precompiled header ProxiesPch.hxx for them\n"
                  "  If no -M option is given, does not do any COM server redirection.\n"
                  "  For instance: "
               << convertUTF16ToUTF8(programName(argv[0]))
@@ -2364,6 +2874,17 @@ static void Usage(wchar_t** argv)
     std::exit(1);
 }
 
+// What to open a file named on the command line with. The Microsoft library takes the UTF-16 name
+// as such, elsewhere it must be converted.
+#ifdef _WIN32
+static const wchar_t* streamFileName(const wchar_t* pFileName) { return pFileName; }
+#else
+static std::string streamFileName(const wchar_t* pFileName)
+{
+    return convertUTF16ToUTF8(pFileName);
+}
+#endif
+
 static bool parseMapping(const char* pLine, InterfaceMapping& rMapping)
 {
     wchar_t* pWLine = _wcsdup(convertUTF8ToUTF16(pLine).data());
@@ -2405,6 +2926,14 @@ int wmain(int argc, wchar_t** argv)
                 argi++;
                 break;
             }
+            case L'D':
+            {
+                if (argi + 1 >= argc)
+                    Usage(argv);
+                pDumpFileName = argv[argi + 1];
+                argi++;
+                break;
+            }
             case L'i':
             {
                 if (argi + 1 >= argc)
@@ -2425,7 +2954,7 @@ int wmain(int argc, wchar_t** argv)
             {
                 if (argi + 1 >= argc)
                     Usage(argv);
-                std::ifstream aIFile(argv[argi + 1]);
+                std::ifstream aIFile(streamFileName(argv[argi + 1]));
                 if (!aIFile.good())
                 {
                     std::cerr << "Could not open " << convertUTF16ToUTF8(argv[argi + 1])
@@ -2446,7 +2975,7 @@ int wmain(int argc, wchar_t** argv)
             {
                 if (argi + 1 >= argc)
                     Usage(argv);
-                std::ifstream aMFile(argv[argi + 1]);
+                std::ifstream aMFile(streamFileName(argv[argi + 1]));
                 if (!aMFile.good())
                 {
                     std::cerr << "Could not open " << convertUTF16ToUTF8(argv[argi + 1])
@@ -2480,7 +3009,7 @@ int wmain(int argc, wchar_t** argv)
             {
                 if (argi + 1 >= argc)
                     Usage(argv);
-                std::ifstream aOFile(argv[argi + 1]);
+                std::ifstream aOFile(streamFileName(argv[argi + 1]));
                 if (!aOFile.good())
                 {
                     std::cerr << "Could not open " << convertUTF16ToUTF8(argv[argi + 1])
@@ -2530,6 +3059,39 @@ int wmain(int argc, wchar_t** argv)
                 argi++;
                 break;
             }
+            case 'S':
+            {
+                if (argi + 1 >= argc)
+                    Usage(argv);
+                std::ifstream aSFile(streamFileName(argv[argi + 1]), std::ios::binary);
+                if (!aSFile.good())
+                {
+                    std::cerr << "Could not open " << convertUTF16ToUTF8(argv[argi + 1])
+                              << " for reading\n";
+                    std::exit(1);
+                }
+                pSnapshot = new TypeLibSnapshot();
+                std::string sError;
+                if (!pSnapshot->read(aSFile, sError))
+                {
+                    std::cerr << "Could not read " << convertUTF16ToUTF8(argv[argi + 1]) << ": "
+                              << sError << "\n";
+                    std::exit(1);
+                }
+                argi++;
+                break;
+            }
+            case 'U':
+            {
+                if (argi + 1 >= argc)
+                    Usage(argv);
+                const long nChunks = std::wcstol(argv[argi + 1], nullptr, 10);
+                if (nChunks < 1 || nChunks > 1000)
+                    Usage(argv);
+                nUnityChunks = (unsigned)nChunks;
+                argi++;
+                break;
+            }
             default:
                 Usage(argv);
         }
@@ -2541,6 +3103,12 @@ int wmain(int argc, wchar_t** argv)
 
     CoInitialize(NULL);
 
+    if (pDumpFileName == nullptr)
+        Emitter::start();
+
+    TypeLibSnapshot aDump;
+    TypeLibSnapshotBuilder aDumpBuilder(aDump);
+
     for (; argi < argc; ++argi)
     {
         wchar_t* const pColon = std::wcschr(argv[argi], L':');
@@ -2553,12 +3121,34 @@ int wmain(int argc, wchar_t** argv)
 
         HRESULT nResult;
         ITypeLib* pTypeLib;
-        nResult = LoadTypeLibEx(argv[argi], REGKIND_NONE, &pTypeLib);
-        if (FAILED(nResult))
+        if (pSnapshot != nullptr)
         {
-            std::cerr << "Could not load '" << convertUTF16ToUTF8(argv[argi])
-                      << "' as a type library: " << WindowsErrorStringFromHRESULT(nResult) << "\n";
-            std::exit(1);
+            const SnapshotLibrary* pLibrary
+                = pSnapshot->findLibrary(convertUTF16ToUTF8(argv[argi]));
+            if (pLibrary == nullptr)
+            {
+                std::cerr << "No '" << convertUTF16ToUTF8(argv[argi]) << "' in the snapshot\n";
+                std::exit(1);
+            }
+            pTypeLib = createSnapshotTypeLib(*pSnapshot, *pLibrary);
+        }
+        else
+        {
+            nResult = LoadTypeLibEx(argv[argi], REGKIND_NONE, &pTypeLib);
+            if (FAILED(nResult))
+            {
+                std::cerr << "Could not load '" << convertUTF16ToUTF8(argv[argi])
+                          << "' as a type library: " << WindowsErrorStringFromHRESULT(nResult)
+                          << "\n";
+                std::exit(1);
+            }
+        }
+
+        // The whole type library, whether an interface was given or not.
+        if (pDumpFileName != nullptr)
+        {
+            aDumpBuilder.addLibrary(convertUTF16ToUTF8(argv[argi]), pTypeLib);
+            continue;
         }
 
         UINT nTypeInfoCount = pTypeLib->GetTypeInfoCount();
@@ -2633,6 +3223,20 @@ int wmain(int argc, wchar_t** argv)
         }
     }
 
+    if (pDumpFileName != nullptr)
+    {
+        std::ofstream aDFile(streamFileName(pDumpFileName), std::ios::binary);
+        aDump.write(aDFile);
+        aDFile.close();
+        if (!aDFile.good())
+        {
+            std::cerr << "Could not write " << convertUTF16ToUTF8(pDumpFileName) << "\n";
+            std::exit(1);
+        }
+        CoUninitialize();
+        return 0;
+    }
+
     GenerateProxyCreator();
 
     GenerateInterfaceMapping();
@@ -2643,9 +3247,35 @@ int wmain(int argc, wchar_t** argv)
 
     GenerateDefaultInterfaceCreator();
 
+    GenerateIIDNames();
+
+    if (nUnityChunks > 0)
+        GenerateUnityBuild();
+
+    Emitter::finish();
+
     CoUninitialize();
 
     return 0;
 }
 
+#ifndef _WIN32
+
+// There is no wmain() elsewhere, and the arguments are in UTF-8.
+int main(int argc, char** argv)
+{
+    std::vector<std::wstring> aArguments;
+    for (int i = 0; i < argc; ++i)
+        aArguments.push_back(convertUTF8ToUTF16(argv[i]));
+
+    std::vector<wchar_t*> aArgv;
+    for (std::wstring& rArgument : aArguments)
+        aArgv.push_back(&rArgument[0]);
+    aArgv.push_back(nullptr);
+
+    return wmain(argc, aArgv.data());
+}
+
+#endif
+
 /* vim:set shiftwidth=4 softtabstop=4 expandtab cinoptions=b1,g0,N-s cinkeys+=0=break: */
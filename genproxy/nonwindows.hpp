@@ -0,0 +1,809 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of Collabora OLE Automation Translator.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_nonwindows_hpp
+#define INCLUDED_nonwindows_hpp
+
+// What genproxy otherwise gets from Windows.h and utils.hpp, for building it elsewhere, where it
+// can generate the proxies only from a snapshot of the type libraries (-S). The types are those of
+// the Windows SDK, as far as genproxy and the snapshot type library use them, with the same
+// values. The few API functions used are implemented on top of the C++ and POSIX libraries, with
+// no more of their semantics than genproxy needs.
+
+#ifdef _WIN32
+#error "Use Windows.h and utils.hpp on Windows"
+#endif
+
+#include <sys/stat.h>
+
+#include <cerrno>
+#include <codecvt>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cwchar>
+#include <iomanip>
+#include <locale>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <thread>
+
+typedef uint8_t BYTE;
+typedef uint16_t WORD;
+typedef uint32_t DWORD;
+typedef int16_t SHORT;
+typedef uint16_t USHORT;
+typedef int32_t INT;
+typedef uint32_t UINT;
+typedef int32_t LONG;
+typedef uint32_t ULONG;
+typedef int64_t LONGLONG;
+typedef uint64_t ULONGLONG;
+typedef uintptr_t ULONG_PTR;
+typedef int BOOL;
+typedef int32_t HRESULT;
+typedef DWORD LCID;
+typedef USHORT VARTYPE;
+typedef LONG MEMBERID;
+typedef LONG DISPID;
+typedef DWORD HREFTYPE;
+typedef wchar_t OLECHAR;
+typedef OLECHAR* LPOLESTR;
+typedef OLECHAR* BSTR;
+typedef char* LPSTR;
+typedef wchar_t* LPWSTR;
+typedef void* PVOID;
+typedef void* LPVOID;
+typedef void* HANDLE;
+
+#define TRUE 1
+#define FALSE 0
+#define WINAPI
+#define STDMETHODCALLTYPE
+
+#define SUCCEEDED(hr) (((HRESULT)(hr)) >= 0)
+#define FAILED(hr) (((HRESULT)(hr)) < 0)
+
+#define S_OK ((HRESULT)0)
+#define S_FALSE ((HRESULT)1)
+#define E_NOTIMPL ((HRESULT)0x80004001)
+#define E_NOINTERFACE ((HRESULT)0x80004002)
+#define E_FAIL ((HRESULT)0x80004005)
+#define E_INVALIDARG ((HRESULT)0x80070057)
+#define TYPE_E_ELEMENTNOTFOUND ((HRESULT)0x8002802B)
+#define TYPE_E_CANTLOADLIBRARY ((HRESULT)0x80029C4A)
+
+struct GUID
+{
+    uint32_t Data1;
+    uint16_t Data2;
+    uint16_t Data3;
+    uint8_t Data4[8];
+};
+
+typedef GUID IID;
+typedef GUID CLSID;
+typedef const GUID& REFGUID;
+typedef const IID& REFIID;
+
+inline bool IsEqualGUID(REFGUID a, REFGUID b) { return std::memcmp(&a, &b, sizeof(a)) == 0; }
+
+inline bool IsEqualIID(REFIID a, REFIID b) { return IsEqualGUID(a, b); }
+
+static const GUID GUID_NULL = {};
+static const IID IID_NULL = {};
+static const IID IID_IUnknown
+    = { 0x00000000, 0x0000, 0x0000, { 0xC0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x46 } };
+static const IID IID_ITypeInfo
+    = { 0x00020401, 0x0000, 0x0000, { 0xC0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x46 } };
+static const IID IID_ITypeLib
+    = { 0x00020402, 0x0000, 0x0000, { 0xC0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x46 } };
+
+// OLE Automation
+
+enum VARENUM
+{
+    VT_EMPTY = 0,
+    VT_NULL = 1,
+    VT_I2 = 2,
+    VT_I4 = 3,
+    VT_R4 = 4,
+    VT_R8 = 5,
+    VT_CY = 6,
+    VT_DATE = 7,
+    VT_BSTR = 8,
+    VT_DISPATCH = 9,
+    VT_ERROR = 10,
+    VT_BOOL = 11,
+    VT_VARIANT = 12,
+    VT_UNKNOWN = 13,
+    VT_DECIMAL = 14,
+    VT_I1 = 16,
+    VT_UI1 = 17,
+    VT_UI2 = 18,
+    VT_UI4 = 19,
+    VT_I8 = 20,
+    VT_UI8 = 21,
+    VT_INT = 22,
+    VT_UINT = 23,
+    VT_VOID = 24,
+    VT_HRESULT = 25,
+    VT_PTR = 26,
+    VT_SAFEARRAY = 27,
+    VT_CARRAY = 28,
+    VT_USERDEFINED = 29,
+    VT_LPSTR = 30,
+    VT_LPWSTR = 31,
+    VT_RECORD = 36,
+    VT_INT_PTR = 37,
+    VT_UINT_PTR = 38,
+    VT_FILETIME = 64,
+    VT_BLOB = 65,
+    VT_STREAM = 66,
+    VT_STORAGE = 67,
+    VT_STREAMED_OBJECT = 68,
+    VT_STORED_OBJECT = 69,
+    VT_BLOB_OBJECT = 70,
+    VT_CF = 71,
+    VT_CLSID = 72,
+    VT_VERSIONED_STREAM = 73,
+    VT_BSTR_BLOB = 0xFFF,
+    VT_VECTOR = 0x1000,
+    VT_ARRAY = 0x2000,
+    VT_BYREF = 0x4000,
+    VT_RESERVED = 0x8000,
+    VT_ILLEGAL = 0xFFFF,
+    VT_ILLEGALMASKED = 0xFFF,
+    VT_TYPEMASK = 0xFFF
+};
+
+enum TYPEKIND
+{
+    TKIND_ENUM,
+    TKIND_RECORD,
+    TKIND_MODULE,
+    TKIND_INTERFACE,
+    TKIND_DISPATCH,
+    TKIND_COCLASS,
+    TKIND_ALIAS,
+    TKIND_UNION,
+    TKIND_MAX
+};
+
+enum FUNCKIND
+{
+    FUNC_VIRTUAL,
+    FUNC_PUREVIRTUAL,
+    FUNC_NONVIRTUAL,
+    FUNC_STATIC,
+    FUNC_DISPATCH
+};
+
+enum INVOKEKIND
+{
+    INVOKE_FUNC = 1,
+    INVOKE_PROPERTYGET = 2,
+    INVOKE_PROPERTYPUT = 4,
+    INVOKE_PROPERTYPUTREF = 8
+};
+
+enum CALLCONV
+{
+    CC_FASTCALL = 0,
+    CC_CDECL = 1,
+    CC_MSCPASCAL = 2,
+    CC_PASCAL = CC_MSCPASCAL,
+    CC_MACPASCAL = 3,
+    CC_STDCALL = 4,
+    CC_FPFASTCALL = 5,
+    CC_SYSCALL = 6,
+    CC_MPWCDECL = 7,
+    CC_MPWPASCAL = 8,
+    CC_MAX = 9
+};
+
+enum VARKIND
+{
+    VAR_PERINSTANCE,
+    VAR_STATIC,
+    VAR_CONST,
+    VAR_DISPATCH
+};
+
+enum SYSKIND
+{
+    SYS_WIN16,
+    SYS_WIN32,
+    SYS_MAC,
+    SYS_WIN64
+};
+
+enum REGKIND
+{
+    REGKIND_DEFAULT,
+    REGKIND_REGISTER,
+    REGKIND_NONE
+};
+
+enum TYPEFLAGS
+{
+    TYPEFLAG_FAPPOBJECT = 0x1,
+    TYPEFLAG_FCANCREATE = 0x2,
+    TYPEFLAG_FLICENSED = 0x4,
+    TYPEFLAG_FPREDECLID = 0x8,
+    TYPEFLAG_FHIDDEN = 0x10,
+    TYPEFLAG_FCONTROL = 0x20,
+    TYPEFLAG_FDUAL = 0x40,
+    TYPEFLAG_FNONEXTENSIBLE = 0x80,
+    TYPEFLAG_FOLEAUTOMATION = 0x100,
+    TYPEFLAG_FRESTRICTED = 0x200,
+    TYPEFLAG_FAGGREGATABLE = 0x400,
+    TYPEFLAG_FREPLACEABLE = 0x800,
+    TYPEFLAG_FDISPATCHABLE = 0x1000,
+    TYPEFLAG_FREVERSEBIND = 0x2000,
+    TYPEFLAG_FPROXY = 0x4000
+};
+
+#define IMPLTYPEFLAG_FDEFAULT 0x1
+#define IMPLTYPEFLAG_FSOURCE 0x2
+#define IMPLTYPEFLAG_FRESTRICTED 0x4
+#define IMPLTYPEFLAG_FDEFAULTVTABLE 0x8
+
+#define PARAMFLAG_NONE 0x0
+#define PARAMFLAG_FIN 0x1
+#define PARAMFLAG_FOUT 0x2
+#define PARAMFLAG_FLCID 0x4
+#define PARAMFLAG_FRETVAL 0x8
+#define PARAMFLAG_FOPT 0x10
+#define PARAMFLAG_FHASDEFAULT 0x20
+#define PARAMFLAG_FHASCUSTDATA 0x40
+
+#define MEMBERID_NIL ((MEMBERID)-1)
+#define DISPID_NEWENUM ((DISPID)-4)
+
+struct ARRAYDESC;
+struct PARAMDESCEX;
+
+struct TYPEDESC
+{
+    union
+    {
+        TYPEDESC* lptdesc;
+        ARRAYDESC* lpadesc;
+        HREFTYPE hreftype;
+    };
+    VARTYPE vt;
+};
+
+struct SAFEARRAYBOUND
+{
+    ULONG cElements;
+    LONG lLbound;
+};
+
+struct ARRAYDESC
+{
+    TYPEDESC tdescElem;
+    USHORT cDims;
+    SAFEARRAYBOUND rgbounds[1];
+};
+
+struct IDLDESC
+{
+    ULONG_PTR dwReserved;
+    USHORT wIDLFlags;
+};
+
+struct PARAMDESC
+{
+    PARAMDESCEX* pparamdescex;
+    USHORT wParamFlags;
+};
+
+struct ELEMDESC
+{
+    TYPEDESC tdesc;
+    union
+    {
+        IDLDESC idldesc;
+        PARAMDESC paramdesc;
+    };
+};
+
+// Only the members of the union that genproxy reads
+struct VARIANT
+{
+    VARTYPE vt;
+    WORD wReserved1;
+    WORD wReserved2;
+    WORD wReserved3;
+    union
+    {
+        LONGLONG llVal;
+        LONG lVal;
+        BYTE bVal;
+        SHORT iVal;
+    };
+};
+
+struct TYPEATTR
+{
+    GUID guid;
+    LCID lcid;
+    DWORD dwReserved;
+    MEMBERID memidConstructor;
+    MEMBERID memidDestructor;
+    LPOLESTR lpstrSchema;
+    ULONG cbSizeInstance;
+    TYPEKIND typekind;
+    WORD cFuncs;
+    WORD cVars;
+    WORD cImplTypes;
+    WORD cbSizeVft;
+    WORD cbAlignment;
+    WORD wTypeFlags;
+    WORD wMajorVerNum;
+    WORD wMinorVerNum;
+    TYPEDESC tdescAlias;
+    IDLDESC idldescType;
+};
+
+struct FUNCDESC
+{
+    MEMBERID memid;
+    HRESULT* lprgscode;
+    ELEMDESC* lprgelemdescParam;
+    FUNCKIND funckind;
+    INVOKEKIND invkind;
+    CALLCONV callconv;
+    SHORT cParams;
+    SHORT cParamsOpt;
+    SHORT oVft;
+    SHORT cScodes;
+    ELEMDESC elemdescFunc;
+    WORD wFuncFlags;
+};
+
+struct VARDESC
+{
+    MEMBERID memid;
+    LPOLESTR lpstrSchema;
+    union
+    {
+        ULONG oInst;
+        VARIANT* lpvarValue;
+    };
+    ELEMDESC elemdescVar;
+    WORD wVarFlags;
+    VARKIND varkind;
+};
+
+struct TLIBATTR
+{
+    GUID guid;
+    LCID lcid;
+    SYSKIND syskind;
+    WORD wMajorVerNum;
+    WORD wMinorVerNum;
+    WORD wLibFlags;
+};
+
+struct DISPPARAMS;
+struct EXCEPINFO;
+class ITypeComp;
+class ITypeLib;
+
+class IUnknown
+{
+public:
+    virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppvObject) = 0;
+    virtual ULONG STDMETHODCALLTYPE AddRef() = 0;
+    virtual ULONG STDMETHODCALLTYPE Release() = 0;
+
+protected:
+    ~IUnknown() = default;
+};
+
+class ITypeInfo : public IUnknown
+{
+public:
+    virtual HRESULT STDMETHODCALLTYPE GetTypeAttr(TYPEATTR** ppTypeAttr) = 0;
+    virtual HRESULT STDMETHODCALLTYPE GetTypeComp(ITypeComp** ppTComp) = 0;
+    virtual HRESULT STDMETHODCALLTYPE GetFuncDesc(UINT index, FUNCDESC** ppFuncDesc) = 0;
+    virtual HRESULT STDMETHODCALLTYPE GetVarDesc(UINT index, VARDESC** ppVarDesc) = 0;
+    virtual HRESULT STDMETHODCALLTYPE GetNames(MEMBERID memid, BSTR* rgBstrNames, UINT cMaxNames,
+                                               UINT* pcNames)
+        = 0;
+    virtual HRESULT STDMETHODCALLTYPE GetRefTypeOfImplType(UINT index, HREFTYPE* pRefType) = 0;
+    virtual HRESULT STDMETHODCALLTYPE GetImplTypeFlags(UINT index, INT* pImplTypeFlags) = 0;
+    virtual HRESULT STDMETHODCALLTYPE GetIDsOfNames(LPOLESTR* rgszNames, UINT cNames,
+                                                    MEMBERID* pMemId)
+        = 0;
+    virtual HRESULT STDMETHODCALLTYPE Invoke(PVOID pvInstance, MEMBERID memid, WORD wFlags,
+                                             DISPPARAMS* pDispParams, VARIANT* pVarResult,
+                                             EXCEPINFO* pExcepInfo, UINT* puArgErr)
+        = 0;
+    virtual HRESULT STDMETHODCALLTYPE GetDocumentation(MEMBERID memid, BSTR* pBstrName,
+                                                       BSTR* pBstrDocString, DWORD* pdwHelpContext,
+                                                       BSTR* pBstrHelpFile)
+        = 0;
+    virtual HRESULT STDMETHODCALLTYPE GetDllEntry(MEMBERID memid, INVOKEKIND invKind,
+                                                  BSTR* pBstrDllName, BSTR* pBstrName,
+                                                  WORD* pwOrdinal)
+        = 0;
+    virtual HRESULT STDMETHODCALLTYPE GetRefTypeInfo(HREFTYPE hRefType, ITypeInfo** ppTInfo) = 0;
+    virtual HRESULT STDMETHODCALLTYPE AddressOfMember(MEMBERID memid, INVOKEKIND invKind,
+                                                      PVOID* ppv)
+        = 0;
+    virtual HRESULT STDMETHODCALLTYPE CreateInstance(IUnknown* pUnkOuter, REFIID riid,
+                                                     PVOID* ppvObj)
+        = 0;
+    virtual HRESULT STDMETHODCALLTYPE GetMops(MEMBERID memid, BSTR* pBstrMops) = 0;
+    virtual HRESULT STDMETHODCALLTYPE GetContainingTypeLib(ITypeLib** ppTLib, UINT* pIndex) = 0;
+    virtual void STDMETHODCALLTYPE ReleaseTypeAttr(TYPEATTR* pTypeAttr) = 0;
+    virtual void STDMETHODCALLTYPE ReleaseFuncDesc(FUNCDESC* pFuncDesc) = 0;
+    virtual void STDMETHODCALLTYPE ReleaseVarDesc(VARDESC* pVarDesc) = 0;
+
+protected:
+    ~ITypeInfo() = default;
+};
+
+class ITypeLib : public IUnknown
+{
+public:
+    virtual UINT STDMETHODCALLTYPE GetTypeInfoCount() = 0;
+    virtual HRESULT STDMETHODCALLTYPE GetTypeInfo(UINT index, ITypeInfo** ppTInfo) = 0;
+    virtual HRESULT STDMETHODCALLTYPE GetTypeInfoType(UINT index, TYPEKIND* pTKind) = 0;
+    virtual HRESULT STDMETHODCALLTYPE GetTypeInfoOfGuid(REFGUID guid, ITypeInfo** ppTinfo) = 0;
+    virtual HRESULT STDMETHODCALLTYPE GetLibAttr(TLIBATTR** ppTLibAttr) = 0;
+    virtual HRESULT STDMETHODCALLTYPE GetTypeComp(ITypeComp** ppTComp) = 0;
+    virtual HRESULT STDMETHODCALLTYPE GetDocumentation(INT index, BSTR* pBstrName,
+                                                       BSTR* pBstrDocString, DWORD* pdwHelpContext,
+                                                       BSTR* pBstrHelpFile)
+        = 0;
+    virtual HRESULT STDMETHODCALLTYPE IsName(LPOLESTR szNameBuf, ULONG lHashVal, BOOL* pfName) = 0;
+    virtual HRESULT STDMETHODCALLTYPE FindName(LPOLESTR szNameBuf, ULONG lHashVal,
+                                               ITypeInfo** ppTInfo, MEMBERID* rgMemId,
+                                               USHORT* pcFound)
+        = 0;
+    virtual void STDMETHODCALLTYPE ReleaseTLibAttr(TLIBATTR* pTLibAttr) = 0;
+
+protected:
+    ~ITypeLib() = default;
+};
+
+// A BSTR here has no length prefix, genproxy only uses it as a string.
+inline BSTR SysAllocString(const OLECHAR* pString)
+{
+    const size_t nLength = std::wcslen(pString);
+    BSTR pResult = new OLECHAR[nLength + 1];
+    std::wmemcpy(pResult, pString, nLength + 1);
+    return pResult;
+}
+
+inline void SysFreeString(BSTR pString) { delete[] pString; }
+
+inline HRESULT CoInitialize(LPVOID) { return S_OK; }
+
+inline void CoUninitialize() {}
+
+// There is no way to read a type library itself here, only a snapshot of it.
+inline HRESULT LoadTypeLibEx(const OLECHAR*, REGKIND, ITypeLib**) { return TYPE_E_CANTLOADLIBRARY; }
+
+inline HRESULT IIDFromString(const OLECHAR* pString, IID* pIID)
+{
+    unsigned int nData1, nData2, nData3, aData4[8];
+    wchar_t cEnd;
+    if (std::wcslen(pString) != 38
+        || std::swscanf(pString, L"{%8x-%4x-%4x-%2x%2x-%2x%2x%2x%2x%2x%2x%lc", &nData1, &nData2,
+                        &nData3, &aData4[0], &aData4[1], &aData4[2], &aData4[3], &aData4[4],
+                        &aData4[5], &aData4[6], &aData4[7], &cEnd)
+               != 12
+        || cEnd != L'}')
+        return E_INVALIDARG;
+
+    pIID->Data1 = nData1;
+    pIID->Data2 = (uint16_t)nData2;
+    pIID->Data3 = (uint16_t)nData3;
+    for (int i = 0; i < 8; ++i)
+        pIID->Data4[i] = (uint8_t)aData4[i];
+    return S_OK;
+}
+
+inline char* _strdup(const char* pString)
+{
+    const size_t nSize = std::strlen(pString) + 1;
+    char* pResult = static_cast<char*>(std::malloc(nSize));
+    std::memcpy(pResult, pString, nSize);
+    return pResult;
+}
+
+inline wchar_t* _wcsdup(const wchar_t* pString)
+{
+    const size_t nLength = std::wcslen(pString) + 1;
+    wchar_t* pResult = static_cast<wchar_t*>(std::malloc(nLength * sizeof(wchar_t)));
+    std::wmemcpy(pResult, pString, nLength);
+    return pResult;
+}
+
+// The threads, locks and condition variables of the Emitter
+
+typedef std::mutex SRWLOCK;
+
+// Never destroyed. genproxy exits with std::exit() while the Emitter's threads wait, which on
+// Windows just ends them, but destroying a std::condition_variable that is waited on hangs.
+struct CONDITION_VARIABLE
+{
+    std::condition_variable& mrCondition = *new std::condition_variable();
+};
+
+typedef DWORD (*LPTHREAD_START_ROUTINE)(LPVOID);
+
+#define SRWLOCK_INIT {}
+#define INFINITE 0xFFFFFFFF
+#define MAXIMUM_WAIT_OBJECTS 64
+
+inline void InitializeSRWLock(SRWLOCK*) {}
+
+inline void AcquireSRWLockExclusive(SRWLOCK* pLock) { pLock->lock(); }
+
+inline void ReleaseSRWLockExclusive(SRWLOCK* pLock) { pLock->unlock(); }
+
+// Without std::shared_mutex in C++14, readers exclude each other, too.
+inline void AcquireSRWLockShared(SRWLOCK* pLock) { pLock->lock(); }
+
+inline void ReleaseSRWLockShared(SRWLOCK* pLock) { pLock->unlock(); }
+
+inline void InitializeConditionVariable(CONDITION_VARIABLE*) {}
+
+inline void WakeConditionVariable(CONDITION_VARIABLE* pCondition)
+{
+    pCondition->mrCondition.notify_one();
+}
+
+inline void WakeAllConditionVariable(CONDITION_VARIABLE* pCondition)
+{
+    pCondition->mrCondition.notify_all();
+}
+
+// Waits as long as it takes, genproxy only uses INFINITE.
+inline BOOL SleepConditionVariableSRW(CONDITION_VARIABLE* pCondition, SRWLOCK* pLock, DWORD, ULONG)
+{
+    std::unique_lock<std::mutex> aLock(*pLock, std::adopt_lock);
+    pCondition->mrCondition.wait(aLock);
+    aLock.release();
+    return TRUE;
+}
+
+struct SYSTEM_INFO
+{
+    DWORD dwNumberOfProcessors;
+};
+
+inline void GetSystemInfo(SYSTEM_INFO* pSystemInfo)
+{
+    pSystemInfo->dwNumberOfProcessors = std::thread::hardware_concurrency();
+}
+
+inline DWORD GetLastError() { return (DWORD)errno; }
+
+// The only handles are those of threads.
+inline HANDLE CreateThread(void*, size_t, LPTHREAD_START_ROUTINE pStartAddress, LPVOID pParameter,
+                           DWORD, DWORD*)
+{
+    try
+    {
+        return new std::thread(pStartAddress, pParameter);
+    }
+    catch (const std::system_error& rError)
+    {
+        errno = rError.code().value();
+        return nullptr;
+    }
+}
+
+inline DWORD WaitForMultipleObjects(DWORD nCount, const HANDLE* pHandles, BOOL, DWORD)
+{
+    for (DWORD i = 0; i < nCount; ++i)
+        static_cast<std::thread*>(pHandles[i])->join();
+    return 0;
+}
+
+inline BOOL CloseHandle(HANDLE hThread)
+{
+    delete static_cast<std::thread*>(hThread);
+    return TRUE;
+}
+
+// The files
+
+struct FILETIME
+{
+    DWORD dwLowDateTime;
+    DWORD dwHighDateTime;
+};
+
+struct WIN32_FILE_ATTRIBUTE_DATA
+{
+    DWORD dwFileAttributes;
+    FILETIME ftCreationTime;
+    FILETIME ftLastAccessTime;
+    FILETIME ftLastWriteTime;
+    DWORD nFileSizeHigh;
+    DWORD nFileSizeLow;
+};
+
+enum GET_FILEEX_INFO_LEVELS
+{
+    GetFileExInfoStandard
+};
+
+// Only the size and the last write time, in 100 ns units like on Windows, but since 1970.
+inline BOOL GetFileAttributesExA(const char* pFileName, GET_FILEEX_INFO_LEVELS, LPVOID pInfo)
+{
+    struct stat aStat;
+    if (stat(pFileName, &aStat) != 0)
+        return FALSE;
+
+    WIN32_FILE_ATTRIBUTE_DATA* pData = static_cast<WIN32_FILE_ATTRIBUTE_DATA*>(pInfo);
+    *pData = {};
+    pData->nFileSizeHigh = (DWORD)((uint64_t)aStat.st_size >> 32);
+    pData->nFileSizeLow = (DWORD)aStat.st_size;
+    const uint64_t nWriteTime
+        = (uint64_t)aStat.st_mtim.tv_sec * 10000000 + (uint64_t)aStat.st_mtim.tv_nsec / 100;
+    pData->ftLastWriteTime.dwHighDateTime = (DWORD)(nWriteTime >> 32);
+    pData->ftLastWriteTime.dwLowDateTime = (DWORD)nWriteTime;
+    return TRUE;
+}
+
+// From proxyruntime.hpp and utils.hpp. hashIID() must stay the same as there, as the generated code
+// looks up in the hash table genproxy builds with it.
+
+inline bool operator<(const IID& a, const IID& b) { return std::memcmp(&a, &b, sizeof(a)) < 0; }
+
+inline unsigned hashIID(const IID& rIID, unsigned nSeed)
+{
+    const unsigned* pWords = reinterpret_cast<const unsigned*>(&rIID);
+    unsigned nHash = nSeed;
+
+    for (int i = 0; i < 4; ++i)
+    {
+        nHash ^= pWords[i];
+        nHash *= 0x9E3779B1u;
+        nHash ^= nHash >> 15;
+    }
+    return nHash;
+}
+
+inline std::string convertUTF16ToUTF8(const wchar_t* pWchar)
+{
+    static std::wstring_convert<std::codecvt_utf8<wchar_t>, wchar_t> aUTF16ToUTF8;
+
+    return std::string(aUTF16ToUTF8.to_bytes(pWchar));
+}
+
+// A wchar_t holds a whole code point here, so this is really UTF-32.
+inline std::wstring convertUTF8ToUTF16(const char* pChar)
+{
+    static std::wstring_convert<std::codecvt_utf8<wchar_t>, wchar_t> aUTF8ToUTF16;
+
+    return std::wstring(aUTF8ToUTF16.from_bytes(pChar));
+}
+
+inline std::string to_ullhex(uint64_t n, int w = 0)
+{
+    std::stringstream aStringStream;
+    aStringStream << std::setfill('0') << std::setw(w) << std::uppercase << std::hex << n;
+    return aStringStream.str();
+}
+
+inline std::string to_uhex(uint32_t n, int w = 0)
+{
+    std::stringstream aStringStream;
+    aStringStream << std::setfill('0') << std::setw(w) << std::uppercase << std::hex << n;
+    return aStringStream.str();
+}
+
+inline std::string to_hex(int32_t n, int w = 0) { return to_uhex((uint32_t)n, w); }
+
+inline std::string HRESULT_to_string(HRESULT nResult)
+{
+    switch (nResult)
+    {
+        case S_OK:
+            return "S_OK";
+        case E_NOTIMPL:
+            return "E_NOTIMPL";
+        case E_NOINTERFACE:
+            return "E_NOINTERFACE";
+        case E_INVALIDARG:
+            return "E_INVALIDARG";
+        case TYPE_E_ELEMENTNOTFOUND:
+            return "TYPE_E_ELEMENTNOTFOUND";
+        case TYPE_E_CANTLOADLIBRARY:
+            return "TYPE_E_CANTLOADLIBRARY, only snapshots (-S) can be read here";
+        default:
+            return to_hex(nResult, 8);
+    }
+}
+
+inline std::string WindowsErrorString(DWORD nErrorCode) { return std::strerror((int)nErrorCode); }
+
+inline std::string WindowsErrorStringFromHRESULT(HRESULT nResult)
+{
+    return HRESULT_to_string(nResult);
+}
+
+inline wchar_t* programName(const wchar_t* sPathname)
+{
+    const wchar_t* const pSlash = std::wcsrchr(sPathname, L'/');
+    return _wcsdup(pSlash ? pSlash + 1 : sPathname);
+}
+
+inline std::string IID_initializer(const IID& aIID)
+{
+    std::string sResult;
+    sResult = "{0x" + to_uhex(aIID.Data1, 8) + ",0x" + to_uhex(aIID.Data2, 4) + ",0x"
+              + to_uhex(aIID.Data3, 4);
+    for (int i = 0; i < 8; ++i)
+        sResult += ",0x" + to_hex(aIID.Data4[i], 2);
+    sResult += "}";
+
+    return sResult;
+}
+
+// Like StringFromIID()
+inline std::string IID_to_string(const IID& aIID)
+{
+    std::string sResult = "{" + to_uhex(aIID.Data1, 8) + "-" + to_uhex(aIID.Data2, 4) + "-"
+                          + to_uhex(aIID.Data3, 4) + "-";
+    for (int i = 0; i < 8; ++i)
+        sResult += (i == 2 ? "-" : "") + to_uhex(aIID.Data4[i], 2);
+    sResult += "}";
+
+    return sResult;
+}
+
+inline bool isDirectlyPrintableType(VARTYPE nVt)
+{
+    switch (nVt)
+    {
+        case VT_I2:
+        case VT_I4:
+        case VT_R4:
+        case VT_R8:
+        case VT_BSTR:
+        case VT_BOOL:
+        case VT_I1:
+        case VT_UI1:
+        case VT_UI2:
+        case VT_UI4:
+        case VT_I8:
+        case VT_UI8:
+        case VT_INT:
+        case VT_UINT:
+        case VT_HRESULT:
+        case VT_PTR:
+        case VT_INT_PTR:
+        case VT_UINT_PTR:
+        case VT_CLSID:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+#endif // INCLUDED_nonwindows_hpp
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab cinoptions=b1,g0,N-s cinkeys+=0=break: */
@@ -0,0 +1,710 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of Collabora OLE Automation Translator.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable : 4365 4571 4625 4668 4774 4820 4917 5026 5039 5045)
+#endif
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <Windows.h>
+#endif
+
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+
+#ifdef _WIN32
+#include "utils.hpp"
+#else
+#include "nonwindows.hpp"
+#endif
+
+#include "snapshottypelib.hpp"
+
+namespace
+{
+SnapshotTypeDesc snapshotTypeDesc(const TYPEDESC& rDesc, std::set<HREFTYPE>& rHrefTypes)
+{
+    SnapshotTypeDesc aResult{};
+    aResult.mnVt = rDesc.vt;
+
+    if (rDesc.vt == VT_USERDEFINED)
+    {
+        aResult.mnHrefType = rDesc.hreftype;
+        rHrefTypes.insert(rDesc.hreftype);
+    }
+    else if (rDesc.vt == VT_CARRAY && rDesc.lpadesc != nullptr)
+    {
+        for (USHORT i = 0; i < rDesc.lpadesc->cDims; ++i)
+            aResult.maBounds.push_back(
+                { rDesc.lpadesc->rgbounds[i].lLbound, rDesc.lpadesc->rgbounds[i].cElements });
+        aResult.mpInner = std::make_shared<SnapshotTypeDesc>(
+            snapshotTypeDesc(rDesc.lpadesc->tdescElem, rHrefTypes));
+    }
+    else if ((rDesc.vt == VT_PTR || rDesc.vt == VT_SAFEARRAY) && rDesc.lptdesc != nullptr)
+        aResult.mpInner
+            = std::make_shared<SnapshotTypeDesc>(snapshotTypeDesc(*rDesc.lptdesc, rHrefTypes));
+
+    return aResult;
+}
+
+SnapshotElemDesc snapshotElemDesc(const ELEMDESC& rDesc, std::set<HREFTYPE>& rHrefTypes)
+{
+    return { snapshotTypeDesc(rDesc.tdesc, rHrefTypes), rDesc.paramdesc.wParamFlags };
+}
+
+[[noreturn]] void fail(const std::string& rWhat, const std::string& rTypeName, HRESULT nResult)
+{
+    std::cerr << rWhat << " of " << rTypeName
+              << " failed: " << WindowsErrorStringFromHRESULT(nResult) << "\n";
+    std::exit(1);
+}
+
+// What to look up a type by in TypeLibSnapshotBuilder::maTypeIndexes
+std::string typeKey(ITypeInfo* pTypeInfo, TYPEKIND nTypeKind)
+{
+    ITypeLib* pTypeLib;
+    UINT nIndex;
+    if (SUCCEEDED(pTypeInfo->GetContainingTypeLib(&pTypeLib, &nIndex)))
+    {
+        TLIBATTR* pLibAttr;
+        if (SUCCEEDED(pTypeLib->GetLibAttr(&pLibAttr)))
+        {
+            const std::string sKey = IID_to_string(pLibAttr->guid) + ":"
+                                     + std::to_string(pLibAttr->wMajorVerNum) + "."
+                                     + std::to_string(pLibAttr->wMinorVerNum) + ":"
+                                     + std::to_string(pLibAttr->lcid) + ":" + std::to_string(nIndex)
+                                     + ":" + std::to_string(nTypeKind);
+            pTypeLib->ReleaseTLibAttr(pLibAttr);
+            pTypeLib->Release();
+            return sKey;
+        }
+        pTypeLib->Release();
+    }
+
+    // Should not happen, but then at least the same ITypeInfo is found again.
+    return "?" + to_ullhex((uint64_t)(uintptr_t)pTypeInfo) + ":" + std::to_string(nTypeKind);
+}
+} // namespace
+
+void TypeLibSnapshotBuilder::addLibrary(const std::string& rFileName, ITypeLib* pTypeLib)
+{
+    SnapshotLibrary aLibrary;
+    aLibrary.msFileName = rFileName;
+
+    BSTR sLibName;
+    HRESULT nResult = pTypeLib->GetDocumentation(-1, &sLibName, NULL, NULL, NULL);
+    if (FAILED(nResult))
+        fail("GetDocumentation(-1)", rFileName, nResult);
+    aLibrary.msName = convertUTF16ToUTF8(sLibName);
+    SysFreeString(sLibName);
+
+    const UINT nTypeInfoCount = pTypeLib->GetTypeInfoCount();
+    for (UINT i = 0; i < nTypeInfoCount; ++i)
+    {
+        ITypeInfo* pTypeInfo;
+        nResult = pTypeLib->GetTypeInfo(i, &pTypeInfo);
+        if (FAILED(nResult))
+            fail("GetTypeInfo(" + std::to_string(i) + ")", rFileName, nResult);
+        aLibrary.maTypes.push_back(addType(pTypeInfo));
+        pTypeInfo->Release();
+    }
+
+    mrSnapshot.maLibraries.push_back(aLibrary);
+}
+
+uint32_t TypeLibSnapshotBuilder::addType(ITypeInfo* pTypeInfo)
+{
+    HRESULT nResult;
+
+    BSTR sNameBstr;
+    nResult = pTypeInfo->GetDocumentation(MEMBERID_NIL, &sNameBstr, NULL, NULL, NULL);
+    if (FAILED(nResult))
+        fail("GetDocumentation", "a type", nResult);
+    const std::string sName = convertUTF16ToUTF8(sNameBstr);
+    SysFreeString(sNameBstr);
+
+    TYPEATTR* pTypeAttr;
+    nResult = pTypeInfo->GetTypeAttr(&pTypeAttr);
+    if (FAILED(nResult))
+        fail("GetTypeAttr", sName, nResult);
+
+    const std::string sKey = typeKey(pTypeInfo, pTypeAttr->typekind);
+    auto p = maTypeIndexes.find(sKey);
+    if (p != maTypeIndexes.end())
+    {
+        pTypeInfo->ReleaseTypeAttr(pTypeAttr);
+        return p->second;
+    }
+
+    // Reserve the index before following references, which can lead back to this type.
+    const uint32_t nIndex = (uint32_t)mrSnapshot.maTypes.size();
+    maTypeIndexes[sKey] = nIndex;
+    mrSnapshot.maTypes.emplace_back();
+
+    SnapshotType aType{};
+    std::set<HREFTYPE> aHrefTypes;
+
+    aType.msName = sName;
+    std::memcpy(aType.maGuid, &pTypeAttr->guid, sizeof(aType.maGuid));
+    aType.mnTypeKind = pTypeAttr->typekind;
+    aType.mnTypeFlags = pTypeAttr->wTypeFlags;
+    aType.mnSizeVft = (uint16_t)(pTypeAttr->cbSizeVft / sizeof(void*));
+    aType.mnMajorVerNum = pTypeAttr->wMajorVerNum;
+    aType.mnMinorVerNum = pTypeAttr->wMinorVerNum;
+    if (pTypeAttr->typekind == TKIND_ALIAS)
+        aType.maAlias = snapshotTypeDesc(pTypeAttr->tdescAlias, aHrefTypes);
+
+    // The member ids in order of appearance, with how many names to ask for
+    std::vector<std::pair<MEMBERID, UINT>> aMemberIds;
+    auto addMemberId = [&aMemberIds](MEMBERID nMemberId, UINT nNames) {
+        for (auto& rMemberId : aMemberIds)
+            if (rMemberId.first == nMemberId)
+            {
+                if (nNames > rMemberId.second)
+                    rMemberId.second = nNames;
+                return;
+            }
+        aMemberIds.push_back({ nMemberId, nNames });
+    };
+
+    for (UINT i = 0; i < pTypeAttr->cFuncs; ++i)
+    {
+        FUNCDESC* pFuncDesc;
+        nResult = pTypeInfo->GetFuncDesc(i, &pFuncDesc);
+        if (FAILED(nResult))
+            fail("GetFuncDesc(" + std::to_string(i) + ")", sName, nResult);
+
+        SnapshotFunc aFunc;
+        aFunc.mnMemberId = pFuncDesc->memid;
+        aFunc.mnFuncKind = pFuncDesc->funckind;
+        aFunc.mnInvKind = pFuncDesc->invkind;
+        aFunc.mnCallConv = pFuncDesc->callconv;
+        aFunc.mnParamsOpt = pFuncDesc->cParamsOpt;
+        aFunc.mnVft = (int16_t)(pFuncDesc->oVft / (SHORT)sizeof(void*));
+        aFunc.mnFuncFlags = pFuncDesc->wFuncFlags;
+        aFunc.maReturn = snapshotElemDesc(pFuncDesc->elemdescFunc, aHrefTypes);
+        for (SHORT j = 0; j < pFuncDesc->cParams; ++j)
+            aFunc.maParams.push_back(
+                snapshotElemDesc(pFuncDesc->lprgelemdescParam[j], aHrefTypes));
+        aType.maFuncs.push_back(aFunc);
+
+        addMemberId(pFuncDesc->memid, 1u + (UINT)pFuncDesc->cParams);
+        pTypeInfo->ReleaseFuncDesc(pFuncDesc);
+    }
+
+    for (UINT i = 0; i < pTypeAttr->cVars; ++i)
+    {
+        VARDESC* pVarDesc;
+        nResult = pTypeInfo->GetVarDesc(i, &pVarDesc);
+        if (FAILED(nResult))
+            fail("GetVarDesc(" + std::to_string(i) + ")", sName, nResult);
+
+        SnapshotVar aVar{};
+        aVar.mnMemberId = pVarDesc->memid;
+        aVar.mnVarKind = pVarDesc->varkind;
+        if (pVarDesc->varkind == VAR_CONST && pVarDesc->lpvarValue != nullptr)
+        {
+            aVar.mnValueType = pVarDesc->lpvarValue->vt;
+            std::memcpy(&aVar.mnValue, &pVarDesc->lpvarValue->llVal, sizeof(aVar.mnValue));
+        }
+        aVar.maElem = snapshotElemDesc(pVarDesc->elemdescVar, aHrefTypes);
+        aType.maVars.push_back(aVar);
+
+        addMemberId(pVarDesc->memid, 1);
+        pTypeInfo->ReleaseVarDesc(pVarDesc);
+    }
+
+    // A member whose names can't be had is left out, so that asking the snapshot fails too.
+    for (const auto& rMemberId : aMemberIds)
+    {
+        BSTR sDocName;
+        if (FAILED(pTypeInfo->GetDocumentation(rMemberId.first, &sDocName, NULL, NULL, NULL)))
+            continue;
+
+        std::vector<BSTR> aNames(rMemberId.second);
+        UINT nNames;
+        if (FAILED(pTypeInfo->GetNames(rMemberId.first, aNames.data(), rMemberId.second, &nNames)))
+            continue;
+
+        SnapshotMember aMember;
+        aMember.mnMemberId = rMemberId.first;
+        aMember.msDocName = convertUTF16ToUTF8(sDocName);
+        SysFreeString(sDocName);
+        for (UINT i = 0; i < nNames; ++i)
+        {
+            aMember.maNames.push_back(convertUTF16ToUTF8(aNames[i]));
+            SysFreeString(aNames[i]);
+        }
+        aType.maMembers.push_back(aMember);
+    }
+
+    for (UINT i = 0; i < pTypeAttr->cImplTypes; ++i)
+    {
+        SnapshotImplType aImplType;
+        HREFTYPE nHrefType;
+        nResult = pTypeInfo->GetRefTypeOfImplType(i, &nHrefType);
+        if (FAILED(nResult))
+            fail("GetRefTypeOfImplType(" + std::to_string(i) + ")", sName, nResult);
+        aImplType.mnHrefType = nHrefType;
+        nResult = pTypeInfo->GetImplTypeFlags(i, &aImplType.mnFlags);
+        if (FAILED(nResult))
+            fail("GetImplTypeFlags(" + std::to_string(i) + ")", sName, nResult);
+        aType.maImplTypes.push_back(aImplType);
+        aHrefTypes.insert(nHrefType);
+    }
+
+    HREFTYPE nDualHrefType;
+    if (pTypeAttr->typekind == TKIND_DISPATCH
+        && SUCCEEDED(pTypeInfo->GetRefTypeOfImplType((UINT)-1, &nDualHrefType)))
+    {
+        aType.mbHasDualInterface = true;
+        aType.mnDualHrefType = nDualHrefType;
+        aHrefTypes.insert(nDualHrefType);
+    }
+
+    pTypeInfo->ReleaseTypeAttr(pTypeAttr);
+
+    for (HREFTYPE nHrefType : aHrefTypes)
+    {
+        ITypeInfo* pReferencedTypeInfo;
+        if (FAILED(pTypeInfo->GetRefTypeInfo(nHrefType, &pReferencedTypeInfo)))
+            continue;
+        aType.maRefs.push_back({ nHrefType, addType(pReferencedTypeInfo) });
+        pReferencedTypeInfo->Release();
+    }
+
+    mrSnapshot.maTypes[nIndex] = std::move(aType);
+
+    return nIndex;
+}
+
+namespace
+{
+class SnapshotTypeInfo;
+
+// The ITypeInfos of a snapshot, created when first asked for
+class SnapshotTypeInfos
+{
+public:
+    explicit SnapshotTypeInfos(const TypeLibSnapshot& rSnapshot)
+        : mrSnapshot(rSnapshot)
+        , maTypeInfos(rSnapshot.maTypes.size())
+    {
+    }
+
+    SnapshotTypeInfo* get(uint32_t nIndex);
+
+    static SnapshotTypeInfos& of(const TypeLibSnapshot& rSnapshot)
+    {
+        static std::map<const TypeLibSnapshot*, SnapshotTypeInfos*> aAll;
+        SnapshotTypeInfos*& rpTypeInfos = aAll[&rSnapshot];
+        if (rpTypeInfos == nullptr)
+            rpTypeInfos = new SnapshotTypeInfos(rSnapshot);
+        return *rpTypeInfos;
+    }
+
+private:
+    const TypeLibSnapshot& mrSnapshot;
+    std::vector<SnapshotTypeInfo*> maTypeInfos;
+};
+
+TYPEDESC typeDesc(const SnapshotTypeDesc& rDesc)
+{
+    TYPEDESC aResult;
+    aResult.vt = rDesc.mnVt;
+    aResult.lptdesc = nullptr;
+
+    if (rDesc.mnVt == VT_USERDEFINED)
+        aResult.hreftype = rDesc.mnHrefType;
+    else if (rDesc.mnVt == VT_CARRAY && rDesc.mpInner)
+    {
+        const USHORT nDims = (USHORT)rDesc.maBounds.size();
+        ARRAYDESC* pArrayDesc = static_cast<ARRAYDESC*>(std::calloc(
+            1, sizeof(ARRAYDESC) + (size_t)(nDims > 1 ? nDims - 1 : 0) * sizeof(SAFEARRAYBOUND)));
+        pArrayDesc->tdescElem = typeDesc(*rDesc.mpInner);
+        pArrayDesc->cDims = nDims;
+        for (USHORT i = 0; i < nDims; ++i)
+        {
+            pArrayDesc->rgbounds[i].lLbound = rDesc.maBounds[i].first;
+            pArrayDesc->rgbounds[i].cElements = rDesc.maBounds[i].second;
+        }
+        aResult.lpadesc = pArrayDesc;
+    }
+    else if (rDesc.mpInner)
+        aResult.lptdesc = new TYPEDESC(typeDesc(*rDesc.mpInner));
+
+    return aResult;
+}
+
+ELEMDESC elemDesc(const SnapshotElemDesc& rDesc)
+{
+    ELEMDESC aResult;
+    aResult.tdesc = typeDesc(rDesc.maType);
+    // There is no PARAMDESCEX for a default value in the snapshot.
+    aResult.paramdesc.wParamFlags = (USHORT)(rDesc.mnParamFlags & ~PARAMFLAG_FHASDEFAULT);
+    aResult.paramdesc.pparamdescex = nullptr;
+    return aResult;
+}
+
+BSTR bstr(const std::string& rString)
+{
+    return SysAllocString(convertUTF8ToUTF16(rString.c_str()).data());
+}
+
+// The descriptors are built up front and never freed, so the Release functions do nothing.
+class SnapshotTypeInfo : public ITypeInfo
+{
+public:
+    SnapshotTypeInfo(SnapshotTypeInfos& rTypeInfos, const SnapshotType& rType)
+        : mrTypeInfos(rTypeInfos)
+        , mrType(rType)
+        , maTypeAttr()
+        , maFuncDescs(rType.maFuncs.size())
+        , maVarDescs(rType.maVars.size())
+    {
+        std::memcpy(&maTypeAttr.guid, rType.maGuid, sizeof(maTypeAttr.guid));
+        maTypeAttr.memidConstructor = MEMBERID_NIL;
+        maTypeAttr.memidDestructor = MEMBERID_NIL;
+        maTypeAttr.typekind = (TYPEKIND)rType.mnTypeKind;
+        maTypeAttr.cFuncs = (WORD)rType.maFuncs.size();
+        maTypeAttr.cVars = (WORD)rType.maVars.size();
+        maTypeAttr.cImplTypes = (WORD)rType.maImplTypes.size();
+        maTypeAttr.cbSizeVft = (WORD)(rType.mnSizeVft * sizeof(void*));
+        maTypeAttr.wTypeFlags = rType.mnTypeFlags;
+        maTypeAttr.wMajorVerNum = rType.mnMajorVerNum;
+        maTypeAttr.wMinorVerNum = rType.mnMinorVerNum;
+        maTypeAttr.tdescAlias = typeDesc(rType.maAlias);
+
+        for (size_t i = 0; i < rType.maFuncs.size(); ++i)
+        {
+            const SnapshotFunc& rFunc = rType.maFuncs[i];
+            FUNCDESC& rFuncDesc = maFuncDescs[i];
+            rFuncDesc.memid = rFunc.mnMemberId;
+            rFuncDesc.funckind = (FUNCKIND)rFunc.mnFuncKind;
+            rFuncDesc.invkind = (INVOKEKIND)rFunc.mnInvKind;
+            rFuncDesc.callconv = (CALLCONV)rFunc.mnCallConv;
+            rFuncDesc.cParams = (SHORT)rFunc.maParams.size();
+            rFuncDesc.cParamsOpt = rFunc.mnParamsOpt;
+            rFuncDesc.oVft = (SHORT)(rFunc.mnVft * (SHORT)sizeof(void*));
+            rFuncDesc.wFuncFlags = rFunc.mnFuncFlags;
+            rFuncDesc.elemdescFunc = elemDesc(rFunc.maReturn);
+            rFuncDesc.lprgelemdescParam = new ELEMDESC[rFunc.maParams.size() + 1];
+            for (size_t j = 0; j < rFunc.maParams.size(); ++j)
+                rFuncDesc.lprgelemdescParam[j] = elemDesc(rFunc.maParams[j]);
+        }
+
+        for (size_t i = 0; i < rType.maVars.size(); ++i)
+        {
+            const SnapshotVar& rVar = rType.maVars[i];
+            VARDESC& rVarDesc = maVarDescs[i];
+            rVarDesc.memid = rVar.mnMemberId;
+            rVarDesc.varkind = (VARKIND)rVar.mnVarKind;
+            rVarDesc.elemdescVar = elemDesc(rVar.maElem);
+            if (rVar.mnVarKind == VAR_CONST)
+            {
+                rVarDesc.lpvarValue = new VARIANT();
+                rVarDesc.lpvarValue->vt = rVar.mnValueType;
+                std::memcpy(&rVarDesc.lpvarValue->llVal, &rVar.mnValue, sizeof(rVar.mnValue));
+            }
+        }
+    }
+
+    SnapshotTypeInfo(const SnapshotTypeInfo&) = delete;
+    SnapshotTypeInfo& operator=(const SnapshotTypeInfo&) = delete;
+
+    // IUnknown
+
+    HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppvObject) override
+    {
+        if (IsEqualIID(riid, IID_IUnknown) || IsEqualIID(riid, IID_ITypeInfo))
+        {
+            *ppvObject = this;
+            return S_OK;
+        }
+        *ppvObject = nullptr;
+        return E_NOINTERFACE;
+    }
+
+    ULONG STDMETHODCALLTYPE AddRef() override { return 1; }
+
+    ULONG STDMETHODCALLTYPE Release() override { return 1; }
+
+    // ITypeInfo
+
+    HRESULT STDMETHODCALLTYPE GetTypeAttr(TYPEATTR** ppTypeAttr) override
+    {
+        *ppTypeAttr = &maTypeAttr;
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE GetTypeComp(ITypeComp**) override { return E_NOTIMPL; }
+
+    HRESULT STDMETHODCALLTYPE GetFuncDesc(UINT index, FUNCDESC** ppFuncDesc) override
+    {
+        if (index >= maFuncDescs.size())
+            return TYPE_E_ELEMENTNOTFOUND;
+        *ppFuncDesc = &maFuncDescs[index];
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE GetVarDesc(UINT index, VARDESC** ppVarDesc) override
+    {
+        if (index >= maVarDescs.size())
+            return TYPE_E_ELEMENTNOTFOUND;
+        *ppVarDesc = &maVarDescs[index];
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE GetNames(MEMBERID memid, BSTR* rgBstrNames, UINT cMaxNames,
+                                       UINT* pcNames) override
+    {
+        const SnapshotMember* pMember = findMember(memid);
+        if (pMember == nullptr)
+            return TYPE_E_ELEMENTNOTFOUND;
+
+        UINT nNames = 0;
+        while (nNames < cMaxNames && nNames < pMember->maNames.size())
+        {
+            rgBstrNames[nNames] = bstr(pMember->maNames[nNames]);
+            nNames++;
+        }
+        *pcNames = nNames;
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE GetRefTypeOfImplType(UINT index, HREFTYPE* pRefType) override
+    {
+        if (index == (UINT)-1 && mrType.mbHasDualInterface)
+        {
+            *pRefType = mrType.mnDualHrefType;
+            return S_OK;
+        }
+        if (index >= mrType.maImplTypes.size())
+            return TYPE_E_ELEMENTNOTFOUND;
+        *pRefType = mrType.maImplTypes[index].mnHrefType;
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE GetImplTypeFlags(UINT index, INT* pImplTypeFlags) override
+    {
+        if (index >= mrType.maImplTypes.size())
+            return TYPE_E_ELEMENTNOTFOUND;
+        *pImplTypeFlags = mrType.maImplTypes[index].mnFlags;
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE GetIDsOfNames(LPOLESTR*, UINT, MEMBERID*) override
+    {
+        return E_NOTIMPL;
+    }
+
+    HRESULT STDMETHODCALLTYPE Invoke(PVOID, MEMBERID, WORD, DISPPARAMS*, VARIANT*, EXCEPINFO*,
+                                     UINT*) override
+    {
+        return E_NOTIMPL;
+    }
+
+    HRESULT STDMETHODCALLTYPE GetDocumentation(MEMBERID memid, BSTR* pBstrName,
+                                               BSTR* pBstrDocString, DWORD* pdwHelpContext,
+                                               BSTR* pBstrHelpFile) override
+    {
+        const std::string* pName = &mrType.msName;
+        if (memid != MEMBERID_NIL)
+        {
+            const SnapshotMember* pMember = findMember(memid);
+            if (pMember == nullptr)
+                return TYPE_E_ELEMENTNOTFOUND;
+            pName = &pMember->msDocName;
+        }
+
+        if (pBstrName != nullptr)
+            *pBstrName = bstr(*pName);
+        if (pBstrDocString != nullptr)
+            *pBstrDocString = nullptr;
+        if (pdwHelpContext != nullptr)
+            *pdwHelpContext = 0;
+        if (pBstrHelpFile != nullptr)
+            *pBstrHelpFile = nullptr;
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE GetDllEntry(MEMBERID, INVOKEKIND, BSTR*, BSTR*, WORD*) override
+    {
+        return E_NOTIMPL;
+    }
+
+    HRESULT STDMETHODCALLTYPE GetRefTypeInfo(HREFTYPE hRefType, ITypeInfo** ppTInfo) override
+    {
+        for (const auto& rRef : mrType.maRefs)
+            if (rRef.first == hRefType)
+            {
+                *ppTInfo = mrTypeInfos.get(rRef.second);
+                return S_OK;
+            }
+        return TYPE_E_ELEMENTNOTFOUND;
+    }
+
+    HRESULT STDMETHODCALLTYPE AddressOfMember(MEMBERID, INVOKEKIND, PVOID*) override
+    {
+        return E_NOTIMPL;
+    }
+
+    HRESULT STDMETHODCALLTYPE CreateInstance(IUnknown*, REFIID, PVOID*) override
+    {
+        return E_NOTIMPL;
+    }
+
+    HRESULT STDMETHODCALLTYPE GetMops(MEMBERID, BSTR*) override { return E_NOTIMPL; }
+
+    HRESULT STDMETHODCALLTYPE GetContainingTypeLib(ITypeLib**, UINT*) override
+    {
+        return E_NOTIMPL;
+    }
+
+    void STDMETHODCALLTYPE ReleaseTypeAttr(TYPEATTR*) override {}
+
+    void STDMETHODCALLTYPE ReleaseFuncDesc(FUNCDESC*) override {}
+
+    void STDMETHODCALLTYPE ReleaseVarDesc(VARDESC*) override {}
+
+private:
+    const SnapshotMember* findMember(MEMBERID nMemberId) const
+    {
+        for (const SnapshotMember& rMember : mrType.maMembers)
+            if (rMember.mnMemberId == nMemberId)
+                return &rMember;
+        return nullptr;
+    }
+
+    SnapshotTypeInfos& mrTypeInfos;
+    const SnapshotType& mrType;
+    TYPEATTR maTypeAttr;
+    std::vector<FUNCDESC> maFuncDescs;
+    std::vector<VARDESC> maVarDescs;
+};
+
+SnapshotTypeInfo* SnapshotTypeInfos::get(uint32_t nIndex)
+{
+    if (maTypeInfos[nIndex] == nullptr)
+        maTypeInfos[nIndex] = new SnapshotTypeInfo(*this, mrSnapshot.maTypes[nIndex]);
+    return maTypeInfos[nIndex];
+}
+
+class SnapshotTypeLib : public ITypeLib
+{
+public:
+    SnapshotTypeLib(const TypeLibSnapshot& rSnapshot, const SnapshotLibrary& rLibrary)
+        : mrSnapshot(rSnapshot)
+        , mrLibrary(rLibrary)
+    {
+    }
+
+    SnapshotTypeLib(const SnapshotTypeLib&) = delete;
+    SnapshotTypeLib& operator=(const SnapshotTypeLib&) = delete;
+
+    // IUnknown
+
+    HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppvObject) override
+    {
+        if (IsEqualIID(riid, IID_IUnknown) || IsEqualIID(riid, IID_ITypeLib))
+        {
+            *ppvObject = this;
+            return S_OK;
+        }
+        *ppvObject = nullptr;
+        return E_NOINTERFACE;
+    }
+
+    ULONG STDMETHODCALLTYPE AddRef() override { return 1; }
+
+    ULONG STDMETHODCALLTYPE Release() override { return 1; }
+
+    // ITypeLib
+
+    UINT STDMETHODCALLTYPE GetTypeInfoCount() override { return (UINT)mrLibrary.maTypes.size(); }
+
+    HRESULT STDMETHODCALLTYPE GetTypeInfo(UINT index, ITypeInfo** ppTInfo) override
+    {
+        if (index >= mrLibrary.maTypes.size())
+            return TYPE_E_ELEMENTNOTFOUND;
+        *ppTInfo = SnapshotTypeInfos::of(mrSnapshot).get(mrLibrary.maTypes[index]);
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE GetTypeInfoType(UINT index, TYPEKIND* pTKind) override
+    {
+        if (index >= mrLibrary.maTypes.size())
+            return TYPE_E_ELEMENTNOTFOUND;
+        *pTKind = (TYPEKIND)mrSnapshot.maTypes[mrLibrary.maTypes[index]].mnTypeKind;
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE GetTypeInfoOfGuid(REFGUID, ITypeInfo**) override
+    {
+        return E_NOTIMPL;
+    }
+
+    HRESULT STDMETHODCALLTYPE GetLibAttr(TLIBATTR**) override { return E_NOTIMPL; }
+
+    HRESULT STDMETHODCALLTYPE GetTypeComp(ITypeComp**) override { return E_NOTIMPL; }
+
+    HRESULT STDMETHODCALLTYPE GetDocumentation(INT index, BSTR* pBstrName, BSTR* pBstrDocString,
+                                               DWORD* pdwHelpContext,
+                                               BSTR* pBstrHelpFile) override
+    {
+        const std::string* pName = &mrLibrary.msName;
+        if (index != -1)
+        {
+            if (index < 0 || (size_t)index >= mrLibrary.maTypes.size())
+                return TYPE_E_ELEMENTNOTFOUND;
+            pName = &mrSnapshot.maTypes[mrLibrary.maTypes[(size_t)index]].msName;
+        }
+
+        if (pBstrName != nullptr)
+            *pBstrName = bstr(*pName);
+        if (pBstrDocString != nullptr)
+            *pBstrDocString = nullptr;
+        if (pdwHelpContext != nullptr)
+            *pdwHelpContext = 0;
+        if (pBstrHelpFile != nullptr)
+            *pBstrHelpFile = nullptr;
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE IsName(LPOLESTR, ULONG, BOOL*) override { return E_NOTIMPL; }
+
+    HRESULT STDMETHODCALLTYPE FindName(LPOLESTR, ULONG, ITypeInfo**, MEMBERID*, USHORT*) override
+    {
+        return E_NOTIMPL;
+    }
+
+    void STDMETHODCALLTYPE ReleaseTLibAttr(TLIBATTR*) override {}
+
+private:
+    const TypeLibSnapshot& mrSnapshot;
+    const SnapshotLibrary& mrLibrary;
+};
+} // namespace
+
+ITypeLib* createSnapshotTypeLib(const TypeLibSnapshot& rSnapshot, const SnapshotLibrary& rLibrary)
+{
+    return new SnapshotTypeLib(rSnapshot, rLibrary);
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab cinoptions=b1,g0,N-s cinkeys+=0=break: */
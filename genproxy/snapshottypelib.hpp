@@ -0,0 +1,67 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of Collabora OLE Automation Translator.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_snapshottypelib_hpp
+#define INCLUDED_snapshottypelib_hpp
+
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable : 4365 4571 4625 4668 4774 4820 4917 5026 5039 5045)
+#endif
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include "nonwindows.hpp"
+#endif
+
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+
+#include "typelibsnapshot.hpp"
+
+// For genproxy -D: adds type libraries, and all types they refer to, to a snapshot. Exits on
+// errors, like the rest of genproxy.
+class TypeLibSnapshotBuilder
+{
+public:
+    explicit TypeLibSnapshotBuilder(TypeLibSnapshot& rSnapshot)
+        : mrSnapshot(rSnapshot)
+    {
+    }
+
+    TypeLibSnapshotBuilder(const TypeLibSnapshotBuilder&) = delete;
+    TypeLibSnapshotBuilder& operator=(const TypeLibSnapshotBuilder&) = delete;
+
+    void addLibrary(const std::string& rFileName, ITypeLib* pTypeLib);
+
+private:
+    // Returns the index of the type in the snapshot, adding it first if it isn't there yet.
+    uint32_t addType(ITypeInfo* pTypeInfo);
+
+    TypeLibSnapshot& mrSnapshot;
+
+    // Types by containing library, index in it, and type kind, as the TKIND_DISPATCH and
+    // TKIND_INTERFACE halves of a dual interface have the same index.
+    std::map<std::string, uint32_t> maTypeIndexes;
+};
+
+// For genproxy -S: an ITypeLib for a library in the snapshot, whose ITypeInfos return what the
+// original ones did, as far as genproxy asks. The snapshot must stay around, and the objects are
+// never freed.
+ITypeLib* createSnapshotTypeLib(const TypeLibSnapshot& rSnapshot, const SnapshotLibrary& rLibrary);
+
+#endif // INCLUDED_snapshottypelib_hpp
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab cinoptions=b1,g0,N-s cinkeys+=0=break: */
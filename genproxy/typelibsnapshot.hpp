@@ -0,0 +1,529 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of Collabora OLE Automation Translator.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_typelibsnapshot_hpp
+#define INCLUDED_typelibsnapshot_hpp
+
+// A snapshot of the type libraries genproxy reads, written with its -D option and read back with
+// -S, so that the proxies can be regenerated without the proxied applications installed.
+//
+// The snapshot holds what genproxy asks the ITypeLib and ITypeInfo interfaces for: the types of
+// the libraries in order, and for each type its TYPEATTR, FUNCDESCs, VARDESCs, implemented
+// interfaces, member names, and the types its HREFTYPEs refer to, also those in other libraries.
+// The original HREFTYPE values are kept, as they can end up in the generated code.
+//
+// The file is a magic string and version number followed by the data in the order of the structs
+// below, with integers in little-endian byte order and strings as a 32-bit length followed by that
+// many bytes of UTF-8. No Windows headers here, so that the format can be read on other platforms
+// too.
+
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable : 4365 4571 4625 4626 4668 4774 4820 4917 5026 5027)
+#endif
+
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <iterator>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+
+static const char TYPELIB_SNAPSHOT_MAGIC[8] = { 'C', 'O', 'L', 'E', 'A', 'T', 'T', 'L' };
+
+// Increase when the layout or the meaning of the data changes
+static const uint32_t TYPELIB_SNAPSHOT_VERSION = 2;
+
+// Like TYPEDESC
+struct SnapshotTypeDesc
+{
+    uint16_t mnVt;
+
+    // For VT_USERDEFINED
+    uint32_t mnHrefType;
+
+    // For VT_CARRAY, the lower bound and number of elements of each dimension
+    std::vector<std::pair<int32_t, uint32_t>> maBounds;
+
+    // The pointed to, array element or array type for VT_PTR, VT_SAFEARRAY and VT_CARRAY
+    std::shared_ptr<SnapshotTypeDesc> mpInner;
+};
+
+// Like ELEMDESC, without default values, which genproxy does not look at
+struct SnapshotElemDesc
+{
+    SnapshotTypeDesc maType;
+    uint16_t mnParamFlags;
+};
+
+// Like FUNCDESC
+struct SnapshotFunc
+{
+    int32_t mnMemberId;
+    int32_t mnFuncKind;
+    int32_t mnInvKind;
+    int32_t mnCallConv;
+    int16_t mnParamsOpt;
+    // In vtable slots, not bytes, so that a snapshot written by a 32-bit genproxy can be read by a
+    // 64-bit one, and the other way round
+    int16_t mnVft;
+    uint16_t mnFuncFlags;
+    SnapshotElemDesc maReturn;
+    std::vector<SnapshotElemDesc> maParams;
+};
+
+// Like VARDESC. The value of a VAR_CONST is kept as the 8 bytes of the VARIANT union, so only
+// values that fit in it, which is what enumerations have.
+struct SnapshotVar
+{
+    int32_t mnMemberId;
+    int32_t mnVarKind;
+    uint16_t mnValueType;
+    uint64_t mnValue;
+    SnapshotElemDesc maElem;
+};
+
+// What ITypeInfo::GetDocumentation() and GetNames() return for a member id
+struct SnapshotMember
+{
+    int32_t mnMemberId;
+    std::string msDocName;
+    std::vector<std::string> maNames;
+};
+
+struct SnapshotImplType
+{
+    uint32_t mnHrefType;
+    int32_t mnFlags;
+};
+
+struct SnapshotType
+{
+    std::string msName;
+    uint8_t maGuid[16];
+    int32_t mnTypeKind;
+    uint16_t mnTypeFlags;
+    // In vtable slots, like SnapshotFunc::mnVft
+    uint16_t mnSizeVft;
+    uint16_t mnMajorVerNum;
+    uint16_t mnMinorVerNum;
+    SnapshotTypeDesc maAlias;
+
+    std::vector<SnapshotFunc> maFuncs;
+    std::vector<SnapshotVar> maVars;
+    std::vector<SnapshotMember> maMembers;
+    std::vector<SnapshotImplType> maImplTypes;
+
+    // For a dual dispinterface, what GetRefTypeOfImplType(-1) returns
+    bool mbHasDualInterface;
+    uint32_t mnDualHrefType;
+
+    // The HREFTYPEs that GetRefTypeInfo() succeeded for, and the indexes of the types they refer
+    // to in TypeLibSnapshot::maTypes.
+    std::vector<std::pair<uint32_t, uint32_t>> maRefs;
+};
+
+struct SnapshotLibrary
+{
+    // The type library file name as given to genproxy -D
+    std::string msFileName;
+    std::string msName;
+
+    // Indexes in TypeLibSnapshot::maTypes, in the order of the type library
+    std::vector<uint32_t> maTypes;
+};
+
+class TypeLibSnapshot
+{
+public:
+    std::vector<SnapshotLibrary> maLibraries;
+    std::vector<SnapshotType> maTypes;
+
+    const SnapshotLibrary* findLibrary(const std::string& rFileName) const
+    {
+        for (const SnapshotLibrary& rLibrary : maLibraries)
+            if (rLibrary.msFileName == rFileName)
+                return &rLibrary;
+        return nullptr;
+    }
+
+    void write(std::ostream& rStream) const
+    {
+        Writer aWriter(rStream);
+
+        rStream.write(TYPELIB_SNAPSHOT_MAGIC, sizeof(TYPELIB_SNAPSHOT_MAGIC));
+        aWriter.u32(TYPELIB_SNAPSHOT_VERSION);
+
+        aWriter.u32((uint32_t)maTypes.size());
+        for (const SnapshotType& rType : maTypes)
+            aWriter.type(rType);
+
+        aWriter.u32((uint32_t)maLibraries.size());
+        for (const SnapshotLibrary& rLibrary : maLibraries)
+        {
+            aWriter.string(rLibrary.msFileName);
+            aWriter.string(rLibrary.msName);
+            aWriter.u32((uint32_t)rLibrary.maTypes.size());
+            for (uint32_t nType : rLibrary.maTypes)
+                aWriter.u32(nType);
+        }
+    }
+
+    // Returns false and sets rError if the data is not a snapshot of this version, or is
+    // truncated or otherwise corrupt.
+    bool read(std::istream& rStream, std::string& rError)
+    {
+        const std::vector<char> aData((std::istreambuf_iterator<char>(rStream)),
+                                      std::istreambuf_iterator<char>());
+        Reader aReader(aData.data(), aData.data() + aData.size());
+
+        if (aData.size() < sizeof(TYPELIB_SNAPSHOT_MAGIC)
+            || std::memcmp(aData.data(), TYPELIB_SNAPSHOT_MAGIC, sizeof(TYPELIB_SNAPSHOT_MAGIC))
+                   != 0)
+        {
+            rError = "not a type library snapshot";
+            return false;
+        }
+        aReader.mpPos += sizeof(TYPELIB_SNAPSHOT_MAGIC);
+
+        const uint32_t nVersion = aReader.u32();
+        if (nVersion != TYPELIB_SNAPSHOT_VERSION)
+        {
+            rError = "snapshot of version " + std::to_string(nVersion) + ", expected version "
+                     + std::to_string(TYPELIB_SNAPSHOT_VERSION);
+            return false;
+        }
+
+        maTypes.resize(aReader.count());
+        for (SnapshotType& rType : maTypes)
+            aReader.type(rType);
+
+        maLibraries.resize(aReader.count());
+        for (SnapshotLibrary& rLibrary : maLibraries)
+        {
+            rLibrary.msFileName = aReader.string();
+            rLibrary.msName = aReader.string();
+            rLibrary.maTypes.resize(aReader.count());
+            for (uint32_t& rIndex : rLibrary.maTypes)
+                rIndex = aReader.u32();
+        }
+
+        if (aReader.mbTruncated)
+        {
+            rError = "truncated";
+            return false;
+        }
+
+        // Check the indexes, so that users can trust them.
+        for (const SnapshotType& rType : maTypes)
+            for (const auto& rRef : rType.maRefs)
+                if (rRef.second >= maTypes.size())
+                {
+                    rError = "bad type index in " + rType.msName;
+                    return false;
+                }
+        for (const SnapshotLibrary& rLibrary : maLibraries)
+            for (uint32_t nType : rLibrary.maTypes)
+                if (nType >= maTypes.size())
+                {
+                    rError = "bad type index in " + rLibrary.msName;
+                    return false;
+                }
+
+        return true;
+    }
+
+private:
+    struct Writer
+    {
+        explicit Writer(std::ostream& rStream)
+            : mrStream(rStream)
+        {
+        }
+
+        std::ostream& mrStream;
+
+        void u8(uint8_t n) { mrStream.put((char)n); }
+
+        void u16(uint16_t n)
+        {
+            u8((uint8_t)n);
+            u8((uint8_t)(n >> 8));
+        }
+
+        void u32(uint32_t n)
+        {
+            u16((uint16_t)n);
+            u16((uint16_t)(n >> 16));
+        }
+
+        void u64(uint64_t n)
+        {
+            u32((uint32_t)n);
+            u32((uint32_t)(n >> 32));
+        }
+
+        void string(const std::string& rString)
+        {
+            u32((uint32_t)rString.size());
+            mrStream.write(rString.data(), (std::streamsize)rString.size());
+        }
+
+        void typeDesc(const SnapshotTypeDesc& rDesc)
+        {
+            u16(rDesc.mnVt);
+            u32(rDesc.mnHrefType);
+            u32((uint32_t)rDesc.maBounds.size());
+            for (const auto& rBound : rDesc.maBounds)
+            {
+                u32((uint32_t)rBound.first);
+                u32(rBound.second);
+            }
+            u8(rDesc.mpInner ? 1 : 0);
+            if (rDesc.mpInner)
+                typeDesc(*rDesc.mpInner);
+        }
+
+        void elemDesc(const SnapshotElemDesc& rDesc)
+        {
+            typeDesc(rDesc.maType);
+            u16(rDesc.mnParamFlags);
+        }
+
+        void type(const SnapshotType& rType)
+        {
+            string(rType.msName);
+            for (uint8_t n : rType.maGuid)
+                u8(n);
+            u32((uint32_t)rType.mnTypeKind);
+            u16(rType.mnTypeFlags);
+            u16(rType.mnSizeVft);
+            u16(rType.mnMajorVerNum);
+            u16(rType.mnMinorVerNum);
+            typeDesc(rType.maAlias);
+
+            u32((uint32_t)rType.maFuncs.size());
+            for (const SnapshotFunc& rFunc : rType.maFuncs)
+            {
+                u32((uint32_t)rFunc.mnMemberId);
+                u32((uint32_t)rFunc.mnFuncKind);
+                u32((uint32_t)rFunc.mnInvKind);
+                u32((uint32_t)rFunc.mnCallConv);
+                u16((uint16_t)rFunc.mnParamsOpt);
+                u16((uint16_t)rFunc.mnVft);
+                u16(rFunc.mnFuncFlags);
+                elemDesc(rFunc.maReturn);
+                u32((uint32_t)rFunc.maParams.size());
+                for (const SnapshotElemDesc& rParam : rFunc.maParams)
+                    elemDesc(rParam);
+            }
+
+            u32((uint32_t)rType.maVars.size());
+            for (const SnapshotVar& rVar : rType.maVars)
+            {
+                u32((uint32_t)rVar.mnMemberId);
+                u32((uint32_t)rVar.mnVarKind);
+                u16(rVar.mnValueType);
+                u64(rVar.mnValue);
+                elemDesc(rVar.maElem);
+            }
+
+            u32((uint32_t)rType.maMembers.size());
+            for (const SnapshotMember& rMember : rType.maMembers)
+            {
+                u32((uint32_t)rMember.mnMemberId);
+                string(rMember.msDocName);
+                u32((uint32_t)rMember.maNames.size());
+                for (const std::string& rName : rMember.maNames)
+                    string(rName);
+            }
+
+            u32((uint32_t)rType.maImplTypes.size());
+            for (const SnapshotImplType& rImplType : rType.maImplTypes)
+            {
+                u32(rImplType.mnHrefType);
+                u32((uint32_t)rImplType.mnFlags);
+            }
+
+            u8(rType.mbHasDualInterface ? 1 : 0);
+            u32(rType.mnDualHrefType);
+
+            u32((uint32_t)rType.maRefs.size());
+            for (const auto& rRef : rType.maRefs)
+            {
+                u32(rRef.first);
+                u32(rRef.second);
+            }
+        }
+    };
+
+    // Reading past the end gives zeros and sets mbTruncated.
+    struct Reader
+    {
+        Reader(const char* pBegin, const char* pEnd)
+            : mpPos(pBegin)
+            , mpEnd(pEnd)
+            , mbTruncated(false)
+        {
+        }
+
+        const char* mpPos;
+        const char* const mpEnd;
+        bool mbTruncated;
+
+        uint8_t u8()
+        {
+            if (mpPos >= mpEnd)
+            {
+                mbTruncated = true;
+                return 0;
+            }
+            return (uint8_t)*mpPos++;
+        }
+
+        uint16_t u16()
+        {
+            const uint16_t nLow = u8();
+            return (uint16_t)(nLow | (u8() << 8));
+        }
+
+        uint32_t u32()
+        {
+            const uint32_t nLow = u16();
+            return nLow | ((uint32_t)u16() << 16);
+        }
+
+        uint64_t u64()
+        {
+            const uint64_t nLow = u32();
+            return nLow | ((uint64_t)u32() << 32);
+        }
+
+        // A number of elements to follow, each of which takes at least a byte, so a corrupt count
+        // can't make us allocate more than the size of the file.
+        size_t count()
+        {
+            const uint32_t nCount = u32();
+            if (nCount > (size_t)(mpEnd - mpPos))
+            {
+                mbTruncated = true;
+                return 0;
+            }
+            return nCount;
+        }
+
+        std::string string()
+        {
+            const size_t nLength = count();
+            std::string sResult(mpPos, nLength);
+            mpPos += nLength;
+            return sResult;
+        }
+
+        void typeDesc(SnapshotTypeDesc& rDesc)
+        {
+            rDesc.mnVt = u16();
+            rDesc.mnHrefType = u32();
+            rDesc.maBounds.resize(count());
+            for (auto& rBound : rDesc.maBounds)
+            {
+                rBound.first = (int32_t)u32();
+                rBound.second = u32();
+            }
+            if (u8())
+            {
+                rDesc.mpInner = std::make_shared<SnapshotTypeDesc>();
+                typeDesc(*rDesc.mpInner);
+            }
+        }
+
+        void elemDesc(SnapshotElemDesc& rDesc)
+        {
+            typeDesc(rDesc.maType);
+            rDesc.mnParamFlags = u16();
+        }
+
+        void type(SnapshotType& rType)
+        {
+            rType.msName = string();
+            for (uint8_t& rByte : rType.maGuid)
+                rByte = u8();
+            rType.mnTypeKind = (int32_t)u32();
+            rType.mnTypeFlags = u16();
+            rType.mnSizeVft = u16();
+            rType.mnMajorVerNum = u16();
+            rType.mnMinorVerNum = u16();
+            typeDesc(rType.maAlias);
+
+            rType.maFuncs.resize(count());
+            for (SnapshotFunc& rFunc : rType.maFuncs)
+            {
+                rFunc.mnMemberId = (int32_t)u32();
+                rFunc.mnFuncKind = (int32_t)u32();
+                rFunc.mnInvKind = (int32_t)u32();
+                rFunc.mnCallConv = (int32_t)u32();
+                rFunc.mnParamsOpt = (int16_t)u16();
+                rFunc.mnVft = (int16_t)u16();
+                rFunc.mnFuncFlags = u16();
+                elemDesc(rFunc.maReturn);
+                rFunc.maParams.resize(count());
+                for (SnapshotElemDesc& rParam : rFunc.maParams)
+                    elemDesc(rParam);
+            }
+
+            rType.maVars.resize(count());
+            for (SnapshotVar& rVar : rType.maVars)
+            {
+                rVar.mnMemberId = (int32_t)u32();
+                rVar.mnVarKind = (int32_t)u32();
+                rVar.mnValueType = u16();
+                rVar.mnValue = u64();
+                elemDesc(rVar.maElem);
+            }
+
+            rType.maMembers.resize(count());
+            for (SnapshotMember& rMember : rType.maMembers)
+            {
+                rMember.mnMemberId = (int32_t)u32();
+                rMember.msDocName = string();
+                rMember.maNames.resize(count());
+                for (std::string& rName : rMember.maNames)
+                    rName = string();
+            }
+
+            rType.maImplTypes.resize(count());
+            for (SnapshotImplType& rImplType : rType.maImplTypes)
+            {
+                rImplType.mnHrefType = u32();
+                rImplType.mnFlags = (int32_t)u32();
+            }
+
+            rType.mbHasDualInterface = u8() != 0;
+            rType.mnDualHrefType = u32();
+
+            rType.maRefs.resize(count());
+            for (auto& rRef : rType.maRefs)
+            {
+                rRef.first = u32();
+                rRef.second = u32();
+            }
+        }
+    };
+};
+
+#endif // INCLUDED_typelibsnapshot_hpp
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab cinoptions=b1,g0,N-s cinkeys+=0=break: */
@@ -0,0 +1,65 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of Collabora OLE Automation Translator.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_AsyncOutput_hpp
+#define INCLUDED_AsyncOutput_hpp
+
+#pragma warning(push)
+#pragma warning(disable : 4668 4820 4917)
+
+#include <ios>
+#include <streambuf>
+
+#pragma warning(pop)
+
+// Replaces the streambuf of a stream (std::cout in practice) with one that collects the output of
+// each thread into lines, prefixes them with the time and the thread id, and queues them for a
+// background thread that writes them to the original streambuf in batches. Writing to a console
+// or pipe synchronously, and flushing after each line, easily costs more than the COM call being
+// traced.
+//
+// When the queue is full, a thread producing output waits a while for the writer to catch up, and
+// after that drops the line. The number of dropped lines is reported in the output.
+//
+// A line is queued only when complete, so a partial line (like the beginning of a trace line for an
+// IDispatch::Invoke() call) is lost if the process crashes before it is finished. Use the
+// synchronous AddTimeStamp instead when that matters.
+
+class AsyncOutput : public std::streambuf
+{
+public:
+    // Intentionally never destroyed, output can happen until the very end of the process. At exit,
+    // the queue is drained and output after that is written directly.
+    static void start(std::basic_ios<char>& rStream);
+
+protected:
+    int_type overflow(int_type c) override;
+    std::streamsize xsputn(const char* pChars, std::streamsize nCount) override;
+    int sync() override;
+
+private:
+    explicit AsyncOutput(std::basic_ios<char>& rStream);
+
+    AsyncOutput(const AsyncOutput&) = delete;
+    AsyncOutput& operator=(const AsyncOutput&) = delete;
+
+    void append(const char* pChars, size_t nCount);
+    void endLine();
+    void writeDirectly(const char* pChars, size_t nCount);
+
+    static unsigned long __stdcall writerThread(void* pParam);
+    static void drainAtExit();
+
+    std::streambuf* mpSink;
+    bool mbNewline;
+};
+
+#endif // INCLUDED_AsyncOutput_hpp
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab cinoptions=b1,g0,N-s cinkeys+=0=break: */
@@ -0,0 +1,90 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of Collabora OLE Automation Translator.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_BinaryTrace_hpp
+#define INCLUDED_BinaryTrace_hpp
+
+#pragma warning(push)
+#pragma warning(disable : 4668 4820 4917)
+
+#include <string>
+
+#include <Windows.h>
+#include <OleAuto.h>
+
+#pragma warning(pop)
+
+#include "tracerecord.hpp"
+
+// Writer of the binary trace file, see tracerecord.hpp for its layout. Formatting the text trace
+// (VARIANTs, IID and type name lookups, error messages) on the calling thread, in the middle of the
+// client's COM calls, is slow. Instead the proxies copy the raw data of each call into a
+// memory-mapped ring file, names are interned so that each is written just once, and the
+// coleat-trace program produces the text offline.
+
+class BinaryTrace
+{
+private:
+    static TraceFileHeader* mpHeader;
+
+    static void* reserve(uint32_t nSize);
+    static TraceNameId appendName(const std::string& rName);
+
+public:
+    // Creates the file, overwriting an existing one.
+    static bool open(const wchar_t* pFileName);
+
+    static bool isOpen() { return mpHeader != nullptr; }
+
+    static uint64_t now();
+
+    // Interned names. A name can be looked up with the object it belongs to (like an ITypeInfo)
+    // and a member number as the key, to avoid having to construct the name again.
+    static TraceNameId name(const std::string& rName);
+    static bool findName(const void* pOwner, int32_t nMember, TraceNameId& rId);
+    static TraceNameId addName(const void* pOwner, int32_t nMember, const std::string& rName);
+
+    // HRESULT_to_string() and WindowsErrorStringFromHRESULT() of nResult, interned
+    static TraceNameId resultName(HRESULT nResult);
+    static TraceNameId errorName(HRESULT nResult);
+
+    // A call or return record built on the stack and copied to the ring in one go. Arguments that
+    // don't fit are dropped, and strings truncated.
+    class Record
+    {
+    private:
+        static const uint32_t NBUFFER = 4096;
+
+        alignas(8) unsigned char maBuffer[NBUFFER];
+        uint32_t mnSize;
+        uint16_t* mpArgCount;
+
+        TraceArg* addArgSpace();
+        void addString(TraceArg& rArg, const wchar_t* pWchar, uint32_t nLength);
+        void addString(TraceArg& rArg, const char* pChar, uint32_t nLength);
+
+    public:
+        Record()
+            : mnSize(0)
+            , mpArgCount(nullptr)
+        {
+        }
+
+        TraceCallRecord& call();
+        TraceReturnRecord& result(TraceReturnKind eKind);
+
+        void addArg(const VARIANT& rVariant, uint8_t nFlags = 0, TraceNameId nArgName = 0);
+
+        void commit();
+    };
+};
+
+#endif // INCLUDED_BinaryTrace_hpp
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab cinoptions=b1,g0,N-s cinkeys+=0=break: */
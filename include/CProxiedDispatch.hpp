@@ -14,14 +14,15 @@
 #pragma warning(disable : 4365 4571 4625 4668 4820 4917 5026)
 
 #include <string>
-#include <vector>
 
 #include <Windows.h>
 #include <OCIdl.h>
 
 #pragma warning(pop)
 
+#include "CallStatistics.hpp"
 #include "CProxiedUnknown.hpp"
+#include "ProxyPool.hpp"
 
 class CProxiedDispatch : public CProxiedUnknown
 {
@@ -35,6 +36,40 @@ private:
     // The name of this property, as a fallback in case of no type information
     const char* const msPropName;
 
+    // Index of the FUNCDESCs of our type, shared by all proxies for the same interface. Looked up
+    // on the first Invoke() call, and set with InterlockedCompareExchangePointer().
+    struct FuncDescIndex;
+    FuncDescIndex* volatile mpFuncDescIndex;
+
+    static FuncDescIndex* getFuncDescIndex(IDispatch* pDispatch);
+    static void freeFuncDescIndex(FuncDescIndex* pIndex);
+    static const std::string& memberName(FuncDescIndex* pIndex, MEMBERID nMemberId);
+
+    // For the -b option, the equivalent of the -t output of Invoke(). The names are null if there
+    // is no type information.
+    void writeBinaryCall(DISPID dispIdMember, const std::string* pTypeName,
+                         const std::string* pMemberName, FUNCDESC* pFuncDesc,
+                         DISPPARAMS* pDispParams);
+    void writeBinaryReturn(HRESULT nResult, FUNCDESC* pFuncDesc, DISPPARAMS* pDispParams,
+                           VARIANT* pVarResult, const std::string& rPrettyResultTypeName);
+
+    // Ditto for genericInvoke(), which has the names but no FUNCDESC.
+    void writeBinaryGenericCall(MEMBERID nMemberId, int nInvKind, const char* sTypeName,
+                                const char* sMemberName, DISPPARAMS* pDispParams);
+
+    // The IID of the interface proxied, to tell members of different interfaces with the same
+    // MEMBERID apart.
+    const IID& interfaceIID() const;
+
+    // For the -c option. The names are only needed the first time this thread calls the member,
+    // if sMemberName is null they are looked up like for tracing.
+    CallStatistics::Counters* callCounters(MEMBERID nMemberId, int nInvKind,
+                                           const char* sTypeName, const char* sMemberName);
+
+    // Called by CProxiedUnknown when the last reference is gone.
+    friend class CProxiedUnknown;
+    static void recycle(CProxiedDispatch* pProxy);
+
 protected:
     CProxiedDispatch(IUnknown* pBaseClassUnknown, IDispatch* pDispatchToProxy, const char* sLibName,
                      const char* sPropName = nullptr);
@@ -43,20 +78,6 @@ protected:
     CProxiedDispatch(IUnknown* pBaseClassUnknown, IDispatch* pDispatchToProxy, const IID& rIID1,
                      const IID& rIID2, const char* sLibName, const char* sPropName = nullptr);
 
-#if 0
-    // We can't have a non-virtual destructor because of the "class has virtual functions, but
-    // destructor is not virtual" problem and we can't make the destructor virtual because our
-    // vtable should have *only* the entries from IUnknown plus the ones from this class
-    // (corresponding to the entries for IDispatch). So ideally we should delete mpDispIdToName in
-    // Release() when the reference count reaches zero.
-
-    ~CProxiedDispatch()
-    {
-        delete mpDispIdToName;
-    }
-
-#endif
-
 public:
     static CProxiedDispatch* get(IUnknown* pBaseClassUnknown, IDispatch* pDispatchToProxy,
                                  const char* sLibName, const char* sPropName = nullptr);
@@ -67,8 +88,33 @@ public:
                                  const IID& rIID1, const IID& rIID2, const char* sLibName,
                                  const char* sPropName = nullptr);
 
-    HRESULT genericInvoke(const std::string& rFuncName, int nInvKind,
-                          std::vector<VARIANT>& rParameters, void* pRetval);
+    // Where the generated code keeps the MEMBERID that a name resolved to in the replacement app,
+    // and the name in UTF-8 for the binary trace and statistics. Zero-initialised means not looked
+    // up yet.
+    struct MemberIdSlot
+    {
+        // Set with InterlockedExchange() after mnMemberId
+        volatile LONG mnLookedUp;
+        MEMBERID mnMemberId;
+        // Set with InterlockedCompareExchangePointer()
+        const char* volatile msName;
+    };
+
+    // The parameters are in the reverse order, as in DISPPARAMS.
+    HRESULT genericInvoke(const char* sTypeName, const wchar_t* pFuncName, int nInvKind,
+                          VARIANTARG* pParameters, UINT nParameters, void* pRetval,
+                          MemberIdSlot& rSlot);
+
+    // Proxies are allocated from ProxyPool, and the memory is given back by recycle() when the
+    // last reference to the proxy is released, see CProxiedUnknown::mnRefs.
+    //
+    // We can't have a non-virtual destructor because of the "class has virtual functions, but
+    // destructor is not virtual" problem and we can't make the destructor virtual because our
+    // vtable should have *only* the entries from IUnknown plus the ones from this class
+    // (corresponding to the entries for IDispatch). So no destructor is run for proxies, and
+    // recycle() deletes what needs deleting itself.
+    static void* operator new(size_t nSize) { return ProxyPool::allocate(nSize); }
+    static void operator delete(void* pObject) { ProxyPool::deallocate(pObject); }
 
     // IDispatch
     virtual HRESULT STDMETHODCALLTYPE GetTypeInfoCount(UINT* pctinfo);
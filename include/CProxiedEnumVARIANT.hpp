@@ -19,7 +19,7 @@
 
 #pragma warning(pop)
 
-#include "utils.hpp"
+#include "proxyruntime.hpp"
 
 #include "CProxiedUnknown.hpp"
 
@@ -14,6 +14,7 @@
 #pragma warning(disable : 4625 4668 4774 4820 4917)
 
 #include <map>
+#include <unordered_map>
 
 #include <Windows.h>
 #include <OCIdl.h>
@@ -21,21 +22,33 @@
 #pragma warning(pop)
 
 #include "exewrapper.hpp"
-#include "utils.hpp"
+#include "identitymap.hpp"
+#include "proxyruntime.hpp"
 
 class CProxiedUnknown : public IUnknown
 {
 private:
     IUnknown* const mpUnknownToProxy;
 
-    // We want to have at most one unique CProxiedUnknown object for each COM object.
+    // We want to have at most one unique CProxiedUnknown object for each COM object, see
+    // identitymap.hpp.
 
-    struct UnknownMapHolder
+    struct SRWLock
     {
-        std::map<IUnknown*, void*> maMap;
+        SRWLock() { InitializeSRWLock(&maLock); }
+
+        SRWLock(const SRWLock&) = delete;
+        SRWLock& operator=(const SRWLock&) = delete;
+
+        void lockShared() { AcquireSRWLockShared(&maLock); }
+        void unlockShared() { ReleaseSRWLockShared(&maLock); }
+        void lockExclusive() { AcquireSRWLockExclusive(&maLock); }
+        void unlockExclusive() { ReleaseSRWLockExclusive(&maLock); }
+
+        SRWLOCK maLock;
     };
 
-    static UnknownMapHolder* const mpLookupMap;
+    static IdentityMap<IUnknown, SRWLock>* const mpLookupMap;
 
     // Also, the proxied object might implement more interfaces than the one we know about (from the
     // type information at proxy generation time). Ones for which the proxied object has responded
@@ -55,18 +68,71 @@ private:
     // that. (IConnectionPointContainer isn't visible in the (pseudo) IDL generated by the OLE/COM
     // Object Viewer, for instance.) So we must special-case at least IConnectionPointContainer.
 
-    // Must have this in a separate object pointed to from CProxiedUnknown to avoid "C4265
+    // An object typically gets asked for just a handful of extra interfaces, so keep the first ones
+    // in a small array in the proxy itself, and only allocate a hash map if that fills up.
+
+    // If the interface is one of our proxies, mpProxy points to it, and if pooled, it removes
+    // itself from the table before it is recycled. Only proxies that belong to this object are
+    // kept here, i.e. this object itself and the ones that have it as mpBaseClassUnknown.
+
+    struct ExtraInterface
+    {
+        IID maIID;
+        void* mpInterface;
+        CProxiedUnknown* mpProxy;
+    };
+
+    static const unsigned NINLINEEXTRAINTERFACES = 6;
+    ExtraInterface maExtraInterfaces[NINLINEEXTRAINTERFACES];
+    unsigned mnExtraInterfaces;
+
+    // Must have the hash map in a separate object pointed to from CProxiedUnknown to avoid "C4265
     // 'CProxiedUnknown': class has virtual functions, but destructor is not virtual".
 
+    struct IIDHash
+    {
+        size_t operator()(const IID& rIID) const
+        {
+            return rIID.Data1 ^ ((size_t)rIID.Data2 << 16) ^ rIID.Data3
+                   ^ *reinterpret_cast<const unsigned long*>(rIID.Data4 + 4);
+        }
+    };
+
     struct IIDMapHolder
     {
-        std::map<IID, void*> maMap;
+        std::unordered_map<IID, ExtraInterface, IIDHash> maMap;
     };
 
-    IIDMapHolder* const mpExtraInterfaces;
+    IIDMapHolder* mpMoreExtraInterfaces;
+
+    SRWLOCK maExtraInterfacesLock;
 
-    // For indenting trace output nicely
-    static unsigned mnIndent;
+    // Returns the interface with a reference added, or nullptr.
+    void* findExtraInterface(REFIID riid);
+    void addExtraInterface(REFIID riid, void* pInterface, CProxiedUnknown* pProxy);
+    void rememberExtraInterface(REFIID riid, CProxiedUnknown* pProxy);
+    void removeExtraInterface(CProxiedUnknown* pProxy);
+    void forgetExtraInterfaces();
+
+    // The references to this proxy. We can't go by what the proxied object's Release() returns, as
+    // that is meant for diagnostics only, and for out-of-process objects it is not the real count.
+    // Besides, the proxied object may well stay alive, through references we haven't seen, after
+    // the last one to our proxy is gone.
+    //
+    // A proxy with a mpBaseClassUnknown holds a reference to that, so the object the extra
+    // interfaces were asked from, and which is in mpLookupMap, stays around as long as any of its
+    // other interfaces. Pooled proxies are given back to ProxyPool when the count drops to zero,
+    // others are never freed as they have no way to run the destructors of derived classes.
+    volatile LONG mnRefs;
+
+    CProxiedUnknown* identity();
+    bool tryAddRef();
+    void releaseRef();
+    void lastRelease();
+
+    // For indenting trace output nicely. Per thread, as calls on different threads nest
+    // independently.
+    static thread_local unsigned mnIndent;
 
 protected:
     CProxiedUnknown(IUnknown* pBaseClassUnknown, IUnknown* pUnknownToProxy, const IID& rIID,
@@ -77,6 +143,8 @@ protected:
     static CProxiedUnknown* find(IUnknown* pUnknownToProxy);
 
     IUnknown* const mpBaseClassUnknown;
+    // Set by CProxiedDispatch, whose objects are allocated from ProxyPool.
+    bool mbPooled;
     const IID maIID1;
     const IID maIID2;
     const char* const msLibName;
@@ -87,6 +155,10 @@ public:
     static CProxiedUnknown* get(IUnknown* pBaseClassUnknown, IUnknown* pUnknownToProxy,
                                 const IID& rIID1, const IID& rIID2, const char* sLibName);
 
+    // Drops a reference that get() took for a pointer that we don't own a reference to, like an
+    // [in] parameter of an event. The proxied object's reference count is not touched.
+    void releaseUnowned();
+
     static void setParam(ThreadProcParam* pParam);
     static ThreadProcParam* getParam();
 
@@ -94,11 +166,14 @@ public:
     // verbose) mode. Not sure whether I should just put these in utils.hpp instead as they don't
     // really have anything to do with CProxiedUnknown except that it is a handy location as most of
     // the code is derived from this class.
+    //
+    // The output streambuf collects the output of each thread into lines of its own, see
+    // AsyncOutput, so the line state is per thread too.
     static void increaseIndent();
     static void decreaseIndent();
     static std::string indent();
 
-    static bool mbIsAtBeginningOfLine;
+    static thread_local bool mbIsAtBeginningOfLine;
 
     // IUnknown
     HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppvObject) override;
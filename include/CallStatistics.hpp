@@ -0,0 +1,101 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of Collabora OLE Automation Translator.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_CallStatistics_hpp
+#define INCLUDED_CallStatistics_hpp
+
+#pragma warning(push)
+#pragma warning(disable : 4668 4820 4917)
+
+#include <cstdint>
+#include <string>
+
+#include <Windows.h>
+
+#pragma warning(pop)
+
+#include "latencyhistogram.hpp"
+
+// For the -c option: how many times each member of each interface is called, how many of the calls
+// fail, and how long the proxied app takes for them. The counters are per thread, so recording a
+// call takes no locks, and they are added up and written to the file when the process exits, as
+// JSON if the file name ends with ".json", otherwise as CSV.
+//
+// Calls are told apart by interface, member id and invoke kind. The member ids are those of the
+// object proxied to, both for calls through IDispatch::Invoke() and through the generated vtable
+// proxies, so the two add up.
+
+class CallStatistics
+{
+public:
+    struct Counters
+    {
+        uint64_t mnCalls;
+        uint64_t mnErrors;
+        uint64_t mnTotalNanos;
+        uint64_t mnMaxNanos;
+        LatencyHistogram maHistogram;
+    };
+
+    static void start(const wchar_t* pFileName);
+
+    static bool isActive() { return mbActive; }
+
+    // Pauses or resumes the recording. Returns false if start() was not called, as there is no file
+    // to write to then.
+    static bool setActive(bool bActive);
+
+    static uint64_t now()
+    {
+        LARGE_INTEGER aNow;
+        QueryPerformanceCounter(&aNow);
+        return (uint64_t)aNow.QuadPart;
+    }
+
+    // The counters of this thread for a member, or nullptr if it hasn't called it yet.
+    static Counters* find(const IID& rIID, MEMBERID nMemberId, int nInvKind);
+
+    // A null sTypeName means to use the name of the IID.
+    static Counters* add(const IID& rIID, MEMBERID nMemberId, int nInvKind, const char* sLibName,
+                         const char* sTypeName, const std::string& rMemberName);
+
+    static void record(Counters* pCounters, uint64_t nStart, HRESULT nResult)
+    {
+        const uint64_t nNanos = (uint64_t)((double)(now() - nStart) * mfNanosPerTick);
+        pCounters->mnCalls++;
+        if (FAILED(nResult))
+            pCounters->mnErrors++;
+        pCounters->mnTotalNanos += nNanos;
+        if (nNanos > pCounters->mnMaxNanos)
+            pCounters->mnMaxNanos = nNanos;
+        pCounters->maHistogram.record(nNanos);
+    }
+
+    // The invoke kind of an IDispatch::Invoke() call without type information.
+    static int invKindFromFlags(WORD nFlags)
+    {
+        if (nFlags & DISPATCH_PROPERTYPUTREF)
+            return INVOKE_PROPERTYPUTREF;
+        if (nFlags & DISPATCH_PROPERTYPUT)
+            return INVOKE_PROPERTYPUT;
+        if (nFlags == DISPATCH_PROPERTYGET)
+            return INVOKE_PROPERTYGET;
+        return INVOKE_FUNC;
+    }
+
+private:
+    static bool mbActive;
+    static double mfNanosPerTick;
+
+    static void writeAtExit();
+};
+
+#endif // INCLUDED_CallStatistics_hpp
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab cinoptions=b1,g0,N-s cinkeys+=0=break: */
@@ -0,0 +1,60 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of Collabora OLE Automation Translator.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_ControlChannel_hpp
+#define INCLUDED_ControlChannel_hpp
+
+#pragma warning(push)
+#pragma warning(disable : 4668 4820 4917)
+
+#include <Windows.h>
+
+#pragma warning(pop)
+
+#include "controlblock.hpp"
+#include "exewrapper.hpp"
+
+// The injected DLL's end of the control block, see controlblock.hpp. It creates the block, keeps
+// its counters up to date, and has a thread that applies the settings "coleat -P" writes into it:
+// the -t and -v flags in the ThreadProcParam, the trace filter, and pausing of the call
+// statistics.
+class ControlChannel
+{
+public:
+    static void start(ThreadProcParam* pParam);
+
+    static void countCall()
+    {
+        if (mpBlock != nullptr)
+            mpBlock->countCall();
+    }
+
+    static void countProxyCreated()
+    {
+        if (mpBlock != nullptr)
+            mpBlock->mnProxiesCreated.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static void countProxyDestroyed()
+    {
+        if (mpBlock != nullptr)
+            mpBlock->mnProxiesDestroyed.fetch_add(1, std::memory_order_relaxed);
+    }
+
+private:
+    static ControlBlock* mpBlock;
+
+    static DWORD WINAPI watch(LPVOID) noexcept;
+    // Returns false after reverting in rNew what could not be applied
+    static bool apply(const ControlSettings& rOld, ControlSettings& rNew);
+};
+
+#endif // INCLUDED_ControlChannel_hpp
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab cinoptions=b1,g0,N-s cinkeys+=0=break: */
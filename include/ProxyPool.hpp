@@ -0,0 +1,39 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of Collabora OLE Automation Translator.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_ProxyPool_hpp
+#define INCLUDED_ProxyPool_hpp
+
+#pragma warning(push)
+#pragma warning(disable : 4668 4820 4917)
+
+#include <ostream>
+
+#pragma warning(pop)
+
+// A slab allocator for proxy objects. A client walking the paragraphs of a large document causes a
+// proxy to be created for each Paragraph and Range object it touches. Allocating those one by one
+// from the heap of the client process fragments it, so allocate them from slabs, one free list per
+// size (which in practice means per proxy class), and reuse the memory of proxies for objects that
+// have gone away.
+
+class ProxyPool
+{
+public:
+    static void* allocate(size_t nSize);
+
+    // Just gives back the memory. No destructor is run.
+    static void deallocate(void* pObject);
+
+    static void dumpStatistics(std::ostream& rStream);
+};
+
+#endif // INCLUDED_ProxyPool_hpp
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab cinoptions=b1,g0,N-s cinkeys+=0=break: */
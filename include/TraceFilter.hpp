@@ -0,0 +1,75 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of Collabora OLE Automation Translator.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_TraceFilter_hpp
+#define INCLUDED_TraceFilter_hpp
+
+#pragma warning(push)
+#pragma warning(disable : 4668 4820 4917)
+
+#include <string>
+
+#include <Windows.h>
+
+#pragma warning(pop)
+
+// Decides which calls get traced, for the -f option. The rules are a comma-separated list of
+//
+//   [+|-]Library[.Interface[.Member]][/N][@R]
+//
+// where a missing part or "*" matches anything, and a part ending with "*" matches names starting
+// with what comes before it. Names are compared case-insensitively. "+" (the default) includes the
+// matching calls and "-" excludes them. The last matching rule decides. Calls matching no rule are
+// traced, unless the first rule is an include rule. For included calls, /N traces just every Nth
+// call of each member, and @R at most R calls per second of each member.
+//
+// For instance "-Word.Range.Text,-Word.Range.Characters" to leave out the most common calls when
+// a client walks a document, or "+Word.Documents,+Word._Document/10" to trace just the document
+// handling, and only every tenth call to _Document.
+//
+// The rules are matched once for each interface and member, and the result remembered.
+
+class TraceFilter
+{
+public:
+    // Returns false and sets rError if the rules are malformed, leaving the previous rules in
+    // effect. The rules can be replaced while calls are being made.
+    static bool compile(const char* pRules, std::string& rError);
+
+    // Nothing is traced after a failed compile().
+    static void rejectAll();
+
+    // Back to tracing all calls, as if no rules had been compiled
+    static void acceptAll();
+
+    // Whether to trace this call. The names are only looked at the first time a call of the
+    // member of the interface is seen.
+    //
+    // bFromTypeLibrary tells whether nMemberId is from the type library genproxy read, as in the
+    // generated code, or from the object called, as in CProxiedDispatch::Invoke(). In the
+    // redirection case the latter is in the replacement app, where the same id can be another
+    // member.
+    static bool accept(const IID& rIID, DISPID nMemberId, bool bFromTypeLibrary,
+                       const char* sLibName, const char* sTypeName, const char* sMemberName)
+    {
+        if (!mbActive)
+            return true;
+        return decide(rIID, nMemberId, bFromTypeLibrary, sLibName, sTypeName, sMemberName);
+    }
+
+private:
+    static bool mbActive;
+
+    static bool decide(const IID& rIID, DISPID nMemberId, bool bFromTypeLibrary,
+                       const char* sLibName, const char* sTypeName, const char* sMemberName);
+};
+
+#endif // INCLUDED_TraceFilter_hpp
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab cinoptions=b1,g0,N-s cinkeys+=0=break: */
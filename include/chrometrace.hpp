@@ -0,0 +1,148 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of Collabora OLE Automation Translator.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_chrometrace_hpp
+#define INCLUDED_chrometrace_hpp
+
+// Writes nested calls as begin and end events in the Chrome trace event JSON format, see
+// https://docs.google.com/document/d/1CvAClvFfyA5R-PhYUmn5OOQtYMH4h6I0nSsKchNAySU , which
+// chrome://tracing, https://ui.perfetto.dev and https://www.speedscope.app can show as flame
+// graphs. Used by coleat-trace, so no Windows headers here.
+
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable : 4365 4571 4625 4626 4668 4774 4820 4917 5026 5027)
+#endif
+
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <ostream>
+#include <string>
+
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+
+class ChromeTraceWriter
+{
+public:
+    explicit ChromeTraceWriter(std::ostream& rStream)
+        : mrStream(rStream)
+        , mfLastMicroseconds(0)
+    {
+        mrStream << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+        mrStream << "\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":";
+        writeString("COLEAT");
+        mrStream << "}}";
+    }
+
+    ChromeTraceWriter(const ChromeTraceWriter&) = delete;
+    ChromeTraceWriter& operator=(const ChromeTraceWriter&) = delete;
+
+    // The times are in microseconds from any fixed point.
+    void begin(uint32_t nThreadId, double fMicroseconds, const std::string& rName,
+               const std::string& rCategory, const std::string& rArguments)
+    {
+        startEvent('B', nThreadId, fMicroseconds);
+        mrStream << ",\"name\":";
+        writeString(rName);
+        mrStream << ",\"cat\":";
+        writeString(rCategory);
+        if (!rArguments.empty())
+        {
+            mrStream << ",\"args\":{\"arguments\":";
+            writeString(rArguments);
+            mrStream << "}";
+        }
+        mrStream << "}";
+
+        maOpen[nThreadId]++;
+    }
+
+    // Ends the innermost open event of the thread. Ignored if there is none, like for the returns
+    // of calls lost when the binary trace ring wrapped around.
+    void end(uint32_t nThreadId, double fMicroseconds, const std::string& rResult)
+    {
+        auto p = maOpen.find(nThreadId);
+        if (p == maOpen.end() || p->second == 0)
+            return;
+        p->second--;
+
+        startEvent('E', nThreadId, fMicroseconds);
+        if (!rResult.empty())
+        {
+            mrStream << ",\"args\":{\"result\":";
+            writeString(rResult);
+            mrStream << "}";
+        }
+        mrStream << "}";
+    }
+
+    // Ends the events still open, for calls in progress when the trace was taken, at the last
+    // time seen, and completes the JSON.
+    void finish()
+    {
+        const double fMicroseconds = mfLastMicroseconds;
+        for (auto& rThread : maOpen)
+        {
+            while (rThread.second > 0)
+                end(rThread.first, fMicroseconds, "");
+        }
+        mrStream << "\n]}\n";
+    }
+
+    // In double quotes. Bytes from 0x80 up are passed through, the strings are UTF-8.
+    void writeString(const std::string& rText)
+    {
+        static const char aHex[] = "0123456789abcdef";
+
+        mrStream << '"';
+        for (char c : rText)
+        {
+            const unsigned char nByte = (unsigned char)c;
+            if (c == '"' || c == '\\')
+                mrStream << '\\' << c;
+            else if (c == '\n')
+                mrStream << "\\n";
+            else if (c == '\r')
+                mrStream << "\\r";
+            else if (c == '\t')
+                mrStream << "\\t";
+            else if (nByte < 0x20)
+                mrStream << "\\u00" << aHex[nByte >> 4] << aHex[nByte & 0x0F];
+            else
+                mrStream << c;
+        }
+        mrStream << '"';
+    }
+
+private:
+    void startEvent(char cPhase, uint32_t nThreadId, double fMicroseconds)
+    {
+        if (fMicroseconds > mfLastMicroseconds)
+            mfLastMicroseconds = fMicroseconds;
+
+        char aTime[32];
+        std::snprintf(aTime, sizeof(aTime), "%.3f", fMicroseconds);
+
+        mrStream << ",\n{\"ph\":\"" << cPhase << "\",\"pid\":1,\"tid\":" << nThreadId
+                 << ",\"ts\":" << aTime;
+    }
+
+    std::ostream& mrStream;
+    double mfLastMicroseconds;
+
+    // The number of open events per thread
+    std::map<uint32_t, unsigned> maOpen;
+};
+
+#endif // INCLUDED_chrometrace_hpp
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab cinoptions=b1,g0,N-s cinkeys+=0=break: */
@@ -0,0 +1,210 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of Collabora OLE Automation Translator.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_controlblock_hpp
+#define INCLUDED_controlblock_hpp
+
+// The layout of the named shared memory through which "coleat -P" changes settings of a running
+// wrapped process, and reads counters from it. The injected DLL creates it, see ControlChannel.
+//
+// Both processes can be of different bitness, so the layout uses only fixed-size types and no
+// pointers. The settings are written under a sequence number that is odd while a write is in
+// progress, so that a reader can tell whether its copy is consistent and whether anything changed.
+// The injected DLL acknowledges each change by storing the sequence number it has applied, so that
+// coleat can wait for that instead of guessing. The counters are plain atomics, as nobody needs a
+// consistent set of them.
+//
+// Like trampoline.hpp this file must not include any Windows headers, so that it can be checked on
+// other platforms, too.
+
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable : 4365 4571 4625 4626 4668 4774 4820 4917 5026 5027)
+#endif
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <string>
+#include <thread>
+
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+
+struct ControlSettings
+{
+    static const size_t NTRACEFILTER = 1000;
+
+    uint8_t mbTrace;
+    uint8_t mbVerbose;
+    uint8_t mbCallStatistics;
+    uint8_t mnUnused;
+    // In UTF-8, empty to trace all calls
+    char msTraceFilter[NTRACEFILTER];
+};
+
+struct ControlBlock
+{
+    static const uint32_t MAGIC = 0x54414C43; // "CLAT"
+    static const uint32_t VERSION = 2;
+
+    // How often beginUpdate() tries before giving up, in case the writer died mid-update
+    static const int NUPDATETRIES = 10000;
+
+    uint32_t mnMagic;
+    uint32_t mnVersion;
+    uint32_t mnSize;
+    uint32_t mnProcessId;
+
+    std::atomic<uint32_t> mnSettingsSequence;
+    // Updated by the injected DLL once it has handled the settings of that sequence number
+    std::atomic<uint32_t> mnAppliedSequence;
+    ControlSettings maSettings;
+
+    // Updated by the injected DLL
+    alignas(8) std::atomic<uint64_t> mnCalls;
+    std::atomic<uint64_t> mnProxiesCreated;
+    std::atomic<uint64_t> mnProxiesDestroyed;
+
+    // Constructs the block in zeroed memory of at least sizeof(ControlBlock) bytes.
+    static ControlBlock* create(void* pMemory, uint32_t nProcessId)
+    {
+        ControlBlock* pBlock = new (pMemory) ControlBlock();
+        pBlock->mnMagic = MAGIC;
+        pBlock->mnVersion = VERSION;
+        pBlock->mnSize = (uint32_t)sizeof(ControlBlock);
+        pBlock->mnProcessId = nProcessId;
+        return pBlock;
+    }
+
+    // Returns nullptr if the memory does not hold a block of this version.
+    static ControlBlock* attach(void* pMemory, size_t nSize)
+    {
+        if (nSize < sizeof(ControlBlock))
+            return nullptr;
+
+        ControlBlock* pBlock = static_cast<ControlBlock*>(pMemory);
+        if (pBlock->mnMagic != MAGIC || pBlock->mnVersion != VERSION
+            || pBlock->mnSize != (uint32_t)sizeof(ControlBlock))
+            return nullptr;
+
+        return pBlock;
+    }
+
+    static std::wstring name(uint32_t nProcessId)
+    {
+        return L"Local\\COLEAT-control-" + std::to_wstring(nProcessId);
+    }
+
+    // The auto-reset event set after the settings change
+    static std::wstring changedEventName(uint32_t nProcessId)
+    {
+        return name(nProcessId) + L"-changed";
+    }
+
+    // Returns the settings to change in place, or nullptr if another update seems stuck. Each
+    // successful call must be followed by endUpdate().
+    ControlSettings* beginUpdate()
+    {
+        for (int i = 0; i < NUPDATETRIES; ++i)
+        {
+            uint32_t nSequence = mnSettingsSequence.load(std::memory_order_relaxed);
+            if ((nSequence & 1) == 0
+                && mnSettingsSequence.compare_exchange_weak(nSequence, nSequence + 1,
+                                                            std::memory_order_acquire))
+            {
+                std::atomic_thread_fence(std::memory_order_release);
+                return &maSettings;
+            }
+            std::this_thread::yield();
+        }
+        return nullptr;
+    }
+
+    void endUpdate() { mnSettingsSequence.fetch_add(1, std::memory_order_release); }
+
+    uint32_t settingsSequence() const
+    {
+        return mnSettingsSequence.load(std::memory_order_acquire);
+    }
+
+    // Copies the settings, and returns the sequence number they have, or returns false if no
+    // consistent copy could be made.
+    bool readSettings(ControlSettings& rSettings, uint32_t& rSequence) const
+    {
+        for (int i = 0; i < NUPDATETRIES; ++i)
+        {
+            const uint32_t nBefore = mnSettingsSequence.load(std::memory_order_acquire);
+            if ((nBefore & 1) == 0)
+            {
+                std::memcpy(&rSettings, &maSettings, sizeof(ControlSettings));
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (mnSettingsSequence.load(std::memory_order_relaxed) == nBefore)
+                {
+                    rSettings.msTraceFilter[ControlSettings::NTRACEFILTER - 1] = '\0';
+                    rSequence = nBefore;
+                    return true;
+                }
+            }
+            std::this_thread::yield();
+        }
+        return false;
+    }
+
+    void acknowledge(uint32_t nSequence)
+    {
+        mnAppliedSequence.store(nSequence, std::memory_order_release);
+    }
+
+    // Waits until settings with at least the sequence number nSequence have been applied, and
+    // returns false if that does not happen in time.
+    bool waitUntilApplied(uint32_t nSequence, unsigned nTimeoutMilliseconds) const
+    {
+        const auto aDeadline
+            = std::chrono::steady_clock::now() + std::chrono::milliseconds(nTimeoutMilliseconds);
+        while (true)
+        {
+            // Compare with wraparound, a long-running process can well see 2^32 changes
+            const uint32_t nApplied = mnAppliedSequence.load(std::memory_order_acquire);
+            if ((int32_t)(nApplied - nSequence) >= 0)
+                return true;
+            if (std::chrono::steady_clock::now() >= aDeadline)
+                return false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+
+    void countCall() { mnCalls.fetch_add(1, std::memory_order_relaxed); }
+
+    uint64_t proxiesAlive() const
+    {
+        // Read the destroyed ones first, so that a proxy destroyed in between is not missed
+        const uint64_t nDestroyed = mnProxiesDestroyed.load(std::memory_order_relaxed);
+        const uint64_t nCreated = mnProxiesCreated.load(std::memory_order_relaxed);
+        return nCreated >= nDestroyed ? nCreated - nDestroyed : 0;
+    }
+};
+
+// Atomics that use a lock would not work between processes.
+static_assert(ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2,
+              "The control block is shared between processes");
+
+// Same in 32- and 64-bit builds
+static_assert(offsetof(ControlBlock, mnAppliedSequence) == 20, "ControlBlock layout changed");
+static_assert(offsetof(ControlBlock, maSettings) == 24, "ControlBlock layout changed");
+static_assert(offsetof(ControlBlock, mnCalls) == 1032, "ControlBlock layout changed");
+static_assert(sizeof(ControlBlock) == 1056, "ControlBlock layout changed");
+
+#endif // INCLUDED_controlblock_hpp
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab cinoptions=b1,g0,N-s cinkeys+=0=break: */
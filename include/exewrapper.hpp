@@ -41,6 +41,7 @@ struct ThreadProcParam
 
     bool mbPassedSizeCheck;
     bool mbNoReplacement;
+    bool mbSynchronousOutput;
     bool mbTrace;
     bool mbVerbose;
 
@@ -51,6 +52,19 @@ struct ThreadProcParam
     static const int NFILENAME = 1000;
     wchar_t msFileName[NFILENAME];
     DWORD mnLastError;
+
+    // For the -b option, empty if not used
+    wchar_t msBinaryTraceFileName[NFILENAME];
+
+    // For the -i option, empty if not used
+    wchar_t msIIDNameCacheFileName[NFILENAME];
+
+    // For the -c option, empty if not used
+    wchar_t msCallStatisticsFileName[NFILENAME];
+
+    // For the -f option, in UTF-8, empty if not used
+    static const int NTRACEFILTER = 1000;
+    char msTraceFilter[NTRACEFILTER];
 };
 
 #endif // INCLUDED_EXEWRAPPER_HPP
@@ -0,0 +1,300 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of Collabora OLE Automation Translator.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_formatbuffer_hpp
+#define INCLUDED_formatbuffer_hpp
+
+// Formatting of values into a caller-supplied buffer, without any heap allocation. Used for the
+// VARIANT output in proxyruntime.hpp, and by coleat-trace to print the same thing from a binary
+// trace, so this file must not include any Windows headers or use Windows types.
+
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable : 4365 4571 4625 4626 4668 4774 4820 4917 5026 5027)
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+
+static const char aFormatHexDigits[] = "0123456789ABCDEF";
+
+static const char aFormatDigitPairs[] = "00010203040506070809"
+                                        "10111213141516171819"
+                                        "20212223242526272829"
+                                        "30313233343536373839"
+                                        "40414243444546474849"
+                                        "50515253545556575859"
+                                        "60616263646566676869"
+                                        "70717273747576777879"
+                                        "80818283848586878889"
+                                        "90919293949596979899";
+
+// How each ASCII character is written inside a quoted string: as is if zero, otherwise as a
+// backslash followed by the character in the table, where 'x' means a numeric escape. Characters
+// above 0x7F always get a numeric escape.
+struct FormatEscapeTable
+{
+    char maEscape[128];
+
+    constexpr FormatEscapeTable()
+        : maEscape()
+    {
+        for (int c = 0; c < 128; ++c)
+            maEscape[c] = (c >= ' ' && c <= '~') ? '\0' : 'x';
+        maEscape['"'] = '"';
+        maEscape['\\'] = '\\';
+        maEscape['\n'] = 'n';
+        maEscape['\r'] = 'r';
+    }
+};
+
+static constexpr FormatEscapeTable aFormatEscapes{};
+
+// Strings longer than this are truncated when printed.
+static const size_t FORMAT_MAX_STRING = 100;
+
+// Output that doesn't fit is cut off, which truncated() tells.
+class FormatBuffer
+{
+public:
+    FormatBuffer(char* pBuffer, size_t nCapacity)
+        : mpBuffer(pBuffer)
+        , mnCapacity(nCapacity)
+        , mnSize(0)
+        , mbTruncated(false)
+    {
+    }
+
+    const char* data() const { return mpBuffer; }
+    size_t size() const { return mnSize; }
+    bool truncated() const { return mbTruncated; }
+
+    void clear()
+    {
+        mnSize = 0;
+        mbTruncated = false;
+    }
+
+    void append(char c)
+    {
+        if (mnSize < mnCapacity)
+            mpBuffer[mnSize++] = c;
+        else
+            mbTruncated = true;
+    }
+
+    void append(const char* pChars, size_t nCount)
+    {
+        if (nCount > mnCapacity - mnSize)
+        {
+            nCount = mnCapacity - mnSize;
+            mbTruncated = true;
+        }
+        std::memcpy(mpBuffer + mnSize, pChars, nCount);
+        mnSize += nCount;
+    }
+
+    void append(const char* pString) { append(pString, std::strlen(pString)); }
+
+    void append(const std::string& rString) { append(rString.data(), rString.size()); }
+
+    // Upper case, padded with zeros to nMinDigits (at most 16) like std::setw() with
+    // std::setfill('0') would.
+    void appendHex(uint64_t n, int nMinDigits = 0)
+    {
+        char aDigits[16];
+        int i = 16;
+        do
+        {
+            aDigits[--i] = aFormatHexDigits[n & 0x0F];
+            n >>= 4;
+        } while (n != 0);
+        while (i > 16 - nMinDigits && i > 0)
+            aDigits[--i] = '0';
+        append(aDigits + i, (size_t)(16 - i));
+    }
+
+    void appendUnsigned(uint64_t n)
+    {
+        char aDigits[20];
+        int i = 20;
+        while (n >= 100)
+        {
+            const size_t nPair = (size_t)(n % 100) * 2;
+            n /= 100;
+            aDigits[--i] = aFormatDigitPairs[nPair + 1];
+            aDigits[--i] = aFormatDigitPairs[nPair];
+        }
+        if (n >= 10)
+        {
+            aDigits[--i] = aFormatDigitPairs[n * 2 + 1];
+            aDigits[--i] = aFormatDigitPairs[n * 2];
+        }
+        else
+            aDigits[--i] = (char)('0' + n);
+        append(aDigits + i, (size_t)(20 - i));
+    }
+
+    void appendSigned(int64_t n)
+    {
+        if (n < 0)
+        {
+            append('-');
+            appendUnsigned(0 - (uint64_t)n);
+        }
+        else
+            appendUnsigned((uint64_t)n);
+    }
+
+    // Like an ostream with the default flags and precision
+    void appendDouble(double f)
+    {
+        char aDigits[32];
+        const int n = std::snprintf(aDigits, sizeof(aDigits), "%g", f);
+        if (n > 0)
+            append(aDigits, (size_t)n);
+    }
+
+    // Like MSVC's ostream does for pointers: all digits, upper case, no 0x.
+    void appendPointer(uint64_t nPointer, size_t nPointerSize)
+    {
+        appendHex(nPointer, (int)nPointerSize * 2);
+    }
+
+    // In double quotes, with escapes. The string has already been truncated.
+    void appendQuoted(const char* pChars, size_t nLength)
+    {
+        append('"');
+        for (size_t i = 0; i < nLength; i++)
+        {
+            const unsigned char c = (unsigned char)pChars[i];
+            const char cEscape = (c < 128) ? aFormatEscapes.maEscape[c] : 'x';
+            if (cEscape == '\0')
+                append((char)c);
+            else if (cEscape != 'x')
+            {
+                append('\\');
+                append(cEscape);
+            }
+            else
+            {
+                append("\\x", 2);
+                appendHex(c, 2);
+            }
+        }
+        append('"');
+    }
+
+    // Ditto for UTF-16, wchar_t on Windows. Characters outside ASCII are written as \u{...}.
+    template <typename C> void appendQuotedUTF16(const C* pChars, size_t nLength)
+    {
+        append('"');
+        for (size_t i = 0; i < nLength; i++)
+        {
+            const uint32_t c = (uint16_t)pChars[i];
+            if (c < 128 && aFormatEscapes.maEscape[c] == '\0')
+                append((char)c);
+            else if (c < 128 && aFormatEscapes.maEscape[c] != 'x')
+            {
+                append('\\');
+                append(aFormatEscapes.maEscape[c]);
+            }
+            else
+            {
+                uint32_t nCodePoint = c;
+                const uint32_t nNext = (i + 1 < nLength) ? (uint16_t)pChars[i + 1] : 0;
+                if (0xD800 <= c && c <= 0xDBFF && 0xDC00 <= nNext && nNext <= 0xDFFF)
+                {
+                    nCodePoint = (((c - 0xD800) << 10) | (nNext - 0xDC00)) | 0x010000;
+                    i++;
+                }
+                append("\\u{", 3);
+                appendHex(nCodePoint);
+                append('}');
+            }
+        }
+        append('"');
+    }
+
+private:
+    char* mpBuffer;
+    size_t mnCapacity;
+    size_t mnSize;
+    bool mbTruncated;
+};
+
+// How many UTF-16 code units of a string to print: at most FORMAT_MAX_STRING, plus one if that
+// would split a surrogate pair.
+template <typename C> size_t formatTruncatedUTF16Length(const C* pChars, size_t nLength)
+{
+    if (nLength <= FORMAT_MAX_STRING)
+        return nLength;
+
+    const uint16_t cLast = (uint16_t)pChars[FORMAT_MAX_STRING - 1];
+    const uint16_t cNext = (uint16_t)pChars[FORMAT_MAX_STRING];
+    if (0xD800 <= cLast && cLast <= 0xDBFF && 0xDC00 <= cNext && cNext <= 0xDFFF)
+        return FORMAT_MAX_STRING + 1;
+    return FORMAT_MAX_STRING;
+}
+
+// Like VARTYPE_to_string() in utils.hpp, which uses this.
+inline void formatVartype(FormatBuffer& rBuffer, uint16_t nVt)
+{
+    // The VT_ constants
+    static const char* const aNames[] = {
+        "EMPTY",   "NULL",     "I2",      "I4",          "R4",      "R8",     "CY",
+        "DATE",    "BSTR",     "DISPATCH", "ERROR",      "BOOL",    "VARIANT", "UNKNOWN",
+        "DECIMAL", nullptr,    "I1",      "UI1",         "UI2",     "UI4",    "I8",
+        "UI8",     "INT",      "UINT",    "VOID",        "HRESULT", "PTR",    "SAFEARRAY",
+        "CARRAY",  "USERDEFINED", "LPSTR", "LPWSTR",     nullptr,   nullptr,  nullptr,
+        nullptr,   "RECORD",   "INT_PTR", "UINT_PTR",
+    };
+    static const char* const aMoreNames[] = {
+        "FILETIME",      "BLOB",        "STREAM", "STORAGE", "STREAMED_OBJECT",
+        "STORED_OBJECT", "BLOB_OBJECT", "CF",     "CLSID",   "VERSIONED_STREAM",
+    };
+
+    if (nVt == 0xFFFF)
+    {
+        rBuffer.append("ILLEGAL");
+        return;
+    }
+
+    if (nVt & 0x1000)
+        rBuffer.append("VECTOR:");
+    if (nVt & 0x2000)
+        rBuffer.append("ARRAY:");
+    if (nVt & 0x4000)
+        rBuffer.append("BYREF:");
+
+    const uint16_t nType = (uint16_t)(nVt & 0x0FFF);
+    if (nType < sizeof(aNames) / sizeof(aNames[0]) && aNames[nType] != nullptr)
+        rBuffer.append(aNames[nType]);
+    else if (nType >= 64 && nType < 64 + sizeof(aMoreNames) / sizeof(aMoreNames[0]))
+        rBuffer.append(aMoreNames[nType - 64]);
+    else if (nType == 0x0FFF)
+        rBuffer.append("BSTR_BLOB");
+    else
+    {
+        rBuffer.append("?(");
+        rBuffer.appendUnsigned(nType);
+        rBuffer.append(')');
+    }
+}
+
+#endif // INCLUDED_formatbuffer_hpp
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab cinoptions=b1,g0,N-s cinkeys+=0=break: */
@@ -0,0 +1,180 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of Collabora OLE Automation Translator.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_guidnames_hpp
+#define INCLUDED_guidnames_hpp
+
+// Formatting and parsing of GUIDs, and a table of names for them, used by the cached IID name
+// lookup in proxyruntime.hpp. Like tracerecord.hpp this file must not include any Windows
+// headers, so that it can be compiled and tried out on other platforms, too.
+
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable : 4365 4571 4625 4626 4668 4774 4820 4917 5026 5027)
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+
+// The bytes of a GUID as laid out in memory on Windows, i.e. Data1, Data2 and Data3 little-endian
+// followed by the eight bytes of Data4.
+struct GuidBytes
+{
+    uint8_t maBytes[16];
+};
+
+inline bool operator==(const GuidBytes& a, const GuidBytes& b)
+{
+    return std::memcmp(a.maBytes, b.maBytes, sizeof(a.maBytes)) == 0;
+}
+
+struct GuidBytesHash
+{
+    size_t operator()(const GuidBytes& rGuid) const
+    {
+        // FNV-1a
+        uint32_t nHash = 2166136261u;
+        for (int i = 0; i < 16; ++i)
+        {
+            nHash ^= (uint32_t)rGuid.maBytes[i];
+            nHash *= 16777619u;
+        }
+        return nHash;
+    }
+};
+
+// The length of the form produced by StringFromIID(), "{00020400-0000-0000-C000-000000000046}".
+static const size_t GUID_STRING_LENGTH = 38;
+
+// In which order the bytes of a GuidBytes appear in the string form
+static const int aGuidStringByteOrder[16]
+    = { 3, 2, 1, 0, 5, 4, 7, 6, 8, 9, 10, 11, 12, 13, 14, 15 };
+
+// Writes GUID_STRING_LENGTH characters and a terminating zero to pBuffer.
+inline void formatGuid(const GuidBytes& rGuid, char* pBuffer)
+{
+    static const char aHex[] = "0123456789ABCDEF";
+
+    char* p = pBuffer;
+    *p++ = '{';
+    for (int i = 0; i < 16; ++i)
+    {
+        if (i == 4 || i == 6 || i == 8 || i == 10)
+            *p++ = '-';
+        const uint8_t nByte = rGuid.maBytes[aGuidStringByteOrder[i]];
+        *p++ = aHex[nByte >> 4];
+        *p++ = aHex[nByte & 0x0F];
+    }
+    *p++ = '}';
+    *p = '\0';
+}
+
+inline int hexDigitValue(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+// Parses the form produced by formatGuid(), in either case. Only the first GUID_STRING_LENGTH
+// characters of pText are looked at.
+inline bool parseGuid(const char* pText, GuidBytes& rGuid)
+{
+    const char* p = pText;
+    if (*p++ != '{')
+        return false;
+    for (int i = 0; i < 16; ++i)
+    {
+        if ((i == 4 || i == 6 || i == 8 || i == 10) && *p++ != '-')
+            return false;
+        const int nHigh = hexDigitValue(*p++);
+        if (nHigh < 0)
+            return false;
+        const int nLow = hexDigitValue(*p++);
+        if (nLow < 0)
+            return false;
+        rGuid.maBytes[aGuidStringByteOrder[i]] = (uint8_t)((nHigh << 4) | nLow);
+    }
+    return *p == '}';
+}
+
+// What to print for a GUID. Not thread-safe in itself. Entries are never removed, and as the
+// table is node-based, pointers returned by find() stay valid when other entries are added.
+class GuidNameTable
+{
+public:
+    const std::string* find(const GuidBytes& rGuid) const
+    {
+        const auto i = maNames.find(rGuid);
+        if (i == maNames.end())
+            return nullptr;
+        return &i->second;
+    }
+
+    // An existing entry is kept as is. Returns the entry for rGuid in any case.
+    const std::string& insert(const GuidBytes& rGuid, const std::string& rName)
+    {
+        return maNames.emplace(rGuid, rName).first->second;
+    }
+
+    size_t size() const { return maNames.size(); }
+
+    // The snapshot format is one "{GUID} name" line per entry.
+    void save(std::ostream& rStream) const
+    {
+        char sGuid[GUID_STRING_LENGTH + 1];
+        for (const auto& i : maNames)
+        {
+            formatGuid(i.first, sGuid);
+            rStream << sGuid << ' ' << i.second << '\n';
+        }
+    }
+
+    // Skips malformed lines and doesn't replace existing entries. Returns the number of entries
+    // added.
+    size_t load(std::istream& rStream)
+    {
+        size_t nAdded = 0;
+        std::string sLine;
+        while (std::getline(rStream, sLine))
+        {
+            if (!sLine.empty() && sLine.back() == '\r')
+                sLine.pop_back();
+
+            GuidBytes aGuid;
+            if (sLine.size() < GUID_STRING_LENGTH + 2 || sLine[GUID_STRING_LENGTH] != ' '
+                || !parseGuid(sLine.data(), aGuid))
+                continue;
+
+            if (maNames.emplace(aGuid, sLine.substr(GUID_STRING_LENGTH + 1)).second)
+                nAdded++;
+        }
+        return nAdded;
+    }
+
+private:
+    std::unordered_map<GuidBytes, std::string, GuidBytesHash> maNames;
+};
+
+#endif // INCLUDED_guidnames_hpp
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab cinoptions=b1,g0,N-s cinkeys+=0=break: */
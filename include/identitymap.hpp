@@ -0,0 +1,125 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of Collabora OLE Automation Translator.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_identitymap_hpp
+#define INCLUDED_identitymap_hpp
+
+// The map from proxied object to its proxy that CProxiedUnknown uses to have at most one proxy
+// for each COM object. Proxies are created and released from several threads in multi-threaded
+// apartment clients, so the map is split into shards, each with its own lock, selected by the
+// proxied pointer.
+//
+// The Lock type has lockShared(), unlockShared(), lockExclusive() and unlockExclusive(). It is an
+// SRWLOCK in the proxies, and something else in tests/identitymap.cpp, as like trampoline.hpp this
+// file must not include any Windows headers.
+
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable : 4365 4571 4625 4626 4668 4774 4820 4917 5026 5027)
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+
+template <typename Key, typename Lock> class IdentityMap
+{
+public:
+    static const size_t NSHARDS = 16;
+
+    IdentityMap() {}
+
+    IdentityMap(const IdentityMap&) = delete;
+    IdentityMap& operator=(const IdentityMap&) = delete;
+
+    // If pAccept is given, it is called with the shard locked, so that it can take a reference to
+    // the value before a concurrent erase() and freeing of it. If it returns false, the value is
+    // on its way out, and nothing is found.
+    void* find(Key* pKey, bool (*pAccept)(void*) = nullptr)
+    {
+        Shard& rShard = shardFor(pKey);
+        void* pResult = nullptr;
+
+        rShard.maLock.lockShared();
+        auto p = rShard.maMap.find(pKey);
+        if (p != rShard.maMap.end() && (pAccept == nullptr || pAccept(p->second)))
+            pResult = p->second;
+        rShard.maLock.unlockShared();
+
+        return pResult;
+    }
+
+    // Returns the value that was replaced, if any.
+    void* insert(Key* pKey, void* pValue)
+    {
+        Shard& rShard = shardFor(pKey);
+
+        rShard.maLock.lockExclusive();
+        void*& rEntry = rShard.maMap[pKey];
+        void* pPrevious = rEntry;
+        rEntry = pValue;
+        rShard.maLock.unlockExclusive();
+
+        return pPrevious;
+    }
+
+    // Erases the entry only if it still is pValue. Once the proxy's reference count has dropped to
+    // zero, another thread may already have replaced it with a new proxy for the same object, or
+    // for a new object at the same address.
+    void erase(Key* pKey, void* pValue)
+    {
+        Shard& rShard = shardFor(pKey);
+
+        rShard.maLock.lockExclusive();
+        auto p = rShard.maMap.find(pKey);
+        if (p != rShard.maMap.end() && p->second == pValue)
+            rShard.maMap.erase(p);
+        rShard.maLock.unlockExclusive();
+    }
+
+    size_t size()
+    {
+        size_t nSize = 0;
+        for (size_t i = 0; i < NSHARDS; ++i)
+        {
+            maShards[i].maLock.lockShared();
+            nSize += maShards[i].maMap.size();
+            maShards[i].maLock.unlockShared();
+        }
+        return nSize;
+    }
+
+private:
+    struct Shard
+    {
+        Shard() {}
+
+        Shard(const Shard&) = delete;
+        Shard& operator=(const Shard&) = delete;
+
+        Lock maLock;
+        std::unordered_map<Key*, void*> maMap;
+    };
+
+    Shard& shardFor(Key* pKey)
+    {
+        // COM objects are heap allocated, so the lowest bits are always zero.
+        return maShards[(reinterpret_cast<uintptr_t>(pKey) >> 4) % NSHARDS];
+    }
+
+    Shard maShards[NSHARDS];
+};
+
+#endif // INCLUDED_identitymap_hpp
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab cinoptions=b1,g0,N-s cinkeys+=0=break: */
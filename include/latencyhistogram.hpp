@@ -0,0 +1,129 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of Collabora OLE Automation Translator.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_latencyhistogram_hpp
+#define INCLUDED_latencyhistogram_hpp
+
+// A histogram of durations in nanoseconds with log-linear buckets, like HdrHistogram: each power
+// of two is split into LATENCY_SUB_BUCKETS equal buckets, so a value is known to within 12.5% at
+// any magnitude, and recording is just a bit scan and an increment. No Windows headers here, like
+// in formatbuffer.hpp.
+
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable : 4365 4571 4625 4626 4668 4774 4820 4917 5026 5027)
+#endif
+
+#include <cstddef>
+#include <cstdint>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#pragma warning(pop)
+#endif
+
+static const int LATENCY_SUB_BUCKET_BITS = 3;
+static const int LATENCY_SUB_BUCKETS = 1 << LATENCY_SUB_BUCKET_BITS;
+
+// Longer durations, over 18 minutes, all go in the last bucket.
+static const int LATENCY_MAX_BIT = 39;
+
+static const int LATENCY_BUCKETS
+    = (LATENCY_MAX_BIT - LATENCY_SUB_BUCKET_BITS + 2) * LATENCY_SUB_BUCKETS;
+
+// n must not be zero.
+inline int latencyHighestBit(uint64_t n)
+{
+#if defined(_M_X64) || defined(_M_ARM64)
+    unsigned long nIndex;
+    _BitScanReverse64(&nIndex, n);
+    return (int)nIndex;
+#elif defined(_MSC_VER)
+    // There is no _BitScanReverse64() in 32-bit code.
+    unsigned long nIndex;
+    if (_BitScanReverse(&nIndex, (unsigned long)(n >> 32)))
+        return (int)nIndex + 32;
+    _BitScanReverse(&nIndex, (unsigned long)n);
+    return (int)nIndex;
+#else
+    return 63 - __builtin_clzll(n);
+#endif
+}
+
+inline int latencyBucket(uint64_t nNanos)
+{
+    if (nNanos < (uint64_t)LATENCY_SUB_BUCKETS)
+        return (int)nNanos;
+
+    const int nBit = latencyHighestBit(nNanos);
+    if (nBit > LATENCY_MAX_BIT)
+        return LATENCY_BUCKETS - 1;
+
+    const int nSub = (int)(nNanos >> (nBit - LATENCY_SUB_BUCKET_BITS)) & (LATENCY_SUB_BUCKETS - 1);
+    return (nBit - LATENCY_SUB_BUCKET_BITS + 1) * LATENCY_SUB_BUCKETS + nSub;
+}
+
+// The smallest value that goes in the bucket
+inline uint64_t latencyBucketLowerBound(int nBucket)
+{
+    if (nBucket < LATENCY_SUB_BUCKETS)
+        return (uint64_t)nBucket;
+
+    const int nBit = nBucket / LATENCY_SUB_BUCKETS + LATENCY_SUB_BUCKET_BITS - 1;
+    const uint64_t nSub = (uint64_t)(nBucket % LATENCY_SUB_BUCKETS);
+    return ((uint64_t)LATENCY_SUB_BUCKETS + nSub) << (nBit - LATENCY_SUB_BUCKET_BITS);
+}
+
+// The largest value that goes in the bucket, what percentiles are reported as
+inline uint64_t latencyBucketUpperBound(int nBucket)
+{
+    if (nBucket == LATENCY_BUCKETS - 1)
+        return UINT64_MAX;
+    return latencyBucketLowerBound(nBucket + 1) - 1;
+}
+
+class LatencyHistogram
+{
+public:
+    LatencyHistogram()
+        : maCounts()
+    {
+    }
+
+    void record(uint64_t nNanos) { maCounts[latencyBucket(nNanos)]++; }
+
+    void add(const LatencyHistogram& rOther)
+    {
+        for (int i = 0; i < LATENCY_BUCKETS; ++i)
+            maCounts[i] += rOther.maCounts[i];
+    }
+
+    uint32_t count(int nBucket) const { return maCounts[nBucket]; }
+
+    // The upper bound of the bucket in which the given fraction (0..1) of nTotal values lie
+    uint64_t percentile(double fFraction, uint64_t nTotal) const
+    {
+        const uint64_t nWanted = (uint64_t)(fFraction * (double)nTotal + 0.5);
+        uint64_t nSeen = 0;
+        for (int i = 0; i < LATENCY_BUCKETS; ++i)
+        {
+            nSeen += maCounts[i];
+            if (nSeen >= nWanted && nSeen > 0)
+                return latencyBucketUpperBound(i);
+        }
+        return 0;
+    }
+
+private:
+    uint32_t maCounts[LATENCY_BUCKETS];
+};
+
+#endif // INCLUDED_latencyhistogram_hpp
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab cinoptions=b1,g0,N-s cinkeys+=0=break: */
@@ -10,12 +10,20 @@
 #ifndef INCLUDED_OUTGOINGMAP_HPP
 #define INCLUDED_OUTGOINGMAP_HPP
 
+#ifdef _MSC_VER
 #pragma warning(push)
 #pragma warning(disable : 4668 4820 4917)
+#endif
 
+#ifdef _WIN32
 #include <Windows.h>
+#else
+#include "nonwindows.hpp"
+#endif
 
+#ifdef _MSC_VER
 #pragma warning(pop)
+#endif
 
 struct NameToMemberIdMapping
 {
@@ -0,0 +1,205 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of Collabora OLE Automation Translator.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_peimports_hpp
+#define INCLUDED_peimports_hpp
+
+// A reader for the import descriptors and import address tables of a PE image, either as loaded
+// by Windows, where the data is laid out by RVA, or as the plain contents of an .exe or .dll file,
+// where RVAs are translated through the section table. Handles both 32- and 64-bit images in
+// either build. Every offset is checked against the size of the data.
+//
+// Like trampoline.hpp this file must not include any Windows headers, so that it can be used on
+// other platforms to look at PE files, too.
+
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable : 4365 4571 4625 4626 4668 4774 4820 4917 5026 5027)
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+
+class PEImports
+{
+public:
+    PEImports(const unsigned char* pData, size_t nSize, bool bImageLayout)
+        : mpData(pData)
+        , mnSize(nSize)
+        , mbImageLayout(bImageLayout)
+        , mbValid(false)
+        , mb64Bit(false)
+        , mnSectionTable(0)
+        , mnSections(0)
+        , mnImportDirectory(0)
+    {
+        const uint32_t nPE = read32(0x3C);
+        if (read16(0) != 0x5A4D || read32(nPE) != 0x00004550)
+            return;
+
+        const uint32_t nOptionalHeader = nPE + 24;
+        const uint16_t nMagic = read16(nOptionalHeader);
+        if (nMagic != 0x10B && nMagic != 0x20B)
+            return;
+        mb64Bit = (nMagic == 0x20B);
+
+        mnSections = read16(nPE + 6);
+        mnSectionTable = nOptionalHeader + read16(nPE + 20);
+
+        // The import directory is the second data directory, preceded by their number
+        const uint32_t nDataDirectories = nOptionalHeader + (mb64Bit ? 112 : 96);
+        if (read32(nDataDirectories - 4) >= 2)
+            mnImportDirectory = read32(nDataDirectories + 8);
+
+        mbValid = true;
+    }
+
+    PEImports(const PEImports&) = delete;
+    PEImports& operator=(const PEImports&) = delete;
+
+    // Whether the headers make sense. An image without imports is still valid.
+    bool isValid() const { return mbValid; }
+
+    bool is64Bit() const { return mb64Bit; }
+
+    // The size of an import address table entry
+    size_t slotSize() const { return mb64Bit ? 8 : 4; }
+
+    // For each import descriptor, calls rVisitor.dll(sDll), and if that returns true,
+    // rVisitor.slot(nOffset, nValue) for each entry of its import address table, where nOffset is
+    // where the entry is in the data and nValue what it holds. Returns the number of descriptors
+    // seen.
+    template <typename Visitor> size_t walk(Visitor& rVisitor) const
+    {
+        if (!mbValid || mnImportDirectory == 0)
+            return 0;
+
+        size_t nDescriptors = 0;
+        for (uint32_t nDescriptor = mnImportDirectory;; nDescriptor += 20)
+        {
+            const size_t nOffset = offsetOf(nDescriptor);
+            if (nOffset == NONE || !fits(nOffset, 20))
+                break;
+
+            // Same end condition as Windows uses: a zero OriginalFirstThunk (Characteristics) or
+            // Name.
+            const uint32_t nOriginalFirstThunk = read32(nOffset);
+            const uint32_t nName = read32(nOffset + 12);
+            const uint32_t nFirstThunk = read32(nOffset + 16);
+            if (nOriginalFirstThunk == 0 || nName == 0)
+                break;
+
+            ++nDescriptors;
+
+            const char* sDll = stringAt(nName);
+            if (sDll == nullptr || !rVisitor.dll(sDll))
+                continue;
+
+            for (uint32_t nSlot = nFirstThunk;; nSlot += (uint32_t)slotSize())
+            {
+                const size_t nSlotOffset = offsetOf(nSlot);
+                if (nSlotOffset == NONE || !fits(nSlotOffset, slotSize()))
+                    break;
+
+                const uint64_t nValue
+                    = mb64Bit ? read64(nSlotOffset) : (uint64_t)read32(nSlotOffset);
+                if (nValue == 0)
+                    break;
+
+                rVisitor.slot(nSlotOffset, nValue);
+            }
+        }
+
+        return nDescriptors;
+    }
+
+private:
+    static const size_t NONE = (size_t)-1;
+
+    bool fits(size_t nOffset, size_t nLength) const
+    {
+        return nOffset <= mnSize && nLength <= mnSize - nOffset;
+    }
+
+    uint16_t read16(size_t nOffset) const
+    {
+        if (!fits(nOffset, 2))
+            return 0;
+        return (uint16_t)(mpData[nOffset] | (mpData[nOffset + 1] << 8));
+    }
+
+    uint32_t read32(size_t nOffset) const
+    {
+        if (!fits(nOffset, 4))
+            return 0;
+        return (uint32_t)read16(nOffset) | ((uint32_t)read16(nOffset + 2) << 16);
+    }
+
+    uint64_t read64(size_t nOffset) const
+    {
+        return (uint64_t)read32(nOffset) | ((uint64_t)read32(nOffset + 4) << 32);
+    }
+
+    // Where the byte at nRVA is in the data, or NONE
+    size_t offsetOf(uint32_t nRVA) const
+    {
+        if (mbImageLayout)
+            return nRVA < mnSize ? nRVA : NONE;
+
+        for (uint32_t i = 0; i < mnSections; ++i)
+        {
+            const size_t nSection = mnSectionTable + i * 40;
+            const uint32_t nVirtualSize = read32(nSection + 8);
+            const uint32_t nVirtualAddress = read32(nSection + 12);
+            const uint32_t nRawSize = read32(nSection + 16);
+            const uint32_t nRawOffset = read32(nSection + 20);
+            const uint32_t nLength = nVirtualSize > nRawSize ? nVirtualSize : nRawSize;
+            if (nRVA >= nVirtualAddress && nRVA - nVirtualAddress < nLength)
+            {
+                const uint32_t nDelta = nRVA - nVirtualAddress;
+                if (nDelta >= nRawSize)
+                    return NONE;
+                const size_t nOffset = (size_t)nRawOffset + nDelta;
+                return nOffset < mnSize ? nOffset : NONE;
+            }
+        }
+        return NONE;
+    }
+
+    const char* stringAt(uint32_t nRVA) const
+    {
+        const size_t nOffset = offsetOf(nRVA);
+        if (nOffset == NONE)
+            return nullptr;
+
+        const char* pString = (const char*)mpData + nOffset;
+        if (std::memchr(pString, '\0', mnSize - nOffset) == nullptr)
+            return nullptr;
+
+        return pString;
+    }
+
+    const unsigned char* const mpData;
+    const size_t mnSize;
+    const bool mbImageLayout;
+    bool mbValid;
+    bool mb64Bit;
+    size_t mnSectionTable;
+    uint32_t mnSections;
+    uint32_t mnImportDirectory;
+};
+
+#endif // INCLUDED_peimports_hpp
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab cinoptions=b1,g0,N-s cinkeys+=0=break: */
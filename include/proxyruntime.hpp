@@ -0,0 +1,604 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of Collabora OLE Automation Translator.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_proxyruntime_hpp
+#define INCLUDED_proxyruntime_hpp
+
+// The part of the utilities that the proxy classes, and the code genproxy generates for them,
+// need: conversions, and formatting of HRESULTs, IIDs, BSTRs and VARIANTs for the trace output.
+// Kept apart from utils.hpp so that changing the rest of that does not recompile the generated
+// code. Add here only what the generated code uses.
+
+#pragma warning(push)
+#pragma warning(disable : 4365 4571 4625 4626 4668 4774 4820 4917 5026 5027)
+
+#include <codecvt>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <Windows.h>
+#include <initguid.h>
+
+#pragma warning(pop)
+
+#include "formatbuffer.hpp"
+#include "guidnames.hpp"
+
+inline bool operator<(const IID& a, const IID& b) { return std::memcmp(&a, &b, sizeof(a)) < 0; }
+
+// Used both by genproxy when it builds the perfect hash table of known interfaces for
+// ProxyCreator(), and by the generated code when looking up in it, so must not change between the
+// two.
+inline unsigned hashIID(const IID& rIID, unsigned nSeed)
+{
+    const unsigned* pWords = reinterpret_cast<const unsigned*>(&rIID);
+    unsigned nHash = nSeed;
+
+    for (int i = 0; i < 4; ++i)
+    {
+        nHash ^= pWords[i];
+        nHash *= 0x9E3779B1u;
+        nHash ^= nHash >> 15;
+    }
+    return nHash;
+}
+
+inline std::string convertUTF16ToUTF8(const wchar_t* pWchar)
+{
+    static std::wstring_convert<std::codecvt_utf8<wchar_t>, wchar_t> aUTF16ToUTF8;
+
+    return std::string(aUTF16ToUTF8.to_bytes(pWchar));
+}
+
+inline std::wstring convertUTF8ToUTF16(const char* pChar)
+{
+    static std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>, wchar_t> aUTF8ToUTF16;
+
+    return std::wstring(aUTF8ToUTF16.from_bytes(pChar));
+}
+
+inline std::string to_ullhex(uint64_t n, int w = 0)
+{
+    std::stringstream aStringStream;
+    aStringStream << std::setfill('0') << std::setw(w) << std::uppercase << std::hex << n;
+    return aStringStream.str();
+}
+
+inline std::string to_uhex(uint32_t n, int w = 0)
+{
+    std::stringstream aStringStream;
+    aStringStream << std::setfill('0') << std::setw(w) << std::uppercase << std::hex << n;
+    return aStringStream.str();
+}
+
+inline std::string to_hex(int32_t n, int w = 0) { return to_uhex((uint32_t)n, w); }
+
+// The symbolic name of common HRESULT codes, or nullptr. This is for developer use anyway, much
+// easier to read "E_NOTIMPL" than the English prose description.
+inline const char* HRESULT_name(HRESULT nResult)
+{
+    switch (nResult)
+    {
+        case S_OK:
+            return "S_OK";
+        case S_FALSE:
+            return "S_FALSE";
+        case E_UNEXPECTED:
+            return "E_UNEXPECTED";
+        case E_NOTIMPL:
+            return "E_NOTIMPL";
+        case E_OUTOFMEMORY:
+            return "E_OUTOFMEMORY";
+        case E_INVALIDARG:
+            return "E_INVALIDARG";
+        case E_NOINTERFACE:
+            return "E_NOINTERFACE";
+        case E_POINTER:
+            return "E_POINTER";
+        case E_HANDLE:
+            return "E_HANDLE";
+        case E_ABORT:
+            return "E_ABORT";
+        case E_FAIL:
+            return "E_FAIL";
+        case E_ACCESSDENIED:
+            return "E_ACCESSDENIED";
+        case DISP_E_UNKNOWNINTERFACE:
+            return "DISP_E_UNKNOWNINTERFACE";
+        case DISP_E_MEMBERNOTFOUND:
+            return "DISP_E_MEMBERNOTFOUND";
+        case DISP_E_PARAMNOTFOUND:
+            return "DISP_E_PARAMNOTFOUND";
+        case DISP_E_TYPEMISMATCH:
+            return "DISP_E_TYPEMISMATCH";
+        case DISP_E_UNKNOWNNAME:
+            return "DISP_E_UNKNOWNNAME";
+        case DISP_E_NONAMEDARGS:
+            return "DISP_E_NONAMEDARGS";
+        case DISP_E_BADVARTYPE:
+            return "DISP_E_BADVARTYPE";
+        case DISP_E_EXCEPTION:
+            return "DISP_E_EXCEPTION";
+        case DISP_E_OVERFLOW:
+            return "DISP_E_OVERFLOW";
+        case DISP_E_BADINDEX:
+            return "DISP_E_BADINDEX";
+        case DISP_E_UNKNOWNLCID:
+            return "DISP_E_UNKNOWNLCID";
+        case DISP_E_ARRAYISLOCKED:
+            return "DISP_E_ARRAYISLOCKED";
+        case DISP_E_BADPARAMCOUNT:
+            return "DISP_E_BADPARAMCOUNT";
+        case DISP_E_PARAMNOTOPTIONAL:
+            return "DISP_E_PARAMNOTOPTIONAL";
+        case DISP_E_BADCALLEE:
+            return "DISP_E_BADCALLEE";
+        case DISP_E_NOTACOLLECTION:
+            return "DISP_E_NOTACOLLECTION";
+        case DISP_E_DIVBYZERO:
+            return "DISP_E_DIVBYZERO";
+        case DISP_E_BUFFERTOOSMALL:
+            return "DISP_E_BUFFERTOOSMALL";
+        default:
+            return nullptr;
+    }
+}
+
+inline std::string HRESULT_to_string(HRESULT nResult)
+{
+    const char* pName = HRESULT_name(nResult);
+    if (pName != nullptr)
+        return pName;
+    return to_hex(nResult, 8);
+}
+
+// What to print for an IID (or CLSID). Looking up the name in the Registry each time one is printed
+// is slow, and verbose output prints IIDs all the time, so the results are kept in a process-wide
+// table. It is seeded with well-known interfaces that don't have their name in the Registry, and
+// by the injected DLL with the interfaces genproxy generated proxies for. It can also be saved to
+// and loaded from a file, to avoid the Registry lookups in later runs.
+
+struct IIDNameSeed
+{
+    IID maIID;
+    const char* msName;
+};
+
+class IIDNameCache
+{
+public:
+    static const std::string& lookup(const IID& rIid)
+    {
+        const GuidBytes aKey = key(rIid);
+
+        AcquireSRWLockShared(&lock());
+        const std::string* pName = table().find(aKey);
+        ReleaseSRWLockShared(&lock());
+
+        if (pName != nullptr)
+            return *pName;
+
+        // Don't hold the lock while reading the Registry. If another thread looks up the same IID
+        // meanwhile, the first one to insert it wins.
+        const std::string sName = fromRegistry(rIid);
+
+        AcquireSRWLockExclusive(&lock());
+        const std::string& rName = table().insert(aKey, sName);
+        dirty() = true;
+        ReleaseSRWLockExclusive(&lock());
+
+        return rName;
+    }
+
+    static void seed(const IIDNameSeed* pSeeds, size_t nCount)
+    {
+        AcquireSRWLockExclusive(&lock());
+        for (size_t i = 0; i < nCount; ++i)
+            table().insert(key(pSeeds[i].maIID), pSeeds[i].msName);
+        ReleaseSRWLockExclusive(&lock());
+    }
+
+    static bool load(const wchar_t* pFileName)
+    {
+        std::ifstream aFile(pFileName);
+        if (!aFile.is_open())
+            return false;
+
+        AcquireSRWLockExclusive(&lock());
+        table().load(aFile);
+        ReleaseSRWLockExclusive(&lock());
+
+        return true;
+    }
+
+    // Does nothing if nothing has been looked up in the Registry since the last save().
+    static bool save(const wchar_t* pFileName)
+    {
+        bool bResult = true;
+
+        AcquireSRWLockExclusive(&lock());
+        if (dirty())
+        {
+            // Write a temporary file and rename it, so that a process reading the file at the
+            // same time never sees a partial one.
+            const std::wstring sTempFileName = std::wstring(pFileName) + L".tmp";
+            std::ofstream aFile(sTempFileName.data());
+            table().save(aFile);
+            aFile.close();
+
+            bResult = (aFile.good()
+                       && MoveFileExW(sTempFileName.data(), pFileName, MOVEFILE_REPLACE_EXISTING));
+            if (bResult)
+                dirty() = false;
+        }
+        ReleaseSRWLockExclusive(&lock());
+
+        return bResult;
+    }
+
+private:
+    static GuidBytes key(const IID& rIid)
+    {
+        static_assert(sizeof(GuidBytes) == sizeof(IID), "GuidBytes must match IID");
+
+        GuidBytes aKey;
+        std::memcpy(aKey.maBytes, &rIid, sizeof(aKey.maBytes));
+        return aKey;
+    }
+
+    static SRWLOCK& lock()
+    {
+        static SRWLOCK aLock = SRWLOCK_INIT;
+        return aLock;
+    }
+
+    static bool& dirty()
+    {
+        static bool bValue = false;
+        return bValue;
+    }
+
+    // Intentionally never destroyed, IIDs can be printed until the very end of the process.
+    static GuidNameTable& table()
+    {
+        static GuidNameTable* pTable = wellKnown();
+        return *pTable;
+    }
+
+    static GuidNameTable* wellKnown()
+    {
+        // Well-known interfaces that pop up a lot, but which don't have their name in the
+        // Registry.
+        const IIDNameSeed aWellKnown[] = {
+            { IID_IAgileObject, "IID_IAgileObject" },
+            { IID_ICallFactory, "IID_ICallFactory" },
+            { IID_IExternalConnection, "IID_IExternalConnection" },
+            { IID_IFastRundown, "IID_IFastRundown" },
+            { IID_IMarshal, "IID_IMarshal" },
+            { IID_IMarshal2, "IID_IMarshal2" },
+            { IID_INoMarshal, "IID_INoMarshal" },
+            { IID_NULL, "IID_NULL" },
+            { IID_IPersistPropertyBag, "IID_IPersistPropertyBag" },
+            { IID_IPersistStreamInit, "IID_IPersistStreamInit" },
+            { IID_IStdMarshalInfo, "IID_IStdMarshalInfo" },
+        };
+
+        GuidNameTable* pTable = new GuidNameTable;
+        for (const auto& i : aWellKnown)
+            pTable->insert(key(i.maIID), i.msName);
+        return pTable;
+    }
+
+    static std::string fromRegistry(const IID& rIid)
+    {
+        char sGuid[GUID_STRING_LENGTH + 1];
+        formatGuid(key(rIid), sGuid);
+        const std::wstring sRiid = convertUTF8ToUTF16(sGuid);
+
+        std::string sName;
+        if (registryDefaultValue(L"Interface\\" + sRiid, sName))
+            return "IID_" + sName;
+        if (registryDefaultValue(L"CLSID\\" + sRiid, sName))
+            return std::string(sGuid) + ":\"" + sName + "\"";
+        return sGuid;
+    }
+
+    static bool registryDefaultValue(const std::wstring& rKey, std::string& rValue)
+    {
+        DWORD nSize;
+        if (RegGetValueW(HKEY_CLASSES_ROOT, rKey.data(), NULL, RRF_RT_REG_SZ, NULL, NULL, &nSize)
+            != ERROR_SUCCESS)
+            return false;
+
+        std::vector<wchar_t> sValue(nSize / 2);
+        if (RegGetValueW(HKEY_CLASSES_ROOT, rKey.data(), NULL, RRF_RT_REG_SZ, NULL, sValue.data(),
+                         &nSize)
+            != ERROR_SUCCESS)
+            return false;
+
+        rValue = convertUTF16ToUTF8(sValue.data());
+        return true;
+    }
+};
+
+template <typename traits>
+inline std::basic_ostream<char, traits>& operator<<(std::basic_ostream<char, traits>& stream,
+                                                    const IID& rIid)
+{
+    return stream << IIDNameCache::lookup(rIid);
+}
+
+inline bool isHighSurrogate(wchar_t c) { return (0xD800 <= c && c <= 0xDBFF); }
+
+inline bool isLowSurrogate(wchar_t c) { return (0xDC00 <= c && c <= 0xDFFF); }
+
+inline UINT surrogatePair(const wchar_t* pWchar)
+{
+    return (UINT)((((pWchar[0] - 0xD800) << 10) | (pWchar[1] - 0xDC00)) | 0x010000);
+}
+
+// Formatting of HRESULTs, IIDs, BSTRs and VARIANTs into a FormatBuffer without heap allocation,
+// used by the operator<< for them. A VARIANT always fits in NFORMATVARIANT characters.
+
+static const size_t NFORMATVARIANT = 1024;
+
+inline void formatPointer(FormatBuffer& rBuffer, const void* pPointer)
+{
+    rBuffer.appendPointer((uint64_t)(uintptr_t)pPointer, sizeof(pPointer));
+}
+
+inline void formatHRESULT(FormatBuffer& rBuffer, HRESULT nResult)
+{
+    const char* pName = HRESULT_name(nResult);
+    if (pName != nullptr)
+        rBuffer.append(pName);
+    else
+        rBuffer.appendHex((uint32_t)nResult, 8);
+}
+
+inline void formatIID(FormatBuffer& rBuffer, const IID& rIid)
+{
+    rBuffer.append(IIDNameCache::lookup(rIid));
+}
+
+inline void formatCharString(FormatBuffer& rBuffer, const char* pChar, size_t nLength)
+{
+    if (pChar == nullptr)
+        rBuffer.append("(null)");
+    else
+        rBuffer.appendQuoted(pChar, nLength > FORMAT_MAX_STRING ? FORMAT_MAX_STRING : nLength);
+}
+
+inline void formatWcharString(FormatBuffer& rBuffer, const wchar_t* pWchar, size_t nLength)
+{
+    if (pWchar == nullptr)
+        rBuffer.append("(null)");
+    else
+        rBuffer.appendQuotedUTF16(pWchar, formatTruncatedUTF16Length(pWchar, nLength));
+}
+
+inline void formatBSTR(FormatBuffer& rBuffer, BSTR pBstr)
+{
+    formatWcharString(rBuffer, pBstr, SysStringLen(pBstr));
+}
+
+inline void formatVARIANT(FormatBuffer& rBuffer, const VARIANT& rVariant)
+{
+    rBuffer.append('<');
+
+    if (rVariant.vt & (VT_VECTOR | VT_ARRAY | VT_BYREF))
+    {
+        formatVartype(rBuffer, rVariant.vt);
+        rBuffer.append('>');
+
+        if (!(rVariant.vt & VT_BYREF) || rVariant.byref == nullptr)
+            return;
+
+        switch (rVariant.vt & VT_TYPEMASK)
+        {
+            case VT_EMPTY:
+            case VT_NULL:
+                // The VARTYPE is all that is needed.
+                break;
+            case VT_I2:
+                rBuffer.appendSigned(*rVariant.piVal);
+                break;
+            case VT_I4:
+            case VT_INT:
+                rBuffer.appendSigned(*rVariant.plVal);
+                break;
+            case VT_R4:
+                rBuffer.appendDouble(*rVariant.pfltVal);
+                break;
+            case VT_R8:
+                rBuffer.appendDouble(*rVariant.pdblVal);
+                break;
+            case VT_CY:
+                rBuffer.appendSigned(rVariant.pcyVal->int64);
+                break;
+            case VT_DATE:
+                rBuffer.appendDouble(*rVariant.pdate); // FIXME
+                break;
+            case VT_BSTR:
+                formatBSTR(rBuffer, *rVariant.pbstrVal);
+                break;
+            case VT_DISPATCH:
+                formatPointer(rBuffer, *rVariant.ppdispVal);
+                break;
+            case VT_ERROR:
+            case VT_HRESULT:
+                formatHRESULT(rBuffer, *rVariant.plVal);
+                break;
+            case VT_BOOL:
+                rBuffer.append(*rVariant.pboolVal ? "True" : "False");
+                break;
+            case VT_UNKNOWN:
+                formatPointer(rBuffer, *rVariant.ppunkVal);
+                break;
+            case VT_DECIMAL:
+                rBuffer.appendHex(rVariant.pdecVal->Hi32, 8);
+                rBuffer.appendHex(rVariant.pdecVal->Lo64, 16);
+                break;
+            case VT_I1:
+            case VT_UI1:
+                rBuffer.appendUnsigned(*rVariant.pbVal);
+                break;
+            case VT_UI2:
+                rBuffer.appendUnsigned((unsigned short)*rVariant.piVal);
+                break;
+            case VT_UI4:
+            case VT_UINT:
+                rBuffer.appendUnsigned((unsigned int)*rVariant.plVal);
+                break;
+            case VT_I8:
+                rBuffer.appendSigned(*rVariant.pllVal);
+                break;
+            case VT_UI8:
+                rBuffer.appendUnsigned((unsigned long long)*rVariant.pllVal);
+                break;
+            case VT_PTR:
+                formatPointer(rBuffer, *(void**)rVariant.byref);
+                break;
+                // Do these make sense with VT_BYREF?
+                // VT_CARRAY
+                // VT_SAFEARRAY
+                // VT_LPSTR
+                // VT_LPWSTR
+                // VT_INT_PTR
+                // VT_UINT_PTR
+            default:
+                rBuffer.append("?(");
+                rBuffer.appendUnsigned((unsigned)(rVariant.vt & VT_TYPEMASK));
+                rBuffer.append(')');
+                break;
+        }
+        return;
+    }
+
+    formatVartype(rBuffer, (VARTYPE)(rVariant.vt & VT_TYPEMASK));
+    rBuffer.append('>');
+
+    switch (rVariant.vt & VT_TYPEMASK)
+    {
+        case VT_EMPTY:
+        case VT_NULL:
+            // The VARTYPE is all that is needed.
+            break;
+        case VT_I2:
+            rBuffer.appendSigned(rVariant.iVal);
+            break;
+        case VT_I4:
+        case VT_INT:
+            rBuffer.appendSigned(rVariant.lVal);
+            break;
+        case VT_R4:
+            rBuffer.appendDouble(rVariant.fltVal);
+            break;
+        case VT_R8:
+            rBuffer.appendDouble(rVariant.dblVal);
+            break;
+        case VT_CY:
+            rBuffer.appendSigned(rVariant.cyVal.int64);
+            break;
+        case VT_DATE:
+            rBuffer.appendDouble(rVariant.date); // FIXME
+            break;
+        case VT_BSTR:
+            formatBSTR(rBuffer, rVariant.bstrVal);
+            break;
+        case VT_DISPATCH:
+            formatPointer(rBuffer, rVariant.pdispVal);
+            break;
+        case VT_ERROR:
+        case VT_HRESULT:
+            formatHRESULT(rBuffer, rVariant.lVal);
+            break;
+        case VT_BOOL:
+            rBuffer.append(rVariant.boolVal ? "True" : "False");
+            break;
+        case VT_UNKNOWN:
+            formatPointer(rBuffer, rVariant.punkVal);
+            break;
+        case VT_DECIMAL:
+            rBuffer.appendHex(rVariant.decVal.Hi32, 8);
+            rBuffer.appendHex(rVariant.decVal.Lo64, 16);
+            break;
+        case VT_I1:
+        case VT_UI1:
+            rBuffer.appendUnsigned(rVariant.bVal);
+            break;
+        case VT_UI2:
+            rBuffer.appendUnsigned((unsigned short)rVariant.iVal);
+            break;
+        case VT_UI4:
+        case VT_UINT:
+            rBuffer.appendUnsigned((unsigned int)rVariant.lVal);
+            break;
+        case VT_I8:
+            rBuffer.appendSigned(rVariant.llVal);
+            break;
+        case VT_UI8:
+            rBuffer.appendUnsigned((unsigned long long)rVariant.llVal);
+            break;
+        case VT_PTR:
+        case VT_CARRAY:
+            formatPointer(rBuffer, rVariant.byref);
+            break;
+        case VT_SAFEARRAY:
+            formatPointer(rBuffer, rVariant.parray);
+            break;
+        case VT_LPSTR:
+            formatCharString(rBuffer, rVariant.pcVal,
+                             rVariant.pcVal ? std::strlen(rVariant.pcVal) : 0);
+            break;
+        case VT_LPWSTR:
+        {
+            const wchar_t* pWchar = (const wchar_t*)rVariant.byref;
+            formatWcharString(rBuffer, pWchar, pWchar ? std::wcslen(pWchar) : 0);
+            break;
+        }
+        case VT_INT_PTR:
+        case VT_UINT_PTR:
+            formatPointer(rBuffer, rVariant.plVal);
+            break;
+        default:
+            rBuffer.append("?(");
+            rBuffer.appendUnsigned((unsigned)(rVariant.vt & VT_TYPEMASK));
+            rBuffer.append(')');
+            break;
+    }
+}
+
+template <typename traits>
+inline std::basic_ostream<char, traits>& operator<<(std::basic_ostream<char, traits>& stream,
+                                                    const BSTR& rBstr)
+{
+    char aBuffer[NFORMATVARIANT];
+    FormatBuffer aFormat(aBuffer, sizeof(aBuffer));
+    formatBSTR(aFormat, rBstr);
+    return stream.write(aFormat.data(), (std::streamsize)aFormat.size());
+}
+
+template <typename traits>
+inline std::basic_ostream<char, traits>& operator<<(std::basic_ostream<char, traits>& stream,
+                                                    const VARIANT& rVariant)
+{
+    char aBuffer[NFORMATVARIANT];
+    FormatBuffer aFormat(aBuffer, sizeof(aBuffer));
+    formatVARIANT(aFormat, rVariant);
+    return stream.write(aFormat.data(), (std::streamsize)aFormat.size());
+}
+#endif // INCLUDED_proxyruntime_hpp
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab cinoptions=b1,g0,N-s cinkeys+=0=break: */
@@ -0,0 +1,192 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of Collabora OLE Automation Translator.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_tracerecord_hpp
+#define INCLUDED_tracerecord_hpp
+
+// The layout of the binary trace file written by the proxies when coleat is run with the -b option,
+// and read by coleat-trace. This file is also compiled on other platforms than Windows, so it must
+// not include any Windows headers or use Windows types.
+//
+// The file starts with a TraceFileHeader. After that comes the name area, where strings (type and
+// member names, error messages etc) are appended once and then referred to by their offset in
+// the area, and then the ring area, where call and return records are written, wrapping around
+// when the end is reached. All records are a multiple of 8 bytes long and start with a
+// TraceRecordHeader. Integers are little-endian.
+
+#include <cstdint>
+
+static const char TRACE_FILE_MAGIC[8] = { 'C', 'O', 'L', 'E', 'A', 'T', 'B', 'T' };
+static const uint32_t TRACE_FILE_VERSION = 1;
+
+struct TraceFileHeader
+{
+    char maMagic[8];
+    uint32_t mnVersion;
+
+    // 4 or 8, depending on the bitness of the traced process. Used to print pointers like the
+    // text trace does.
+    uint32_t mnPointerSize;
+
+    // QueryPerformanceFrequency() and QueryPerformanceCounter() when the trace was started, and
+    // the time then, in milliseconds since 1970 UTC. Record timestamps are in ticks.
+    uint64_t mnTicksPerSecond;
+    uint64_t mnStartTicks;
+    uint64_t mnStartMilliseconds;
+
+    // What to add to UTC to get the local time of the traced process, which is what the text trace
+    // timestamps use.
+    int64_t mnLocalTimeOffsetSeconds;
+
+    uint64_t mnNamesOffset;
+    uint64_t mnNamesCapacity;
+    uint64_t mnNamesHead;
+
+    uint64_t mnRingOffset;
+    uint64_t mnRingCapacity;
+
+    // The total number of bytes ever reserved in the ring. When larger than mnRingCapacity the
+    // ring has wrapped, and the oldest data starts at mnRingHead % mnRingCapacity, possibly in the
+    // middle of a record.
+    uint64_t mnRingHead;
+};
+
+// Written last, as one 64-bit store, when the rest of the record is in place.
+struct TraceRecordHeader
+{
+    uint16_t mnMagic;
+    uint8_t mnType;
+    uint8_t mnFlags;
+    uint32_t mnSize;
+};
+
+static const uint16_t TRACE_RECORD_MAGIC = 0xC0EA;
+
+enum TraceRecordType : uint8_t
+{
+    // Fills the end of the ring when a record doesn't fit there
+    TRACE_PADDING = 1,
+    TRACE_CALL = 2,
+    TRACE_RETURN = 3,
+    // In the name area only
+    TRACE_NAME = 4,
+};
+
+// Names are referred to by their offset in the name area, zero meaning "no name".
+typedef uint32_t TraceNameId;
+
+// Followed by the UTF-8 name, not zero-terminated, padded to a multiple of 8.
+struct TraceNameRecord
+{
+    TraceRecordHeader maHeader;
+    uint32_t mnLength;
+    uint32_t mnReserved;
+};
+
+// mnFlags of a TRACE_CALL record
+static const uint8_t TRACE_CALL_PARENTHESES = 0x01;
+
+// Followed by mnArgs arguments.
+struct TraceCallRecord
+{
+    TraceRecordHeader maHeader;
+    uint64_t mnTicks;
+    uint64_t mnProxy;
+    uint32_t mnThreadId;
+    int32_t mnDispId;
+    TraceNameId mnLibName;
+    TraceNameId mnTypeName;
+    TraceNameId mnMemberName;
+    uint16_t mnInvKind;
+    uint16_t mnArgs;
+    // Of the interface proxied, see CProxiedDispatch::interfaceIID()
+    uint8_t maIID[16];
+};
+
+enum TraceReturnKind : uint8_t
+{
+    TRACE_RETURN_NOTHING = 0,
+    // " -> value"
+    TRACE_RETURN_RESULT = 1,
+    // " = value", for property assignments
+    TRACE_RETURN_ASSIGNED = 2,
+    // ": error"
+    TRACE_RETURN_ERROR = 3,
+};
+
+// mnFlags is a TraceReturnKind. Followed by one argument for TRACE_RETURN_RESULT and
+// TRACE_RETURN_ASSIGNED.
+struct TraceReturnRecord
+{
+    TraceRecordHeader maHeader;
+    uint64_t mnTicks;
+    uint32_t mnThreadId;
+    int32_t mnResult;
+    TraceNameId mnErrorString;
+    TraceNameId mnResultTypeName;
+};
+
+// How the value of an argument is stored. The writer has already dereferenced VT_BYREF values and
+// mapped the VARTYPE to one of these, so the reader doesn't need to know about VARTYPEs except to
+// print their names.
+enum TraceValueKind : uint8_t
+{
+    TRACE_VALUE_NONE = 0,
+    TRACE_VALUE_SIGNED = 1,
+    TRACE_VALUE_UNSIGNED = 2,
+    TRACE_VALUE_DOUBLE = 3,
+    TRACE_VALUE_BOOL = 4,
+    TRACE_VALUE_POINTER = 5,
+    // An interned string, for instance an HRESULT already turned into text
+    TRACE_VALUE_NAME = 6,
+    // mnLength UTF-16 code units follow, padded to a multiple of 8
+    TRACE_VALUE_WSTRING = 7,
+    // mnLength bytes follow, padded to a multiple of 8
+    TRACE_VALUE_STRING = 8,
+    // A NULL string pointer
+    TRACE_VALUE_NULLSTRING = 9,
+    // mnValue holds the low 64 bits, mnLength the high 32 bits
+    TRACE_VALUE_DECIMAL = 10,
+    // A VARTYPE we can't print, mnValue is the VARTYPE
+    TRACE_VALUE_UNHANDLED = 11,
+};
+
+// mnFlags of an argument
+static const uint8_t TRACE_ARG_OUT = 0x01;
+static const uint8_t TRACE_ARG_NAMED = 0x02;
+
+// The VT_ bits of interest to the reader
+static const uint16_t TRACE_VT_VECTOR = 0x1000;
+static const uint16_t TRACE_VT_ARRAY = 0x2000;
+static const uint16_t TRACE_VT_BYREF = 0x4000;
+static const uint16_t TRACE_VT_TYPEMASK = 0x0FFF;
+
+struct TraceArg
+{
+    uint16_t mnVt;
+    uint8_t mnKind;
+    uint8_t mnFlags;
+    uint32_t mnLength;
+    uint64_t mnValue;
+    TraceNameId mnArgName;
+    uint32_t mnReserved;
+};
+
+inline uint32_t traceAlign(uint32_t nSize) { return (nSize + 7) & ~7u; }
+
+static_assert(sizeof(TraceFileHeader) == 96, "TraceFileHeader layout");
+static_assert(sizeof(TraceRecordHeader) == 8, "TraceRecordHeader layout");
+static_assert(sizeof(TraceNameRecord) == 16, "TraceNameRecord layout");
+static_assert(sizeof(TraceCallRecord) == 64, "TraceCallRecord layout");
+static_assert(sizeof(TraceReturnRecord) == 32, "TraceReturnRecord layout");
+static_assert(sizeof(TraceArg) == 24, "TraceArg layout");
+
+#endif // INCLUDED_tracerecord_hpp
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab cinoptions=b1,g0,N-s cinkeys+=0=break: */
@@ -0,0 +1,316 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of Collabora OLE Automation Translator.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_trampoline_hpp
+#define INCLUDED_trampoline_hpp
+
+// The machine code of the trampolines the injected DLL hands out instead of functions like
+// DllGetClassObject, so that its replacement function knows which module it was called for. A
+// trampoline calls the function with the same arguments, and has a unique id stored right after
+// its final ret instruction, where the function finds it from its return address.
+//
+// Both the 32-bit and the 64-bit encoding are available in either build. Like guidnames.hpp this
+// file must not include any Windows headers, so that the bytes can be checked on other platforms,
+// too.
+
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable : 4365 4571 4625 4626 4668 4774 4820 4917 5026 5027)
+#endif
+
+#include <cstddef>
+#include <cstdint>
+
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+
+enum class TrampolineArch
+{
+    X86,
+    X64
+};
+
+// Room needed for any trampoline, and the most arguments one can pass on
+static const size_t NTRAMPOLINEMAX = 128;
+static const short NTRAMPOLINEMAXARGUMENTS = 8;
+
+// The distance from the return address of the call to the function to the id, i.e. the length of
+// the epilogue.
+inline size_t trampolineIdOffset(TrampolineArch eArch)
+{
+    return eArch == TrampolineArch::X86 ? 9 : 6;
+}
+
+class TrampolineEncoder
+{
+public:
+    // pBuffer needs room for NTRAMPOLINEMAX bytes. nCodeAddress is where the trampoline will be
+    // executed, as the 32-bit call is relative to it.
+    TrampolineEncoder(unsigned char* pBuffer, uint64_t nCodeAddress)
+        : mpBuffer(pBuffer)
+        , mnCodeAddress(nCodeAddress)
+        , mnSize(0)
+    {
+    }
+
+    TrampolineEncoder(const TrampolineEncoder&) = delete;
+    TrampolineEncoder& operator=(const TrampolineEncoder&) = delete;
+
+    // Returns the number of bytes written, or 0 if nArguments is out of range.
+    size_t encode(TrampolineArch eArch, uint64_t nFunction, uint64_t nId, short nArguments)
+    {
+        mnSize = 0;
+        if (nArguments < 0 || nArguments > NTRAMPOLINEMAXARGUMENTS)
+            return 0;
+
+        if (eArch == TrampolineArch::X86)
+            encodeX86((uint32_t)nFunction, (uint32_t)nId, nArguments);
+        else
+            encodeX64(nFunction, nId, nArguments);
+
+        return mnSize;
+    }
+
+private:
+    void byte(unsigned n) { mpBuffer[mnSize++] = (unsigned char)n; }
+
+    void bytes(unsigned n1, unsigned n2)
+    {
+        byte(n1);
+        byte(n2);
+    }
+
+    void bytes(unsigned n1, unsigned n2, unsigned n3)
+    {
+        byte(n1);
+        byte(n2);
+        byte(n3);
+    }
+
+    void bytes(unsigned n1, unsigned n2, unsigned n3, unsigned n4)
+    {
+        bytes(n1, n2);
+        bytes(n3, n4);
+    }
+
+    void bytes(unsigned n1, unsigned n2, unsigned n3, unsigned n4, unsigned n5)
+    {
+        bytes(n1, n2, n3, n4);
+        byte(n5);
+    }
+
+    // Little-endian
+    void value(uint64_t n, int nBytes)
+    {
+        for (int i = 0; i < nBytes; ++i)
+            byte((unsigned)(n >> (8 * i)) & 0xFF);
+    }
+
+    void encodeX86(uint32_t nFunction, uint32_t nId, short nArguments)
+    {
+        // Normal __stdcall prologue
+
+        // push ebp
+        byte(0x55);
+
+        // mov ebp, esp
+        bytes(0x8B, 0xEC);
+
+        // sub esp, 64
+        bytes(0x83, 0xEC, 0x40);
+
+        // push ebx
+        byte(0x53);
+
+        // push esi
+        byte(0x56);
+
+        // push edi
+        byte(0x57);
+
+        // Push our parameters
+        for (short i = 0; i < nArguments; ++i)
+        {
+            const unsigned nOffset = (unsigned)(8 + (nArguments - i - 1) * 4);
+            if ((i % 3) == 0)
+            {
+                // mov eax, dword ptr arg[ebp]
+                bytes(0x8B, 0x45, nOffset);
+
+                // push eax
+                byte(0x50);
+            }
+            else if ((i % 3) == 1)
+            {
+                // mov ecx, dword ptr arg[ebp]
+                bytes(0x8B, 0x4D, nOffset);
+
+                // push ecx
+                byte(0x51);
+            }
+            else
+            {
+                // mov edx, dword ptr arg[ebp]
+                bytes(0x8B, 0x55, nOffset);
+
+                // push edx
+                byte(0x52);
+            }
+        }
+
+        // call <relative 32-bit offset>
+        byte(0xE8);
+        value(nFunction - (uint32_t)(mnCodeAddress + mnSize + 4), 4);
+
+        // Normal __stdcall epilogue
+
+        // pop edi
+        byte(0x5F);
+
+        // pop esi
+        byte(0x5E);
+
+        // pop ebx
+        byte(0x5B);
+
+        // mov esp, ebp
+        bytes(0x8B, 0xE5);
+
+        // pop ebp
+        byte(0x5D);
+
+        // ret <nArguments*4>
+        byte(0xC2);
+        value((uint64_t)(nArguments * 4), 2);
+
+        // the unique id is stored after the ret <n>
+        value(nId, 4);
+    }
+
+    void encodeX64(uint64_t nFunction, uint64_t nId, short nArguments)
+    {
+        // Normal prologue
+
+        if (nArguments > 3)
+        {
+            // mov qword ptr [rsp+32], r9
+            bytes(0x4C, 0x89, 0x4C, 0x24, 0x20);
+        }
+
+        if (nArguments > 2)
+        {
+            // mov qword ptr [rsp+24], r8
+            bytes(0x4C, 0x89, 0x44, 0x24, 0x18);
+        }
+
+        if (nArguments > 1)
+        {
+            // mov qword ptr [rsp+16], rdx
+            bytes(0x48, 0x89, 0x54, 0x24, 0x10);
+        }
+
+        if (nArguments > 0)
+        {
+            // mov qword ptr [rsp+8], rcx
+            bytes(0x48, 0x89, 0x4C, 0x24, 0x08);
+        }
+
+        // push rbp
+        bytes(0x40, 0x55);
+
+        // sub rsp, <x>
+        const unsigned nFrame
+            = nArguments <= 4 ? 0x60 : 0x70 + (unsigned)(nArguments - 5) / 2 * 0x10;
+        if (nFrame < 0x80)
+            bytes(0x48, 0x83, 0xEC, nFrame);
+        else
+        {
+            // The 8-bit immediate is sign-extended, so 0x80 needs the 32-bit one.
+            bytes(0x48, 0x81, 0xEC);
+            value(nFrame, 4);
+        }
+
+        // lea rbp, qword ptr [rsp+<x>]
+        bytes(0x48, 0x8D, 0x6C, 0x24);
+        if (nArguments <= 4)
+            byte(0x20);
+        else
+            byte((unsigned)(0x30 + (nArguments - 5) / 2 * 0x10));
+
+        // Parameters
+        for (short i = 0; i < nArguments; ++i)
+        {
+            if (i == 0)
+            {
+                // mov rcx, qword ptr arg0[rbp]
+                bytes(0x48, 0x8B, 0x4D, 0x50);
+            }
+            else if (i == 1)
+            {
+                // mov rdx, qword ptr arg1[rbp]
+                bytes(0x48, 0x8B, 0x55, 0x58);
+            }
+            else if (i == 2)
+            {
+                // mov r8, qword ptr arg2[rbp]
+                bytes(0x4C, 0x8B, 0x45, 0x60);
+            }
+            else if (i == 3)
+            {
+                // mov r9, qword ptr arg3[rbp]
+                bytes(0x4C, 0x8B, 0x4D, 0x68);
+            }
+            else
+            {
+                // mov rax, qword ptr (112+(i-4)*8)[rbp]
+                const unsigned nOffset = (unsigned)(112 + (i - 4) * 8);
+                if (i <= 5)
+                    bytes(0x48, 0x8B, 0x45, nOffset);
+                else
+                {
+                    bytes(0x48, 0x8B, 0x85);
+                    value(nOffset, 4);
+                }
+
+                // mov qword ptr [rsp+32+(i-4)*8], rax
+                bytes(0x48, 0x89, 0x44, 0x24, (unsigned)(32 + (i - 4) * 8));
+            }
+        }
+
+        // mov rax, pFunction
+        bytes(0x48, 0xB8);
+        value(nFunction, 8);
+
+        // call rax
+        bytes(0xFF, 0xD0);
+
+        // Normal epilogue
+
+        // lea rsp, qword ptr [rbp+64]
+        bytes(0x48, 0x8D, 0x65, 0x40);
+
+        // pop rbp
+        byte(0x5D);
+
+        // ret
+        byte(0xC3);
+
+        // the unique id is stored after the ret
+        value(nId, 8);
+    }
+
+    unsigned char* const mpBuffer;
+    const uint64_t mnCodeAddress;
+    size_t mnSize;
+};
+
+#endif // INCLUDED_trampoline_hpp
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab cinoptions=b1,g0,N-s cinkeys+=0=break: */
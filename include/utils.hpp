@@ -16,6 +16,7 @@
 #include <cctype>
 #include <codecvt>
 #include <cstdio>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
@@ -30,15 +31,7 @@
 #pragma warning(pop)
 
 #include "exewrapper.hpp"
-
-inline bool operator<(const IID& a, const IID& b) { return std::memcmp(&a, &b, sizeof(a)) < 0; }
-
-inline std::string convertUTF16ToUTF8(const wchar_t* pWchar)
-{
-    static std::wstring_convert<std::codecvt_utf8<wchar_t>, wchar_t> aUTF16ToUTF8;
-
-    return std::string(aUTF16ToUTF8.to_bytes(pWchar));
-}
+#include "proxyruntime.hpp"
 
 inline std::wstring convertACPToUTF16(const char* pChar)
 {
@@ -64,13 +57,6 @@ inline std::wstring convertACPToUTF16(const char* pChar)
     return sResult;
 }
 
-inline std::wstring convertUTF8ToUTF16(const char* pChar)
-{
-    static std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>, wchar_t> aUTF8ToUTF16;
-
-    return std::wstring(aUTF8ToUTF16.from_bytes(pChar));
-}
-
 inline const wchar_t* baseName(const wchar_t* sPathname)
 {
     const wchar_t* const pBackslash = wcsrchr(sPathname, L'\\');
@@ -91,22 +77,6 @@ inline wchar_t* programName(const wchar_t* sPathname)
     return pRetval;
 }
 
-inline std::string to_ullhex(uint64_t n, int w = 0)
-{
-    std::stringstream aStringStream;
-    aStringStream << std::setfill('0') << std::setw(w) << std::uppercase << std::hex << n;
-    return aStringStream.str();
-}
-
-inline std::string to_uhex(uint32_t n, int w = 0)
-{
-    std::stringstream aStringStream;
-    aStringStream << std::setfill('0') << std::setw(w) << std::uppercase << std::hex << n;
-    return aStringStream.str();
-}
-
-inline std::string to_hex(int32_t n, int w = 0) { return to_uhex((uint32_t)n, w); }
-
 inline std::string IID_initializer(const IID& aIID)
 {
     std::string sResult;
@@ -129,160 +99,10 @@ inline std::string IID_to_string(const IID& aIID)
 
 inline std::string VARTYPE_to_string(VARTYPE nVt)
 {
-    if (nVt == VT_ILLEGAL)
-        return "ILLEGAL";
-
-    std::string sResult;
-
-    if (nVt & VT_VECTOR)
-        sResult += "VECTOR:";
-    if (nVt & VT_ARRAY)
-        sResult += "ARRAY:";
-    if (nVt & VT_BYREF)
-        sResult += "BYREF:";
-
-    switch (nVt & VT_TYPEMASK)
-    {
-        case VT_EMPTY:
-            sResult += "EMPTY";
-            break;
-        case VT_NULL:
-            sResult += "NULL";
-            break;
-        case VT_I2:
-            sResult += "I2";
-            break;
-        case VT_I4:
-            sResult += "I4";
-            break;
-        case VT_R4:
-            sResult += "R4";
-            break;
-        case VT_R8:
-            sResult += "R8";
-            break;
-        case VT_CY:
-            sResult += "CY";
-            break;
-        case VT_DATE:
-            sResult += "DATE";
-            break;
-        case VT_BSTR:
-            sResult += "BSTR";
-            break;
-        case VT_DISPATCH:
-            sResult += "DISPATCH";
-            break;
-        case VT_ERROR:
-            sResult += "ERROR";
-            break;
-        case VT_BOOL:
-            sResult += "BOOL";
-            break;
-        case VT_VARIANT:
-            sResult += "VARIANT";
-            break;
-        case VT_UNKNOWN:
-            sResult += "UNKNOWN";
-            break;
-        case VT_DECIMAL:
-            sResult += "DECIMAL";
-            break;
-        case VT_I1:
-            sResult += "I1";
-            break;
-        case VT_UI1:
-            sResult += "UI1";
-            break;
-        case VT_UI2:
-            sResult += "UI2";
-            break;
-        case VT_UI4:
-            sResult += "UI4";
-            break;
-        case VT_I8:
-            sResult += "I8";
-            break;
-        case VT_UI8:
-            sResult += "UI8";
-            break;
-        case VT_INT:
-            sResult += "INT";
-            break;
-        case VT_UINT:
-            sResult += "UINT";
-            break;
-        case VT_VOID:
-            sResult += "VOID";
-            break;
-        case VT_HRESULT:
-            sResult += "HRESULT";
-            break;
-        case VT_PTR:
-            sResult += "PTR";
-            break;
-        case VT_SAFEARRAY:
-            sResult += "SAFEARRAY";
-            break;
-        case VT_CARRAY:
-            sResult += "CARRAY";
-            break;
-        case VT_USERDEFINED:
-            sResult += "USERDEFINED";
-            break;
-        case VT_LPSTR:
-            sResult += "LPSTR";
-            break;
-        case VT_LPWSTR:
-            sResult += "LPWSTR";
-            break;
-        case VT_RECORD:
-            sResult += "RECORD";
-            break;
-        case VT_INT_PTR:
-            sResult += "INT_PTR";
-            break;
-        case VT_UINT_PTR:
-            sResult += "UINT_PTR";
-            break;
-        case VT_FILETIME:
-            sResult += "FILETIME";
-            break;
-        case VT_BLOB:
-            sResult += "BLOB";
-            break;
-        case VT_STREAM:
-            sResult += "STREAM";
-            break;
-        case VT_STORAGE:
-            sResult += "STORAGE";
-            break;
-        case VT_STREAMED_OBJECT:
-            sResult += "STREAMED_OBJECT";
-            break;
-        case VT_STORED_OBJECT:
-            sResult += "STORED_OBJECT";
-            break;
-        case VT_BLOB_OBJECT:
-            sResult += "BLOB_OBJECT";
-            break;
-        case VT_CF:
-            sResult += "CF";
-            break;
-        case VT_CLSID:
-            sResult += "CLSID";
-            break;
-        case VT_VERSIONED_STREAM:
-            sResult += "VERSIONED_STREAM";
-            break;
-        case VT_BSTR_BLOB:
-            sResult += "BSTR_BLOB";
-            break;
-        default:
-            sResult += "?(" + std::to_string(nVt & VT_TYPEMASK) + ")";
-            break;
-    }
-    return sResult;
+    char aBuffer[64];
+    FormatBuffer aFormat(aBuffer, sizeof(aBuffer));
+    formatVartype(aFormat, nVt);
+    return std::string(aFormat.data(), aFormat.size());
 }
 
 inline bool GetWindowsErrorString(DWORD nErrorCode, LPWSTR* pPMsgBuf)
@@ -404,77 +224,6 @@ inline std::string WindowsErrorString(DWORD nErrorCode)
     return sResult;
 }
 
-inline std::string HRESULT_to_string(HRESULT nResult)
-{
-    // Return common HRESULT codes symbolically. This is for developer use anyway, much easier to
-    // read "E_NOTIMPL" than the English prose description.
-    switch (nResult)
-    {
-        case S_OK:
-            return "S_OK";
-        case S_FALSE:
-            return "S_FALSE";
-        case E_UNEXPECTED:
-            return "E_UNEXPECTED";
-        case E_NOTIMPL:
-            return "E_NOTIMPL";
-        case E_OUTOFMEMORY:
-            return "E_OUTOFMEMORY";
-        case E_INVALIDARG:
-            return "E_INVALIDARG";
-        case E_NOINTERFACE:
-            return "E_NOINTERFACE";
-        case E_POINTER:
-            return "E_POINTER";
-        case E_HANDLE:
-            return "E_HANDLE";
-        case E_ABORT:
-            return "E_ABORT";
-        case E_FAIL:
-            return "E_FAIL";
-        case E_ACCESSDENIED:
-            return "E_ACCESSDENIED";
-        case DISP_E_UNKNOWNINTERFACE:
-            return "DISP_E_UNKNOWNINTERFACE";
-        case DISP_E_MEMBERNOTFOUND:
-            return "DISP_E_MEMBERNOTFOUND";
-        case DISP_E_PARAMNOTFOUND:
-            return "DISP_E_PARAMNOTFOUND";
-        case DISP_E_TYPEMISMATCH:
-            return "DISP_E_TYPEMISMATCH";
-        case DISP_E_UNKNOWNNAME:
-            return "DISP_E_UNKNOWNNAME";
-        case DISP_E_NONAMEDARGS:
-            return "DISP_E_NONAMEDARGS";
-        case DISP_E_BADVARTYPE:
-            return "DISP_E_BADVARTYPE";
-        case DISP_E_EXCEPTION:
-            return "DISP_E_EXCEPTION";
-        case DISP_E_OVERFLOW:
-            return "DISP_E_OVERFLOW";
-        case DISP_E_BADINDEX:
-            return "DISP_E_BADINDEX";
-        case DISP_E_UNKNOWNLCID:
-            return "DISP_E_UNKNOWNLCID";
-        case DISP_E_ARRAYISLOCKED:
-            return "DISP_E_ARRAYISLOCKED";
-        case DISP_E_BADPARAMCOUNT:
-            return "DISP_E_BADPARAMCOUNT";
-        case DISP_E_PARAMNOTOPTIONAL:
-            return "DISP_E_PARAMNOTOPTIONAL";
-        case DISP_E_BADCALLEE:
-            return "DISP_E_BADCALLEE";
-        case DISP_E_NOTACOLLECTION:
-            return "DISP_E_NOTACOLLECTION";
-        case DISP_E_DIVBYZERO:
-            return "DISP_E_DIVBYZERO";
-        case DISP_E_BUFFERTOOSMALL:
-            return "DISP_E_BUFFERTOOSMALL";
-        default:
-            return to_hex(nResult, 8);
-    }
-}
-
 inline std::string WindowsErrorStringFromHRESULT(HRESULT nResult)
 {
     std::string sSymbolic = HRESULT_to_string(nResult);
@@ -594,364 +343,6 @@ inline void waitForAnyKey()
         Sleep(100);
 }
 
-template <typename traits>
-inline std::basic_ostream<char, traits>& operator<<(std::basic_ostream<char, traits>& stream,
-                                                    const IID& rIid)
-{
-    LPOLESTR pRiid;
-    if (StringFromIID(rIid, &pRiid) != S_OK)
-        return stream << "?";
-
-    // Special case well-known interfaces that pop up a lot, but which don't have their name in
-    // the Registry.
-
-    if (IsEqualIID(rIid, IID_IAgileObject))
-        return stream << "IID_IAgileObject";
-    if (IsEqualIID(rIid, IID_ICallFactory))
-        return stream << "IID_ICallFactory";
-    if (IsEqualIID(rIid, IID_IExternalConnection))
-        return stream << "IID_IExternalConnection";
-    if (IsEqualIID(rIid, IID_IFastRundown))
-        return stream << "IID_IFastRundown";
-    if (IsEqualIID(rIid, IID_IMarshal))
-        return stream << "IID_IMarshal";
-    if (IsEqualIID(rIid, IID_IMarshal2))
-        return stream << "IID_IMarshal2";
-    if (IsEqualIID(rIid, IID_INoMarshal))
-        return stream << "IID_INoMarshal";
-    if (IsEqualIID(rIid, IID_NULL))
-        return stream << "IID_NULL";
-    if (IsEqualIID(rIid, IID_IPersistPropertyBag))
-        return stream << "IID_IPersistPropertyBag";
-    if (IsEqualIID(rIid, IID_IPersistStreamInit))
-        return stream << "IID_IPersistStreamInit";
-    if (IsEqualIID(rIid, IID_IStdMarshalInfo))
-        return stream << "IID_IStdMarshalInfo";
-
-    DWORD nSize;
-    if (RegGetValueW(HKEY_CLASSES_ROOT, std::wstring(L"Interface\\").append(pRiid).data(), NULL,
-                     RRF_RT_REG_SZ, NULL, NULL, &nSize)
-        == ERROR_SUCCESS)
-    {
-        std::vector<wchar_t> sValue(nSize / 2);
-        if (RegGetValueW(HKEY_CLASSES_ROOT, std::wstring(L"Interface\\").append(pRiid).data(), NULL,
-                         RRF_RT_REG_SZ, NULL, sValue.data(), &nSize)
-            == ERROR_SUCCESS)
-        {
-            stream << "IID_" << convertUTF16ToUTF8(sValue.data());
-        }
-    }
-    else if (RegGetValueW(HKEY_CLASSES_ROOT, std::wstring(L"CLSID\\").append(pRiid).data(), NULL,
-                          RRF_RT_REG_SZ, NULL, NULL, &nSize)
-             == ERROR_SUCCESS)
-    {
-        std::vector<wchar_t> sValue(nSize / 2);
-        if (RegGetValueW(HKEY_CLASSES_ROOT, std::wstring(L"CLSID\\").append(pRiid).data(), NULL,
-                         RRF_RT_REG_SZ, NULL, sValue.data(), &nSize)
-            == ERROR_SUCCESS)
-        {
-            stream << convertUTF16ToUTF8(pRiid) << ":\"" << convertUTF16ToUTF8(sValue.data())
-                   << "\"";
-        }
-    }
-    else
-    {
-        stream << convertUTF16ToUTF8(pRiid);
-    }
-
-    CoTaskMemFree(pRiid);
-    return stream;
-}
-
-inline bool isHighSurrogate(wchar_t c) { return (0xD800 <= c && c <= 0xDBFF); }
-
-inline bool isLowSurrogate(wchar_t c) { return (0xDC00 <= c && c <= 0xDFFF); }
-
-inline UINT surrogatePair(const wchar_t* pWchar)
-{
-    return (UINT)((((pWchar[0] - 0xD800) << 10) | (pWchar[1] - 0xDC00)) | 0x010000);
-}
-
-template <typename traits>
-inline std::basic_ostream<char, traits>& outputCharString(const char* pChar, UINT nLength,
-                                                          std::basic_ostream<char, traits>& rStream)
-{
-    if (pChar == nullptr)
-    {
-        rStream << "(null)";
-        return rStream;
-    }
-
-    rStream << "\"";
-    if (nLength > 100)
-        nLength = 100;
-
-    for (UINT i = 0; i < nLength; i++)
-    {
-        if (pChar[i] == '"' || pChar[i] == '\\')
-            rStream << '\\' << pChar[i];
-        else if (pChar[i] == '\n')
-            rStream << "\\n";
-        else if (pChar[i] == '\r')
-            rStream << "\\r";
-        else if (pChar[i] >= ' ' && pChar[i] <= '~')
-            rStream << pChar[i];
-        else
-            rStream << "\\x" << to_uhex((UINT)pChar[i], 2);
-    }
-
-    rStream << "\"";
-
-    return rStream;
-}
-
-template <typename traits>
-inline std::basic_ostream<char, traits>&
-outputWcharString(const wchar_t* pWchar, UINT nLength, std::basic_ostream<char, traits>& rStream)
-{
-    if (pWchar == nullptr)
-    {
-        rStream << "(null)";
-        return rStream;
-    }
-
-    rStream << "\"";
-    if (nLength > 100)
-    {
-        nLength = 100;
-        if (isHighSurrogate(pWchar[nLength - 1]) && isLowSurrogate(pWchar[nLength]))
-            nLength++;
-    }
-
-    for (UINT i = 0; i < nLength; i++)
-    {
-        if (isHighSurrogate(pWchar[i]) && i < nLength - 1 && isLowSurrogate(pWchar[i + 1]))
-        {
-            rStream << "\\u{" << to_uhex(surrogatePair(pWchar + i)) << "}";
-            i++;
-        }
-        else if (pWchar[i] == '"' || pWchar[i] == '\\')
-            rStream << '\\' << (char)pWchar[i];
-        else if (pWchar[i] == '\n')
-            rStream << "\\n";
-        else if (pWchar[i] == '\r')
-            rStream << "\\r";
-        else if (pWchar[i] >= ' ' && pWchar[i] <= '~')
-            rStream << (char)pWchar[i];
-        else
-            rStream << "\\u{" << to_uhex((UINT)pWchar[i]) << "}";
-    }
-
-    rStream << "\"";
-
-    return rStream;
-}
-
-template <typename traits>
-inline std::basic_ostream<char, traits>& operator<<(std::basic_ostream<char, traits>& stream,
-                                                    const BSTR& rBstr)
-{
-    return outputWcharString(rBstr, SysStringLen(rBstr), stream);
-}
-
-template <typename traits>
-inline std::basic_ostream<char, traits>& operator<<(std::basic_ostream<char, traits>& stream,
-                                                    const VARIANT& rVariant)
-{
-    if (rVariant.vt & (VT_VECTOR | VT_ARRAY | VT_BYREF))
-    {
-        stream << "<" << VARTYPE_to_string(rVariant.vt) << ">";
-
-        if (rVariant.vt & VT_BYREF && rVariant.byref != nullptr)
-        {
-            switch (rVariant.vt & VT_TYPEMASK)
-            {
-                case VT_EMPTY:
-                case VT_NULL:
-                    // The VARTYPE_to_string is all that is needed.
-                    break;
-                case VT_I2:
-                    stream << *rVariant.piVal;
-                    break;
-                case VT_I4:
-                    stream << *rVariant.plVal;
-                    break;
-                case VT_R4:
-                    stream << *rVariant.pfltVal;
-                    break;
-                case VT_R8:
-                    stream << *rVariant.pdblVal;
-                    break;
-                case VT_CY:
-                    stream << rVariant.pcyVal->int64;
-                    break;
-                case VT_DATE:
-                    stream << (double)(*rVariant.pdate);
-                    break; // FIXME
-                case VT_BSTR:
-                    stream << *rVariant.pbstrVal;
-                    break;
-                case VT_DISPATCH:
-                    stream << *rVariant.ppdispVal;
-                    break;
-                case VT_ERROR:
-                    stream << HRESULT_to_string(*rVariant.plVal);
-                    break;
-                case VT_BOOL:
-                    stream << (*rVariant.pboolVal ? "True" : "False");
-                    break;
-                case VT_UNKNOWN:
-                    stream << *rVariant.ppunkVal;
-                    break;
-                case VT_DECIMAL:
-                    stream << to_uhex(rVariant.pdecVal->Hi32, 8) << to_ullhex(rVariant.pdecVal->Lo64, 16);
-                    break;
-                case VT_I1:
-                    stream << (int)(*rVariant.pbVal);
-                    break;
-                case VT_UI1:
-                    stream << (unsigned int)(*rVariant.pbVal);
-                    break;
-                case VT_UI2:
-                    stream << (unsigned short)(*rVariant.piVal);
-                    break;
-                case VT_UI4:
-                    stream << (unsigned int)(*rVariant.plVal);
-                    break;
-                case VT_I8:
-                    stream << *rVariant.pllVal;
-                    break;
-                case VT_UI8:
-                    stream << (unsigned long long)(*rVariant.pllVal);
-                    break;
-                case VT_INT:
-                    stream << *rVariant.plVal;
-                    break;
-                case VT_UINT:
-                    stream << (unsigned int)(*rVariant.plVal);
-                    break;
-                case VT_HRESULT:
-                    stream << HRESULT_to_string(*rVariant.plVal);
-                    break;
-                case VT_PTR:
-                    stream << *(void**)rVariant.byref;
-                    break;
-                    // Do these make sense with VT_BYREF?
-                    // VT_CARRAY
-                    // VT_SAFEARRAY
-                    // VT_LPSTR
-                    // VT_LPWSTR
-                    // VT_INT_PTR
-                    // VT_UINT_PTR
-                default:
-                    stream << "?(" << (rVariant.vt & VT_TYPEMASK) << ")";
-                    break;
-            }
-        }
-
-        return stream;
-    }
-
-    stream << "<" << VARTYPE_to_string(rVariant.vt & VT_TYPEMASK) << ">";
-
-    switch (rVariant.vt & VT_TYPEMASK)
-    {
-        case VT_EMPTY:
-        case VT_NULL:
-            // The VARTYPE_to_string is all that is needed.
-            break;
-        case VT_I2:
-            stream << rVariant.iVal;
-            break;
-        case VT_I4:
-            stream << rVariant.lVal;
-            break;
-        case VT_R4:
-            stream << rVariant.fltVal;
-            break;
-        case VT_R8:
-            stream << rVariant.dblVal;
-            break;
-        case VT_CY:
-            stream << rVariant.cyVal.int64;
-            break;
-        case VT_DATE:
-            stream << (double)rVariant.date;
-            break; // FIXME
-        case VT_BSTR:
-            stream << rVariant.bstrVal;
-            break;
-        case VT_DISPATCH:
-            stream << rVariant.pdispVal;
-            break;
-        case VT_ERROR:
-            stream << HRESULT_to_string(rVariant.lVal);
-            break;
-        case VT_BOOL:
-            stream << (rVariant.boolVal ? "True" : "False");
-            break;
-        case VT_UNKNOWN:
-            stream << rVariant.punkVal;
-            break;
-        case VT_DECIMAL:
-            stream << to_uhex(rVariant.decVal.Hi32, 8) << to_ullhex(rVariant.decVal.Lo64, 16);
-            break;
-        case VT_I1:
-            stream << (int)rVariant.bVal;
-            break;
-        case VT_UI1:
-            stream << (unsigned int)rVariant.bVal;
-            break;
-        case VT_UI2:
-            stream << (unsigned short)rVariant.iVal;
-            break;
-        case VT_UI4:
-            stream << (unsigned int)rVariant.lVal;
-            break;
-        case VT_I8:
-            stream << rVariant.llVal;
-            break;
-        case VT_UI8:
-            stream << (unsigned long long)rVariant.llVal;
-            break;
-        case VT_INT:
-            stream << rVariant.lVal;
-            break;
-        case VT_UINT:
-            stream << (unsigned int)rVariant.lVal;
-            break;
-        case VT_HRESULT:
-            stream << HRESULT_to_string(rVariant.lVal);
-            break;
-        case VT_PTR:
-            stream << rVariant.byref;
-            break;
-        case VT_CARRAY:
-            stream << rVariant.byref;
-            break;
-        case VT_SAFEARRAY:
-            stream << rVariant.parray;
-            break;
-        case VT_LPSTR:
-            outputCharString(rVariant.pcVal, (UINT)std::strlen(rVariant.pcVal), stream);
-            break;
-        case VT_LPWSTR:
-            outputWcharString((const wchar_t*)rVariant.byref,
-                              (UINT)wcslen((const wchar_t*)rVariant.byref), stream);
-            break;
-        case VT_INT_PTR:
-            stream << rVariant.plVal;
-            break;
-        case VT_UINT_PTR:
-            stream << rVariant.plVal;
-            break;
-        default:
-            stream << "?(" << (rVariant.vt & VT_TYPEMASK) << ")";
-            break;
-    }
-    return stream;
-}
-
 inline bool isDirectlyPrintableType(VARTYPE nVt)
 {
     switch (nVt)
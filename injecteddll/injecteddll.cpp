@@ -10,24 +10,32 @@
 #pragma warning(push)
 #pragma warning(disable : 4365 4458 4571 4625 4668 4774 4820 4917 5026 5039)
 
+#include <algorithm>
 #include <cassert>
 #include <chrono>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
 #include <cwchar>
 #include <filesystem>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <map>
+#include <set>
 #include <sstream>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include <intrin.h>
 #include <process.h>
 
 #include <Windows.h>
 #include <gdiplus.h>
+#include <psapi.h>
 #include <shlwapi.h>
 
 // DbgHelp.h has even more sloppier code than <Windows.h>
@@ -41,21 +49,36 @@
 #include "exewrapper.hpp"
 #include "utils.hpp"
 
+#include "AsyncOutput.hpp"
+#include "BinaryTrace.hpp"
+#include "CallStatistics.hpp"
 #include "CProxiedClassFactory.hpp"
 #include "CProxiedCoclass.hpp"
 #include "CProxiedDispatch.hpp"
 #include "CProxiedMoniker.hpp"
+#include "ControlChannel.hpp"
+#include "peimports.hpp"
+#include "TraceFilter.hpp"
+#include "trampoline.hpp"
 
+#include "IIDNames.hxx"
 #include "InterfaceMapping.hxx"
 
+// Used for the -s option. Each thread's output is collected into lines, which are written with
+// the time and thread id in front in one go, so that the output of threads making calls at the same
+// time doesn't get mixed up. A flush writes out a partial line right away, in case the client
+// crashes before the line is complete. Should another thread then write, it starts a new line, and
+// the rest of the partial line later goes on a line of its own.
+
 class AddTimeStamp : public std::streambuf
 {
 public:
     AddTimeStamp( std::basic_ios< char >& out )
         : out_( out )
         , sink_()
-        , newline_( true )
+        , sinkLineThread_( 0 )
     {
+        InitializeSRWLock( &lock_ );
         sink_ = out_.rdbuf( this );
         assert( sink_ );
     }
@@ -67,21 +90,65 @@ protected:
     int_type overflow( int_type m = traits_type::eof() )
     {
         if( traits_type::eq_int_type( m, traits_type::eof() ) )
-            return sink_->pubsync() == -1 ? m: traits_type::not_eof(m);
-        if( newline_ )
-        {
-            std::ostream str( sink_ );
-            if( !(str << getTimeStamp() << ":") )
-                return traits_type::eof();
-        }
-        newline_ = traits_type::to_char_type( m ) == '\n';
-        return sink_->sputc( (char) m );
+            return sync() == -1 ? m : traits_type::not_eof(m);
+        const char c = traits_type::to_char_type( m );
+        line_ += c;
+        if( c == '\n' )
+            writeLine();
+        return m;
+    }
+
+    std::streamsize xsputn( const char* s, std::streamsize n )
+    {
+        line_.append( s, (size_t) n );
+        if( std::memchr( s, '\n', (size_t) n ) != nullptr )
+            writeLine();
+        return n;
+    }
+
+    int sync()
+    {
+        writeLine();
+        return 0;
     }
 
 private:
     AddTimeStamp( const AddTimeStamp& );
     AddTimeStamp& operator=( const AddTimeStamp& ); // not copyable
 
+    // Writes what this thread has collected, which ends with a newline unless flushed.
+    void writeLine()
+    {
+        if( line_.empty() )
+            return;
+
+        const DWORD thread = GetCurrentThreadId();
+        std::string text;
+
+        AcquireSRWLockExclusive( &lock_ );
+        if( sinkLineThread_ != 0 && sinkLineThread_ != thread )
+        {
+            text += '\n';
+            sinkLineThread_ = 0;
+        }
+        size_t start = 0;
+        while( start < line_.size() )
+        {
+            size_t end = line_.find( '\n', start );
+            end = ( end == std::string::npos ) ? line_.size() : end + 1;
+            if( sinkLineThread_ == 0 )
+                text += getTimeStamp() + ":" + std::to_string( thread ) + ":";
+            text.append( line_, start, end - start );
+            sinkLineThread_ = ( line_[end - 1] == '\n' ) ? 0 : thread;
+            start = end;
+        }
+        sink_->sputn( text.data(), (std::streamsize) text.size() );
+        sink_->pubsync();
+        ReleaseSRWLockExclusive( &lock_ );
+
+        line_.clear();
+    }
+
     std::string getTimeStamp()
     {
         std::chrono::system_clock::time_point now = std::chrono::system_clock::now();
@@ -99,9 +166,15 @@ private:
 
     std::basic_ios< char >& out_;
     std::streambuf* sink_;
-    bool newline_;
+    SRWLOCK lock_;
+    // The thread whose partial line the sink ends with, or zero
+    DWORD sinkLineThread_;
+    // What this thread has written since its last complete line
+    static thread_local std::string line_;
 };
 
+thread_local std::string AddTimeStamp::line_;
+
 struct UNICODE_STRING
 {
     USHORT Length;
@@ -123,8 +196,10 @@ static BOOL(WINAPI* pSetDllDirectoryW)(LPCWSTR) = NULL;
 static BOOL(WINAPI* pSetDllDirectoryA)(LPCSTR) = NULL;
 
 static bool hook(bool bMandatory, ThreadProcParam* pParam, HMODULE hModule,
-                 const wchar_t* sModuleName, const wchar_t* sDll, const char* sFunction,
-                 PVOID pOwnFunction);
+                 const wchar_t* sModuleName);
+static void hookNewModules(ThreadProcParam* pParam);
+static void hookLoadedModule(HMODULE hModule, const wchar_t* sModuleName);
+static void forgetUnloadedModules();
 
 static HMODULE WINAPI myLoadLibraryA(LPCSTR lpFileName);
 static HMODULE WINAPI myLoadLibraryExW(LPCWSTR lpFileName, HANDLE hFile, DWORD dwFlags);
@@ -144,307 +219,97 @@ static void printCreateInstanceResult(void* pV)
     std::cout << std::endl;
 }
 
-static void* generateTrampoline(void* pFunction, uintptr_t nId, short nArguments)
-{
-    // We must allocate a fresh page for each trampoline because of multi-thread concerns: Otherwise
-    // we would need to change the protection of the page back to RW for a moment when creating
-    // another trampoline on it, and if another thread was just executing an existing trampoline,
-    // that would be a problem.
-    unsigned char* pPage = (unsigned char*)VirtualAlloc(NULL, 100, MEM_COMMIT, PAGE_READWRITE);
-    if (pPage == NULL)
-    {
-        std::cout << "VirtualAlloc failed\n";
-        std::exit(1);
-    }
-    unsigned char* pCode = pPage;
-
 #ifndef _WIN64
-    // Normal __stdcall prologue
-
-    // push ebp
-    *pCode++ = 0x55;
-
-    // mov evp, esp
-    *pCode++ = 0x8B;
-    *pCode++ = 0xEC;
-
-    // sub esp, 64
-    *pCode++ = 0x83;
-    *pCode++ = 0xEC;
-    *pCode++ = 0x40;
-
-    // push ebx
-    *pCode++ = 0x53;
-
-    // push esi
-    *pCode++ = 0x56;
-
-    // push edi
-    *pCode++ = 0x57;
+static const TrampolineArch TRAMPOLINEARCH = TrampolineArch::X86;
+#else
+static const TrampolineArch TRAMPOLINEARCH = TrampolineArch::X64;
+#endif
 
-    // Push our parameters
-    for (short i = 0; i < nArguments; ++i)
+// The trampolines myGetProcAddress() hands out for DllGetClassObject, one for each function and
+// id, however often a client asks. They are packed into chunks, each a section mapped twice:
+// writable, where new trampolines are written, and executable, where they run. No view is both
+// writable and executable, and as no protection changes, writing a new trampoline can't disturb
+// another thread executing an earlier one in the same chunk.
+class TrampolineArena
+{
+public:
+    static void* get(void* pFunction, uintptr_t nId, short nArguments)
     {
-        if ((i % 3) == 0)
-        {
-            // mov eax, dword ptr arg[ebp]
-            *pCode++ = 0x8B;
-            *pCode++ = 0x45;
-            *pCode++ = (unsigned char)(8 + (nArguments - i - 1) * 4);
-
-            // push eax
-            *pCode++ = 0x50;
-        }
-        else if ((i % 3) == 1)
-        {
-            // mov ecx, dword ptr arg[ebp]
-            *pCode++ = 0x8B;
-            *pCode++ = 0x4D;
-            *pCode++ = (unsigned char)(8 + (nArguments - i - 1) * 4);
+        AcquireSRWLockExclusive(&maLock);
+        void*& rTrampoline = maTrampolines[{ pFunction, nId }];
+        if (rTrampoline == nullptr)
+            rTrampoline = generate(pFunction, nId, nArguments);
+        void* const pTrampoline = rTrampoline;
+        ReleaseSRWLockExclusive(&maLock);
 
-            // push ecx
-            *pCode++ = 0x51;
-        }
-        else if ((i % 3) == 2)
-        {
-            // mov edx, dword ptr arg[ebp]
-            *pCode++ = 0x8B;
-            *pCode++ = 0x55;
-            *pCode++ = (unsigned char)(8 + (nArguments - i - 1) * 4);
-
-            // push edx
-            *pCode++ = 0x52;
-        }
-        else
-            abort();
+        return pTrampoline;
     }
 
-    // call <relative 32-bit offset>
-    *pCode++ = 0xE8;
-    intptr_t nDiff = ((unsigned char*)pFunction - pCode - 4);
-    *pCode++ = ((unsigned char*)&nDiff)[0];
-    *pCode++ = ((unsigned char*)&nDiff)[1];
-    *pCode++ = ((unsigned char*)&nDiff)[2];
-    *pCode++ = ((unsigned char*)&nDiff)[3];
-
-    // Normal __stdcall epilogue
-
-    // pop edi
-    *pCode++ = 0x5F;
-
-    // pop esi
-    *pCode++ = 0x5E;
-
-    // pop ebx
-    *pCode++ = 0x5B;
-
-    // mov esp, ebp
-    *pCode++ = 0x8B;
-    *pCode++ = 0xE5;
-
-    // pop ebp
-    *pCode++ = 0x5D;
-
-    // ret <nArguments*4>
-    *pCode++ = 0xC2;
-    short n = nArguments * 4;
-    *pCode++ = ((unsigned char*)&n)[0];
-    *pCode++ = ((unsigned char*)&n)[1];
-
-    // the unique id is stored after the ret <n>
-    *pCode++ = ((unsigned char*)&nId)[0];
-    *pCode++ = ((unsigned char*)&nId)[1];
-    *pCode++ = ((unsigned char*)&nId)[2];
-    *pCode++ = ((unsigned char*)&nId)[3];
-#else
-    // Normal prologue
+private:
+    static const size_t NCHUNK = 65536;
 
-    if (nArguments > 3)
-    {
-        // mov qword ptr [rsp+32], r9
-        *pCode++ = 0x4C;
-        *pCode++ = 0x89;
-        *pCode++ = 0x4C;
-        *pCode++ = 0x24;
-        *pCode++ = 0x20;
-    }
+    static SRWLOCK maLock;
+    static std::map<std::pair<void*, uintptr_t>, void*> maTrampolines;
 
-    if (nArguments > 2)
-    {
-        // mov qword ptr [rsp+24], r8
-        *pCode++ = 0x4C;
-        *pCode++ = 0x89;
-        *pCode++ = 0x44;
-        *pCode++ = 0x24;
-        *pCode++ = 0x18;
-    }
+    static unsigned char* mpWritable;
+    static unsigned char* mpExecutable;
+    static size_t mnUsed;
 
-    if (nArguments > 1)
+    static void* generate(void* pFunction, uintptr_t nId, short nArguments)
     {
-        // mov qword ptr [rsp+16], rdx
-        *pCode++ = 0x48;
-        *pCode++ = 0x89;
-        *pCode++ = 0x54;
-        *pCode++ = 0x24;
-        *pCode++ = 0x10;
-    }
+        if (mpWritable == nullptr || mnUsed + NTRAMPOLINEMAX > NCHUNK)
+            newChunk();
 
-    if (nArguments > 0)
-    {
-        // mov qword ptr [rsp+8], rcx
-        *pCode++ = 0x48;
-        *pCode++ = 0x89;
-        *pCode++ = 0x4C;
-        *pCode++ = 0x24;
-        *pCode++ = 0x08;
-    }
+        unsigned char* const pCode = mpExecutable + mnUsed;
+        TrampolineEncoder aEncoder(mpWritable + mnUsed, (uintptr_t)pCode);
+        const size_t nSize = aEncoder.encode(TRAMPOLINEARCH, (uintptr_t)pFunction, nId, nArguments);
+        if (nSize == 0)
+        {
+            std::cout << "Can not generate a trampoline with " << nArguments << " arguments\n";
+            std::exit(1);
+        }
+        FlushInstructionCache(GetCurrentProcess(), pCode, nSize);
 
-    // push rbp
-    *pCode++ = 0x40;
-    *pCode++ = 0x55;
+        mnUsed += (nSize + 15) & ~(size_t)15;
 
-    // sub rsp, <x>
-    *pCode++ = 0x48;
-    *pCode++ = 0x83;
-    *pCode++ = 0xEC;
-    if (nArguments <= 4)
-        *pCode++ = 0x60;
-    else
-    {
-        assert(0x70 + (nArguments - 5) / 2 * 0x10 <= 0xFF);
-        *pCode++ = (unsigned char)(0x70 + (nArguments - 5) / 2 * 0x10);
+        return pCode;
     }
 
-    // lea rbp, qword ptr [rsp+<x>]
-    *pCode++ = 0x48;
-    *pCode++ = 0x8D;
-    *pCode++ = 0x6C;
-    *pCode++ = 0x24;
-    if (nArguments <= 4)
-        *pCode++ = 0x20;
-    else
+    static void newChunk()
     {
-        assert(0x30 + (nArguments - 5) / 2 * 0x10 <= 0xFF);
-        *pCode++ = (unsigned char)(0x30 + (nArguments - 5) / 2 * 0x10);
-    }
+        // The executable view of a full chunk stays, as its trampolines are in use.
+        if (mpWritable != nullptr)
+            UnmapViewOfFile(mpWritable);
 
-    // Parameters
-    for (short i = 0; i < nArguments; ++i)
-    {
-        if (i == 0)
-        {
-            // mov rcx, qword ptr arg0[rbp]
-            *pCode++ = 0x48;
-            *pCode++ = 0x8B;
-            *pCode++ = 0x4D;
-            *pCode++ = 0x50;
-        }
-        else if (i == 1)
-        {
-            // mov rdx, qword ptr arg1[rbp]
-            *pCode++ = 0x48;
-            *pCode++ = 0x8B;
-            *pCode++ = 0x55;
-            *pCode++ = 0x58;
-        }
-        else if (i == 2)
+        HANDLE hSection = CreateFileMappingW(INVALID_HANDLE_VALUE, NULL, PAGE_EXECUTE_READWRITE, 0,
+                                             (DWORD)NCHUNK, NULL);
+        if (hSection == NULL)
         {
-            // mov r8, qword ptr arg2[rbp]
-            *pCode++ = 0x4C;
-            *pCode++ = 0x8B;
-            *pCode++ = 0x45;
-            *pCode++ = 0x60;
+            std::cout << "CreateFileMapping failed: " << WindowsErrorString(GetLastError()) << "\n";
+            std::exit(1);
         }
-        else if (i == 3)
-        {
-            // mov r9, qword ptr arg2[rbp]
-            *pCode++ = 0x4C;
-            *pCode++ = 0x8B;
-            *pCode++ = 0x4D;
-            *pCode++ = 0x68;
-        }
-        else
-        {
-            if (i <= 5)
-            {
-                // mov rax, qword ptr (112+(i-4)*8)[rbp]
-                *pCode++ = 0x48;
-                *pCode++ = 0x8B;
-                *pCode++ = 0x45;
-                *pCode++ = (unsigned char)(112 + (i - 4) * 8);
-            }
-            else
-            {
-                // mov rax, qword ptr (112+(i-4)*8)[rbp]
-                *pCode++ = 0x48;
-                *pCode++ = 0x8B;
-                *pCode++ = 0x85;
-                int n = 112 + (i - 4) * 8;
-                *pCode++ = ((unsigned char*)&n)[0];
-                *pCode++ = ((unsigned char*)&n)[1];
-                *pCode++ = ((unsigned char*)&n)[2];
-                *pCode++ = ((unsigned char*)&n)[3];
-            }
 
-            // mov qword ptr [rsp+32+(i-4)*8], rax
-            *pCode++ = 0x48;
-            *pCode++ = 0x89;
-            *pCode++ = 0x44;
-            *pCode++ = 0x24;
-            *pCode++ = (unsigned char)(32 + (i - 4) * 8);
+        mpWritable = (unsigned char*)MapViewOfFile(hSection, FILE_MAP_WRITE, 0, 0, NCHUNK);
+        mpExecutable = (unsigned char*)MapViewOfFile(hSection, FILE_MAP_READ | FILE_MAP_EXECUTE, 0,
+                                                     0, NCHUNK);
+        if (mpWritable == nullptr || mpExecutable == nullptr)
+        {
+            std::cout << "MapViewOfFile failed: " << WindowsErrorString(GetLastError()) << "\n";
+            std::exit(1);
         }
-    }
 
-    // mov rax, qword ptr pFunction (or something like that)
-    *pCode++ = 0x48;
-    *pCode++ = 0xB8;
-    *pCode++ = ((unsigned char*)&pFunction)[0];
-    *pCode++ = ((unsigned char*)&pFunction)[1];
-    *pCode++ = ((unsigned char*)&pFunction)[2];
-    *pCode++ = ((unsigned char*)&pFunction)[3];
-    *pCode++ = ((unsigned char*)&pFunction)[4];
-    *pCode++ = ((unsigned char*)&pFunction)[5];
-    *pCode++ = ((unsigned char*)&pFunction)[6];
-    *pCode++ = ((unsigned char*)&pFunction)[7];
-
-    // call rax
-    *pCode++ = 0xFF;
-    *pCode++ = 0xD0;
-
-    // Normal epilogue
-
-    // lea rsp, qword ptr [rbp+64]
-    *pCode++ = 0x48;
-    *pCode++ = 0x8D;
-    *pCode++ = 0x65;
-    *pCode++ = 0x40;
-
-    // pop rbp
-    *pCode++ = 0x5D;
-
-    // ret
-    *pCode++ = 0xC3;
-
-    // the unique number is stored after the ret
-    *pCode++ = ((unsigned char*)&nId)[0];
-    *pCode++ = ((unsigned char*)&nId)[1];
-    *pCode++ = ((unsigned char*)&nId)[2];
-    *pCode++ = ((unsigned char*)&nId)[3];
-    *pCode++ = ((unsigned char*)&nId)[4];
-    *pCode++ = ((unsigned char*)&nId)[5];
-    *pCode++ = ((unsigned char*)&nId)[6];
-    *pCode++ = ((unsigned char*)&nId)[7];
-#endif
+        // The views keep the section alive.
+        CloseHandle(hSection);
 
-    DWORD nOldProtection;
-    if (!VirtualProtect(pPage, 100, PAGE_EXECUTE, &nOldProtection))
-    {
-        std::cout << "VirtualProtect failed\n";
-        std::exit(1);
+        mnUsed = 0;
     }
+};
 
-    return pPage;
-}
+SRWLOCK TrampolineArena::maLock = SRWLOCK_INIT;
+std::map<std::pair<void*, uintptr_t>, void*> TrampolineArena::maTrampolines;
+unsigned char* TrampolineArena::mpWritable = nullptr;
+unsigned char* TrampolineArena::mpExecutable = nullptr;
+size_t TrampolineArena::mnUsed = 0;
 
 static HRESULT WINAPI myCoCreateInstance(REFCLSID rclsid, LPUNKNOWN pUnkOuter, DWORD dwClsContext,
                                          REFIID riid, LPVOID* ppv)
@@ -2120,13 +1985,8 @@ static BOOL myShellExecuteExW(SHELLEXECUTEINFOW* pExecInfo)
 
 static HRESULT __stdcall myDllGetClassObject(REFCLSID rclsid, REFIID riid, LPVOID* ppv)
 {
-#ifndef _WIN64
-    // 9 = the length of the __stdcall epilogue
-    unsigned char* pHModule = (unsigned char*)_ReturnAddress() + 9;
-#else
-    // 6 = the length of the epilogue
-    unsigned char* pHModule = (unsigned char*)_ReturnAddress() + 6;
-#endif
+    // Called from a trampoline, which has the module handle after its epilogue
+    unsigned char* pHModule = (unsigned char*)_ReturnAddress() + trampolineIdOffset(TRAMPOLINEARCH);
     HMODULE hModule;
     std::memmove(&hModule, pHModule, sizeof(HMODULE));
 
@@ -2162,104 +2022,69 @@ static HRESULT __stdcall myDllGetClassObject(REFCLSID rclsid, REFIID riid, LPVOI
     return nResult;
 }
 
-static PROC WINAPI myGetProcAddress(HMODULE hModule, LPCSTR lpProcName)
+// A function we patch import table entries for, see aHookedFunctions
+struct HookedFunction
 {
-    HMODULE hOle32 = GetModuleHandleW(L"ole32.dll");
-    HMODULE hShell32 = GetModuleHandleW(L"shell32.dll");
-    HMODULE hKernel32 = GetModuleHandleW(L"kernel32.dll");
-    FunPtr pFun;
+    const char* msDll;
+    const char* msFunction;
+    PVOID mpOwnFunction;
+    // Whether hooking msvbvm60.dll fails if it does not import this
+    bool mbMandatory;
+    // Whether myGetProcAddress() also returns mpOwnFunction when asked for this
+    bool mbGetProcAddress;
+};
 
-    if (hModule == hKernel32 && std::strcmp(lpProcName, "OutputDebugStringA") == 0)
-    {
-        if (pGlobalParamPtr->mbVerbose)
-            std::cout << "GetProcAddress(kernel32.dll, OutputDebugStringA) from "
-                      << prettyCodeAddress(_ReturnAddress()) << std::endl;
-        pFun.pVoid = myOutputDebugStringA;
-        return pFun.pProc;
-    }
+// The functions myGetProcAddress() replaces, placed by hash so that no two share a slot. The hash
+// seed that achieves that is found when we get injected, see buildGetProcAddressSlots().
+static const unsigned NGETPROCADDRESSSLOTS = 32;
+static const HookedFunction* apGetProcAddressSlots[NGETPROCADDRESSSLOTS];
+static uint32_t nGetProcAddressSeed = 0;
 
-    if (hModule == hKernel32 && std::strcmp(lpProcName, "OutputDebugStringW") == 0)
-    {
-        if (pGlobalParamPtr->mbVerbose)
-            std::cout << "GetProcAddress(kernel32.dll, OutputDebugStringW) from "
-                      << prettyCodeAddress(_ReturnAddress()) << std::endl;
-        pFun.pVoid = myOutputDebugStringW;
-        return pFun.pProc;
-    }
+static unsigned getProcAddressSlot(const char* sName, uint32_t nSeed)
+{
+    // FNV-1a, taking the top five bits as there are 32 slots
+    uint32_t nHash = 2166136261u ^ nSeed;
+    for (const char* p = sName; *p != '\0'; ++p)
+        nHash = (nHash ^ (unsigned char)*p) * 16777619u;
 
-    if (hModule == hShell32 && std::strcmp(lpProcName, "ShellExecuteA") == 0)
-    {
-        if (pGlobalParamPtr->mbVerbose)
-            std::cout << "GetProcAddress(shell32.dll, ShellExecuteA) from "
-                      << prettyCodeAddress(_ReturnAddress()) << std::endl;
-        pFun.pVoid = myShellExecuteA;
-        return pFun.pProc;
-    }
+    return nHash >> 27;
+}
 
-    if (hModule == hShell32 && std::strcmp(lpProcName, "ShellExecuteW") == 0)
-    {
-        if (pGlobalParamPtr->mbVerbose)
-            std::cout << "GetProcAddress(shell32.dll, ShellExecuteW) from "
-                      << prettyCodeAddress(_ReturnAddress()) << std::endl;
-        pFun.pVoid = myShellExecuteW;
-        return pFun.pProc;
-    }
+static const HookedFunction* getProcAddressReplacement(HMODULE hModule, LPCSTR lpProcName)
+{
+    const HookedFunction* pFunction
+        = apGetProcAddressSlots[getProcAddressSlot(lpProcName, nGetProcAddressSeed)];
 
-    if (hModule == hShell32 && std::strcmp(lpProcName, "ShellExecuteExA") == 0)
-    {
-        if (pGlobalParamPtr->mbVerbose)
-            std::cout << "GetProcAddress(shell32.dll, ShellExecuteExA) from "
-                      << prettyCodeAddress(_ReturnAddress()) << std::endl;
-        pFun.pVoid = myShellExecuteExA;
-        return pFun.pProc;
-    }
+    if (pFunction == nullptr || std::strcmp(pFunction->msFunction, lpProcName) != 0
+        || hModule != GetModuleHandleA(pFunction->msDll))
+        return nullptr;
 
-    if (hModule == hShell32 && std::strcmp(lpProcName, "ShellExecuteExW") == 0)
-    {
-        if (pGlobalParamPtr->mbVerbose)
-            std::cout << "GetProcAddress(shell32.dll, ShellExecuteExW) from "
-                      << prettyCodeAddress(_ReturnAddress()) << std::endl;
-        pFun.pVoid = myShellExecuteExW;
-        return pFun.pProc;
-    }
+    return pFunction;
+}
 
-    if (hModule == hOle32 && std::strcmp(lpProcName, "OleCreateLink") == 0)
+static PROC WINAPI myGetProcAddress(HMODULE hModule, LPCSTR lpProcName)
+{
+    if ((uintptr_t)lpProcName < 10000)
     {
+        // It is most likely an ordinal, sigh
         if (pGlobalParamPtr->mbVerbose)
-            std::cout << "GetProcAddress(ole32.dll, OleCreateLink) from "
-                      << prettyCodeAddress(_ReturnAddress()) << std::endl;
-        pFun.pVoid = myOleCreateLink;
-        return pFun.pProc;
-    }
+            std::cout << "GetProcAddress(" << moduleName(hModule) << ", " << (uintptr_t)lpProcName
+                      << ") from " << prettyCodeAddress(_ReturnAddress()) << std::endl;
 
-    if (hModule == hOle32 && std::strcmp(lpProcName, "CoCreateInstanceEx") == 0)
-    {
-        if (pGlobalParamPtr->mbVerbose)
-            std::cout << "GetProcAddress(ole32.dll, CoCreateInstanceEx) from "
-                      << prettyCodeAddress(_ReturnAddress()) << std::endl;
-        pFun.pVoid = myCoCreateInstanceEx;
-        return pFun.pProc;
+        return GetProcAddress(hModule, lpProcName);
     }
 
-    if (hModule == hOle32 && std::strcmp(lpProcName, "CoCreateInstance") == 0)
+    const HookedFunction* pReplacement = getProcAddressReplacement(hModule, lpProcName);
+    if (pReplacement != nullptr)
     {
         if (pGlobalParamPtr->mbVerbose)
-            std::cout << "GetProcAddress(ole32.dll, CoCreateInstance) from "
+            std::cout << "GetProcAddress(" << pReplacement->msDll << ", " << lpProcName << ") from "
                       << prettyCodeAddress(_ReturnAddress()) << std::endl;
-        pFun.pVoid = myCoCreateInstance;
+        FunPtr pFun;
+        pFun.pVoid = pReplacement->mpOwnFunction;
         return pFun.pProc;
     }
 
-    if ((uintptr_t)lpProcName < 10000)
-    {
-        // It is most likely an ordinal, sigh
-        if (pGlobalParamPtr->mbVerbose)
-            std::cout << "GetProcAddress(" << moduleName(hModule) << ", " << (uintptr_t)lpProcName
-                      << ") from " << prettyCodeAddress(_ReturnAddress()) << std::endl;
-
-        return GetProcAddress(hModule, lpProcName);
-    }
-
     if (std::strcmp(lpProcName, "DllGetClassObject") == 0)
     {
         PROC pProc = GetProcAddress(hModule, lpProcName);
@@ -2273,14 +2098,14 @@ static PROC WINAPI myGetProcAddress(HMODULE hModule, LPCSTR lpProcName)
             return NULL;
         }
 
-        // Interesting case. We must generate a unique trampoline for it.
+        // Interesting case. We must return a trampoline unique to the module.
         FunPtr aTrampoline;
-        aTrampoline.pVoid = generateTrampoline(myDllGetClassObject, (uintptr_t)hModule, 3);
+        aTrampoline.pVoid = TrampolineArena::get(myDllGetClassObject, (uintptr_t)hModule, 3);
 
         if (pGlobalParamPtr->mbVerbose)
             std::cout << "GetProcAddress(" << moduleName(hModule) << ", "
                       << "DllGetClassObject) from " << prettyCodeAddress(_ReturnAddress())
-                      << ": Generated trampoline" << std::endl;
+                      << ": Trampoline " << aTrampoline.pVoid << std::endl;
 
         return aTrampoline.pProc;
     }
@@ -2350,44 +2175,7 @@ static HMODULE WINAPI myLoadLibraryW(LPCWSTR lpFileName)
         if (pGlobalParamPtr->mbVerbose)
             std::cout << std::endl;
 
-        hook(false, pGlobalParamPtr, hModule, lpFileName, L"kernel32.dll", "GetProcAddress",
-             myGetProcAddress);
-        if (pAddDllDirectory)
-            hook(false, pGlobalParamPtr, hModule, lpFileName, L"kernel32.dll", "AddDllDirectory",
-                 myAddDllDirectory);
-        if (pSetDllDirectoryW)
-            hook(false, pGlobalParamPtr, hModule, lpFileName, L"kernel32.dll", "SetDllDirectoryW",
-                 mySetDllDirectoryW);
-        if (pSetDllDirectoryA)
-            hook(false, pGlobalParamPtr, hModule, lpFileName, L"kernel32.dll", "SetDllDirectoryA",
-                 mySetDllDirectoryA);
-        hook(false, pGlobalParamPtr, hModule, lpFileName, L"kernel32.dll", "LoadLibraryW",
-             myLoadLibraryW);
-        hook(false, pGlobalParamPtr, hModule, lpFileName, L"kernel32.dll", "LoadLibraryA",
-             myLoadLibraryA);
-        hook(false, pGlobalParamPtr, hModule, lpFileName, L"kernel32.dll", "LoadLibraryExW",
-             myLoadLibraryExW);
-        hook(false, pGlobalParamPtr, hModule, lpFileName, L"kernel32.dll", "LoadLibraryExA",
-             myLoadLibraryExA);
-        hook(false, pGlobalParamPtr, hModule, lpFileName, L"ntdll.dll", "LdrLoadDll", myLdrLoadDll);
-        hook(false, pGlobalParamPtr, hModule, lpFileName, L"ole32.dll", "CoCreateInstance",
-             myCoCreateInstance);
-        hook(false, pGlobalParamPtr, hModule, lpFileName, L"ole32.dll", "CoCreateInstanceEx",
-             myCoCreateInstanceEx);
-        hook(false, pGlobalParamPtr, hModule, lpFileName, L"ole32.dll", "OleCreateLink",
-             myOleCreateLink);
-        hook(false, pGlobalParamPtr, hModule, lpFileName, L"kernel32.dll", "OutputDebugStringA",
-             myOutputDebugStringA);
-        hook(false, pGlobalParamPtr, hModule, lpFileName, L"kernel32.dll", "OutputDebugStringW",
-             myOutputDebugStringW);
-        hook(false, pGlobalParamPtr, hModule, lpFileName, L"shell32.dll", "ShellExecuteA",
-             myShellExecuteA);
-        hook(false, pGlobalParamPtr, hModule, lpFileName, L"shell32.dll", "ShellExecuteW",
-             myShellExecuteW);
-        hook(false, pGlobalParamPtr, hModule, lpFileName, L"shell32.dll", "ShellExecuteExA",
-             myShellExecuteExA);
-        hook(false, pGlobalParamPtr, hModule, lpFileName, L"shell32.dll", "ShellExecuteExW",
-             myShellExecuteExW);
+        hookLoadedModule(hModule, lpFileName);
     }
 
     return hModule;
@@ -2416,47 +2204,7 @@ static HMODULE WINAPI myLoadLibraryA(LPCSTR lpFileName)
         if (pGlobalParamPtr->mbVerbose)
             std::cout << std::endl;
 
-        std::wstring sWFileName = convertACPToUTF16(lpFileName);
-
-        hook(false, pGlobalParamPtr, hModule, sWFileName.data(), L"kernel32.dll", "GetProcAddress",
-             myGetProcAddress);
-        if (pAddDllDirectory)
-            hook(false, pGlobalParamPtr, hModule, sWFileName.data(), L"kernel32.dll",
-                 "AddDllDirectory", myAddDllDirectory);
-        if (pSetDllDirectoryW)
-            hook(false, pGlobalParamPtr, hModule, sWFileName.data(), L"kernel32.dll",
-                 "SetDllDirectoryW", mySetDllDirectoryW);
-        if (pSetDllDirectoryA)
-            hook(false, pGlobalParamPtr, hModule, sWFileName.data(), L"kernel32.dll",
-                 "SetDllDirectoryA", mySetDllDirectoryA);
-        hook(false, pGlobalParamPtr, hModule, sWFileName.data(), L"kernel32.dll", "LoadLibraryW",
-             myLoadLibraryW);
-        hook(false, pGlobalParamPtr, hModule, sWFileName.data(), L"kernel32.dll", "LoadLibraryA",
-             myLoadLibraryA);
-        hook(false, pGlobalParamPtr, hModule, sWFileName.data(), L"kernel32.dll", "LoadLibraryExW",
-             myLoadLibraryExW);
-        hook(false, pGlobalParamPtr, hModule, sWFileName.data(), L"kernel32.dll", "LoadLibraryExA",
-             myLoadLibraryExA);
-        hook(false, pGlobalParamPtr, hModule, sWFileName.data(), L"ntdll.dll", "LdrLoadDll",
-             myLdrLoadDll);
-        hook(false, pGlobalParamPtr, hModule, sWFileName.data(), L"ole32.dll", "CoCreateInstance",
-             myCoCreateInstance);
-        hook(false, pGlobalParamPtr, hModule, sWFileName.data(), L"ole32.dll", "CoCreateInstanceEx",
-             myCoCreateInstanceEx);
-        hook(false, pGlobalParamPtr, hModule, sWFileName.data(), L"ole32.dll", "OleCreateLink",
-             myOleCreateLink);
-        hook(false, pGlobalParamPtr, hModule, sWFileName.data(), L"kernel32.dll",
-             "OutputDebugStringA", myOutputDebugStringA);
-        hook(false, pGlobalParamPtr, hModule, sWFileName.data(), L"kernel32.dll",
-             "OutputDebugStringW", myOutputDebugStringW);
-        hook(false, pGlobalParamPtr, hModule, sWFileName.data(), L"shell32.dll", "ShellExecuteA",
-             myShellExecuteA);
-        hook(false, pGlobalParamPtr, hModule, sWFileName.data(), L"shell32.dll", "ShellExecuteW",
-             myShellExecuteW);
-        hook(false, pGlobalParamPtr, hModule, sWFileName.data(), L"shell32.dll", "ShellExecuteExA",
-             myShellExecuteExA);
-        hook(false, pGlobalParamPtr, hModule, sWFileName.data(), L"shell32.dll", "ShellExecuteExW",
-             myShellExecuteExW);
+        hookLoadedModule(hModule, convertACPToUTF16(lpFileName).data());
     }
 
     return hModule;
@@ -2485,43 +2233,7 @@ static HMODULE WINAPI innerMyLoadLibraryExW(const std::string& caller, LPCWSTR l
               & (LOAD_LIBRARY_AS_DATAFILE | LOAD_LIBRARY_AS_DATAFILE_EXCLUSIVE
                  | LOAD_LIBRARY_AS_IMAGE_RESOURCE)))
         {
-            hook(false, pGlobalParamPtr, hModule, lpFileName, L"kernel32.dll", "GetProcAddress",
-                 myGetProcAddress);
-            if (pAddDllDirectory)
-                hook(false, pGlobalParamPtr, hModule, lpFileName, L"kernel32.dll",
-                     "AddDllDirectory", myAddDllDirectory);
-            if (pSetDllDirectoryW)
-                hook(false, pGlobalParamPtr, hModule, lpFileName, L"kernel32.dll",
-                     "SetDllDirectoryW", mySetDllDirectoryW);
-            if (pSetDllDirectoryA)
-                hook(false, pGlobalParamPtr, hModule, lpFileName, L"kernel32.dll",
-                     "SetDllDirectoryA", mySetDllDirectoryA);
-            hook(false, pGlobalParamPtr, hModule, lpFileName, L"kernel32.dll", "LoadLibraryW",
-                 myLoadLibraryW);
-            hook(false, pGlobalParamPtr, hModule, lpFileName, L"kernel32.dll", "LoadLibraryA",
-                 myLoadLibraryA);
-            hook(false, pGlobalParamPtr, hModule, lpFileName, L"kernel32.dll", "LoadLibraryExW",
-                 myLoadLibraryExW);
-            hook(false, pGlobalParamPtr, hModule, lpFileName, L"ntdll.dll", "LdrLoadDll",
-                 myLdrLoadDll);
-            hook(false, pGlobalParamPtr, hModule, lpFileName, L"ole32.dll", "CoCreateInstance",
-                 myCoCreateInstance);
-            hook(false, pGlobalParamPtr, hModule, lpFileName, L"ole32.dll", "CoCreateInstanceEx",
-                 myCoCreateInstanceEx);
-            hook(false, pGlobalParamPtr, hModule, lpFileName, L"ole32.dll", "OleCreateLink",
-                 myOleCreateLink);
-            hook(false, pGlobalParamPtr, hModule, lpFileName, L"kernel32.dll", "OutputDebugStringA",
-                 myOutputDebugStringA);
-            hook(false, pGlobalParamPtr, hModule, lpFileName, L"kernel32.dll", "OutputDebugStringW",
-                 myOutputDebugStringW);
-            hook(false, pGlobalParamPtr, hModule, lpFileName, L"shell32.dll", "ShellExecuteA",
-                 myShellExecuteA);
-            hook(false, pGlobalParamPtr, hModule, lpFileName, L"shell32.dll", "ShellExecuteW",
-                 myShellExecuteW);
-            hook(false, pGlobalParamPtr, hModule, lpFileName, L"shell32.dll", "ShellExecuteExA",
-                 myShellExecuteExA);
-            hook(false, pGlobalParamPtr, hModule, lpFileName, L"shell32.dll", "ShellExecuteExW",
-                 myShellExecuteExW);
+            hookLoadedModule(hModule, lpFileName);
         }
     }
 
@@ -2567,53 +2279,33 @@ static HMODULE WINAPI myLoadLibraryExA(LPCSTR lpFileName, HANDLE hFile, DWORD dw
               & (LOAD_LIBRARY_AS_DATAFILE | LOAD_LIBRARY_AS_DATAFILE_EXCLUSIVE
                  | LOAD_LIBRARY_AS_IMAGE_RESOURCE)))
         {
-            std::wstring sWFileName = convertACPToUTF16(lpFileName);
-
-            hook(false, pGlobalParamPtr, hModule, sWFileName.data(), L"kernel32.dll",
-                 "GetProcAddress", myGetProcAddress);
-            if (pAddDllDirectory)
-                hook(false, pGlobalParamPtr, hModule, sWFileName.data(), L"kernel32.dll",
-                     "AddDllDirectory", myAddDllDirectory);
-            if (pSetDllDirectoryW)
-                hook(false, pGlobalParamPtr, hModule, sWFileName.data(), L"kernel32.dll",
-                     "SetDllDirectoryW", mySetDllDirectoryW);
-            if (pSetDllDirectoryA)
-                hook(false, pGlobalParamPtr, hModule, sWFileName.data(), L"kernel32.dll",
-                     "SetDllDirectoryA", mySetDllDirectoryA);
-            hook(false, pGlobalParamPtr, hModule, sWFileName.data(), L"kernel32.dll",
-                 "LoadLibraryW", myLoadLibraryW);
-            hook(false, pGlobalParamPtr, hModule, sWFileName.data(), L"kernel32.dll",
-                 "LoadLibraryA", myLoadLibraryA);
-            hook(false, pGlobalParamPtr, hModule, sWFileName.data(), L"kernel32.dll",
-                 "LoadLibraryExW", myLoadLibraryExW);
-            hook(false, pGlobalParamPtr, hModule, sWFileName.data(), L"kernel32.dll",
-                 "LoadLibraryExA", myLoadLibraryExA);
-            hook(false, pGlobalParamPtr, hModule, sWFileName.data(), L"ntdll.dll", "LdrLoadDll",
-                 myLdrLoadDll);
-            hook(false, pGlobalParamPtr, hModule, sWFileName.data(), L"ole32.dll",
-                 "CoCreateInstance", myCoCreateInstance);
-            hook(false, pGlobalParamPtr, hModule, sWFileName.data(), L"ole32.dll",
-                 "CoCreateInstanceEx", myCoCreateInstanceEx);
-            hook(false, pGlobalParamPtr, hModule, sWFileName.data(), L"ole32.dll", "OleCreateLink",
-                 myOleCreateLink);
-            hook(false, pGlobalParamPtr, hModule, sWFileName.data(), L"kernel32.dll",
-                 "OutputDebugStringA", myOutputDebugStringA);
-            hook(false, pGlobalParamPtr, hModule, sWFileName.data(), L"kernel32.dll",
-                 "OutputDebugStringW", myOutputDebugStringW);
-            hook(false, pGlobalParamPtr, hModule, sWFileName.data(), L"shell32.dll",
-                 "ShellExecuteA", myShellExecuteA);
-            hook(false, pGlobalParamPtr, hModule, sWFileName.data(), L"shell32.dll",
-                 "ShellExecuteW", myShellExecuteW);
-            hook(false, pGlobalParamPtr, hModule, sWFileName.data(), L"shell32.dll",
-                 "ShellExecuteExA", myShellExecuteExA);
-            hook(false, pGlobalParamPtr, hModule, sWFileName.data(), L"shell32.dll",
-                 "ShellExecuteExW", myShellExecuteExW);
+            hookLoadedModule(hModule, convertACPToUTF16(lpFileName).data());
         }
     }
 
     return hModule;
 }
 
+// Once a module is unloaded, another one, or the same one afresh, can be loaded at its address,
+// and then needs to be hooked.
+static BOOL WINAPI myFreeLibrary(HMODULE hLibModule)
+{
+    BOOL bResult = FreeLibrary(hLibModule);
+
+    if (pGlobalParamPtr->mbVerbose)
+        std::cout << "FreeLibrary(" << hLibModule << ") from "
+                  << prettyCodeAddress(_ReturnAddress()) << ": " << bResult << std::endl;
+
+    HMODULE hStillLoaded;
+    if (bResult
+        && !GetModuleHandleExW(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS
+                                   | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                               (LPCWSTR)hLibModule, &hStillLoaded))
+        forgetUnloadedModules();
+
+    return bResult;
+}
+
 static NTSTATUS NTAPI myLdrLoadDll(PWCHAR PathToFile, ULONG Flags, UNICODE_STRING* ModuleFileName,
                                    PHANDLE ModuleHandle)
 {
@@ -2636,107 +2328,248 @@ static NTSTATUS NTAPI myLdrLoadDll(PWCHAR PathToFile, ULONG Flags, UNICODE_STRIN
     return 0;
 }
 
-static bool hook(bool bMandatory, ThreadProcParam* pParam, HMODULE hModule,
-                 const wchar_t* sModuleName, const wchar_t* sDll, const char* sFunction,
-                 PVOID pOwnFunction)
+// The functions we hook, in the import tables of the modules we patch, and in what
+// myGetProcAddress() returns for those with mbGetProcAddress set. Functions that this version of
+// Windows lacks are skipped.
+static const HookedFunction aHookedFunctions[] = {
+    { "kernel32.dll", "GetProcAddress", myGetProcAddress, true, false },
+    { "kernel32.dll", "AddDllDirectory", myAddDllDirectory, false, false },
+    { "kernel32.dll", "SetDllDirectoryW", mySetDllDirectoryW, false, false },
+    { "kernel32.dll", "SetDllDirectoryA", mySetDllDirectoryA, false, false },
+    { "kernel32.dll", "LoadLibraryW", myLoadLibraryW, false, false },
+    { "kernel32.dll", "LoadLibraryA", myLoadLibraryA, false, false },
+    { "kernel32.dll", "LoadLibraryExW", myLoadLibraryExW, false, false },
+    { "kernel32.dll", "LoadLibraryExA", myLoadLibraryExA, false, false },
+    { "kernel32.dll", "FreeLibrary", myFreeLibrary, false, false },
+    { "kernel32.dll", "OutputDebugStringA", myOutputDebugStringA, false, true },
+    { "kernel32.dll", "OutputDebugStringW", myOutputDebugStringW, false, true },
+    { "ntdll.dll", "LdrLoadDll", myLdrLoadDll, false, false },
+    { "ole32.dll", "CoCreateInstance", myCoCreateInstance, true, true },
+    { "ole32.dll", "CoCreateInstanceEx", myCoCreateInstanceEx, false, true },
+    { "ole32.dll", "OleCreateLink", myOleCreateLink, false, true },
+    { "ole32.dll", "CoGetClassObject", myCoGetClassObject, false, false },
+    { "shell32.dll", "ShellExecuteA", myShellExecuteA, false, true },
+    { "shell32.dll", "ShellExecuteW", myShellExecuteW, false, true },
+    { "shell32.dll", "ShellExecuteExA", myShellExecuteExA, false, true },
+    { "shell32.dll", "ShellExecuteExW", myShellExecuteExW, false, true },
+};
+
+static const size_t NHOOKEDFUNCTIONS = sizeof(aHookedFunctions) / sizeof(aHookedFunctions[0]);
+
+// The real functions, looked up the first time we patch a module that imports from their DLL,
+// after which the import table entries we look for are known. Also protects nHookedFunctions.
+static PROC apOriginalFunctions[NHOOKEDFUNCTIONS];
+static bool abOriginalFunctionLookedUp[NHOOKEDFUNCTIONS];
+static SRWLOCK aHookLock = SRWLOCK_INIT;
+
+// The modules hookNewModules() and hookLoadedModule() have seen, also protected by aHookLock
+static std::set<HMODULE> aSeenModules;
+
+static bool buildGetProcAddressSlots()
 {
-    ULONG nSize;
-    PIMAGE_IMPORT_DESCRIPTOR pImportDescriptor
-        = (PIMAGE_IMPORT_DESCRIPTOR)ImageDirectoryEntryToDataEx(
-            hModule, TRUE, IMAGE_DIRECTORY_ENTRY_IMPORT, &nSize, NULL);
-    if (pImportDescriptor == NULL)
+    for (uint32_t nSeed = 0; nSeed < 1000; ++nSeed)
     {
-        if (bMandatory)
-            std::cout << "Could not find import directory in " << convertUTF16ToUTF8(sModuleName)
-                      << std::endl;
-        return false;
-    }
+        for (unsigned i = 0; i < NGETPROCADDRESSSLOTS; ++i)
+            apGetProcAddressSlots[i] = nullptr;
 
-    bool bFound = false;
-    while (pImportDescriptor->Characteristics && pImportDescriptor->Name)
-    {
-        PSTR sName = (PSTR)((PBYTE)hModule + pImportDescriptor->Name);
-        if (_stricmp(sName, convertUTF16ToUTF8(sDll).data()) == 0)
+        bool bCollision = false;
+        for (const HookedFunction& rFunction : aHookedFunctions)
         {
-            bFound = true;
-            break;
+            if (!rFunction.mbGetProcAddress)
+                continue;
+
+            const HookedFunction*& rpSlot
+                = apGetProcAddressSlots[getProcAddressSlot(rFunction.msFunction, nSeed)];
+            if (rpSlot != nullptr)
+            {
+                bCollision = true;
+                break;
+            }
+            rpSlot = &rFunction;
+        }
+
+        if (!bCollision)
+        {
+            nGetProcAddressSeed = nSeed;
+            return true;
         }
-        pImportDescriptor++;
     }
 
-    if (!bFound)
-    {
-        if (bMandatory)
-            std::cout << "Import descriptor for " << convertUTF16ToUTF8(sDll) << " not found in "
-                      << convertUTF16ToUTF8(sModuleName) << std::endl;
+    return false;
+}
 
-        return false;
+// Collects the import table entries of a module that hold functions we hook
+class HookedImportCollector
+{
+public:
+    typedef std::pair<PROC*, size_t> Patch;
+
+    HookedImportCollector(HMODULE hModule, std::vector<Patch>& rPatches)
+        : mhModule(hModule)
+        , mrPatches(rPatches)
+        , mnCandidates(0)
+    {
     }
 
-    PROC pOriginalFunc = (PROC)GetProcAddress(GetModuleHandleW(sDll), sFunction);
-    if (pOriginalFunc == NULL)
+    HookedImportCollector(const HookedImportCollector&) = delete;
+    HookedImportCollector& operator=(const HookedImportCollector&) = delete;
+
+    static bool isBefore(const Patch& rA, const Patch& rB)
     {
-        std::cout << "Could not find original " << sFunction << " in " << convertUTF16ToUTF8(sDll)
-                  << std::endl;
-        return false;
+        return (uintptr_t)rA.first < (uintptr_t)rB.first;
     }
 
-    PIMAGE_THUNK_DATA pThunk = (PIMAGE_THUNK_DATA)((PBYTE)hModule + pImportDescriptor->FirstThunk);
-    while (pThunk->u1.Function)
+    bool dll(const char* sDll)
     {
-        PROC* pFunc = (PROC*)&pThunk->u1.Function;
-        if (*pFunc == pOriginalFunc)
+        // Which of the functions we hook could be imported from this DLL
+        mnCandidates = 0;
+        for (size_t i = 0; i < NHOOKEDFUNCTIONS; ++i)
         {
-            MEMORY_BASIC_INFORMATION aMBI;
-            if (!VirtualQuery(pFunc, &aMBI, sizeof(MEMORY_BASIC_INFORMATION)))
+            if (_stricmp(sDll, aHookedFunctions[i].msDll) != 0)
+                continue;
+
+            if (!abOriginalFunctionLookedUp[i])
             {
-                std::cout << "VirtualQuery failed: " << WindowsErrorString(GetLastError())
-                          << std::endl;
-                return false;
+                apOriginalFunctions[i] = GetProcAddress(GetModuleHandleA(aHookedFunctions[i].msDll),
+                                                        aHookedFunctions[i].msFunction);
+                abOriginalFunctionLookedUp[i] = true;
             }
 
-            if (!VirtualProtect(aMBI.BaseAddress, aMBI.RegionSize, PAGE_READWRITE, &aMBI.Protect))
+            if (apOriginalFunctions[i] != NULL)
+                maCandidates[mnCandidates++] = i;
+        }
+
+        return mnCandidates > 0;
+    }
+
+    void slot(size_t nOffset, uint64_t nValue)
+    {
+        for (size_t j = 0; j < mnCandidates; ++j)
+        {
+            const size_t i = maCandidates[j];
+            if (nValue == (uintptr_t)apOriginalFunctions[i])
             {
-                std::cout << "VirtualProtect failed: " << WindowsErrorString(GetLastError())
-                          << std::endl;
-                return false;
+                mrPatches.push_back(Patch((PROC*)((PBYTE)mhModule + nOffset), i));
+                return;
             }
+        }
+    }
+
+private:
+    const HMODULE mhModule;
+    std::vector<Patch>& mrPatches;
+    size_t maCandidates[NHOOKEDFUNCTIONS];
+    size_t mnCandidates;
+};
+
+// Patches the import table of hModule for all of aHookedFunctions. The entries to patch are
+// collected first in one walk over the import descriptors, then patched a page at a time so that
+// each page's protection is changed just once. Returns false if bMandatory and a mandatory
+// function was not hooked.
+static bool hook(bool bMandatory, ThreadProcParam* pParam, HMODULE hModule,
+                 const wchar_t* sModuleName)
+{
+    PIMAGE_NT_HEADERS pNtHeaders = ImageNtHeader(hModule);
+    if (pNtHeaders == NULL)
+    {
+        if (bMandatory)
+            std::cout << "Could not find PE headers in " << convertUTF16ToUTF8(sModuleName)
+                      << std::endl;
+        return false;
+    }
+
+    PEImports aImports((const unsigned char*)hModule, pNtHeaders->OptionalHeader.SizeOfImage, true);
+
+    SYSTEM_INFO aSystemInfo;
+    GetSystemInfo(&aSystemInfo);
+    const uintptr_t nPageMask = ~(uintptr_t)(aSystemInfo.dwPageSize - 1);
+
+    std::vector<HookedImportCollector::Patch> aPatches;
+    bool abHooked[NHOOKEDFUNCTIONS] = {};
+    size_t nPatched = 0;
+    size_t nPages = 0;
+
+    AcquireSRWLockExclusive(&aHookLock);
+
+    HookedImportCollector aCollector(hModule, aPatches);
+    aImports.walk(aCollector);
+
+    std::sort(aPatches.begin(), aPatches.end(), HookedImportCollector::isBefore);
+
+    for (size_t nFirst = 0; nFirst < aPatches.size();)
+    {
+        const uintptr_t nPage = (uintptr_t)aPatches[nFirst].first & nPageMask;
+        size_t nEnd = nFirst + 1;
+        while (nEnd < aPatches.size() && ((uintptr_t)aPatches[nEnd].first & nPageMask) == nPage)
+            nEnd++;
+
+        DWORD nProtect;
+        if (!VirtualProtect((LPVOID)nPage, aSystemInfo.dwPageSize, PAGE_READWRITE, &nProtect))
+        {
+            std::cout << "VirtualProtect failed: " << WindowsErrorString(GetLastError())
+                      << std::endl;
+            nFirst = nEnd;
+            continue;
+        }
 
+        for (size_t n = nFirst; n < nEnd; n++)
+        {
             FunPtr pFun;
-            pFun.pVoid = pOwnFunction;
-            *pFunc = pFun.pProc;
+            pFun.pVoid = aHookedFunctions[aPatches[n].second].mpOwnFunction;
+            *aPatches[n].first = pFun.pProc;
+            abHooked[aPatches[n].second] = true;
+        }
+        nPatched += nEnd - nFirst;
+        nPages++;
+
+        DWORD nOldProtect;
+        if (!VirtualProtect((LPVOID)nPage, aSystemInfo.dwPageSize, nProtect, &nOldProtect))
+            std::cout << "VirtualProtect failed: " << WindowsErrorString(GetLastError())
+                      << std::endl;
+
+        nFirst = nEnd;
+    }
 
-            DWORD nOldProtect;
-            if (!VirtualProtect(aMBI.BaseAddress, aMBI.RegionSize, aMBI.Protect, &nOldProtect))
+    nHookedFunctions += (int)nPatched;
+
+    ReleaseSRWLockExclusive(&aHookLock);
+
+    if (pParam->mbVerbose && nPatched > 0)
+    {
+        std::cout << "Hooked";
+        const char* sSeparator = " ";
+        for (size_t i = 0; i < NHOOKEDFUNCTIONS; ++i)
+        {
+            if (abHooked[i])
             {
-                std::cout << "VirtualProtect failed: " << WindowsErrorString(GetLastError())
-                          << std::endl;
-                return false;
+                std::cout << sSeparator << aHookedFunctions[i].msFunction << " ("
+                          << aHookedFunctions[i].msDll << ")";
+                sSeparator = ", ";
             }
+        }
+        std::cout << " in " << convertUTF16ToUTF8(sModuleName) << ": " << nPatched
+                  << " import table entries on " << nPages << " pages" << std::endl;
+    }
 
-            nHookedFunctions++;
+    if (!bMandatory)
+        return true;
 
-            if (pParam->mbVerbose)
-                std::cout << "Hooked " << sFunction << " in import table for "
-                          << convertUTF16ToUTF8(sDll) << " in " << convertUTF16ToUTF8(sModuleName)
-                          << std::endl;
-            return true;
+    bool bResult = true;
+    for (size_t i = 0; i < NHOOKEDFUNCTIONS; ++i)
+    {
+        if (aHookedFunctions[i].mbMandatory && !abHooked[i])
+        {
+            std::cout << "Did not find " << aHookedFunctions[i].msFunction
+                      << " in import table for " << aHookedFunctions[i].msDll << " in "
+                      << convertUTF16ToUTF8(sModuleName) << std::endl;
+            bResult = false;
         }
-
-        pThunk++;
     }
 
-    // Don't bother mentioning non-mandatory imports not found even in verbose mode.
-    if (bMandatory && pParam->mbVerbose)
-        std::cout << "Did not find " << sFunction << " in import table for "
-                  << convertUTF16ToUTF8(sDll) << " in " << convertUTF16ToUTF8(sModuleName)
-                  << std::endl;
-
-    return false;
+    return bResult;
 }
 
-static bool hook(bool bMandatory, ThreadProcParam* pParam, const wchar_t* sModule,
-                 const wchar_t* sDll, const char* sFunction, PVOID pOwnFunction)
+static bool hook(bool bMandatory, ThreadProcParam* pParam, const wchar_t* sModule)
 {
     const wchar_t* sModuleName;
 
@@ -2762,14 +2595,207 @@ static bool hook(bool bMandatory, ThreadProcParam* pParam, const wchar_t* sModul
         return false;
     }
 
-    return hook(bMandatory, pParam, hModule, sModuleName, sDll, sFunction, pOwnFunction);
+    return hook(bMandatory, pParam, hModule, sModuleName);
 }
 
-extern "C" DWORD WINAPI InjectedDllMainFunction(ThreadProcParam* pParam)
+// With a trailing backslash, or empty if it could not be found
+static const std::wstring& windowsDirectory()
 {
-    // Prepend a timestamp to all std::cout output lines.
-    new AddTimeStamp(std::cout);
+    static const std::wstring sWindowsDirectory = []() {
+        wchar_t sDirectory[MAX_PATH + 1];
+        const UINT nDirectory = GetWindowsDirectoryW(sDirectory, MAX_PATH);
+        if (nDirectory == 0 || nDirectory >= MAX_PATH)
+            return std::wstring();
+
+        std::wstring sResult(sDirectory, nDirectory);
+        if (sResult.back() != L'\\')
+            sResult += L'\\';
+        return sResult;
+    }();
+
+    return sWindowsDirectory;
+}
+
+// Whether calls from hModule are the client's, that is, it is neither ours nor a module of Windows
+// itself. Sets rFileName to its file name.
+static bool isClientModule(HMODULE hModule, std::wstring& rFileName)
+{
+    HMODULE hOurModule = NULL;
+    GetModuleHandleExW(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS
+                           | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                       (LPCWSTR)&aSeenModules, &hOurModule);
+    if (hModule == hOurModule)
+        return false;
+
+    const DWORD NFILENAME = 1000;
+    wchar_t sFileName[NFILENAME];
+    DWORD nSizeOut = GetModuleFileNameW(hModule, sFileName, NFILENAME);
+    if (nSizeOut == 0 || nSizeOut == NFILENAME)
+        return false;
+
+    const std::wstring& rWindowsDirectory = windowsDirectory();
+    if (!rWindowsDirectory.empty()
+        && _wcsnicmp(sFileName, rWindowsDirectory.c_str(), rWindowsDirectory.size()) == 0)
+        return false;
 
+    rFileName.assign(sFileName, nSizeOut);
+    return true;
+}
+
+// Hooks the modules loaded since the last call, so that calls from the DLLs of the client, and
+// from DLLs those pulled in, are seen, too. Modules of Windows itself and ours are left alone, as
+// their calls are not the client's. Called when we get injected, modules loaded later are hooked
+// by hookLoadedModule().
+static void hookNewModules(ThreadProcParam* pParam)
+{
+    std::vector<HMODULE> aModules(256);
+    DWORD nNeeded = 0;
+    while (true)
+    {
+        const DWORD nSize = (DWORD)(aModules.size() * sizeof(HMODULE));
+        if (!EnumProcessModules(GetCurrentProcess(), aModules.data(), nSize, &nNeeded))
+        {
+            std::cout << "EnumProcessModules failed: " << WindowsErrorString(GetLastError())
+                      << std::endl;
+            return;
+        }
+        if (nNeeded <= nSize)
+            break;
+        aModules.resize(nNeeded / sizeof(HMODULE));
+    }
+    aModules.resize(nNeeded / sizeof(HMODULE));
+
+    std::vector<HMODULE> aNewModules;
+
+    AcquireSRWLockExclusive(&aHookLock);
+
+    // Forget modules since unloaded, as another one might get loaded at the same address
+    const std::set<HMODULE> aLoadedModules(aModules.begin(), aModules.end());
+    for (std::set<HMODULE>::iterator i = aSeenModules.begin(); i != aSeenModules.end();)
+    {
+        if (aLoadedModules.count(*i) == 0)
+            i = aSeenModules.erase(i);
+        else
+            ++i;
+    }
+
+    for (HMODULE hModule : aModules)
+    {
+        if (aSeenModules.insert(hModule).second)
+            aNewModules.push_back(hModule);
+    }
+
+    ReleaseSRWLockExclusive(&aHookLock);
+
+    for (HMODULE hModule : aNewModules)
+    {
+        std::wstring sFileName;
+        if (isClientModule(hModule, sFileName))
+            hook(false, pParam, hModule, baseName(sFileName.c_str()));
+    }
+}
+
+// Marks hModule as seen, returns false if it already was
+static bool markSeen(HMODULE hModule)
+{
+    AcquireSRWLockExclusive(&aHookLock);
+    const bool bNew = aSeenModules.insert(hModule).second;
+    ReleaseSRWLockExclusive(&aHookLock);
+
+    return bNew;
+}
+
+// Collects the names of the DLLs a module imports from
+class ImportedDllCollector
+{
+public:
+    explicit ImportedDllCollector(std::vector<std::string>& rDlls)
+        : mrDlls(rDlls)
+    {
+    }
+
+    ImportedDllCollector(const ImportedDllCollector&) = delete;
+    ImportedDllCollector& operator=(const ImportedDllCollector&) = delete;
+
+    bool dll(const char* sDll)
+    {
+        mrDlls.push_back(sDll);
+        return false;
+    }
+
+    void slot(size_t, uint64_t) {}
+
+private:
+    std::vector<std::string>& mrDlls;
+};
+
+// Hooks the client's modules that hModule pulled in when it was loaded, and theirs in turn. Only
+// the import descriptors of modules not seen before are looked at.
+static void hookDependencies(HMODULE hModule)
+{
+    PIMAGE_NT_HEADERS pNtHeaders = ImageNtHeader(hModule);
+    if (pNtHeaders == NULL)
+        return;
+
+    std::vector<std::string> aDlls;
+    ImportedDllCollector aCollector(aDlls);
+    PEImports aImports((const unsigned char*)hModule, pNtHeaders->OptionalHeader.SizeOfImage, true);
+    aImports.walk(aCollector);
+
+    for (const std::string& rDll : aDlls)
+    {
+        HMODULE hDependency = GetModuleHandleA(rDll.c_str());
+        if (hDependency == NULL || !markSeen(hDependency))
+            continue;
+
+        std::wstring sFileName;
+        if (!isClientModule(hDependency, sFileName))
+            continue;
+
+        hook(false, pGlobalParamPtr, hDependency, baseName(sFileName.c_str()));
+        hookDependencies(hDependency);
+    }
+}
+
+// For a module the client loaded explicitly, wherever it is, and what it pulled in. A module
+// already seen, as LoadLibrary() of a loaded module just returns it, is not looked at again.
+static void hookLoadedModule(HMODULE hModule, const wchar_t* sModuleName)
+{
+    if (!markSeen(hModule))
+        return;
+
+    hook(false, pGlobalParamPtr, hModule, sModuleName);
+    hookDependencies(hModule);
+}
+
+// Called when FreeLibrary() unloaded a module, which might have taken others with it
+static void forgetUnloadedModules()
+{
+    AcquireSRWLockExclusive(&aHookLock);
+    for (std::set<HMODULE>::iterator i = aSeenModules.begin(); i != aSeenModules.end();)
+    {
+        HMODULE hLoaded;
+        if (!GetModuleHandleExW(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS
+                                    | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                                (LPCWSTR)*i, &hLoaded)
+            || hLoaded != *i)
+            i = aSeenModules.erase(i);
+        else
+            ++i;
+    }
+    ReleaseSRWLockExclusive(&aHookLock);
+}
+
+static void saveIIDNames()
+{
+    if (!IIDNameCache::save(pGlobalParamPtr->msIIDNameCacheFileName))
+        std::cout << "Could not write interface name file '"
+                  << convertUTF16ToUTF8(pGlobalParamPtr->msIIDNameCacheFileName)
+                  << "': " << WindowsErrorString(GetLastError()) << std::endl;
+}
+
+extern "C" DWORD WINAPI InjectedDllMainFunction(ThreadProcParam* pParam)
+{
 // Magic to export this function using a plain undecorated name despite it being WINAPI
 #ifdef _WIN64
 #pragma comment(linker, "/EXPORT:InjectedDllMainFunction=InjectedDllMainFunction")
@@ -2785,6 +2811,12 @@ extern "C" DWORD WINAPI InjectedDllMainFunction(ThreadProcParam* pParam)
 
     pParam->mbPassedSizeCheck = true;
 
+    // Prepend a timestamp to all std::cout output lines.
+    if (pParam->mbSynchronousOutput)
+        new AddTimeStamp(std::cout);
+    else
+        AsyncOutput::start(std::cout);
+
     // This function returns and the remotely created thread exits, and the wrapper process will
     // copy back the parameter block, but we keep a pointer to it for use by the hook functions.
     pGlobalParamPtr = pParam;
@@ -2793,6 +2825,37 @@ extern "C" DWORD WINAPI InjectedDllMainFunction(ThreadProcParam* pParam)
 
     tryToEnsureStdHandlesOpen(bDidAllocConsole);
 
+    if (pParam->msBinaryTraceFileName[0] != L'\0'
+        && !BinaryTrace::open(pParam->msBinaryTraceFileName))
+        std::cout << "Could not create binary trace file '"
+                  << convertUTF16ToUTF8(pParam->msBinaryTraceFileName)
+                  << "': " << WindowsErrorString(GetLastError()) << std::endl;
+
+    if (pParam->msCallStatisticsFileName[0] != L'\0')
+        CallStatistics::start(pParam->msCallStatisticsFileName);
+
+    if (pParam->msTraceFilter[0] != '\0')
+    {
+        std::string sError;
+        if (!TraceFilter::compile(pParam->msTraceFilter, sError))
+        {
+            std::cout << "Bad trace filter: " << sError << ", nothing will be traced" << std::endl;
+            TraceFilter::rejectAll();
+        }
+    }
+
+    ControlChannel::start(pParam);
+
+    IIDNameCache::seed(aGeneratedIIDNames,
+                       sizeof(aGeneratedIIDNames) / sizeof(aGeneratedIIDNames[0]));
+
+    if (pParam->msIIDNameCacheFileName[0] != L'\0')
+    {
+        // It not existing yet is fine, it is written at exit.
+        IIDNameCache::load(pParam->msIIDNameCacheFileName);
+        std::atexit(saveIIDNames);
+    }
+
     FunPtr aFun;
     aFun.pProc = GetProcAddress(GetModuleHandleW(L"kernel32.dll"), "AddDllDirectory");
     pAddDllDirectory = aFun.pAddDllDirectory;
@@ -2803,6 +2866,13 @@ extern "C" DWORD WINAPI InjectedDllMainFunction(ThreadProcParam* pParam)
     aFun.pProc = GetProcAddress(GetModuleHandleW(L"kernel32.dll"), "SetDllDirectoryA");
     pSetDllDirectoryA = aFun.pSetDllDirectoryA;
 
+    if (!buildGetProcAddressSlots())
+    {
+        std::cout << "Could not place the GetProcAddress() replacements in a hash table"
+                  << std::endl;
+        return FALSE;
+    }
+
     // Do our IAT patching. We want to hook CoCreateInstance() and CoCreateInstanceEx().
 
     HMODULE hMsvbvm60 = GetModuleHandleW(L"msvbvm60.dll");
@@ -2817,67 +2887,19 @@ extern "C" DWORD WINAPI InjectedDllMainFunction(ThreadProcParam* pParam)
         // msvbvm60.dll.
 
         // Msvbvm60.dll seems to import just CoCreateInstance() directly, it looks up
-        // CoCreateInstanceEx() with GetProcAddress(). (But try to hook CoCreateInstanceEx() anyway,
-        // just in case.) Thus we need to hook GetProcAddress() too.
-
-        if (!hook(true, pParam, L"msvbvm60.dll", L"ole32.dll", "CoCreateInstance",
-                  myCoCreateInstance))
-            return FALSE;
-
-        hook(false, pParam, L"msvbvm60.dll", L"ole32.dll", "CoCreateInstanceEx",
-             myCoCreateInstanceEx);
+        // CoCreateInstanceEx() with GetProcAddress(). Thus we need to hook GetProcAddress() too,
+        // which is why both are mandatory.
 
-        hook(false, pParam, L"msvbvm60.dll", L"ole32.dll", "OleCreateLink", myOleCreateLink);
-
-        hook(false, pParam, L"msvbvm60.dll", L"kernel32.dll", "OutputDebugStringA",
-             myOutputDebugStringA);
-
-        hook(false, pParam, L"msvbvm60.dll", L"kernel32.dll", "OutputDebugStringW",
-             myOutputDebugStringW);
-
-        hook(false, pParam, L"msvbvm60.dll", L"ole32.dll", "CoGetClassObject", myCoGetClassObject);
-
-        if (!hook(true, pParam, L"msvbvm60.dll", L"kernel32.dll", "GetProcAddress",
-                  myGetProcAddress))
+        if (!hook(true, pParam, L"msvbvm60.dll"))
             return FALSE;
-
-        hook(false, pParam, L"msvbvm60.dll", L"kernel32.dll", "LoadLibraryW", myLoadLibraryW);
-        hook(false, pParam, L"msvbvm60.dll", L"kernel32.dll", "LoadLibraryA", myLoadLibraryA);
-        hook(false, pParam, L"msvbvm60.dll", L"kernel32.dll", "LoadLibraryExW", myLoadLibraryExW);
-        hook(false, pParam, L"msvbvm60.dll", L"kernel32.dll", "LoadLibraryExA", myLoadLibraryExA);
-        hook(false, pParam, L"msvbvm60.dll", L"ntdll.dll", "LdrLoadDll", myLdrLoadDll);
-        hook(false, pParam, L"msvbvm60.dll", L"shell32.dll", "ShellExecuteA", myShellExecuteA);
-        hook(false, pParam, L"msvbvm60.dll", L"shell32.dll", "ShellExecuteW", myShellExecuteW);
-        hook(false, pParam, L"msvbvm60.dll", L"shell32.dll", "ShellExecuteExA", myShellExecuteExA);
-        hook(false, pParam, L"msvbvm60.dll", L"shell32.dll", "ShellExecuteExW", myShellExecuteExW);
     }
     else
     {
         // It is some other executable. We must hook LoadLibrary*().
 
         nHookedFunctions = 0;
-        hook(false, pParam, nullptr, L"kernel32.dll", "GetProcAddress", myGetProcAddress);
-        if (pAddDllDirectory)
-            hook(false, pParam, nullptr, L"kernel32.dll", "AddDllDirectory", myAddDllDirectory);
-        if (pSetDllDirectoryW)
-            hook(false, pParam, nullptr, L"kernel32.dll", "SetDllDirectoryW", mySetDllDirectoryW);
-        if (pSetDllDirectoryA)
-            hook(false, pParam, nullptr, L"kernel32.dll", "SetDllDirectoryA", mySetDllDirectoryA);
-        hook(false, pParam, nullptr, L"kernel32.dll", "LoadLibraryW", myLoadLibraryW);
-        hook(false, pParam, nullptr, L"kernel32.dll", "LoadLibraryA", myLoadLibraryA);
-        hook(false, pParam, nullptr, L"kernel32.dll", "LoadLibraryExW", myLoadLibraryExW);
-        hook(false, pParam, nullptr, L"kernel32.dll", "LoadLibraryExA", myLoadLibraryExA);
-        hook(false, pParam, nullptr, L"ntdll.dll", "LdrLoadDll", myLdrLoadDll);
-        hook(false, pParam, nullptr, L"shell32.dll", "ShellExecuteA", myShellExecuteA);
-        hook(false, pParam, nullptr, L"shell32.dll", "ShellExecuteW", myShellExecuteW);
-        hook(false, pParam, nullptr, L"shell32.dll", "ShellExecuteExA", myShellExecuteExA);
-        hook(false, pParam, nullptr, L"shell32.dll", "ShellExecuteExW", myShellExecuteExW);
-        hook(false, pParam, nullptr, L"ole32.dll", "CoCreateInstance", myCoCreateInstance);
-        hook(false, pParam, nullptr, L"ole32.dll", "CoCreateInstanceEx", myCoCreateInstanceEx);
-        hook(false, pParam, nullptr, L"ole32.dll", "OleCreateLink", myOleCreateLink);
-        hook(false, pParam, nullptr, L"kernel32.dll", "OutputDebugStringA", myOutputDebugStringA);
-        hook(false, pParam, nullptr, L"kernel32.dll", "OutputDebugStringW", myOutputDebugStringW);
-        hook(false, pParam, nullptr, L"ole32.dll", "CoGetClassObject", myCoGetClassObject);
+        hook(false, pParam, nullptr);
+        hookNewModules(pParam);
         if (nHookedFunctions == 0)
         {
             std::cout << "Could not hook a single interesting function to hook" << std::endl;
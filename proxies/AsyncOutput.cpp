@@ -0,0 +1,421 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of Collabora OLE Automation Translator.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma warning(push)
+#pragma warning(disable : 4668 4820 4917)
+
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+#include <Windows.h>
+
+#pragma warning(pop)
+
+#include "AsyncOutput.hpp"
+
+// The queue is a bounded multi-producer single-consumer ring of slots, each with a sequence number
+// telling whether it is free for the producer that claims position N (sequence == N) or holds a
+// line ready for the consumer (sequence == N + 1), see
+// http://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue . Typical lines fit
+// in the slot itself, longer ones are put in a separately allocated string.
+
+static const LONG NSLOTS = 4096;
+static const size_t NSLOTTEXT = 240;
+
+// How long a producer waits for room in the queue before it drops its line
+static const ULONGLONG NMAXWAITMILLISECONDS = 50;
+
+namespace
+{
+struct Slot
+{
+    volatile LONG mnSequence;
+    unsigned mnLength;
+    ULONGLONG mnTime;
+    DWORD mnThreadId;
+    std::string* mpLongText;
+    char maText[NSLOTTEXT];
+};
+
+Slot aSlots[NSLOTS];
+
+volatile LONG nEnqueuePos;
+LONG nDequeuePos;
+
+volatile LONG nDropped;
+LONG nTotalDropped;
+
+HANDLE hWakeEvent;
+volatile LONG nWriterSleeping;
+volatile LONG nConsumerBusy;
+volatile LONG nStopping;
+
+AsyncOutput* pInstance;
+
+// For writeDirectly(), which all threads use once the writer thread is gone or could not be
+// started. Guards mbNewline and the sink.
+SRWLOCK aDirectLock = SRWLOCK_INIT;
+
+// The line being built by each thread
+thread_local char aLine[NSLOTTEXT];
+thread_local unsigned nLineLength;
+thread_local std::string* pLongLine;
+thread_local ULONGLONG nLineTime;
+thread_local bool bHaveLine;
+
+ULONGLONG now()
+{
+    FILETIME aNow;
+    GetSystemTimeAsFileTime(&aNow);
+    return ((ULONGLONG)aNow.dwHighDateTime << 32) | aNow.dwLowDateTime;
+}
+
+// The date and time part of the last timestamp, as most lines in a batch are from the same second
+struct TimeStampCache
+{
+    std::time_t mnSecond = -1;
+    std::string msSecond;
+};
+
+// The same format as the AddTimeStamp class in injecteddll.cpp
+void appendTimeStamp(std::string& rBuffer, ULONGLONG nTime, TimeStampCache& rCache)
+{
+    // FILETIME is in 100 ns units since 1601.
+    const ULONGLONG nMilliseconds = (nTime - 116444736000000000ull) / 10000;
+    const std::time_t nSecond = (std::time_t)(nMilliseconds / 1000);
+
+    if (nSecond != rCache.mnSecond)
+    {
+        std::stringstream s;
+#pragma warning(push)
+#pragma warning(disable : 4996)
+        s << std::put_time(std::localtime(&nSecond), "%F:%T");
+#pragma warning(pop)
+        rCache.msSecond = s.str();
+        rCache.mnSecond = nSecond;
+    }
+
+    const unsigned nFraction = (unsigned)(nMilliseconds % 1000);
+    rBuffer += rCache.msSecond;
+    rBuffer += '.';
+    rBuffer += (char)('0' + nFraction / 100);
+    rBuffer += (char)('0' + nFraction / 10 % 10);
+    rBuffer += (char)('0' + nFraction % 10);
+    rBuffer += ':';
+}
+
+void appendThreadId(std::string& rBuffer, DWORD nThreadId)
+{
+    rBuffer += std::to_string(nThreadId);
+    rBuffer += ':';
+}
+
+void wakeWriter()
+{
+    if (nWriterSleeping && InterlockedExchange(&nWriterSleeping, 0))
+        SetEvent(hWakeEvent);
+}
+
+bool isLineReady()
+{
+    return aSlots[nDequeuePos & (NSLOTS - 1)].mnSequence == nDequeuePos + 1;
+}
+
+// Writes all queued lines to rSink in one go. Only one thread at a time may do this. The slots are
+// given back only after the write, so that if the writer thread gets killed in the middle of it at
+// process exit, drainAtExit() still finds the lines. It can't tell how far the write got, though,
+// and writes them all again, so the last batch before exit may show up twice in the output. Better
+// than losing it.
+bool consume(std::streambuf& rSink, std::string& rBatch)
+{
+    static TimeStampCache aCache;
+
+    if (InterlockedCompareExchange(&nConsumerBusy, 1, 0) != 0)
+        return false;
+
+    rBatch.clear();
+
+    LONG nPos = nDequeuePos;
+    while (aSlots[nPos & (NSLOTS - 1)].mnSequence == nPos + 1)
+    {
+        const Slot& rSlot = aSlots[nPos & (NSLOTS - 1)];
+        appendTimeStamp(rBatch, rSlot.mnTime, aCache);
+        appendThreadId(rBatch, rSlot.mnThreadId);
+        if (rSlot.mpLongText != nullptr)
+            rBatch += *rSlot.mpLongText;
+        else
+            rBatch.append(rSlot.maText, rSlot.mnLength);
+        nPos++;
+    }
+
+    const LONG nNewlyDropped = InterlockedExchange(&nDropped, 0);
+    if (nNewlyDropped > 0)
+    {
+        nTotalDropped += nNewlyDropped;
+        appendTimeStamp(rBatch, now(), aCache);
+        rBatch += "[" + std::to_string(nNewlyDropped) + " lines of output dropped, "
+                  + std::to_string(nTotalDropped) + " in total]\n";
+    }
+
+    if (!rBatch.empty())
+    {
+        rSink.sputn(rBatch.data(), (std::streamsize)rBatch.size());
+        rSink.pubsync();
+    }
+
+    for (LONG i = nDequeuePos; i != nPos; ++i)
+    {
+        Slot& rSlot = aSlots[i & (NSLOTS - 1)];
+        delete rSlot.mpLongText;
+        rSlot.mpLongText = nullptr;
+        InterlockedExchange(&rSlot.mnSequence, i + NSLOTS);
+    }
+    nDequeuePos = nPos;
+
+    InterlockedExchange(&nConsumerBusy, 0);
+
+    return !rBatch.empty();
+}
+
+void enqueue(ULONGLONG nTime, const char* pText, unsigned nLength, std::string* pLongText)
+{
+    ULONGLONG nWaitStart = 0;
+
+    for (;;)
+    {
+        const LONG nPos = nEnqueuePos;
+        Slot& rSlot = aSlots[nPos & (NSLOTS - 1)];
+        const LONG nDiff = rSlot.mnSequence - nPos;
+
+        if (nDiff == 0)
+        {
+            if (InterlockedCompareExchange(&nEnqueuePos, nPos + 1, nPos) != nPos)
+                continue;
+
+            rSlot.mnTime = nTime;
+            rSlot.mnThreadId = GetCurrentThreadId();
+            rSlot.mpLongText = pLongText;
+            if (pLongText == nullptr)
+            {
+                std::memcpy(rSlot.maText, pText, nLength);
+                rSlot.mnLength = nLength;
+            }
+            InterlockedExchange(&rSlot.mnSequence, nPos + 1);
+
+            wakeWriter();
+            return;
+        }
+        else if (nDiff < 0)
+        {
+            // Full. Give the writer a chance to catch up, but don't block the client forever.
+            wakeWriter();
+            if (nWaitStart == 0)
+                nWaitStart = GetTickCount64();
+            else if (GetTickCount64() - nWaitStart > NMAXWAITMILLISECONDS)
+            {
+                InterlockedIncrement(&nDropped);
+                delete pLongText;
+                return;
+            }
+            SwitchToThread();
+        }
+        // Else another producer claimed this position already, try the next one.
+    }
+}
+} // namespace
+
+AsyncOutput::AsyncOutput(std::basic_ios<char>& rStream)
+    : mpSink(rStream.rdbuf())
+    , mbNewline(true)
+{
+}
+
+void AsyncOutput::start(std::basic_ios<char>& rStream)
+{
+    assert(pInstance == nullptr);
+
+    for (LONG i = 0; i < NSLOTS; ++i)
+        aSlots[i].mnSequence = i;
+
+    hWakeEvent = CreateEventW(NULL, FALSE, FALSE, NULL);
+    pInstance = new AsyncOutput(rStream);
+
+    HANDLE hThread = NULL;
+    if (hWakeEvent != NULL)
+        hThread = CreateThread(NULL, 0, writerThread, nullptr, 0, NULL);
+
+    // If that failed, just write synchronously.
+    if (hThread == NULL)
+        nStopping = 1;
+    else
+        CloseHandle(hThread);
+
+    rStream.rdbuf(pInstance);
+
+    std::atexit(drainAtExit);
+}
+
+unsigned long __stdcall AsyncOutput::writerThread(void*)
+{
+    std::string aBatch;
+
+    while (!nStopping)
+    {
+        if (consume(*pInstance->mpSink, aBatch))
+            continue;
+
+        InterlockedExchange(&nWriterSleeping, 1);
+        if (isLineReady() || nStopping)
+        {
+            InterlockedExchange(&nWriterSleeping, 0);
+            continue;
+        }
+        // Wake up now and then anyway, to report dropped lines.
+        WaitForSingleObject(hWakeEvent, 100);
+        InterlockedExchange(&nWriterSleeping, 0);
+    }
+
+    return 0;
+}
+
+// Called late in process exit, when the writer thread (like all other threads) is already gone.
+void AsyncOutput::drainAtExit()
+{
+    InterlockedExchange(&nStopping, 1);
+
+    // In case the writer thread was killed in the middle of consume().
+    const ULONGLONG nWaitStart = GetTickCount64();
+    while (nConsumerBusy && GetTickCount64() - nWaitStart < 100)
+        Sleep(1);
+    InterlockedExchange(&nConsumerBusy, 0);
+
+    std::string aBatch;
+    while (consume(*pInstance->mpSink, aBatch))
+        ;
+
+    // Whatever this thread had started writing.
+    if (bHaveLine)
+    {
+        if (pLongLine != nullptr)
+            pInstance->writeDirectly(pLongLine->data(), pLongLine->size());
+        else
+            pInstance->writeDirectly(aLine, nLineLength);
+        bHaveLine = false;
+    }
+}
+
+void AsyncOutput::writeDirectly(const char* pChars, size_t nCount)
+{
+    TimeStampCache aCache;
+    std::string aBuffer;
+
+    AcquireSRWLockExclusive(&aDirectLock);
+    for (size_t i = 0; i < nCount; ++i)
+    {
+        if (mbNewline)
+        {
+            appendTimeStamp(aBuffer, now(), aCache);
+            appendThreadId(aBuffer, GetCurrentThreadId());
+        }
+        aBuffer += pChars[i];
+        mbNewline = (pChars[i] == '\n');
+    }
+    mpSink->sputn(aBuffer.data(), (std::streamsize)aBuffer.size());
+    mpSink->pubsync();
+    ReleaseSRWLockExclusive(&aDirectLock);
+}
+
+void AsyncOutput::endLine()
+{
+    if (pLongLine != nullptr)
+        enqueue(nLineTime, nullptr, 0, pLongLine);
+    else
+        enqueue(nLineTime, aLine, nLineLength, nullptr);
+
+    pLongLine = nullptr;
+    nLineLength = 0;
+    bHaveLine = false;
+}
+
+void AsyncOutput::append(const char* pChars, size_t nCount)
+{
+    if (nStopping)
+    {
+        writeDirectly(pChars, nCount);
+        return;
+    }
+
+    while (nCount > 0)
+    {
+        if (!bHaveLine)
+        {
+            nLineTime = now();
+            bHaveLine = true;
+        }
+
+        const char* pNewline = static_cast<const char*>(std::memchr(pChars, '\n', nCount));
+        const size_t nChunk = pNewline ? (size_t)(pNewline - pChars) + 1 : nCount;
+
+        if (pLongLine != nullptr)
+            pLongLine->append(pChars, nChunk);
+        else if (nLineLength + nChunk <= NSLOTTEXT)
+        {
+            std::memcpy(aLine + nLineLength, pChars, nChunk);
+            nLineLength += (unsigned)nChunk;
+        }
+        else
+        {
+            pLongLine = new std::string(aLine, nLineLength);
+            pLongLine->append(pChars, nChunk);
+        }
+
+        if (pNewline)
+            endLine();
+
+        pChars += nChunk;
+        nCount -= nChunk;
+    }
+}
+
+AsyncOutput::int_type AsyncOutput::overflow(int_type c)
+{
+    if (traits_type::eq_int_type(c, traits_type::eof()))
+        return sync() == -1 ? c : traits_type::not_eof(c);
+
+    const char cChar = traits_type::to_char_type(c);
+    append(&cChar, 1);
+    return c;
+}
+
+std::streamsize AsyncOutput::xsputn(const char* pChars, std::streamsize nCount)
+{
+    append(pChars, (size_t)nCount);
+    return nCount;
+}
+
+// A std::endl or std::flush. Lines are queued as soon as they are complete anyway, and the
+// writer thread flushes after each batch.
+int AsyncOutput::sync()
+{
+    if (nStopping)
+    {
+        AcquireSRWLockExclusive(&aDirectLock);
+        const int nResult = mpSink->pubsync();
+        ReleaseSRWLockExclusive(&aDirectLock);
+        return nResult;
+    }
+    return 0;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab cinoptions=b1,g0,N-s cinkeys+=0=break: */
@@ -0,0 +1,615 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of Collabora OLE Automation Translator.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma warning(push)
+#pragma warning(disable : 4668 4820 4917)
+
+#include <cassert>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+
+#include <Windows.h>
+
+#pragma warning(pop)
+
+#include "utils.hpp"
+
+#include "BinaryTrace.hpp"
+
+// The name area needs to hold all the distinct type and member names used, which is not that many
+// even for large programs. The ring is for the calls, and once it is full the oldest ones are
+// overwritten.
+static const uint64_t NHEADERAREA = 4096;
+static const uint64_t NNAMEAREA = 4 * 1024 * 1024;
+static const uint64_t NRINGAREA = 64 * 1024 * 1024;
+
+TraceFileHeader* BinaryTrace::mpHeader = nullptr;
+
+namespace
+{
+struct NameKey
+{
+    const void* mpOwner;
+    int32_t mnMember;
+
+    bool operator==(const NameKey& rOther) const
+    {
+        return mpOwner == rOther.mpOwner && mnMember == rOther.mnMember;
+    }
+};
+
+struct NameKeyHash
+{
+    size_t operator()(const NameKey& rKey) const
+    {
+        return std::hash<const void*>()(rKey.mpOwner) ^ ((size_t)rKey.mnMember * 0x9E3779B1u);
+    }
+};
+
+struct NameMaps
+{
+    SRWLOCK maLock;
+    std::unordered_map<std::string, TraceNameId> maByName;
+    std::unordered_map<NameKey, TraceNameId, NameKeyHash> maByKey;
+};
+
+// Intentionally never deleted, proxies might still be called while the process exits.
+NameMaps* pNameMaps;
+
+// Distinct owners for the HRESULT strings
+const char aResultNameTag = 0;
+const char aErrorNameTag = 0;
+} // namespace
+
+bool BinaryTrace::open(const wchar_t* pFileName)
+{
+    assert(mpHeader == nullptr);
+
+    const uint64_t nFileSize = NHEADERAREA + NNAMEAREA + NRINGAREA;
+
+    HANDLE hFile = CreateFileW(pFileName, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL,
+                               CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return false;
+
+    HANDLE hMapping = CreateFileMappingW(hFile, NULL, PAGE_READWRITE, (DWORD)(nFileSize >> 32),
+                                         (DWORD)nFileSize, NULL);
+    if (hMapping == NULL)
+    {
+        CloseHandle(hFile);
+        return false;
+    }
+
+    // The view keeps the mapping and the file open.
+    void* pView = MapViewOfFile(hMapping, FILE_MAP_WRITE, 0, 0, 0);
+    CloseHandle(hMapping);
+    CloseHandle(hFile);
+    if (pView == NULL)
+        return false;
+
+    pNameMaps = new NameMaps;
+    InitializeSRWLock(&pNameMaps->maLock);
+
+    TraceFileHeader* pHeader = static_cast<TraceFileHeader*>(pView);
+
+    std::memcpy(pHeader->maMagic, TRACE_FILE_MAGIC, sizeof(pHeader->maMagic));
+    pHeader->mnVersion = TRACE_FILE_VERSION;
+    pHeader->mnPointerSize = sizeof(void*);
+
+    LARGE_INTEGER aTicks;
+    QueryPerformanceFrequency(&aTicks);
+    pHeader->mnTicksPerSecond = (uint64_t)aTicks.QuadPart;
+    QueryPerformanceCounter(&aTicks);
+    pHeader->mnStartTicks = (uint64_t)aTicks.QuadPart;
+
+    FILETIME aNow;
+    GetSystemTimeAsFileTime(&aNow);
+    // FILETIME is in 100 ns units since 1601.
+    pHeader->mnStartMilliseconds
+        = ((((uint64_t)aNow.dwHighDateTime << 32) | aNow.dwLowDateTime) - 116444736000000000ull)
+          / 10000;
+
+    TIME_ZONE_INFORMATION aTimeZone;
+    LONG nBias;
+    switch (GetTimeZoneInformation(&aTimeZone))
+    {
+        case TIME_ZONE_ID_STANDARD:
+            nBias = aTimeZone.Bias + aTimeZone.StandardBias;
+            break;
+        case TIME_ZONE_ID_DAYLIGHT:
+            nBias = aTimeZone.Bias + aTimeZone.DaylightBias;
+            break;
+        default:
+            nBias = aTimeZone.Bias;
+            break;
+    }
+    pHeader->mnLocalTimeOffsetSeconds = -(int64_t)nBias * 60;
+
+    pHeader->mnNamesOffset = NHEADERAREA;
+    pHeader->mnNamesCapacity = NNAMEAREA;
+    // Offset zero is reserved to mean no name.
+    pHeader->mnNamesHead = 8;
+
+    pHeader->mnRingOffset = NHEADERAREA + NNAMEAREA;
+    pHeader->mnRingCapacity = NRINGAREA;
+    pHeader->mnRingHead = 0;
+
+    MemoryBarrier();
+    mpHeader = pHeader;
+
+    return true;
+}
+
+uint64_t BinaryTrace::now()
+{
+    LARGE_INTEGER aTicks;
+    QueryPerformanceCounter(&aTicks);
+    return (uint64_t)aTicks.QuadPart;
+}
+
+// Publishes a record. Readers of a live trace check the magic, so it must be written last.
+static void commitHeader(void* pRecord, TraceRecordType eType, uint8_t nFlags, uint32_t nSize)
+{
+    TraceRecordHeader aHeader;
+    aHeader.mnMagic = TRACE_RECORD_MAGIC;
+    aHeader.mnType = eType;
+    aHeader.mnFlags = nFlags;
+    aHeader.mnSize = nSize;
+
+    LONG64 nHeader;
+    std::memcpy(&nHeader, &aHeader, sizeof(nHeader));
+    InterlockedExchange64(static_cast<LONG64*>(pRecord), nHeader);
+}
+
+void* BinaryTrace::reserve(uint32_t nSize)
+{
+    assert(nSize % 8 == 0 && nSize <= mpHeader->mnRingCapacity);
+
+    const uint64_t nCapacity = mpHeader->mnRingCapacity;
+    char* const pRing = reinterpret_cast<char*>(mpHeader) + mpHeader->mnRingOffset;
+
+    volatile LONG64* pHead = reinterpret_cast<volatile LONG64*>(&mpHeader->mnRingHead);
+    LONG64 nOld;
+    uint64_t nPos, nPadding;
+    do
+    {
+        nOld = *pHead;
+        nPos = (uint64_t)nOld % nCapacity;
+        nPadding = (nPos + nSize > nCapacity) ? nCapacity - nPos : 0;
+    } while (InterlockedCompareExchange64(pHead, nOld + (LONG64)(nPadding + nSize), nOld) != nOld);
+
+    if (nPadding > 0)
+    {
+        commitHeader(pRing + nPos, TRACE_PADDING, 0, (uint32_t)nPadding);
+        nPos = 0;
+    }
+
+    // Clear the header of whatever old record was here, so that a reader doesn't take the
+    // partially written new one for it.
+    InterlockedExchange64(reinterpret_cast<LONG64*>(pRing + nPos), 0);
+
+    return pRing + nPos;
+}
+
+TraceNameId BinaryTrace::appendName(const std::string& rName)
+{
+    uint32_t nLength = (uint32_t)rName.length();
+    if (nLength > 1000)
+        nLength = 1000;
+
+    const uint32_t nSize = traceAlign(sizeof(TraceNameRecord) + nLength);
+
+    // Only called with the lock in NameMaps held.
+    if (mpHeader->mnNamesHead + nSize > mpHeader->mnNamesCapacity)
+        return 0;
+
+    const TraceNameId nId = (TraceNameId)mpHeader->mnNamesHead;
+    char* const pRecord = reinterpret_cast<char*>(mpHeader) + mpHeader->mnNamesOffset + nId;
+
+    TraceNameRecord* pName = reinterpret_cast<TraceNameRecord*>(pRecord);
+    pName->mnLength = nLength;
+    pName->mnReserved = 0;
+    std::memcpy(pName + 1, rName.data(), nLength);
+    commitHeader(pName, TRACE_NAME, 0, nSize);
+
+    mpHeader->mnNamesHead += nSize;
+
+    return nId;
+}
+
+TraceNameId BinaryTrace::name(const std::string& rName)
+{
+    AcquireSRWLockShared(&pNameMaps->maLock);
+    auto p = pNameMaps->maByName.find(rName);
+    const bool bFound = (p != pNameMaps->maByName.end());
+    const TraceNameId nFoundId = bFound ? p->second : 0;
+    ReleaseSRWLockShared(&pNameMaps->maLock);
+
+    if (bFound)
+        return nFoundId;
+
+    AcquireSRWLockExclusive(&pNameMaps->maLock);
+    TraceNameId& rId = pNameMaps->maByName[rName];
+    if (rId == 0)
+        rId = appendName(rName);
+    const TraceNameId nId = rId;
+    ReleaseSRWLockExclusive(&pNameMaps->maLock);
+
+    return nId;
+}
+
+bool BinaryTrace::findName(const void* pOwner, int32_t nMember, TraceNameId& rId)
+{
+    AcquireSRWLockShared(&pNameMaps->maLock);
+    auto p = pNameMaps->maByKey.find(NameKey{ pOwner, nMember });
+    const bool bFound = (p != pNameMaps->maByKey.end());
+    if (bFound)
+        rId = p->second;
+    ReleaseSRWLockShared(&pNameMaps->maLock);
+
+    return bFound;
+}
+
+TraceNameId BinaryTrace::addName(const void* pOwner, int32_t nMember, const std::string& rName)
+{
+    const TraceNameId nId = name(rName);
+
+    AcquireSRWLockExclusive(&pNameMaps->maLock);
+    pNameMaps->maByKey[NameKey{ pOwner, nMember }] = nId;
+    ReleaseSRWLockExclusive(&pNameMaps->maLock);
+
+    return nId;
+}
+
+TraceNameId BinaryTrace::resultName(HRESULT nResult)
+{
+    TraceNameId nId;
+    if (findName(&aResultNameTag, nResult, nId))
+        return nId;
+    return addName(&aResultNameTag, nResult, HRESULT_to_string(nResult));
+}
+
+TraceNameId BinaryTrace::errorName(HRESULT nResult)
+{
+    TraceNameId nId;
+    if (findName(&aErrorNameTag, nResult, nId))
+        return nId;
+    return addName(&aErrorNameTag, nResult, WindowsErrorStringFromHRESULT(nResult));
+}
+
+TraceCallRecord& BinaryTrace::Record::call()
+{
+    assert(mnSize == 0);
+
+    TraceCallRecord* pCall = reinterpret_cast<TraceCallRecord*>(maBuffer);
+    std::memset(pCall, 0, sizeof(*pCall));
+    pCall->maHeader.mnType = TRACE_CALL;
+    pCall->mnTicks = now();
+    pCall->mnThreadId = GetCurrentThreadId();
+    mpArgCount = &pCall->mnArgs;
+    mnSize = sizeof(*pCall);
+
+    return *pCall;
+}
+
+TraceReturnRecord& BinaryTrace::Record::result(TraceReturnKind eKind)
+{
+    assert(mnSize == 0);
+
+    TraceReturnRecord* pReturn = reinterpret_cast<TraceReturnRecord*>(maBuffer);
+    std::memset(pReturn, 0, sizeof(*pReturn));
+    pReturn->maHeader.mnType = TRACE_RETURN;
+    pReturn->maHeader.mnFlags = eKind;
+    pReturn->mnTicks = now();
+    pReturn->mnThreadId = GetCurrentThreadId();
+    mnSize = sizeof(*pReturn);
+
+    return *pReturn;
+}
+
+TraceArg* BinaryTrace::Record::addArgSpace()
+{
+    if (mnSize + sizeof(TraceArg) > NBUFFER)
+        return nullptr;
+
+    TraceArg* pArg = reinterpret_cast<TraceArg*>(maBuffer + mnSize);
+    std::memset(pArg, 0, sizeof(*pArg));
+    mnSize += sizeof(TraceArg);
+    if (mpArgCount != nullptr)
+        (*mpArgCount)++;
+
+    return pArg;
+}
+
+void BinaryTrace::Record::addString(TraceArg& rArg, const wchar_t* pWchar, uint32_t nLength)
+{
+    if (pWchar == nullptr)
+    {
+        rArg.mnKind = TRACE_VALUE_NULLSTRING;
+        return;
+    }
+
+    // Truncate like the text trace does.
+    nLength = (uint32_t)formatTruncatedUTF16Length(pWchar, nLength);
+
+    // Whatever fits in the record if it is nearly full
+    const uint32_t nRoom = (NBUFFER - mnSize) / sizeof(wchar_t) & ~3u;
+    if (nLength > nRoom)
+        nLength = nRoom;
+
+    rArg.mnKind = TRACE_VALUE_WSTRING;
+    rArg.mnLength = nLength;
+    std::memcpy(maBuffer + mnSize, pWchar, nLength * sizeof(wchar_t));
+    mnSize += traceAlign(nLength * sizeof(wchar_t));
+}
+
+void BinaryTrace::Record::addString(TraceArg& rArg, const char* pChar, uint32_t nLength)
+{
+    if (pChar == nullptr)
+    {
+        rArg.mnKind = TRACE_VALUE_NULLSTRING;
+        return;
+    }
+
+    if (nLength > FORMAT_MAX_STRING)
+        nLength = FORMAT_MAX_STRING;
+
+    const uint32_t nRoom = (NBUFFER - mnSize) & ~7u;
+    if (nLength > nRoom)
+        nLength = nRoom;
+
+    rArg.mnKind = TRACE_VALUE_STRING;
+    rArg.mnLength = nLength;
+    std::memcpy(maBuffer + mnSize, pChar, nLength);
+    mnSize += traceAlign(nLength);
+}
+
+// Mirrors the operator<< for VARIANT in utils.hpp, which is what coleat-trace needs to reproduce.
+
+void BinaryTrace::Record::addArg(const VARIANT& rVariant, uint8_t nFlags, TraceNameId nArgName)
+{
+    TraceArg* pArg = addArgSpace();
+    if (pArg == nullptr)
+        return;
+
+    pArg->mnVt = rVariant.vt;
+    pArg->mnFlags = nFlags;
+    pArg->mnArgName = nArgName;
+
+    if (nFlags & TRACE_ARG_OUT)
+        return;
+
+    if (rVariant.vt & (VT_VECTOR | VT_ARRAY | VT_BYREF))
+    {
+        if (!(rVariant.vt & VT_BYREF) || rVariant.byref == nullptr)
+            return;
+
+        switch (rVariant.vt & VT_TYPEMASK)
+        {
+            case VT_EMPTY:
+            case VT_NULL:
+                break;
+            case VT_I2:
+                pArg->mnKind = TRACE_VALUE_SIGNED;
+                pArg->mnValue = (uint64_t)(int64_t)*rVariant.piVal;
+                break;
+            case VT_I4:
+            case VT_INT:
+                pArg->mnKind = TRACE_VALUE_SIGNED;
+                pArg->mnValue = (uint64_t)(int64_t)*rVariant.plVal;
+                break;
+            case VT_R4:
+            {
+                const double fValue = *rVariant.pfltVal;
+                pArg->mnKind = TRACE_VALUE_DOUBLE;
+                std::memcpy(&pArg->mnValue, &fValue, sizeof(fValue));
+                break;
+            }
+            case VT_R8:
+                pArg->mnKind = TRACE_VALUE_DOUBLE;
+                std::memcpy(&pArg->mnValue, rVariant.pdblVal, sizeof(double));
+                break;
+            case VT_CY:
+                pArg->mnKind = TRACE_VALUE_SIGNED;
+                pArg->mnValue = (uint64_t)rVariant.pcyVal->int64;
+                break;
+            case VT_DATE:
+                pArg->mnKind = TRACE_VALUE_DOUBLE;
+                std::memcpy(&pArg->mnValue, rVariant.pdate, sizeof(double));
+                break;
+            case VT_BSTR:
+                addString(*pArg, *rVariant.pbstrVal, SysStringLen(*rVariant.pbstrVal));
+                break;
+            case VT_DISPATCH:
+                pArg->mnKind = TRACE_VALUE_POINTER;
+                pArg->mnValue = (uint64_t)(uintptr_t)*rVariant.ppdispVal;
+                break;
+            case VT_ERROR:
+            case VT_HRESULT:
+                pArg->mnKind = TRACE_VALUE_NAME;
+                pArg->mnValue = resultName(*rVariant.plVal);
+                break;
+            case VT_BOOL:
+                pArg->mnKind = TRACE_VALUE_BOOL;
+                pArg->mnValue = (*rVariant.pboolVal != 0);
+                break;
+            case VT_UNKNOWN:
+                pArg->mnKind = TRACE_VALUE_POINTER;
+                pArg->mnValue = (uint64_t)(uintptr_t)*rVariant.ppunkVal;
+                break;
+            case VT_DECIMAL:
+                pArg->mnKind = TRACE_VALUE_DECIMAL;
+                pArg->mnValue = rVariant.pdecVal->Lo64;
+                pArg->mnLength = rVariant.pdecVal->Hi32;
+                break;
+            case VT_I1:
+                pArg->mnKind = TRACE_VALUE_SIGNED;
+                pArg->mnValue = (uint64_t)(int64_t)(int)*rVariant.pbVal;
+                break;
+            case VT_UI1:
+                pArg->mnKind = TRACE_VALUE_UNSIGNED;
+                pArg->mnValue = *rVariant.pbVal;
+                break;
+            case VT_UI2:
+                pArg->mnKind = TRACE_VALUE_UNSIGNED;
+                pArg->mnValue = (unsigned short)*rVariant.piVal;
+                break;
+            case VT_UI4:
+            case VT_UINT:
+                pArg->mnKind = TRACE_VALUE_UNSIGNED;
+                pArg->mnValue = (unsigned int)*rVariant.plVal;
+                break;
+            case VT_I8:
+                pArg->mnKind = TRACE_VALUE_SIGNED;
+                pArg->mnValue = (uint64_t)*rVariant.pllVal;
+                break;
+            case VT_UI8:
+                pArg->mnKind = TRACE_VALUE_UNSIGNED;
+                pArg->mnValue = (uint64_t)*rVariant.pllVal;
+                break;
+            case VT_PTR:
+                pArg->mnKind = TRACE_VALUE_POINTER;
+                pArg->mnValue = (uint64_t)(uintptr_t)*(void**)rVariant.byref;
+                break;
+            default:
+                pArg->mnKind = TRACE_VALUE_UNHANDLED;
+                pArg->mnValue = rVariant.vt & VT_TYPEMASK;
+                break;
+        }
+        return;
+    }
+
+    switch (rVariant.vt & VT_TYPEMASK)
+    {
+        case VT_EMPTY:
+        case VT_NULL:
+            break;
+        case VT_I2:
+            pArg->mnKind = TRACE_VALUE_SIGNED;
+            pArg->mnValue = (uint64_t)(int64_t)rVariant.iVal;
+            break;
+        case VT_I4:
+        case VT_INT:
+            pArg->mnKind = TRACE_VALUE_SIGNED;
+            pArg->mnValue = (uint64_t)(int64_t)rVariant.lVal;
+            break;
+        case VT_R4:
+        {
+            const double fValue = rVariant.fltVal;
+            pArg->mnKind = TRACE_VALUE_DOUBLE;
+            std::memcpy(&pArg->mnValue, &fValue, sizeof(fValue));
+            break;
+        }
+        case VT_R8:
+            pArg->mnKind = TRACE_VALUE_DOUBLE;
+            std::memcpy(&pArg->mnValue, &rVariant.dblVal, sizeof(double));
+            break;
+        case VT_CY:
+            pArg->mnKind = TRACE_VALUE_SIGNED;
+            pArg->mnValue = (uint64_t)rVariant.cyVal.int64;
+            break;
+        case VT_DATE:
+            pArg->mnKind = TRACE_VALUE_DOUBLE;
+            std::memcpy(&pArg->mnValue, &rVariant.date, sizeof(double));
+            break;
+        case VT_BSTR:
+            addString(*pArg, rVariant.bstrVal, SysStringLen(rVariant.bstrVal));
+            break;
+        case VT_DISPATCH:
+            pArg->mnKind = TRACE_VALUE_POINTER;
+            pArg->mnValue = (uint64_t)(uintptr_t)rVariant.pdispVal;
+            break;
+        case VT_ERROR:
+        case VT_HRESULT:
+            pArg->mnKind = TRACE_VALUE_NAME;
+            pArg->mnValue = resultName(rVariant.lVal);
+            break;
+        case VT_BOOL:
+            pArg->mnKind = TRACE_VALUE_BOOL;
+            pArg->mnValue = (rVariant.boolVal != 0);
+            break;
+        case VT_UNKNOWN:
+            pArg->mnKind = TRACE_VALUE_POINTER;
+            pArg->mnValue = (uint64_t)(uintptr_t)rVariant.punkVal;
+            break;
+        case VT_DECIMAL:
+            pArg->mnKind = TRACE_VALUE_DECIMAL;
+            pArg->mnValue = rVariant.decVal.Lo64;
+            pArg->mnLength = rVariant.decVal.Hi32;
+            break;
+        case VT_I1:
+            pArg->mnKind = TRACE_VALUE_SIGNED;
+            pArg->mnValue = (uint64_t)(int64_t)(int)rVariant.bVal;
+            break;
+        case VT_UI1:
+            pArg->mnKind = TRACE_VALUE_UNSIGNED;
+            pArg->mnValue = rVariant.bVal;
+            break;
+        case VT_UI2:
+            pArg->mnKind = TRACE_VALUE_UNSIGNED;
+            pArg->mnValue = (unsigned short)rVariant.iVal;
+            break;
+        case VT_UI4:
+        case VT_UINT:
+            pArg->mnKind = TRACE_VALUE_UNSIGNED;
+            pArg->mnValue = (unsigned int)rVariant.lVal;
+            break;
+        case VT_I8:
+            pArg->mnKind = TRACE_VALUE_SIGNED;
+            pArg->mnValue = (uint64_t)rVariant.llVal;
+            break;
+        case VT_UI8:
+            pArg->mnKind = TRACE_VALUE_UNSIGNED;
+            pArg->mnValue = (uint64_t)rVariant.llVal;
+            break;
+        case VT_PTR:
+        case VT_CARRAY:
+            pArg->mnKind = TRACE_VALUE_POINTER;
+            pArg->mnValue = (uint64_t)(uintptr_t)rVariant.byref;
+            break;
+        case VT_SAFEARRAY:
+            pArg->mnKind = TRACE_VALUE_POINTER;
+            pArg->mnValue = (uint64_t)(uintptr_t)rVariant.parray;
+            break;
+        case VT_LPSTR:
+            addString(*pArg, rVariant.pcVal,
+                      rVariant.pcVal ? (uint32_t)std::strlen(rVariant.pcVal) : 0);
+            break;
+        case VT_LPWSTR:
+        {
+            const wchar_t* pWchar = (const wchar_t*)rVariant.byref;
+            addString(*pArg, pWchar, pWchar ? (uint32_t)wcslen(pWchar) : 0);
+            break;
+        }
+        case VT_INT_PTR:
+        case VT_UINT_PTR:
+            pArg->mnKind = TRACE_VALUE_POINTER;
+            pArg->mnValue = (uint64_t)(uintptr_t)rVariant.plVal;
+            break;
+        default:
+            pArg->mnKind = TRACE_VALUE_UNHANDLED;
+            pArg->mnValue = rVariant.vt & VT_TYPEMASK;
+            break;
+    }
+}
+
+void BinaryTrace::Record::commit()
+{
+    assert(mnSize >= sizeof(TraceRecordHeader) && mnSize % 8 == 0);
+
+    const TraceRecordHeader* pHeader = reinterpret_cast<const TraceRecordHeader*>(maBuffer);
+
+    char* pRecord = static_cast<char*>(reserve(mnSize));
+    std::memcpy(pRecord + sizeof(TraceRecordHeader), maBuffer + sizeof(TraceRecordHeader),
+                mnSize - sizeof(TraceRecordHeader));
+    commitHeader(pRecord, (TraceRecordType)pHeader->mnType, pHeader->mnFlags, mnSize);
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab cinoptions=b1,g0,N-s cinkeys+=0=break: */
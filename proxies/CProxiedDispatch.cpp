@@ -12,8 +12,11 @@
 
 #include <cassert>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <map>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <Windows.h>
@@ -23,8 +26,11 @@
 
 #include "utils.hpp"
 
+#include "BinaryTrace.hpp"
 #include "CProxiedDispatch.hpp"
 #include "CProxiedEnumVARIANT.hpp"
+#include "ControlChannel.hpp"
+#include "TraceFilter.hpp"
 
 #include "ProxyCreator.hxx"
 
@@ -48,12 +54,24 @@ CProxiedDispatch::CProxiedDispatch(IUnknown* pBaseClassUnknown, IDispatch* pDisp
     , mpDispatchToProxy(pDispatchToProxy)
     , mpDispIdToName(new std::map<DISPID, std::map<DISPID, std::string>>)
     , msPropName(sPropName)
+    , mpFuncDescIndex(nullptr)
 {
+    mbPooled = true;
+
     if (getParam()->mbVerbose)
         std::cout << this << "@CProxiedDispatch::CTOR(" << pBaseClassUnknown << ", "
                   << pDispatchToProxy << ", " << rIID1 << ", " << rIID2 << ")" << std::endl;
 }
 
+void CProxiedDispatch::recycle(CProxiedDispatch* pProxy)
+{
+    if (getParam()->mbVerbose)
+        std::cout << pProxy << "@CProxiedDispatch::recycle" << std::endl;
+
+    delete pProxy->mpDispIdToName;
+    ProxyPool::deallocate(pProxy);
+}
+
 CProxiedDispatch* CProxiedDispatch::get(IUnknown* pBaseClassUnknown, IDispatch* pDispatchToProxy,
                                         const char* sLibName, const char* sPropName)
 {
@@ -79,29 +97,268 @@ CProxiedDispatch* CProxiedDispatch::get(IUnknown* pBaseClassUnknown, IDispatch*
                                 sPropName);
 }
 
-HRESULT CProxiedDispatch::genericInvoke(const std::string& rFuncName, int nInvKind,
-                                        std::vector<VARIANT>& rParameters, void* pRetval)
+// Walking all the FUNCDESCs of a type to find the one for a DISPID is expensive for the large
+// interfaces in Word and Excel, so we do it just once per interface. The ITypeInfo and the
+// FUNCDESCs are intentionally never released, the index lives as long as the process.
+
+struct CProxiedDispatch::FuncDescIndex
+{
+    ITypeInfo* mpTypeInfo;
+
+    // From the TYPEATTR, GUID_NULL if it has none
+    IID maGuid;
+
+    // The FUNCDESCs for each MEMBERID, in the order of the type. Typically just one, or a property
+    // get and put pair.
+    std::unordered_map<MEMBERID, std::vector<FUNCDESC*>> maFuncDescs;
+
+    // For tracing. GetDocumentation() allocates a BSTR that we would then convert to UTF-8 on each
+    // call, so the names are looked up once, the member names when first needed. As the index
+    // and its ITypeInfo are never released, the strings stay valid and can be used without
+    // holding the lock.
+    std::string msTypeName;
+    SRWLOCK maMemberNamesLock;
+    std::unordered_map<MEMBERID, std::string> maMemberNames;
+};
+
+static std::string documentationName(ITypeInfo* pTI, MEMBERID nMemberId)
+{
+    BSTR sName = NULL;
+    if (FAILED(pTI->GetDocumentation(nMemberId, &sName, NULL, NULL, NULL)))
+        return "?";
+
+    std::string sResult = convertUTF16ToUTF8(sName);
+    SysFreeString(sName);
+    return sResult;
+}
+
+const std::string& CProxiedDispatch::memberName(FuncDescIndex* pIndex, MEMBERID nMemberId)
+{
+    const std::string* pName = nullptr;
+
+    AcquireSRWLockShared(&pIndex->maMemberNamesLock);
+    auto p = pIndex->maMemberNames.find(nMemberId);
+    if (p != pIndex->maMemberNames.end())
+        pName = &p->second;
+    ReleaseSRWLockShared(&pIndex->maMemberNamesLock);
+
+    if (pName != nullptr)
+        return *pName;
+
+    const std::string sName = documentationName(pIndex->mpTypeInfo, nMemberId);
+
+    AcquireSRWLockExclusive(&pIndex->maMemberNamesLock);
+    const std::string& rName = pIndex->maMemberNames.emplace(nMemberId, sName).first->second;
+    ReleaseSRWLockExclusive(&pIndex->maMemberNamesLock);
+
+    return rName;
+}
+
+// Only the first thread to build the index of an interface gets to keep it, others throw theirs
+// away.
+void CProxiedDispatch::freeFuncDescIndex(FuncDescIndex* pIndex)
+{
+    for (auto& rFuncDescs : pIndex->maFuncDescs)
+        for (FUNCDESC* pFuncDesc : rFuncDescs.second)
+            pIndex->mpTypeInfo->ReleaseFuncDesc(pFuncDesc);
+    pIndex->mpTypeInfo->Release();
+    delete pIndex;
+}
+
+CProxiedDispatch::FuncDescIndex* CProxiedDispatch::getFuncDescIndex(IDispatch* pDispatch)
+{
+    static std::map<IID, FuncDescIndex*>& rIndexByGuid = *new std::map<IID, FuncDescIndex*>;
+
+    // For types without a GUID, which presumably are rare. We hold on to the ITypeInfo so the key
+    // stays unique.
+    static std::map<ITypeInfo*, FuncDescIndex*>& rIndexByTypeInfo
+        = *new std::map<ITypeInfo*, FuncDescIndex*>;
+
+    // Guards both maps. Not held while calling the ITypeInfo.
+    static SRWLOCK aIndexLock = SRWLOCK_INIT;
+
+    ITypeInfo* pTI = NULL;
+    if (FAILED(pDispatch->GetTypeInfo(0, LOCALE_USER_DEFAULT, &pTI)))
+        return nullptr;
+
+    TYPEATTR* pTA = NULL;
+    HRESULT nResult = pTI->GetTypeAttr(&pTA);
+    const bool bHaveGuid = !FAILED(nResult) && pTA->guid != GUID_NULL;
+    const IID aGuid = bHaveGuid ? pTA->guid : GUID_NULL;
+
+    FuncDescIndex* pExisting = nullptr;
+
+    AcquireSRWLockShared(&aIndexLock);
+    if (bHaveGuid)
+    {
+        auto p = rIndexByGuid.find(aGuid);
+        if (p != rIndexByGuid.end())
+            pExisting = p->second;
+    }
+    else
+    {
+        auto p = rIndexByTypeInfo.find(pTI);
+        if (p != rIndexByTypeInfo.end())
+            pExisting = p->second;
+    }
+    ReleaseSRWLockShared(&aIndexLock);
+
+    if (pExisting != nullptr)
+    {
+        if (!FAILED(nResult))
+            pTI->ReleaseTypeAttr(pTA);
+        pTI->Release();
+        return pExisting;
+    }
+
+    // Keeps the reference we got from GetTypeInfo().
+    FuncDescIndex* pIndex = new FuncDescIndex;
+    pIndex->mpTypeInfo = pTI;
+    pIndex->maGuid = aGuid;
+    pIndex->msTypeName = documentationName(pTI, MEMBERID_NIL);
+    InitializeSRWLock(&pIndex->maMemberNamesLock);
+
+    if (!FAILED(nResult))
+    {
+        for (UINT i = 0; i < pTA->cFuncs; ++i)
+        {
+            FUNCDESC* pFuncDesc;
+            if (FAILED(pTI->GetFuncDesc(i, &pFuncDesc)))
+                break;
+            pIndex->maFuncDescs[pFuncDesc->memid].push_back(pFuncDesc);
+        }
+        pTI->ReleaseTypeAttr(pTA);
+    }
+
+    // Look again, another thread might have been building the same index meanwhile.
+    AcquireSRWLockExclusive(&aIndexLock);
+    if (bHaveGuid)
+    {
+        auto p = rIndexByGuid.emplace(aGuid, pIndex);
+        if (!p.second)
+            pExisting = p.first->second;
+    }
+    else
+    {
+        auto p = rIndexByTypeInfo.emplace(pTI, pIndex);
+        if (!p.second)
+            pExisting = p.first->second;
+    }
+    ReleaseSRWLockExclusive(&aIndexLock);
+
+    if (pExisting != nullptr)
+    {
+        freeFuncDescIndex(pIndex);
+        return pExisting;
+    }
+
+    return pIndex;
+}
+
+// The single-IID constructor puts IID_IDispatch in maIID1 and the interface in maIID2. Generated
+// proxies for a coclass's default interface put the interface in maIID1 and the coclass's IID in
+// maIID2. Generic proxies often have neither, then the type information is all we have.
+const IID& CProxiedDispatch::interfaceIID() const
+{
+    if (!IsEqualIID(maIID1, IID_IDispatch))
+        return maIID1;
+    if (!IsEqualIID(maIID2, IID_NULL))
+        return maIID2;
+
+    const FuncDescIndex* pIndex = mpFuncDescIndex;
+    if (pIndex != nullptr && !IsEqualIID(pIndex->maGuid, GUID_NULL))
+        return pIndex->maGuid;
+
+    return maIID1;
+}
+
+CallStatistics::Counters* CProxiedDispatch::callCounters(MEMBERID nMemberId, int nInvKind,
+                                                         const char* sTypeName,
+                                                         const char* sMemberName)
+{
+    const IID& rIID = interfaceIID();
+    CallStatistics::Counters* pCounters = CallStatistics::find(rIID, nMemberId, nInvKind);
+    if (pCounters != nullptr)
+        return pCounters;
+
+    if (sMemberName != nullptr)
+        return CallStatistics::add(rIID, nMemberId, nInvKind, msLibName, sTypeName, sMemberName);
+
+    sTypeName = msPropName;
+    std::string sName;
+
+    FuncDescIndex* pIndex = mpFuncDescIndex;
+    if (pIndex != nullptr)
+    {
+        sTypeName = pIndex->msTypeName.c_str();
+        sName = memberName(pIndex, nMemberId);
+    }
+    else if (mpDispIdToName->count(nMemberId))
+        sName = (*mpDispIdToName)[nMemberId][0];
+    else
+        sName = std::to_string(nMemberId);
+
+    return CallStatistics::add(rIID, nMemberId, nInvKind, msLibName, sTypeName, sName);
+}
+
+HRESULT CProxiedDispatch::genericInvoke(const char* sTypeName, const wchar_t* pFuncName,
+                                        int nInvKind, VARIANTARG* pParameters, UINT nParameters,
+                                        void* pRetval, MemberIdSlot& rSlot)
 {
     if (getParam()->mbVerbose)
     {
         std::cout << std::endl;
-        std::cout << this << "@CProxiedDispatch::genericInvoke(" << rFuncName << ")..."
-                  << std::endl;
+        std::cout << this << "@CProxiedDispatch::genericInvoke(" << convertUTF16ToUTF8(pFuncName)
+                  << ")..." << std::endl;
     }
 
     HRESULT nResult = S_OK;
 
-    std::wstring sFuncNameWstr = convertUTF8ToUTF16(rFuncName.c_str());
-    LPOLESTR pFuncNameWstr = (LPOLESTR)sFuncNameWstr.data();
+    // In the redirection case each GetIDsOfNames() call is a round trip to the replacement app, so
+    // the result, also a negative one, is remembered in the slot, which is per generated class. We
+    // assume that all objects proxied as the same interface are of the same class in the
+    // replacement app.
+    //
+    // Several threads can look up the same name at once. Each calls GetIDsOfNames() into a local
+    // and then publishes the id before the flag, so that a thread that sees the flag set also sees
+    // the id.
 
     MEMBERID nMemberId;
+    if (rSlot.mnLookedUp == 0)
+    {
+        // Never freed, like the slot. Only the first copy is kept.
+        if (rSlot.msName == nullptr)
+        {
+            char* sName = _strdup(convertUTF16ToUTF8(pFuncName).data());
+            if (InterlockedCompareExchangePointer((PVOID volatile*)&rSlot.msName, sName, nullptr)
+                != nullptr)
+                free(sName);
+        }
+
+        nResult = mpDispatchToProxy->GetIDsOfNames(IID_NULL, const_cast<LPOLESTR*>(&pFuncName), 1,
+                                                   LOCALE_USER_DEFAULT, &nMemberId);
+
+        // Other failures might be transient, don't remember those.
+        if (nResult == DISP_E_UNKNOWNNAME)
+            nMemberId = DISPID_UNKNOWN;
+        if (nResult == DISP_E_UNKNOWNNAME || !FAILED(nResult))
+        {
+            rSlot.mnMemberId = nMemberId;
+            InterlockedExchange(&rSlot.mnLookedUp, 1);
+        }
+    }
+    else
+    {
+        nMemberId = rSlot.mnMemberId;
+        if (nMemberId == DISPID_UNKNOWN)
+            nResult = DISP_E_UNKNOWNNAME;
+    }
 
-    nResult = mpDispatchToProxy->GetIDsOfNames(IID_NULL, &pFuncNameWstr, 1, LOCALE_USER_DEFAULT,
-                                               &nMemberId);
     if (nResult == DISP_E_UNKNOWNNAME)
     {
         if (getParam()->mbVerbose)
-            std::cout << this << "@CProxiedDispatch::genericInvoke(" << rFuncName
+            std::cout << this << "@CProxiedDispatch::genericInvoke("
+                      << convertUTF16ToUTF8(pFuncName)
                       << "): Not implemented in the replacement app" << std::endl;
         return E_NOTIMPL;
     }
@@ -109,7 +366,8 @@ HRESULT CProxiedDispatch::genericInvoke(const std::string& rFuncName, int nInvKi
     if (FAILED(nResult))
     {
         if (getParam()->mbVerbose)
-            std::cout << this << "@CProxiedDispatch::genericInvoke(" << rFuncName
+            std::cout << this << "@CProxiedDispatch::genericInvoke("
+                      << convertUTF16ToUTF8(pFuncName)
                       << "): GetIDsOfNames failed: " << WindowsErrorStringFromHRESULT(nResult)
                       << std::endl;
         return nResult;
@@ -131,15 +389,16 @@ HRESULT CProxiedDispatch::genericInvoke(const std::string& rFuncName, int nInvKi
             nFlags = DISPATCH_PROPERTYPUTREF;
             break;
         default:
-            std::cout << this << "@CProxiedDispatch::genericInvoke(" << rFuncName
-                      << "): Unhandled nInvKind: " << nInvKind << std::endl;
+            std::cout << this << "@CProxiedDispatch::genericInvoke("
+                      << convertUTF16ToUTF8(pFuncName) << "): Unhandled nInvKind: " << nInvKind
+                      << std::endl;
             std::abort();
     }
 
     DISPPARAMS aDispParams;
-    aDispParams.rgvarg = rParameters.data();
+    aDispParams.rgvarg = pParameters;
     aDispParams.rgdispidNamedArgs = NULL;
-    aDispParams.cArgs = (UINT)rParameters.size();
+    aDispParams.cArgs = nParameters;
     aDispParams.cNamedArgs = 0;
 
     VARIANT aResult;
@@ -155,12 +414,39 @@ HRESULT CProxiedDispatch::genericInvoke(const std::string& rFuncName, int nInvKi
         aDispParams.cNamedArgs = 1;
     }
 
+    // The -t output is done by the generated code, which knows the parameter types.
+    const bool bBinaryTrace
+        = BinaryTrace::isOpen()
+          && TraceFilter::accept(interfaceIID(), nMemberId, false, msLibName, sTypeName,
+                                 rSlot.msName);
+    if (bBinaryTrace)
+        writeBinaryGenericCall(nMemberId, nInvKind, sTypeName, rSlot.msName, &aDispParams);
+
+    CallStatistics::Counters* pCounters = nullptr;
+    uint64_t nStart = 0;
+    if (CallStatistics::isActive())
+    {
+        pCounters = callCounters(nMemberId, nInvKind, sTypeName, rSlot.msName);
+        nStart = CallStatistics::now();
+    }
+
+    ControlChannel::countCall();
     nResult = mpDispatchToProxy->Invoke(nMemberId, IID_NULL, LOCALE_USER_DEFAULT, nFlags,
                                         &aDispParams, &aResult, NULL, &nArgErr);
+
+    if (pCounters != nullptr)
+        CallStatistics::record(pCounters, nStart, nResult);
+
+    if (bBinaryTrace)
+        writeBinaryReturn(nResult, NULL, &aDispParams,
+                          (nInvKind == INVOKE_FUNC || nInvKind == INVOKE_PROPERTYGET) ? &aResult
+                                                                                      : NULL,
+                          "");
     if (FAILED(nResult))
     {
         if (getParam()->mbVerbose)
-            std::cout << "..." << this << "@CProxiedDispatch::genericInvoke(" << rFuncName
+            std::cout << "..." << this << "@CProxiedDispatch::genericInvoke("
+                      << convertUTF16ToUTF8(pFuncName)
                       << "): " << WindowsErrorStringFromHRESULT(nResult) << std::endl;
         return nResult;
     }
@@ -188,14 +474,15 @@ HRESULT CProxiedDispatch::genericInvoke(const std::string& rFuncName, int nInvKi
                 *(IDispatch**)pRetval = aResult.pdispVal;
                 break;
             default:
-                std::cout << this << "@CProxiedDispatch::genericInvoke(" << rFuncName
-                          << "): Unhandled vt: " << aResult.vt << std::endl;
+                std::cout << this << "@CProxiedDispatch::genericInvoke("
+                          << convertUTF16ToUTF8(pFuncName) << "): Unhandled vt: " << aResult.vt
+                          << std::endl;
                 std::abort();
         }
     }
     if (getParam()->mbVerbose)
-        std::cout << "..." << this << "@CProxiedDispatch::genericInvoke(" << rFuncName << "): S_OK"
-                  << std::endl;
+        std::cout << "..." << this << "@CProxiedDispatch::genericInvoke("
+                  << convertUTF16ToUTF8(pFuncName) << "): S_OK" << std::endl;
 
     return S_OK;
 }
@@ -252,7 +539,9 @@ HRESULT STDMETHODCALLTYPE CProxiedDispatch::GetIDsOfNames(REFIID riid, LPOLESTR*
     }
     nResult = mpDispatchToProxy->GetIDsOfNames(riid, rgszNames, cNames, lcid, rgDispId);
 
-    if (rgszNames && rgDispId && nResult == S_OK && getParam()->mbTrace)
+    const bool bTrace = getParam()->mbTrace || BinaryTrace::isOpen();
+
+    if (rgszNames && rgDispId && nResult == S_OK && bTrace)
     {
         std::string sName = convertUTF16ToUTF8(rgszNames[0]);
         if (mpDispIdToName->count(rgDispId[0]))
@@ -281,7 +570,7 @@ HRESULT STDMETHODCALLTYPE CProxiedDispatch::GetIDsOfNames(REFIID riid, LPOLESTR*
         else
             std::cout << WindowsErrorStringFromHRESULT(nResult) << std::endl;
     }
-    else if (getParam()->mbTrace)
+    else if (bTrace)
     {
         if (nResult == S_OK)
         {
@@ -295,6 +584,148 @@ HRESULT STDMETHODCALLTYPE CProxiedDispatch::GetIDsOfNames(REFIID riid, LPOLESTR*
     return nResult;
 }
 
+// Names are added just once, keyed by the address of the string they come from, which stays the
+// same.
+
+void CProxiedDispatch::writeBinaryCall(DISPID dispIdMember, const std::string* pTypeName,
+                                       const std::string* pMemberName, FUNCDESC* pFuncDesc,
+                                       DISPPARAMS* pDispParams)
+{
+    BinaryTrace::Record aRecord;
+    TraceCallRecord& rCall = aRecord.call();
+
+    rCall.mnProxy = (uint64_t)(uintptr_t)(mpBaseClassUnknown ? mpBaseClassUnknown : this);
+    rCall.mnDispId = dispIdMember;
+    std::memcpy(rCall.maIID, &interfaceIID(), sizeof(rCall.maIID));
+    if (pFuncDesc != NULL)
+        rCall.mnInvKind = (uint16_t)pFuncDesc->invkind;
+
+    if (!BinaryTrace::findName(msLibName, 0, rCall.mnLibName))
+        rCall.mnLibName = BinaryTrace::addName(msLibName, 0, msLibName);
+
+    if (pTypeName == nullptr)
+    {
+        if (msPropName == nullptr)
+            rCall.mnTypeName = BinaryTrace::name("?");
+        else if (!BinaryTrace::findName(msPropName, 0, rCall.mnTypeName))
+            rCall.mnTypeName = BinaryTrace::addName(msPropName, 0, msPropName);
+
+        if (mpDispIdToName->count(dispIdMember))
+            rCall.mnMemberName = BinaryTrace::name((*mpDispIdToName)[dispIdMember][0]);
+        else
+            rCall.mnMemberName = BinaryTrace::name(std::to_string(dispIdMember));
+    }
+    else
+    {
+        if (!BinaryTrace::findName(pTypeName, 0, rCall.mnTypeName))
+            rCall.mnTypeName = BinaryTrace::addName(pTypeName, 0, *pTypeName);
+        if (!BinaryTrace::findName(pMemberName, 0, rCall.mnMemberName))
+            rCall.mnMemberName = BinaryTrace::addName(pMemberName, 0, *pMemberName);
+    }
+
+    // Same choice of what to print as for the text trace in Invoke().
+
+    if (pFuncDesc != NULL
+        && !(pFuncDesc->invkind == INVOKE_PROPERTYGET && pDispParams->cArgs == 0)
+        && !((pFuncDesc->invkind == INVOKE_PROPERTYPUT
+              || pFuncDesc->invkind == INVOKE_PROPERTYPUTREF)
+             && pDispParams->cArgs == 1))
+    {
+        rCall.maHeader.mnFlags = TRACE_CALL_PARENTHESES;
+        for (UINT n = 0; n < pDispParams->cArgs; ++n)
+        {
+            if ((SHORT)n < pFuncDesc->cParams
+                && !(pFuncDesc->lprgelemdescParam[n].paramdesc.wParamFlags & PARAMFLAG_FIN))
+                aRecord.addArg(pDispParams->rgvarg[n], TRACE_ARG_OUT);
+            else
+                aRecord.addArg(pDispParams->rgvarg[n]);
+        }
+    }
+    else if (pFuncDesc == NULL)
+    {
+        rCall.maHeader.mnFlags = TRACE_CALL_PARENTHESES;
+        for (UINT n = 0; n < pDispParams->cArgs; ++n)
+        {
+            TraceNameId nArgName = 0;
+            if (n < pDispParams->cNamedArgs && pTypeName == nullptr
+                && mpDispIdToName->count(dispIdMember)
+                && (*mpDispIdToName)[dispIdMember].count(pDispParams->rgdispidNamedArgs[n]))
+                nArgName = BinaryTrace::name(
+                    (*mpDispIdToName)[dispIdMember][pDispParams->rgdispidNamedArgs[n]]);
+
+            aRecord.addArg(pDispParams->rgvarg[n], (uint8_t)(nArgName ? TRACE_ARG_NAMED : 0),
+                           nArgName);
+        }
+    }
+
+    aRecord.commit();
+}
+
+void CProxiedDispatch::writeBinaryGenericCall(MEMBERID nMemberId, int nInvKind,
+                                              const char* sTypeName, const char* sMemberName,
+                                              DISPPARAMS* pDispParams)
+{
+    BinaryTrace::Record aRecord;
+    TraceCallRecord& rCall = aRecord.call();
+
+    rCall.mnProxy = (uint64_t)(uintptr_t)(mpBaseClassUnknown ? mpBaseClassUnknown : this);
+    rCall.mnDispId = nMemberId;
+    std::memcpy(rCall.maIID, &interfaceIID(), sizeof(rCall.maIID));
+    rCall.mnInvKind = (uint16_t)nInvKind;
+
+    if (!BinaryTrace::findName(msLibName, 0, rCall.mnLibName))
+        rCall.mnLibName = BinaryTrace::addName(msLibName, 0, msLibName);
+    if (!BinaryTrace::findName(sTypeName, 0, rCall.mnTypeName))
+        rCall.mnTypeName = BinaryTrace::addName(sTypeName, 0, sTypeName);
+    if (!BinaryTrace::findName(sMemberName, 0, rCall.mnMemberName))
+        rCall.mnMemberName = BinaryTrace::addName(sMemberName, 0, sMemberName);
+
+    // Like writeBinaryCall() without a FUNCDESC, so a value assigned is among the parameters.
+    if (nInvKind == INVOKE_FUNC || pDispParams->cArgs > 0)
+    {
+        rCall.maHeader.mnFlags = TRACE_CALL_PARENTHESES;
+        for (UINT n = 0; n < pDispParams->cArgs; ++n)
+            aRecord.addArg(pDispParams->rgvarg[n]);
+    }
+
+    aRecord.commit();
+}
+
+void CProxiedDispatch::writeBinaryReturn(HRESULT nResult, FUNCDESC* pFuncDesc,
+                                         DISPPARAMS* pDispParams, VARIANT* pVarResult,
+                                         const std::string& rPrettyResultTypeName)
+{
+    BinaryTrace::Record aRecord;
+
+    if (nResult != S_OK)
+    {
+        TraceReturnRecord& rReturn = aRecord.result(TRACE_RETURN_ERROR);
+        rReturn.mnResult = nResult;
+        rReturn.mnErrorString = BinaryTrace::errorName(nResult);
+    }
+    else if ((pFuncDesc == NULL || pFuncDesc->invkind == INVOKE_FUNC
+              || pFuncDesc->invkind == INVOKE_PROPERTYGET)
+             && pVarResult != NULL)
+    {
+        TraceReturnRecord& rReturn = aRecord.result(TRACE_RETURN_RESULT);
+        if (rPrettyResultTypeName != "")
+            rReturn.mnResultTypeName = BinaryTrace::name(rPrettyResultTypeName);
+        aRecord.addArg(*pVarResult);
+    }
+    else if (pFuncDesc != NULL
+             && (pFuncDesc->invkind == INVOKE_PROPERTYPUT
+                 || pFuncDesc->invkind == INVOKE_PROPERTYPUTREF)
+             && pDispParams->cArgs > 0)
+    {
+        aRecord.result(TRACE_RETURN_ASSIGNED);
+        aRecord.addArg(pDispParams->rgvarg[pDispParams->cArgs - 1]);
+    }
+    else
+        aRecord.result(TRACE_RETURN_NOTHING);
+
+    aRecord.commit();
+}
+
 HRESULT STDMETHODCALLTYPE CProxiedDispatch::Invoke(DISPID dispIdMember, REFIID riid, LCID lcid,
                                                    WORD wFlags, DISPPARAMS* pDispParams,
                                                    VARIANT* pVarResult, EXCEPINFO* pExcepInfo,
@@ -302,61 +733,88 @@ HRESULT STDMETHODCALLTYPE CProxiedDispatch::Invoke(DISPID dispIdMember, REFIID r
 {
     HRESULT nResult;
 
+    // Several threads can get here at once for the same proxy. They all get the same index, but
+    // the member is still set only once.
+    FuncDescIndex* pIndex = mpFuncDescIndex;
+    if (pIndex == nullptr)
+    {
+        pIndex = getFuncDescIndex(mpDispatchToProxy);
+        if (pIndex != nullptr)
+            InterlockedCompareExchangePointer(reinterpret_cast<PVOID volatile*>(&mpFuncDescIndex),
+                                              pIndex, nullptr);
+    }
+
     ITypeInfo* pTI = NULL;
     FUNCDESC* pFuncDesc = NULL;
 
-    nResult = mpDispatchToProxy->GetTypeInfo(0, LOCALE_USER_DEFAULT, &pTI);
+    if (pIndex != nullptr)
+    {
+        pTI = pIndex->mpTypeInfo;
 
-    TYPEATTR* pTA = NULL;
-    if (!FAILED(nResult))
-        nResult = pTI->GetTypeAttr(&pTA);
+        auto p = pIndex->maFuncDescs.find(dispIdMember);
+        if (p != pIndex->maFuncDescs.end())
+        {
+            for (FUNCDESC* pCandidate : p->second)
+            {
+                if (((wFlags & DISPATCH_METHOD) && pCandidate->invkind == INVOKE_FUNC)
+                    || ((wFlags & DISPATCH_PROPERTYGET)
+                        && pCandidate->invkind == INVOKE_PROPERTYGET)
+                    || ((wFlags & DISPATCH_PROPERTYPUT)
+                        && pCandidate->invkind == INVOKE_PROPERTYPUT)
+                    || ((wFlags & DISPATCH_PROPERTYPUTREF)
+                        && pCandidate->invkind == INVOKE_PROPERTYPUTREF))
+                {
+                    pFuncDesc = pCandidate;
+                    break;
+                }
+            }
+        }
+    }
 
-    if (!FAILED(nResult))
+    const std::string* pTypeName = nullptr;
+    const std::string* pMemberName = nullptr;
+
+    bool bTrace = getParam()->mbTrace;
+    bool bBinaryTrace = BinaryTrace::isOpen();
+
+    if (pTI != NULL && (bTrace || bBinaryTrace))
     {
-        for (UINT i = 0; i < pTA->cFuncs; ++i)
-        {
-            nResult = pTI->GetFuncDesc(i, &pFuncDesc);
-            if (FAILED(nResult))
-                break;
+        pTypeName = &pIndex->msTypeName;
+        pMemberName = &memberName(pIndex, dispIdMember);
+    }
 
-            if (pFuncDesc->memid == dispIdMember
-                && (((wFlags & DISPATCH_METHOD) && pFuncDesc->invkind == INVOKE_FUNC)
-                    || ((wFlags & DISPATCH_PROPERTYGET) && pFuncDesc->invkind == INVOKE_PROPERTYGET)
-                    || ((wFlags & DISPATCH_PROPERTYPUT) && pFuncDesc->invkind == INVOKE_PROPERTYPUT)
-                    || ((wFlags & DISPATCH_PROPERTYPUTREF)
-                        && pFuncDesc->invkind == INVOKE_PROPERTYPUTREF)))
-                break;
-            pTI->ReleaseFuncDesc(pFuncDesc);
-            pFuncDesc = NULL;
+    if (bTrace || bBinaryTrace)
+    {
+        const char* sTypeName = (pTypeName != nullptr) ? pTypeName->c_str() : msPropName;
+        const char* sMemberName = nullptr;
+        if (pMemberName != nullptr)
+            sMemberName = pMemberName->c_str();
+        else if (mpDispIdToName->count(dispIdMember))
+            sMemberName = (*mpDispIdToName)[dispIdMember][0].c_str();
+
+        if (!TraceFilter::accept(interfaceIID(), dispIdMember, false, msLibName, sTypeName,
+                                 sMemberName))
+        {
+            bTrace = false;
+            bBinaryTrace = false;
         }
     }
 
-    if (getParam()->mbTrace)
+    if (bTrace)
     {
         std::cout << msLibName << "." << std::flush;
 
-        if (pTI == NULL)
+        if (pTypeName == nullptr)
             if (msPropName != nullptr)
                 std::cout << msPropName;
             else
                 std::cout << "?";
         else
-        {
-            BSTR sTypeName = NULL;
-            nResult = pTI->GetDocumentation(MEMBERID_NIL, &sTypeName, NULL, NULL, NULL);
-
-            if (FAILED(nResult))
-                std::cout << "?";
-            else
-            {
-                std::cout << convertUTF16ToUTF8(sTypeName);
-                SysFreeString(sTypeName);
-            }
-        }
+            std::cout << *pTypeName;
 
         std::cout << "<" << (mpBaseClassUnknown ? mpBaseClassUnknown : this) << ">.";
 
-        if (pTI == NULL)
+        if (pMemberName == nullptr)
             if (mpDispIdToName->count(dispIdMember))
             {
                 std::cout << (*mpDispIdToName)[dispIdMember][0];
@@ -364,18 +822,7 @@ HRESULT STDMETHODCALLTYPE CProxiedDispatch::Invoke(DISPID dispIdMember, REFIID r
             else
                 std::cout << dispIdMember;
         else
-        {
-            BSTR sFuncName = NULL;
-            nResult = pTI->GetDocumentation(dispIdMember, &sFuncName, NULL, NULL, NULL);
-
-            if (FAILED(nResult))
-                std::cout << "?";
-            else
-            {
-                std::cout << convertUTF16ToUTF8(sFuncName);
-                SysFreeString(sFuncName);
-            }
-        }
+            std::cout << *pMemberName;
 
         // Print in and inout parameters. If we don't have type information, we don't know which
         // ones are just out. If this is a property assignment, and there is just one parameter,
@@ -429,11 +876,29 @@ HRESULT STDMETHODCALLTYPE CProxiedDispatch::Invoke(DISPID dispIdMember, REFIID r
         std::cout << this << "@CProxiedDispatch::Invoke(0x" << to_hex(dispIdMember) << ")..."
                   << std::endl;
 
+    if (bBinaryTrace)
+        writeBinaryCall(dispIdMember, pTypeName, pMemberName, pFuncDesc, pDispParams);
+
+    CallStatistics::Counters* pCounters = nullptr;
+    uint64_t nStart = 0;
+    if (CallStatistics::isActive())
+    {
+        pCounters = callCounters(dispIdMember,
+                                 pFuncDesc != NULL ? (int)pFuncDesc->invkind
+                                                   : CallStatistics::invKindFromFlags(wFlags),
+                                 nullptr, nullptr);
+        nStart = CallStatistics::now();
+    }
+
+    ControlChannel::countCall();
     increaseIndent();
     nResult = mpDispatchToProxy->Invoke(dispIdMember, riid, lcid, wFlags, pDispParams, pVarResult,
                                         pExcepInfo, puArgErr);
     decreaseIndent();
 
+    if (pCounters != nullptr)
+        CallStatistics::record(pCounters, nStart, nResult);
+
     std::string sPrettyResultTypeName;
 
     if (nResult == S_OK && pFuncDesc != NULL)
@@ -464,7 +929,10 @@ HRESULT STDMETHODCALLTYPE CProxiedDispatch::Invoke(DISPID dispIdMember, REFIID r
         }
     }
 
-    if (nResult == S_OK && getParam()->mbTrace)
+    if (bBinaryTrace)
+        writeBinaryReturn(nResult, pFuncDesc, pDispParams, pVarResult, sPrettyResultTypeName);
+
+    if (nResult == S_OK && bTrace)
     {
         // FIXME: Print inout and out parameters here.
 
@@ -520,11 +988,8 @@ HRESULT STDMETHODCALLTYPE CProxiedDispatch::Invoke(DISPID dispIdMember, REFIID r
                 mbIsAtBeginningOfLine = true;
             }
         }
-
-        if (pFuncDesc != NULL)
-            pTI->ReleaseFuncDesc(pFuncDesc);
     }
-    else if (getParam()->mbTrace)
+    else if (bTrace)
     {
         std::cout << ": " << WindowsErrorStringFromHRESULT(nResult) << std::endl;
         mbIsAtBeginningOfLine = true;
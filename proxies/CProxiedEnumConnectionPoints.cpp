@@ -16,6 +16,8 @@
 
 #pragma warning(pop)
 
+#include "utils.hpp"
+
 #include "CProxiedConnectionPoint.hpp"
 #include "CProxiedConnectionPointContainer.hpp"
 #include "CProxiedEnumConnectionPoints.hpp"
@@ -16,6 +16,7 @@
 #include <string>
 
 #include <Windows.h>
+#include <emmintrin.h>
 
 #pragma warning(pop)
 
@@ -27,13 +28,14 @@
 #include "CProxiedEnumConnections.hpp"
 #include "CProxiedSink.hpp"
 #include "CProxiedUnknown.hpp"
+#include "ProxyPool.hpp"
 
 static ThreadProcParam* pGlobalParam;
 
-CProxiedUnknown::UnknownMapHolder* const CProxiedUnknown::mpLookupMap
-    = new CProxiedUnknown::UnknownMapHolder();
-unsigned CProxiedUnknown::mnIndent = 0;
-bool CProxiedUnknown::mbIsAtBeginningOfLine = true;
+IdentityMap<IUnknown, CProxiedUnknown::SRWLock>* const CProxiedUnknown::mpLookupMap
+    = new IdentityMap<IUnknown, CProxiedUnknown::SRWLock>();
+thread_local unsigned CProxiedUnknown::mnIndent = 0;
+thread_local bool CProxiedUnknown::mbIsAtBeginningOfLine = true;
 
 CProxiedUnknown::CProxiedUnknown(IUnknown* pBaseClassUnknown, IUnknown* pUnknownToProxy,
                                  const IID& rIID, const char* sLibName)
@@ -44,28 +46,35 @@ CProxiedUnknown::CProxiedUnknown(IUnknown* pBaseClassUnknown, IUnknown* pUnknown
 CProxiedUnknown::CProxiedUnknown(IUnknown* pBaseClassUnknown, IUnknown* pUnknownToProxy,
                                  const IID& rIID1, const IID& rIID2, const char* sLibName)
     : mpUnknownToProxy(pUnknownToProxy)
-    // FIXME: Must delete mpExtraInterfaces when Release() returns zero?
-    , mpExtraInterfaces(new IIDMapHolder())
+    , mnExtraInterfaces(0)
+    , mpMoreExtraInterfaces(nullptr)
+    , mnRefs(1)
     , mpBaseClassUnknown(pBaseClassUnknown)
+    , mbPooled(false)
     , maIID1(rIID1)
     , maIID2(rIID2)
     , msLibName(sLibName)
 {
+    InitializeSRWLock(&maExtraInterfacesLock);
+
     if (getParam()->mbVerbose)
         std::cout << this << "@CProxiedUnknown::CTOR(" << pBaseClassUnknown << ", "
                   << pUnknownToProxy << ", " << rIID1 << ", " << rIID2 << ")" << std::endl;
 
-    // Assertion fails with customer application so don't use a real assert() for now until I
-    // understand what is going on.
-    if (!(pBaseClassUnknown != NULL || mpLookupMap->maMap.count(pUnknownToProxy) == 0))
+    if (pBaseClassUnknown != NULL)
+        InterlockedIncrement(&static_cast<CProxiedUnknown*>(pBaseClassUnknown)->mnRefs);
+    else
     {
-        std::cout << "ASSERTION FAILURE! pBaseClassUnknown=" << pBaseClassUnknown
-                  << ", mpLookupMap->maMap.count(" << pUnknownToProxy
-                  << ")=" << mpLookupMap->maMap.count(pUnknownToProxy) << std::endl;
+        // Assertion fails with customer application so don't use a real assert() for now until I
+        // understand what is going on. (It also fails if two threads race to create a proxy for
+        // the same object. The last one wins, the other one still works but is not found.)
+        void* pPrevious = mpLookupMap->insert(pUnknownToProxy, this);
+        if (pPrevious != nullptr)
+        {
+            std::cout << "ASSERTION FAILURE! Replaced proxy " << pPrevious << " for "
+                      << pUnknownToProxy << std::endl;
+        }
     }
-
-    if (pBaseClassUnknown == NULL)
-        mpLookupMap->maMap[pUnknownToProxy] = this;
 }
 
 CProxiedUnknown* CProxiedUnknown::get(IUnknown* pBaseClassUnknown, IUnknown* pUnknownToProxy,
@@ -84,16 +93,210 @@ CProxiedUnknown* CProxiedUnknown::get(IUnknown* pBaseClassUnknown, IUnknown* pUn
     return new CProxiedUnknown(pBaseClassUnknown, pUnknownToProxy, rIID1, rIID2, sLibName);
 }
 
+// Returns the proxy with a reference added, as if just created.
+
 CProxiedUnknown* CProxiedUnknown::find(IUnknown* pUnknownToProxy)
 {
-    auto p = mpLookupMap->maMap.find(pUnknownToProxy);
-    if (p != mpLookupMap->maMap.end())
-        return reinterpret_cast<CProxiedUnknown*>(p->second);
+    return reinterpret_cast<CProxiedUnknown*>(mpLookupMap->find(
+        pUnknownToProxy,
+        [](void* pProxy) { return reinterpret_cast<CProxiedUnknown*>(pProxy)->tryAddRef(); }));
+}
+
+CProxiedUnknown* CProxiedUnknown::identity()
+{
+    return mpBaseClassUnknown ? static_cast<CProxiedUnknown*>(mpBaseClassUnknown) : this;
+}
+
+// Fails for a pooled proxy whose last reference is already gone, as it is about to be freed. The
+// others are never freed, so if some table still has them, they can come back to life.
+
+bool CProxiedUnknown::tryAddRef()
+{
+    LONG nRefs = mnRefs;
+    while (nRefs > 0 || !mbPooled)
+    {
+        const LONG nPrevious = InterlockedCompareExchange(&mnRefs, nRefs + 1, nRefs);
+        if (nPrevious == nRefs)
+            return true;
+        nRefs = nPrevious;
+    }
+    return false;
+}
+
+void CProxiedUnknown::releaseRef()
+{
+    if (InterlockedDecrement(&mnRefs) == 0)
+        lastRelease();
+}
+
+void CProxiedUnknown::releaseUnowned()
+{
+    if (getParam()->mbVerbose)
+        std::cout << this << "@CProxiedUnknown::releaseUnowned" << std::endl;
+
+    releaseRef();
+}
+
+// Nobody can find this proxy any more once it is out of mpLookupMap and the table of its base, so
+// after that it can be recycled.
+
+void CProxiedUnknown::lastRelease()
+{
+    if (mpBaseClassUnknown == NULL)
+        mpLookupMap->erase(mpUnknownToProxy, this);
+    forgetExtraInterfaces();
+
+    if (!mbPooled)
+        return;
+
+    CProxiedUnknown* pBase = static_cast<CProxiedUnknown*>(mpBaseClassUnknown);
+    if (pBase != nullptr)
+        pBase->removeExtraInterface(this);
+
+    CProxiedDispatch::recycle(static_cast<CProxiedDispatch*>(this));
+
+    if (pBase != nullptr)
+        pBase->releaseRef();
+}
+
+void* CProxiedUnknown::findExtraInterface(REFIID riid)
+{
+    void* pResult = nullptr;
+    CProxiedUnknown* pProxy = nullptr;
+
+    AcquireSRWLockShared(&maExtraInterfacesLock);
+
+    // Compare all 16 bytes of the IIDs at once.
+    const __m128i aIID = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&riid));
+    for (unsigned i = 0; i < mnExtraInterfaces; ++i)
+    {
+        const __m128i aCandidate
+            = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&maExtraInterfaces[i].maIID));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(aIID, aCandidate)) == 0xFFFF)
+        {
+            pResult = maExtraInterfaces[i].mpInterface;
+            pProxy = maExtraInterfaces[i].mpProxy;
+            break;
+        }
+    }
+
+    if (pResult == nullptr && mpMoreExtraInterfaces != nullptr)
+    {
+        auto p = mpMoreExtraInterfaces->maMap.find(riid);
+        if (p != mpMoreExtraInterfaces->maMap.end())
+        {
+            pResult = p->second.mpInterface;
+            pProxy = p->second.mpProxy;
+        }
+    }
+
+    // A proxy that is being released will remove itself from the table as soon as it gets the
+    // lock, so must not be handed out again. Ask the proxied object for a new one instead.
+    if (pProxy != nullptr && !pProxy->tryAddRef())
+        pResult = nullptr;
+
+    ReleaseSRWLockShared(&maExtraInterfacesLock);
+
+    if (pProxy != nullptr && pResult != nullptr)
+        pProxy->mpUnknownToProxy->AddRef();
+    else if (pResult != nullptr)
+        static_cast<IUnknown*>(pResult)->AddRef();
+
+    return pResult;
+}
+
+void CProxiedUnknown::addExtraInterface(REFIID riid, void* pInterface, CProxiedUnknown* pProxy)
+{
+    AcquireSRWLockExclusive(&maExtraInterfacesLock);
+
+    bool bFound = false;
+    for (unsigned i = 0; i < mnExtraInterfaces; ++i)
+    {
+        if (IsEqualIID(maExtraInterfaces[i].maIID, riid))
+        {
+            maExtraInterfaces[i].mpInterface = pInterface;
+            maExtraInterfaces[i].mpProxy = pProxy;
+            bFound = true;
+            break;
+        }
+    }
+
+    if (!bFound)
+    {
+        if (mnExtraInterfaces < NINLINEEXTRAINTERFACES)
+        {
+            maExtraInterfaces[mnExtraInterfaces].maIID = riid;
+            maExtraInterfaces[mnExtraInterfaces].mpInterface = pInterface;
+            maExtraInterfaces[mnExtraInterfaces].mpProxy = pProxy;
+            mnExtraInterfaces++;
+        }
+        else
+        {
+            if (mpMoreExtraInterfaces == nullptr)
+                mpMoreExtraInterfaces = new IIDMapHolder();
+            mpMoreExtraInterfaces->maMap[riid] = { riid, pInterface, pProxy };
+        }
+    }
+
+    ReleaseSRWLockExclusive(&maExtraInterfacesLock);
+}
+
+// The extra interfaces are kept in the table of the object that is in mpLookupMap, whichever of its
+// interfaces they were asked from. A proxy that was found in mpLookupMap instead of created for us
+// belongs to some other object, and could go away before this one, so it is not remembered.
+
+void CProxiedUnknown::rememberExtraInterface(REFIID riid, CProxiedUnknown* pProxy)
+{
+    CProxiedUnknown* pIdentity = identity();
+    if (pProxy == pIdentity || pProxy->mpBaseClassUnknown == pIdentity)
+        pIdentity->addExtraInterface(riid, pProxy, pProxy);
+}
+
+void CProxiedUnknown::removeExtraInterface(CProxiedUnknown* pProxy)
+{
+    AcquireSRWLockExclusive(&maExtraInterfacesLock);
+
+    for (unsigned i = 0; i < mnExtraInterfaces;)
+    {
+        if (maExtraInterfaces[i].mpProxy == pProxy)
+            maExtraInterfaces[i] = maExtraInterfaces[--mnExtraInterfaces];
+        else
+            i++;
+    }
+
+    if (mpMoreExtraInterfaces != nullptr)
+    {
+        for (auto p = mpMoreExtraInterfaces->maMap.begin();
+             p != mpMoreExtraInterfaces->maMap.end();)
+        {
+            if (p->second.mpProxy == pProxy)
+                p = mpMoreExtraInterfaces->maMap.erase(p);
+            else
+                ++p;
+        }
+    }
 
-    return nullptr;
+    ReleaseSRWLockExclusive(&maExtraInterfacesLock);
 }
 
-void CProxiedUnknown::setParam(ThreadProcParam* pParam) { pGlobalParam = pParam; }
+void CProxiedUnknown::forgetExtraInterfaces()
+{
+    AcquireSRWLockExclusive(&maExtraInterfacesLock);
+
+    mnExtraInterfaces = 0;
+    delete mpMoreExtraInterfaces;
+    mpMoreExtraInterfaces = nullptr;
+
+    ReleaseSRWLockExclusive(&maExtraInterfacesLock);
+}
+
+void CProxiedUnknown::setParam(ThreadProcParam* pParam)
+{
+    pGlobalParam = pParam;
+
+    if (pParam->mbVerbose)
+        std::atexit([]() { ProxyPool::dumpStatistics(std::cout); });
+}
 
 ThreadProcParam* CProxiedUnknown::getParam() { return pGlobalParam; }
 
@@ -133,7 +336,8 @@ HRESULT STDMETHODCALLTYPE CProxiedUnknown::QueryInterface(REFIID riid, void** pp
                           << std::endl;
             *ppvObject = this;
         }
-        AddRef();
+        // The caller will release the object it got, not necessarily this one
+        static_cast<IUnknown*>(*ppvObject)->AddRef();
         return S_OK;
     }
 
@@ -157,13 +361,13 @@ HRESULT STDMETHODCALLTYPE CProxiedUnknown::QueryInterface(REFIID riid, void** pp
         return S_OK;
     }
 
-    auto p = mpExtraInterfaces->maMap.find(riid);
-    if (p != mpExtraInterfaces->maMap.end())
+    void* pExtraInterface = identity()->findExtraInterface(riid);
+    if (pExtraInterface != nullptr)
     {
         if (getParam()->mbVerbose)
             std::cout << this << "@CProxiedUnknown::QueryInterface(" << riid
-                      << "): found: " << p->second << ": S_OK" << std::endl;
-        *ppvObject = p->second;
+                      << "): found: " << pExtraInterface << ": S_OK" << std::endl;
+        *ppvObject = pExtraInterface;
         return S_OK;
     }
 
@@ -178,10 +382,11 @@ HRESULT STDMETHODCALLTYPE CProxiedUnknown::QueryInterface(REFIID riid, void** pp
 
     if (nResult == S_OK && IsEqualIID(riid, IID_IDispatch))
     {
-        *ppvObject = CProxiedDispatch::get(mpBaseClassUnknown ? mpBaseClassUnknown : this,
-                                           (IDispatch*)*ppvObject, msLibName);
+        CProxiedDispatch* pDispatch
+            = CProxiedDispatch::get(identity(), (IDispatch*)*ppvObject, msLibName);
+        *ppvObject = pDispatch;
 
-        mpExtraInterfaces->maMap[riid] = *ppvObject;
+        rememberExtraInterface(riid, pDispatch);
 
         if (getParam()->mbVerbose)
             std::cout << "..." << this << "@CProxiedUnknown::QueryInterface(" << riid << "): S_OK"
@@ -209,11 +414,11 @@ HRESULT STDMETHODCALLTYPE CProxiedUnknown::QueryInterface(REFIID riid, void** pp
                 return E_NOINTERFACE;
             }
         }
-        *ppvObject = CProxiedConnectionPointContainer::get(
-            mpBaseClassUnknown ? mpBaseClassUnknown : this, (IConnectionPointContainer*)*ppvObject,
-            pPCI, msLibName);
+        CProxiedConnectionPointContainer* pCPC = CProxiedConnectionPointContainer::get(
+            identity(), (IConnectionPointContainer*)*ppvObject, pPCI, msLibName);
+        *ppvObject = pCPC;
 
-        mpExtraInterfaces->maMap[riid] = *ppvObject;
+        rememberExtraInterface(riid, pCPC);
 
         if (getParam()->mbVerbose)
             std::cout << "..." << this << "@CProxiedUnknown::QueryInterface(" << riid << "): S_OK"
@@ -231,13 +436,14 @@ HRESULT STDMETHODCALLTYPE CProxiedUnknown::QueryInterface(REFIID riid, void** pp
     }
 
     if (nResult == S_OK)
-        mpExtraInterfaces->maMap[riid] = *ppvObject;
+        identity()->addExtraInterface(riid, *ppvObject, nullptr);
 
     return nResult;
 }
 
 ULONG STDMETHODCALLTYPE CProxiedUnknown::AddRef()
 {
+    InterlockedIncrement(&mnRefs);
     ULONG nRetval = mpUnknownToProxy->AddRef();
     if (getParam()->mbVerbose)
         std::cout << this << "@CProxiedUnknown::AddRef: " << nRetval << std::endl;
@@ -251,11 +457,8 @@ ULONG STDMETHODCALLTYPE CProxiedUnknown::Release()
     if (getParam()->mbVerbose)
         std::cout << this << "@CProxiedUnknown::Release: " << nRetval << std::endl;
 
-    if (nRetval == 0 && mpBaseClassUnknown == NULL)
-    {
-        assert(mpLookupMap->maMap.count(mpUnknownToProxy) == 1);
-        mpLookupMap->maMap.erase(mpUnknownToProxy);
-    }
+    // The return value is for diagnostics only, it's our own count that says when we can go.
+    releaseRef();
 
     return nRetval;
 }
@@ -0,0 +1,315 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of Collabora OLE Automation Translator.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma warning(push)
+#pragma warning(disable : 4668 4820 4917)
+
+#include <algorithm>
+#include <cstdlib>
+#include <cwchar>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <Windows.h>
+
+#pragma warning(pop)
+
+#include "utils.hpp"
+
+#include "CallStatistics.hpp"
+
+bool CallStatistics::mbActive = false;
+double CallStatistics::mfNanosPerTick = 0;
+
+namespace
+{
+struct Key
+{
+    IID maIID;
+    MEMBERID mnMemberId;
+    int mnInvKind;
+
+    bool operator==(const Key& rOther) const
+    {
+        return IsEqualIID(maIID, rOther.maIID) && mnMemberId == rOther.mnMemberId
+               && mnInvKind == rOther.mnInvKind;
+    }
+};
+
+struct KeyHash
+{
+    size_t operator()(const Key& rKey) const
+    {
+        return hashIID(rKey.maIID, (unsigned)rKey.mnMemberId * 4 + (unsigned)rKey.mnInvKind);
+    }
+};
+
+struct Entry
+{
+    Key maKey;
+    const char* msLibName;
+    std::string msTypeName;
+    std::string msMemberName;
+    CallStatistics::Counters maCounters;
+};
+
+typedef std::unordered_map<Key, Entry*, KeyHash> EntryMap;
+
+thread_local EntryMap* pThreadEntries;
+
+// The entries of all threads, for writeAtExit(). Intentionally never destroyed, like the entries
+// themselves, as threads can still be making calls while the process exits.
+SRWLOCK aAllEntriesLock = SRWLOCK_INIT;
+std::vector<Entry*>& rAllEntries = *new std::vector<Entry*>;
+
+const wchar_t* pOutputFileName;
+
+const char* invKindName(int nInvKind)
+{
+    switch (nInvKind)
+    {
+        case INVOKE_FUNC:
+            return "method";
+        case INVOKE_PROPERTYGET:
+            return "get";
+        case INVOKE_PROPERTYPUT:
+            return "put";
+        case INVOKE_PROPERTYPUTREF:
+            return "putref";
+        default:
+            return "?";
+    }
+}
+
+std::string csvField(const std::string& rText)
+{
+    if (rText.find_first_of(",\"") == std::string::npos)
+        return rText;
+
+    std::string sResult = "\"";
+    for (char c : rText)
+    {
+        if (c == '"')
+            sResult += '"';
+        sResult += c;
+    }
+    return sResult + "\"";
+}
+
+std::string jsonString(const std::string& rText)
+{
+    std::string sResult = "\"";
+    for (char c : rText)
+    {
+        if (c == '"' || c == '\\')
+            sResult += '\\';
+        sResult += c;
+    }
+    return sResult + "\"";
+}
+
+// Percentiles are bucket upper bounds, which for the last bucket is meaningless.
+uint64_t percentile(const CallStatistics::Counters& rCounters, double fFraction)
+{
+    const uint64_t nNanos = rCounters.maHistogram.percentile(fFraction, rCounters.mnCalls);
+    return nNanos < rCounters.mnMaxNanos ? nNanos : rCounters.mnMaxNanos;
+}
+
+void writeMicroseconds(std::ostream& rStream, uint64_t nNanos)
+{
+    rStream << std::fixed << std::setprecision(1) << (double)nNanos / 1000;
+}
+
+bool endsWithJson(const wchar_t* pFileName)
+{
+    const size_t nLength = std::wcslen(pFileName);
+    return nLength >= 5 && _wcsicmp(pFileName + nLength - 5, L".json") == 0;
+}
+} // namespace
+
+void CallStatistics::start(const wchar_t* pFileName)
+{
+    LARGE_INTEGER aFrequency;
+    QueryPerformanceFrequency(&aFrequency);
+    mfNanosPerTick = 1e9 / (double)aFrequency.QuadPart;
+
+    pOutputFileName = pFileName;
+    mbActive = true;
+
+    std::atexit(writeAtExit);
+}
+
+bool CallStatistics::setActive(bool bActive)
+{
+    if (pOutputFileName == nullptr)
+        return false;
+
+    mbActive = bActive;
+    return true;
+}
+
+CallStatistics::Counters* CallStatistics::find(const IID& rIID, MEMBERID nMemberId, int nInvKind)
+{
+    if (pThreadEntries == nullptr)
+        return nullptr;
+
+    auto p = pThreadEntries->find(Key{ rIID, nMemberId, nInvKind });
+    if (p == pThreadEntries->end())
+        return nullptr;
+    return &p->second->maCounters;
+}
+
+CallStatistics::Counters* CallStatistics::add(const IID& rIID, MEMBERID nMemberId, int nInvKind,
+                                              const char* sLibName, const char* sTypeName,
+                                              const std::string& rMemberName)
+{
+    if (pThreadEntries == nullptr)
+        pThreadEntries = new EntryMap;
+
+    Entry* pEntry = new Entry();
+    pEntry->maKey = Key{ rIID, nMemberId, nInvKind };
+    pEntry->msLibName = sLibName;
+    if (sTypeName != nullptr)
+        pEntry->msTypeName = sTypeName;
+    pEntry->msMemberName = rMemberName;
+
+    (*pThreadEntries)[pEntry->maKey] = pEntry;
+
+    AcquireSRWLockExclusive(&aAllEntriesLock);
+    rAllEntries.push_back(pEntry);
+    ReleaseSRWLockExclusive(&aAllEntriesLock);
+
+    return &pEntry->maCounters;
+}
+
+void CallStatistics::writeAtExit()
+{
+    // Add up the threads. The names are taken from the first thread that has a type name.
+    std::unordered_map<Key, Entry, KeyHash> aTotals;
+
+    AcquireSRWLockShared(&aAllEntriesLock);
+    for (const Entry* pEntry : rAllEntries)
+    {
+        auto q = aTotals.emplace(pEntry->maKey, *pEntry);
+        if (q.second)
+            continue;
+
+        Entry& rTotal = q.first->second;
+        if (rTotal.msTypeName.empty())
+            rTotal.msTypeName = pEntry->msTypeName;
+        rTotal.maCounters.mnCalls += pEntry->maCounters.mnCalls;
+        rTotal.maCounters.mnErrors += pEntry->maCounters.mnErrors;
+        rTotal.maCounters.mnTotalNanos += pEntry->maCounters.mnTotalNanos;
+        if (pEntry->maCounters.mnMaxNanos > rTotal.maCounters.mnMaxNanos)
+            rTotal.maCounters.mnMaxNanos = pEntry->maCounters.mnMaxNanos;
+        rTotal.maCounters.maHistogram.add(pEntry->maCounters.maHistogram);
+    }
+    ReleaseSRWLockShared(&aAllEntriesLock);
+
+    // Most time spent first
+    std::vector<Entry*> aSorted;
+    for (auto& i : aTotals)
+    {
+        // A thread that was killed between add() and record()
+        if (i.second.maCounters.mnCalls == 0)
+            continue;
+        if (i.second.msTypeName.empty())
+            i.second.msTypeName = IIDNameCache::lookup(i.first.maIID);
+        aSorted.push_back(&i.second);
+    }
+    std::sort(aSorted.begin(), aSorted.end(), [](const Entry* a, const Entry* b) {
+        return a->maCounters.mnTotalNanos > b->maCounters.mnTotalNanos;
+    });
+
+    std::ofstream aFile(pOutputFileName);
+
+    if (endsWithJson(pOutputFileName))
+    {
+        aFile << "[\n";
+        for (size_t n = 0; n < aSorted.size(); ++n)
+        {
+            const Entry& rEntry = *aSorted[n];
+            const Counters& rCounters = rEntry.maCounters;
+
+            aFile << "  {\"library\": " << jsonString(rEntry.msLibName)
+                  << ", \"interface\": " << jsonString(rEntry.msTypeName)
+                  << ", \"member\": " << jsonString(rEntry.msMemberName) << ", \"kind\": \""
+                  << invKindName(rEntry.maKey.mnInvKind) << "\", \"calls\": " << rCounters.mnCalls
+                  << ", \"errors\": " << rCounters.mnErrors << ", \"total_us\": ";
+            writeMicroseconds(aFile, rCounters.mnTotalNanos);
+            aFile << ", \"mean_us\": ";
+            writeMicroseconds(aFile, rCounters.mnTotalNanos / rCounters.mnCalls);
+            aFile << ", \"p50_us\": ";
+            writeMicroseconds(aFile, percentile(rCounters, 0.5));
+            aFile << ", \"p90_us\": ";
+            writeMicroseconds(aFile, percentile(rCounters, 0.9));
+            aFile << ", \"p99_us\": ";
+            writeMicroseconds(aFile, percentile(rCounters, 0.99));
+            aFile << ", \"max_us\": ";
+            writeMicroseconds(aFile, rCounters.mnMaxNanos);
+
+            // The non-empty buckets as [upper bound, count] pairs
+            aFile << ",\n   \"histogram\": [";
+            bool bFirst = true;
+            for (int i = 0; i < LATENCY_BUCKETS; ++i)
+            {
+                if (rCounters.maHistogram.count(i) == 0)
+                    continue;
+                if (!bFirst)
+                    aFile << ", ";
+                aFile << "[";
+                const uint64_t nUpperBound = latencyBucketUpperBound(i);
+                writeMicroseconds(aFile, nUpperBound < rCounters.mnMaxNanos
+                                             ? nUpperBound
+                                             : rCounters.mnMaxNanos);
+                aFile << ", " << rCounters.maHistogram.count(i) << "]";
+                bFirst = false;
+            }
+            aFile << "]}" << (n + 1 < aSorted.size() ? "," : "") << "\n";
+        }
+        aFile << "]\n";
+    }
+    else
+    {
+        aFile << "library,interface,member,kind,calls,errors,total_us,mean_us,p50_us,p90_us,"
+                 "p99_us,max_us\n";
+        for (const Entry* pEntry : aSorted)
+        {
+            const Counters& rCounters = pEntry->maCounters;
+
+            aFile << csvField(pEntry->msLibName) << "," << csvField(pEntry->msTypeName) << ","
+                  << csvField(pEntry->msMemberName) << ","
+                  << invKindName(pEntry->maKey.mnInvKind) << "," << rCounters.mnCalls << ","
+                  << rCounters.mnErrors << ",";
+            writeMicroseconds(aFile, rCounters.mnTotalNanos);
+            aFile << ",";
+            writeMicroseconds(aFile, rCounters.mnTotalNanos / rCounters.mnCalls);
+            aFile << ",";
+            writeMicroseconds(aFile, percentile(rCounters, 0.5));
+            aFile << ",";
+            writeMicroseconds(aFile, percentile(rCounters, 0.9));
+            aFile << ",";
+            writeMicroseconds(aFile, percentile(rCounters, 0.99));
+            aFile << ",";
+            writeMicroseconds(aFile, rCounters.mnMaxNanos);
+            aFile << "\n";
+        }
+    }
+
+    aFile.close();
+    if (!aFile.good())
+        std::cout << "Could not write call statistics file '"
+                  << convertUTF16ToUTF8(pOutputFileName) << "'" << std::endl;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab cinoptions=b1,g0,N-s cinkeys+=0=break: */
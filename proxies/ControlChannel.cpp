@@ -0,0 +1,190 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of Collabora OLE Automation Translator.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma warning(push)
+#pragma warning(disable : 4668 4820 4917)
+
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include <Windows.h>
+
+#pragma warning(pop)
+
+#include "utils.hpp"
+
+#include "CallStatistics.hpp"
+#include "ControlChannel.hpp"
+#include "TraceFilter.hpp"
+
+ControlBlock* ControlChannel::mpBlock = nullptr;
+
+static ThreadProcParam* pParam;
+static HANDLE hChanged;
+
+void ControlChannel::start(ThreadProcParam* pThreadProcParam)
+{
+    pParam = pThreadProcParam;
+
+    const DWORD nProcessId = GetCurrentProcessId();
+
+    // The mapping and the event are intentionally never closed, they are needed until the process
+    // exits.
+    HANDLE hMapping
+        = CreateFileMappingW(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0,
+                             (DWORD)sizeof(ControlBlock), ControlBlock::name(nProcessId).c_str());
+    if (hMapping == NULL)
+    {
+        std::cout << "Could not create control block: " << WindowsErrorString(GetLastError())
+                  << std::endl;
+        return;
+    }
+
+    void* pView = MapViewOfFile(hMapping, FILE_MAP_WRITE, 0, 0, sizeof(ControlBlock));
+    if (pView == NULL)
+    {
+        std::cout << "MapViewOfFile failed: " << WindowsErrorString(GetLastError()) << std::endl;
+        CloseHandle(hMapping);
+        return;
+    }
+
+    hChanged = CreateEventW(NULL, FALSE, FALSE, ControlBlock::changedEventName(nProcessId).c_str());
+    if (hChanged == NULL)
+    {
+        std::cout << "Could not create control event: " << WindowsErrorString(GetLastError())
+                  << std::endl;
+        UnmapViewOfFile(pView);
+        CloseHandle(hMapping);
+        return;
+    }
+
+    ControlBlock* pBlock = ControlBlock::create(pView, nProcessId);
+
+    // Start with what the command line said. Nobody else can know about the block yet.
+    ControlSettings* pSettings = pBlock->beginUpdate();
+    pSettings->mbTrace = (uint8_t)pParam->mbTrace;
+    pSettings->mbVerbose = (uint8_t)pParam->mbVerbose;
+    pSettings->mbCallStatistics = (uint8_t)CallStatistics::isActive();
+    strcpy_s(pSettings->msTraceFilter, ControlSettings::NTRACEFILTER, pParam->msTraceFilter);
+    pBlock->endUpdate();
+    pBlock->acknowledge(pBlock->settingsSequence());
+
+    mpBlock = pBlock;
+
+    HANDLE hThread = CreateThread(NULL, 0, watch, NULL, 0, NULL);
+    if (hThread == NULL)
+        std::cout << "Could not start control thread: " << WindowsErrorString(GetLastError())
+                  << std::endl;
+    else
+        CloseHandle(hThread);
+
+    if (pParam->mbVerbose)
+        std::cout << "Control block " << convertUTF16ToUTF8(ControlBlock::name(nProcessId).c_str())
+                  << " created" << std::endl;
+}
+
+DWORD WINAPI ControlChannel::watch(LPVOID) noexcept
+{
+    ControlSettings aApplied;
+    uint32_t nAppliedSequence;
+    if (!mpBlock->readSettings(aApplied, nAppliedSequence))
+        return 0;
+
+    while (WaitForSingleObject(hChanged, INFINITE) == WAIT_OBJECT_0)
+    {
+        ControlSettings aNew;
+        uint32_t nSequence;
+        if (!mpBlock->readSettings(aNew, nSequence))
+        {
+            std::cout << "Could not read the changed settings from the control block"
+                      << std::endl;
+            continue;
+        }
+
+        if (nSequence == nAppliedSequence)
+            continue;
+
+        // Put back what could not be applied, so that coleat can tell, unless the settings have
+        // been changed again meanwhile, in which case the event is set again, too.
+        if (!apply(aApplied, aNew))
+        {
+            ControlSettings* pSettings = mpBlock->beginUpdate();
+            if (pSettings != nullptr)
+            {
+                if (mpBlock->settingsSequence() == nSequence + 1)
+                {
+                    std::memcpy(pSettings, &aNew, sizeof(ControlSettings));
+                    nSequence += 2;
+                }
+                mpBlock->endUpdate();
+            }
+        }
+
+        aApplied = aNew;
+        nAppliedSequence = nSequence;
+        mpBlock->acknowledge(nSequence);
+    }
+
+    return 0;
+}
+
+bool ControlChannel::apply(const ControlSettings& rOld, ControlSettings& rNew)
+{
+    bool bAllApplied = true;
+
+    if (rNew.mbTrace != rOld.mbTrace)
+    {
+        pParam->mbTrace = (rNew.mbTrace != 0);
+        std::cout << "Control: tracing turned " << (rNew.mbTrace ? "on" : "off") << std::endl;
+    }
+
+    if (rNew.mbVerbose != rOld.mbVerbose)
+    {
+        pParam->mbVerbose = (rNew.mbVerbose != 0);
+        std::cout << "Control: verbose logging turned " << (rNew.mbVerbose ? "on" : "off")
+                  << std::endl;
+    }
+
+    if (rNew.mbCallStatistics != rOld.mbCallStatistics)
+    {
+        if (CallStatistics::setActive(rNew.mbCallStatistics != 0))
+            std::cout << "Control: call statistics turned "
+                      << (rNew.mbCallStatistics ? "on" : "off") << std::endl;
+        else
+        {
+            std::cout << "Control: call statistics need the -c option" << std::endl;
+            rNew.mbCallStatistics = rOld.mbCallStatistics;
+            bAllApplied = false;
+        }
+    }
+
+    if (std::strcmp(rNew.msTraceFilter, rOld.msTraceFilter) != 0)
+    {
+        std::string sError;
+        if (rNew.msTraceFilter[0] == '\0')
+        {
+            TraceFilter::acceptAll();
+            std::cout << "Control: trace filter removed" << std::endl;
+        }
+        else if (TraceFilter::compile(rNew.msTraceFilter, sError))
+            std::cout << "Control: trace filter now " << rNew.msTraceFilter << std::endl;
+        else
+        {
+            std::cout << "Control: bad trace filter: " << sError << ", keeping the previous one"
+                      << std::endl;
+            std::memcpy(rNew.msTraceFilter, rOld.msTraceFilter, ControlSettings::NTRACEFILTER);
+            bAllApplied = false;
+        }
+    }
+
+    return bAllApplied;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab cinoptions=b1,g0,N-s cinkeys+=0=break: */
@@ -0,0 +1,159 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of Collabora OLE Automation Translator.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma warning(push)
+#pragma warning(disable : 4668 4820 4917)
+
+#include <cassert>
+#include <new>
+#include <ostream>
+
+#include <Windows.h>
+
+#pragma warning(pop)
+
+#include "ControlChannel.hpp"
+#include "ProxyPool.hpp"
+
+// Sizes are rounded up to a multiple of NGRANULE, and objects larger than the biggest size class
+// are allocated from the heap as usual.
+static const size_t NGRANULE = 16;
+static const size_t NSIZECLASSES = 32;
+static const size_t NSLAB = 64 * 1024;
+
+static const size_t NOSIZECLASS = (size_t)-1;
+
+// Each block starts with a header telling where it belongs, padded so that the object itself stays
+// aligned like with the normal operator new.
+union BlockHeader
+{
+    size_t mnSizeClass;
+    char maPadding[NGRANULE];
+};
+
+struct FreeBlock
+{
+    FreeBlock* mpNext;
+};
+
+struct SizeClass
+{
+    SRWLOCK maLock;
+    FreeBlock* mpFreeList;
+    char* mpSlabRover;
+    char* mpSlabEnd;
+
+    size_t mnAllocations;
+    size_t mnReused;
+    size_t mnLive;
+    size_t mnSlabs;
+};
+
+// Zero-initialised, which is also what SRWLOCK_INIT is.
+static SizeClass aSizeClasses[NSIZECLASSES];
+
+static volatile size_t nHeapAllocations;
+
+void* ProxyPool::allocate(size_t nSize)
+{
+    const size_t nGranules = (nSize + NGRANULE - 1) / NGRANULE;
+
+    ControlChannel::countProxyCreated();
+
+    if (nGranules == 0 || nGranules > NSIZECLASSES)
+    {
+        BlockHeader* pHeader
+            = static_cast<BlockHeader*>(::operator new(sizeof(BlockHeader) + nSize));
+        pHeader->mnSizeClass = NOSIZECLASS;
+        InterlockedIncrementSizeT(&nHeapAllocations);
+        return pHeader + 1;
+    }
+
+    const size_t nSizeClass = nGranules - 1;
+    const size_t nBlockSize = sizeof(BlockHeader) + nGranules * NGRANULE;
+    SizeClass& rClass = aSizeClasses[nSizeClass];
+    BlockHeader* pHeader;
+
+    AcquireSRWLockExclusive(&rClass.maLock);
+
+    if (rClass.mpFreeList != nullptr)
+    {
+        pHeader = reinterpret_cast<BlockHeader*>(rClass.mpFreeList);
+        rClass.mpFreeList = rClass.mpFreeList->mpNext;
+        rClass.mnReused++;
+    }
+    else
+    {
+        if (rClass.mpSlabRover == nullptr
+            || rClass.mpSlabEnd - rClass.mpSlabRover < (ptrdiff_t)nBlockSize)
+        {
+            // The tail of the previous slab, if any, is just wasted. Slabs are never given back.
+            rClass.mpSlabRover = static_cast<char*>(::operator new(NSLAB));
+            rClass.mpSlabEnd = rClass.mpSlabRover + NSLAB;
+            rClass.mnSlabs++;
+        }
+        pHeader = reinterpret_cast<BlockHeader*>(rClass.mpSlabRover);
+        rClass.mpSlabRover += nBlockSize;
+    }
+    rClass.mnAllocations++;
+    rClass.mnLive++;
+
+    ReleaseSRWLockExclusive(&rClass.maLock);
+
+    pHeader->mnSizeClass = nSizeClass;
+    return pHeader + 1;
+}
+
+void ProxyPool::deallocate(void* pObject)
+{
+    if (pObject == nullptr)
+        return;
+
+    ControlChannel::countProxyDestroyed();
+
+    BlockHeader* pHeader = static_cast<BlockHeader*>(pObject) - 1;
+
+    if (pHeader->mnSizeClass == NOSIZECLASS)
+    {
+        ::operator delete(pHeader);
+        return;
+    }
+
+    assert(pHeader->mnSizeClass < NSIZECLASSES);
+    SizeClass& rClass = aSizeClasses[pHeader->mnSizeClass];
+
+    AcquireSRWLockExclusive(&rClass.maLock);
+
+    FreeBlock* pBlock = reinterpret_cast<FreeBlock*>(pHeader);
+    pBlock->mpNext = rClass.mpFreeList;
+    rClass.mpFreeList = pBlock;
+    rClass.mnLive--;
+
+    ReleaseSRWLockExclusive(&rClass.maLock);
+}
+
+void ProxyPool::dumpStatistics(std::ostream& rStream)
+{
+    for (size_t i = 0; i < NSIZECLASSES; ++i)
+    {
+        SizeClass& rClass = aSizeClasses[i];
+
+        AcquireSRWLockShared(&rClass.maLock);
+        if (rClass.mnAllocations > 0)
+            rStream << "Proxy pool: " << (i + 1) * NGRANULE << " byte objects: "
+                    << rClass.mnAllocations << " allocated, " << rClass.mnReused << " reused, "
+                    << rClass.mnLive << " live, " << rClass.mnSlabs << " slabs" << std::endl;
+        ReleaseSRWLockShared(&rClass.maLock);
+    }
+    if (nHeapAllocations > 0)
+        rStream << "Proxy pool: " << nHeapAllocations << " large objects allocated from the heap"
+                << std::endl;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab cinoptions=b1,g0,N-s cinkeys+=0=break: */
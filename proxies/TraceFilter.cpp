@@ -0,0 +1,300 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of Collabora OLE Automation Translator.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma warning(push)
+#pragma warning(disable : 4668 4820 4917)
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <Windows.h>
+
+#pragma warning(pop)
+
+#include "utils.hpp"
+
+#include "TraceFilter.hpp"
+
+bool TraceFilter::mbActive = false;
+
+namespace
+{
+enum
+{
+    LIBRARY,
+    INTERFACE,
+    MEMBER,
+    NPARTS
+};
+
+struct Rule
+{
+    bool mbInclude;
+    std::string maParts[NPARTS];
+    unsigned mnEvery;
+    unsigned mnPerSecond;
+};
+
+// What the rules say about one member of one interface, and the counters for the sampling.
+struct Decision
+{
+    bool mbInclude;
+    unsigned mnEvery;
+    unsigned mnPerSecond;
+    volatile LONG mnCalls;
+    volatile LONG mnSecond;
+    volatile LONG mnCallsThisSecond;
+};
+
+struct Key
+{
+    IID maIID;
+    DISPID mnMemberId;
+    bool mbFromTypeLibrary;
+
+    bool operator==(const Key& rOther) const
+    {
+        return IsEqualIID(maIID, rOther.maIID) && mnMemberId == rOther.mnMemberId
+               && mbFromTypeLibrary == rOther.mbFromTypeLibrary;
+    }
+};
+
+struct KeyHash
+{
+    size_t operator()(const Key& rKey) const
+    {
+        return hashIID(rKey.maIID, (unsigned)rKey.mnMemberId * 2 + rKey.mbFromTypeLibrary);
+    }
+};
+
+std::vector<Rule> aRules;
+bool bIncludeByDefault = true;
+
+SRWLOCK aDecisionsLock = SRWLOCK_INIT;
+
+// Intentionally never destroyed, calls can happen until the very end of the process.
+std::unordered_map<Key, Decision*, KeyHash>& rDecisions
+    = *new std::unordered_map<Key, Decision*, KeyHash>;
+
+// Called with aDecisionsLock held exclusively when the rules change. The decisions themselves are
+// leaked, as other threads might still be looking at them.
+void forgetDecisions() { rDecisions.clear(); }
+
+bool matches(const std::string& rPart, const char* sName)
+{
+    if (rPart == "*")
+        return true;
+    if (sName == nullptr)
+        return false;
+    if (rPart.back() == '*')
+        return _strnicmp(sName, rPart.data(), rPart.size() - 1) == 0;
+    return _stricmp(sName, rPart.data()) == 0;
+}
+
+bool parseCount(const std::string& rText, unsigned& rCount)
+{
+    if (rText.empty() || rText.find_first_not_of("0123456789") != std::string::npos)
+        return false;
+    rCount = (unsigned)std::strtoul(rText.data(), nullptr, 10);
+    return rCount > 0;
+}
+
+bool parseRule(std::string sRule, Rule& rRule, std::string& rError)
+{
+    rRule.mbInclude = true;
+    rRule.mnEvery = 1;
+    rRule.mnPerSecond = 0;
+
+    if (!sRule.empty() && (sRule[0] == '+' || sRule[0] == '-'))
+    {
+        rRule.mbInclude = (sRule[0] == '+');
+        sRule.erase(0, 1);
+    }
+
+    // The /N and @R suffixes, in either order
+    for (;;)
+    {
+        const size_t nSuffix = sRule.find_last_of("/@");
+        if (nSuffix == std::string::npos)
+            break;
+
+        unsigned& rCount = (sRule[nSuffix] == '/') ? rRule.mnEvery : rRule.mnPerSecond;
+        if (!parseCount(sRule.substr(nSuffix + 1), rCount))
+        {
+            rError = "Bad number in '" + sRule + "'";
+            return false;
+        }
+        if (!rRule.mbInclude)
+        {
+            rError = "Sampling makes no sense for an exclude rule: '" + sRule + "'";
+            return false;
+        }
+        sRule.erase(nSuffix);
+    }
+
+    int nPart = 0;
+    size_t nStart = 0;
+    for (;;)
+    {
+        if (nPart == NPARTS)
+        {
+            rError = "Too many parts in '" + sRule + "'";
+            return false;
+        }
+        const size_t nDot = sRule.find('.', nStart);
+        rRule.maParts[nPart]
+            = sRule.substr(nStart, nDot == std::string::npos ? nDot : nDot - nStart);
+        if (rRule.maParts[nPart].empty())
+        {
+            rError = "Empty name in '" + sRule + "'";
+            return false;
+        }
+        nPart++;
+        if (nDot == std::string::npos)
+            break;
+        nStart = nDot + 1;
+    }
+    while (nPart < NPARTS)
+        rRule.maParts[nPart++] = "*";
+
+    return true;
+}
+} // namespace
+
+bool TraceFilter::compile(const char* pRules, std::string& rError)
+{
+    std::vector<Rule> aNewRules;
+    std::string sRules(pRules);
+    size_t nStart = 0;
+    for (;;)
+    {
+        const size_t nComma = sRules.find(',', nStart);
+        std::string sRule
+            = sRules.substr(nStart, nComma == std::string::npos ? nComma : nComma - nStart);
+
+        // Allow spaces after the commas.
+        const size_t nFirst = sRule.find_first_not_of(' ');
+        sRule.erase(0, nFirst);
+
+        Rule aRule;
+        if (!parseRule(sRule, aRule, rError))
+            return false;
+        aNewRules.push_back(aRule);
+
+        if (nComma == std::string::npos)
+            break;
+        nStart = nComma + 1;
+    }
+
+    AcquireSRWLockExclusive(&aDecisionsLock);
+    aRules.swap(aNewRules);
+    bIncludeByDefault = !aRules[0].mbInclude;
+    forgetDecisions();
+    mbActive = true;
+    ReleaseSRWLockExclusive(&aDecisionsLock);
+
+    return true;
+}
+
+void TraceFilter::rejectAll()
+{
+    AcquireSRWLockExclusive(&aDecisionsLock);
+    aRules.clear();
+    bIncludeByDefault = false;
+    forgetDecisions();
+    mbActive = true;
+    ReleaseSRWLockExclusive(&aDecisionsLock);
+}
+
+void TraceFilter::acceptAll()
+{
+    AcquireSRWLockExclusive(&aDecisionsLock);
+    aRules.clear();
+    bIncludeByDefault = true;
+    forgetDecisions();
+    mbActive = false;
+    ReleaseSRWLockExclusive(&aDecisionsLock);
+}
+
+bool TraceFilter::decide(const IID& rIID, DISPID nMemberId, bool bFromTypeLibrary,
+                         const char* sLibName, const char* sTypeName, const char* sMemberName)
+{
+    const Key aKey{ rIID, nMemberId, bFromTypeLibrary };
+    Decision* pDecision = nullptr;
+
+    AcquireSRWLockShared(&aDecisionsLock);
+    auto p = rDecisions.find(aKey);
+    if (p != rDecisions.end())
+        pDecision = p->second;
+    ReleaseSRWLockShared(&aDecisionsLock);
+
+    if (pDecision == nullptr)
+    {
+        const char* const aNames[NPARTS] = { sLibName, sTypeName, sMemberName };
+
+        // Decide with the lock held exclusively, so that the rules can't change meanwhile. This
+        // happens just once for each member.
+        AcquireSRWLockExclusive(&aDecisionsLock);
+        auto q = rDecisions.find(aKey);
+        if (q != rDecisions.end())
+        {
+            // Another thread got there first.
+            pDecision = q->second;
+        }
+        else
+        {
+            pDecision = new Decision();
+            pDecision->mbInclude = bIncludeByDefault;
+            pDecision->mnEvery = 1;
+
+            for (const auto& rRule : aRules)
+            {
+                if (matches(rRule.maParts[LIBRARY], aNames[LIBRARY])
+                    && matches(rRule.maParts[INTERFACE], aNames[INTERFACE])
+                    && matches(rRule.maParts[MEMBER], aNames[MEMBER]))
+                {
+                    pDecision->mbInclude = rRule.mbInclude;
+                    pDecision->mnEvery = rRule.mnEvery;
+                    pDecision->mnPerSecond = rRule.mnPerSecond;
+                }
+            }
+
+            rDecisions.emplace(aKey, pDecision);
+        }
+        ReleaseSRWLockExclusive(&aDecisionsLock);
+    }
+
+    if (!pDecision->mbInclude)
+        return false;
+
+    if (pDecision->mnEvery > 1
+        && (unsigned)(InterlockedIncrement(&pDecision->mnCalls) - 1) % pDecision->mnEvery != 0)
+        return false;
+
+    if (pDecision->mnPerSecond > 0)
+    {
+        // Not exact when several threads call the same member at the turn of a second, but good
+        // enough.
+        const LONG nSecond = (LONG)(GetTickCount64() / 1000);
+        if (pDecision->mnSecond != nSecond)
+        {
+            InterlockedExchange(&pDecision->mnCallsThisSecond, 0);
+            InterlockedExchange(&pDecision->mnSecond, nSecond);
+        }
+        if ((unsigned)InterlockedIncrement(&pDecision->mnCallsThisSecond) > pDecision->mnPerSecond)
+            return false;
+    }
+
+    return true;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab cinoptions=b1,g0,N-s cinkeys+=0=break: */
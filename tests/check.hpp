@@ -0,0 +1,52 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of Collabora OLE Automation Translator.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_check_hpp
+#define INCLUDED_check_hpp
+
+// The little the tests in this directory need: CHECK() prints what failed and where, and main()
+// returns checkResult(), which prints the test name and OK or the number of failures. The tests
+// are plain programs built with g++, see BUILD.txt.
+
+#include <atomic>
+#include <iostream>
+
+inline std::atomic<int>& checkFailures()
+{
+    static std::atomic<int> nFailures(0);
+    return nFailures;
+}
+
+inline void checkFailed(const char* sWhat, const char* sFile, int nLine)
+{
+    std::cerr << sFile << ":" << nLine << ": CHECK(" << sWhat << ") failed" << std::endl;
+    ++checkFailures();
+}
+
+#define CHECK(x)                                                                                   \
+    do                                                                                             \
+    {                                                                                              \
+        if (!(x))                                                                                  \
+            checkFailed(#x, __FILE__, __LINE__);                                                   \
+    } while (false)
+
+inline int checkResult(const char* sTest)
+{
+    if (checkFailures() == 0)
+    {
+        std::cout << sTest << ": OK" << std::endl;
+        return 0;
+    }
+    std::cout << sTest << ": " << checkFailures() << " failures" << std::endl;
+    return 1;
+}
+
+#endif // INCLUDED_check_hpp
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab cinoptions=b1,g0,N-s cinkeys+=0=break: */
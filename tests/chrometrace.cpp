@@ -0,0 +1,108 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of Collabora OLE Automation Translator.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+// Checks the JSON that ChromeTraceWriter produces, byte for byte.
+
+#include <sstream>
+#include <string>
+
+#include "check.hpp"
+#include "chrometrace.hpp"
+
+static const char HEADER[] = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+                             "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+                             "\"args\":{\"name\":\"COLEAT\"}}";
+
+static const char FOOTER[] = "\n]}\n";
+
+static std::string escaped(const std::string& rText)
+{
+    std::ostringstream aStream;
+    ChromeTraceWriter aWriter(aStream);
+    aStream.str("");
+    aWriter.writeString(rText);
+    return aStream.str();
+}
+
+static void testEmpty()
+{
+    std::ostringstream aStream;
+    ChromeTraceWriter aWriter(aStream);
+    aWriter.finish();
+
+    CHECK(aStream.str() == std::string(HEADER) + FOOTER);
+}
+
+static void testNesting()
+{
+    std::ostringstream aStream;
+    ChromeTraceWriter aWriter(aStream);
+    aWriter.begin(7, 1.5, "Word.Application.Documents", "Word", "");
+    aWriter.begin(7, 2.25, "Word.Documents.Add", "Word", "(\"x\")");
+    aWriter.end(7, 10, "Word.Document<0x1234>");
+    aWriter.end(7, 12.0004, "");
+    aWriter.finish();
+
+    CHECK(aStream.str()
+          == std::string(HEADER)
+                 + ",\n{\"ph\":\"B\",\"pid\":1,\"tid\":7,\"ts\":1.500,"
+                   "\"name\":\"Word.Application.Documents\",\"cat\":\"Word\"}"
+                   ",\n{\"ph\":\"B\",\"pid\":1,\"tid\":7,\"ts\":2.250,"
+                   "\"name\":\"Word.Documents.Add\",\"cat\":\"Word\","
+                   "\"args\":{\"arguments\":\"(\\\"x\\\")\"}}"
+                   ",\n{\"ph\":\"E\",\"pid\":1,\"tid\":7,\"ts\":10.000,"
+                   "\"args\":{\"result\":\"Word.Document<0x1234>\"}}"
+                   ",\n{\"ph\":\"E\",\"pid\":1,\"tid\":7,\"ts\":12.000}"
+                 + FOOTER);
+}
+
+// Returns of calls whose begin was lost are dropped, and calls still open at the end are ended at
+// the last time seen, per thread.
+static void testUnbalanced()
+{
+    std::ostringstream aStream;
+    ChromeTraceWriter aWriter(aStream);
+    aWriter.end(1, 1, "lost");
+    aWriter.begin(1, 2, "a", "X", "");
+    aWriter.begin(2, 3, "b", "X", "");
+    aWriter.end(2, 4, "");
+    aWriter.end(2, 5, "lost too");
+    aWriter.finish();
+
+    CHECK(aStream.str()
+          == std::string(HEADER)
+                 + ",\n{\"ph\":\"B\",\"pid\":1,\"tid\":1,\"ts\":2.000,\"name\":\"a\",\"cat\":\"X\"}"
+                   ",\n{\"ph\":\"B\",\"pid\":1,\"tid\":2,\"ts\":3.000,\"name\":\"b\",\"cat\":\"X\"}"
+                   ",\n{\"ph\":\"E\",\"pid\":1,\"tid\":2,\"ts\":4.000}"
+                   ",\n{\"ph\":\"E\",\"pid\":1,\"tid\":1,\"ts\":4.000}"
+                 + FOOTER);
+}
+
+static void testEscaping()
+{
+    CHECK(escaped("") == "\"\"");
+    CHECK(escaped("plain") == "\"plain\"");
+    CHECK(escaped("a\"b\\c") == "\"a\\\"b\\\\c\"");
+    CHECK(escaped("\n\r\t") == "\"\\n\\r\\t\"");
+    CHECK(escaped(std::string("\x01\x1f\0", 3)) == "\"\\u0001\\u001f\\u0000\"");
+    CHECK(escaped("\x7f") == "\"\x7f\"");
+    // UTF-8 is passed through
+    CHECK(escaped("\xc3\xa4") == "\"\xc3\xa4\"");
+}
+
+int main()
+{
+    testEmpty();
+    testNesting();
+    testUnbalanced();
+    testEscaping();
+    return checkResult("chrometrace");
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab cinoptions=b1,g0,N-s cinkeys+=0=break: */
@@ -0,0 +1,304 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of Collabora OLE Automation Translator.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+// Decodes binary trace files built here the way BinaryTrace.cpp writes them, and checks the text
+// that coleat-trace prints for them, also when the ring has wrapped around and when there is
+// garbage in it. coleat-trace.cpp is included with its main() renamed, so that it can be run on
+// one file after another in this process.
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+
+#define main coleatTraceMain
+#include "../coleat-trace/coleat-trace.cpp"
+#undef main
+
+// Like BinaryTrace::start(), with a clock that ticks once per microsecond and starts at
+// 2020-01-02 03:04:05.678 UTC, one hour ahead of it in the traced process.
+class TraceImage
+{
+public:
+    TraceImage(uint32_t nRingCapacity)
+        : maNames(1024, '\0')
+        , maRing(nRingCapacity, '\0')
+        , mnNamesHead(8)
+        , mnRingHead(0)
+    {
+    }
+
+    TraceNameId name(const std::string& rName)
+    {
+        const uint32_t nSize = traceAlign((uint32_t)(sizeof(TraceNameRecord) + rName.size()));
+        const TraceNameId nId = mnNamesHead;
+
+        TraceNameRecord aName = {};
+        aName.maHeader = { TRACE_RECORD_MAGIC, TRACE_NAME, 0, nSize };
+        aName.mnLength = (uint32_t)rName.size();
+        std::memcpy(&maNames[nId], &aName, sizeof(aName));
+        std::memcpy(&maNames[nId + sizeof(aName)], rName.data(), rName.size());
+        mnNamesHead += nSize;
+
+        return nId;
+    }
+
+    // Like BinaryTrace::reserve(), but the record is written in one go.
+    void append(const std::string& rRecord)
+    {
+        const uint64_t nCapacity = maRing.size();
+        uint64_t nPos = mnRingHead % nCapacity;
+        if (nPos + rRecord.size() > nCapacity)
+        {
+            const TraceRecordHeader aPadding
+                = { TRACE_RECORD_MAGIC, TRACE_PADDING, 0, (uint32_t)(nCapacity - nPos) };
+            std::memcpy(&maRing[nPos], &aPadding, sizeof(aPadding));
+            mnRingHead += nCapacity - nPos;
+            nPos = 0;
+        }
+        std::memcpy(&maRing[nPos], rRecord.data(), rRecord.size());
+        mnRingHead += rRecord.size();
+    }
+
+    void appendGarbage(uint32_t nSize)
+    {
+        append(std::string(nSize, '\xA5'));
+    }
+
+    std::string file() const
+    {
+        TraceFileHeader aHeader = {};
+        std::memcpy(aHeader.maMagic, TRACE_FILE_MAGIC, sizeof(aHeader.maMagic));
+        aHeader.mnVersion = TRACE_FILE_VERSION;
+        aHeader.mnPointerSize = 8;
+        aHeader.mnTicksPerSecond = 1000000;
+        aHeader.mnStartTicks = 5000000;
+        aHeader.mnStartMilliseconds = 1577934245678ull;
+        aHeader.mnLocalTimeOffsetSeconds = 3600;
+        aHeader.mnNamesOffset = sizeof(aHeader);
+        aHeader.mnNamesCapacity = maNames.size();
+        aHeader.mnNamesHead = mnNamesHead;
+        aHeader.mnRingOffset = sizeof(aHeader) + maNames.size();
+        aHeader.mnRingCapacity = maRing.size();
+        aHeader.mnRingHead = mnRingHead;
+
+        return std::string(reinterpret_cast<const char*>(&aHeader), sizeof(aHeader)) + maNames
+               + maRing;
+    }
+
+private:
+    std::string maNames;
+    std::string maRing;
+    uint32_t mnNamesHead;
+    uint64_t mnRingHead;
+};
+
+static TraceArg arg(uint16_t nVt, TraceValueKind eKind, uint64_t nValue)
+{
+    TraceArg aArg = {};
+    aArg.mnVt = nVt;
+    aArg.mnKind = eKind;
+    aArg.mnValue = nValue;
+    return aArg;
+}
+
+static std::string bytes(const void* pData, size_t nSize)
+{
+    return std::string(static_cast<const char*>(pData), nSize);
+}
+
+// The parts of a record after its fixed part, padded to a multiple of 8
+static std::string argBytes(const TraceArg& rArg, const std::string& rPayload = "")
+{
+    std::string sResult = bytes(&rArg, sizeof(rArg)) + rPayload;
+    sResult.resize(traceAlign((uint32_t)sResult.size()), '\0');
+    return sResult;
+}
+
+static std::string stringArgBytes(const char16_t* pString)
+{
+    size_t nLength = 0;
+    while (pString[nLength] != 0)
+        nLength++;
+
+    TraceArg aArg = arg(8, TRACE_VALUE_WSTRING, 0);
+    aArg.mnLength = (uint32_t)nLength;
+    return argBytes(aArg, bytes(pString, nLength * 2));
+}
+
+static std::string callRecord(uint64_t nTicks, uint32_t nThreadId, TraceNameId nLib,
+                              TraceNameId nType, TraceNameId nMember, bool bParentheses,
+                              const std::vector<std::string>& rArgs)
+{
+    std::string sArgs;
+    for (const std::string& rArg : rArgs)
+        sArgs += rArg;
+
+    TraceCallRecord aCall = {};
+    aCall.maHeader = { TRACE_RECORD_MAGIC, TRACE_CALL,
+                       (uint8_t)(bParentheses ? TRACE_CALL_PARENTHESES : 0),
+                       (uint32_t)(sizeof(aCall) + sArgs.size()) };
+    aCall.mnTicks = nTicks;
+    aCall.mnProxy = 0x1234ABCD;
+    aCall.mnThreadId = nThreadId;
+    aCall.mnLibName = nLib;
+    aCall.mnTypeName = nType;
+    aCall.mnMemberName = nMember;
+    aCall.mnArgs = (uint16_t)rArgs.size();
+
+    return bytes(&aCall, sizeof(aCall)) + sArgs;
+}
+
+static std::string returnRecord(uint64_t nTicks, uint32_t nThreadId, TraceReturnKind eKind,
+                                const std::string& rArg = "", TraceNameId nError = 0)
+{
+    TraceReturnRecord aReturn = {};
+    aReturn.maHeader = { TRACE_RECORD_MAGIC, TRACE_RETURN, eKind,
+                         (uint32_t)(sizeof(aReturn) + rArg.size()) };
+    aReturn.mnTicks = nTicks;
+    aReturn.mnThreadId = nThreadId;
+    aReturn.mnErrorString = nError;
+
+    return bytes(&aReturn, sizeof(aReturn)) + rArg;
+}
+
+// Runs coleat-trace on the image and returns what it prints
+static std::string decode(const TraceImage& rImage, bool bChromeTrace = false)
+{
+    static const char sFileName[] = "coleat-trace-test.bin";
+    {
+        std::ofstream aFile(sFileName, std::ios::binary);
+        aFile << rImage.file();
+    }
+
+    // The state that the real program only needs once
+    pChromeTrace = nullptr;
+    bIsAtBeginningOfLine = true;
+    nLineThreadId = 0;
+
+    std::ostringstream aOutput;
+    std::streambuf* pOldBuf = std::cout.rdbuf(aOutput.rdbuf());
+
+    char sProgram[] = "coleat-trace";
+    char sJson[] = "-j";
+    char sFile[sizeof(sFileName)];
+    std::memcpy(sFile, sFileName, sizeof(sFileName));
+    char* aArgv[] = { sProgram, bChromeTrace ? sJson : sFile, sFile, nullptr };
+    coleatTraceMain(bChromeTrace ? 3 : 2, aArgv);
+
+    std::cout.rdbuf(pOldBuf);
+    std::remove(sFileName);
+
+    return aOutput.str();
+}
+
+static void testCallsAndReturns()
+{
+    TraceImage aImage(4096);
+    const TraceNameId nWord = aImage.name("Word");
+    const TraceNameId nDocuments = aImage.name("Documents");
+    const TraceNameId nAdd = aImage.name("Add");
+    const TraceNameId nCount = aImage.name("Count");
+    const TraceNameId nError = aImage.name("80020009: Exception occurred");
+
+    aImage.append(callRecord(5001000, 7, nWord, nDocuments, nAdd, true,
+                             { argBytes(arg(3, TRACE_VALUE_SIGNED, (uint64_t)-5)),
+                               stringArgBytes(u"Normal \"x\""),
+                               argBytes(arg(11, TRACE_VALUE_BOOL, 1)) }));
+    aImage.append(returnRecord(5002000, 7, TRACE_RETURN_RESULT,
+                               argBytes(arg(9, TRACE_VALUE_POINTER, 0xABCDEF))));
+    aImage.append(callRecord(5003000, 7, nWord, nDocuments, nCount, false, {}));
+    aImage.append(returnRecord(5004000, 7, TRACE_RETURN_ERROR, "", nError));
+
+    CHECK(decode(aImage)
+          == "2020-01-02:04:04:05.679:7:Word.Documents<000000001234ABCD>.Add(<I4>-5,"
+             "<BSTR>\"Normal \\\"x\\\"\",<BOOL>True) -> <DISPATCH>0000000000ABCDEF\n"
+             "2020-01-02:04:04:05.681:7:Word.Documents<000000001234ABCD>.Count: "
+             "80020009: Exception occurred\n");
+
+    CHECK(decode(aImage, true)
+          == "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+             "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"COLEAT\"}},\n"
+             "{\"ph\":\"B\",\"pid\":1,\"tid\":7,\"ts\":1000.000,\"name\":\"Word.Documents.Add\","
+             "\"cat\":\"Word\",\"args\":{\"arguments\":\"(<I4>-5,<BSTR>\\\"Normal \\\\\\\"x\\\\\\\""
+             "\\\",<BOOL>True)\"}},\n"
+             "{\"ph\":\"E\",\"pid\":1,\"tid\":7,\"ts\":2000.000,"
+             "\"args\":{\"result\":\"<DISPATCH>0000000000ABCDEF\"}},\n"
+             "{\"ph\":\"B\",\"pid\":1,\"tid\":7,\"ts\":3000.000,\"name\":\"Word.Documents.Count\","
+             "\"cat\":\"Word\"},\n"
+             "{\"ph\":\"E\",\"pid\":1,\"tid\":7,\"ts\":4000.000,"
+             "\"args\":{\"result\":\"80020009: Exception occurred\"}}\n"
+             "]}\n");
+}
+
+// Calls of another thread in the middle of a line start a new line, and property assignments
+// print like in the text trace.
+static void testThreads()
+{
+    TraceImage aImage(4096);
+    const TraceNameId nExcel = aImage.name("Excel");
+    const TraceNameId nRange = aImage.name("Range");
+    const TraceNameId nValue = aImage.name("Value");
+
+    aImage.append(callRecord(5000000, 1, nExcel, nRange, nValue, false, {}));
+    aImage.append(callRecord(5000000, 2, nExcel, nRange, nValue, false, {}));
+    aImage.append(returnRecord(5000000, 2, TRACE_RETURN_ASSIGNED,
+                               argBytes(arg(5, TRACE_VALUE_DOUBLE, 0x3FF8000000000000ull))));
+    aImage.append(returnRecord(5000000, 1, TRACE_RETURN_NOTHING));
+
+    CHECK(decode(aImage)
+          == "2020-01-02:04:04:05.678:1:Excel.Range<000000001234ABCD>.Value\n"
+             "2020-01-02:04:04:05.678:2:Excel.Range<000000001234ABCD>.Value = <R8>1.5\n");
+}
+
+// After the ring has wrapped, the oldest records are partly overwritten, and what is left of them
+// is skipped until the next record header.
+static void testWrapped()
+{
+    TraceImage aImage(512);
+    const TraceNameId nApp = aImage.name("App");
+    const TraceNameId nObject = aImage.name("Object");
+    const TraceNameId nOld = aImage.name("Old");
+    const TraceNameId nNew = aImage.name("New");
+
+    for (int i = 0; i < 8; ++i)
+    {
+        aImage.append(callRecord(5000000, 1, nApp, nObject, nOld, false, {}));
+        aImage.append(returnRecord(5000000, 1, TRACE_RETURN_NOTHING));
+    }
+    aImage.appendGarbage(40);
+    for (int i = 0; i < 3; ++i)
+    {
+        aImage.append(callRecord(5000000, 1, nApp, nObject, nNew, false, {}));
+        aImage.append(returnRecord(5000000, 1, TRACE_RETURN_NOTHING));
+    }
+
+    const std::string sOutput = decode(aImage);
+    const std::string sOld = "2020-01-02:04:04:05.678:1:App.Object<000000001234ABCD>.Old\n";
+    const std::string sNew = "2020-01-02:04:04:05.678:1:App.Object<000000001234ABCD>.New\n";
+
+    // The oldest data left is the tail of the seventh old call, which is skipped, then the eighth,
+    // the garbage, which is skipped too, and the new calls. The return of the second new call
+    // didn't fit at the end of the ring, so there is padding before it.
+    CHECK(sOutput == sOld + sNew + sNew + sNew);
+}
+
+int main()
+{
+    testCallsAndReturns();
+    testThreads();
+    testWrapped();
+    return checkResult("coleat-trace");
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab cinoptions=b1,g0,N-s cinkeys+=0=break: */
@@ -0,0 +1,139 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of Collabora OLE Automation Translator.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+// Checks the ControlBlock layout, that readers never see half-written settings while "coleat -P"
+// writes them, and the acknowledgement coleat waits for. The layout itself is also checked by the
+// static_asserts in controlblock.hpp, here we just make sure a 64-bit g++ build agrees with them.
+
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "check.hpp"
+#include "controlblock.hpp"
+
+static const int NWRITES = 20000;
+static const int NREADERS = 4;
+
+static std::unique_ptr<ControlBlock> newBlock()
+{
+    // The DLL gets zeroed memory from CreateFileMapping()
+    void* pMemory = ::operator new(sizeof(ControlBlock));
+    std::memset(pMemory, 0, sizeof(ControlBlock));
+    return std::unique_ptr<ControlBlock>(ControlBlock::create(pMemory, 1234));
+}
+
+static void testAttach()
+{
+    std::unique_ptr<ControlBlock> pBlock = newBlock();
+
+    CHECK(ControlBlock::attach(pBlock.get(), sizeof(ControlBlock)) == pBlock.get());
+    CHECK(ControlBlock::attach(pBlock.get(), sizeof(ControlBlock) - 1) == nullptr);
+
+    pBlock->mnVersion = ControlBlock::VERSION - 1;
+    CHECK(ControlBlock::attach(pBlock.get(), sizeof(ControlBlock)) == nullptr);
+    pBlock->mnVersion = ControlBlock::VERSION;
+
+    CHECK(ControlBlock::name(1234) == L"Local\\COLEAT-control-1234");
+    CHECK(ControlBlock::changedEventName(1234) == L"Local\\COLEAT-control-1234-changed");
+}
+
+// Each write fills the whole filter with one letter and sets the flags to match it, so a torn copy
+// has either mixed letters or flags that don't fit.
+static void writeSettings(ControlBlock* pBlock)
+{
+    for (int i = 0; i < NWRITES; ++i)
+    {
+        ControlSettings* pSettings = pBlock->beginUpdate();
+        CHECK(pSettings != nullptr);
+        if (pSettings == nullptr)
+            return;
+
+        const char c = (char)('a' + i % 26);
+        pSettings->mbTrace = (uint8_t)(i & 1);
+        pSettings->mbVerbose = (uint8_t)c;
+        std::memset(pSettings->msTraceFilter, c, ControlSettings::NTRACEFILTER - 1);
+        pSettings->msTraceFilter[ControlSettings::NTRACEFILTER - 1] = '\0';
+        pBlock->endUpdate();
+    }
+}
+
+static void readSettings(ControlBlock* pBlock, std::atomic<bool>* pDone)
+{
+    uint32_t nLastSequence = 0;
+    while (!*pDone)
+    {
+        ControlSettings aSettings;
+        uint32_t nSequence;
+        if (!pBlock->readSettings(aSettings, nSequence))
+            continue;
+
+        CHECK((nSequence & 1) == 0);
+        CHECK(nSequence >= nLastSequence);
+        nLastSequence = nSequence;
+
+        if (aSettings.mbVerbose == 0)
+            continue;
+        const char aLetter[] = { (char)aSettings.mbVerbose, '\0' };
+        CHECK(std::strspn(aSettings.msTraceFilter, aLetter) == ControlSettings::NTRACEFILTER - 1);
+        // 26 is even, so the letter tells whether the write was an odd one
+        CHECK(aSettings.mbTrace == (uint8_t)((aLetter[0] - 'a') & 1));
+    }
+}
+
+static void testSeqlock()
+{
+    std::unique_ptr<ControlBlock> pBlock = newBlock();
+    std::atomic<bool> bDone(false);
+
+    std::vector<std::thread> aReaders;
+    for (int i = 0; i < NREADERS; ++i)
+        aReaders.emplace_back(readSettings, pBlock.get(), &bDone);
+
+    writeSettings(pBlock.get());
+    bDone = true;
+    for (auto& rReader : aReaders)
+        rReader.join();
+
+    CHECK(pBlock->settingsSequence() == 2 * (uint32_t)NWRITES);
+}
+
+static void testAcknowledge()
+{
+    std::unique_ptr<ControlBlock> pBlock = newBlock();
+
+    pBlock->acknowledge(4);
+    CHECK(pBlock->waitUntilApplied(2, 0));
+    CHECK(pBlock->waitUntilApplied(4, 0));
+    CHECK(!pBlock->waitUntilApplied(6, 50));
+
+    std::thread aApplier([&pBlock]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        pBlock->acknowledge(6);
+    });
+    CHECK(pBlock->waitUntilApplied(6, 5000));
+    aApplier.join();
+
+    // The sequence numbers wrap around
+    pBlock->acknowledge(2);
+    CHECK(pBlock->waitUntilApplied(0xFFFFFFFE, 0));
+    CHECK(!pBlock->waitUntilApplied(4, 0));
+}
+
+int main()
+{
+    testAttach();
+    testSeqlock();
+    testAcknowledge();
+    return checkResult("controlblock");
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab cinoptions=b1,g0,N-s cinkeys+=0=break: */
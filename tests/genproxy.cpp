@@ -0,0 +1,272 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of Collabora OLE Automation Translator.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+// Runs genproxy -S on a snapshot of a small type library, like one written with -D where Office
+// is installed: an enumeration, a dual interface, a coclass with it as the default interface, and
+// an event interface. Checks the generated code for each, and the proxy creator and manifest.
+// genproxy.cpp is included with its main() renamed, and is run once, as it keeps what it has
+// generated in globals.
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+
+#define main genproxyMain
+#include "../genproxy/genproxy.cpp"
+#undef main
+
+#include "../genproxy/snapshottypelib.cpp"
+
+static SnapshotTypeDesc typeDesc(uint16_t nVt, uint32_t nHrefType = 0)
+{
+    SnapshotTypeDesc aDesc;
+    aDesc.mnVt = nVt;
+    aDesc.mnHrefType = nHrefType;
+    return aDesc;
+}
+
+static SnapshotTypeDesc pointerTo(const SnapshotTypeDesc& rInner)
+{
+    SnapshotTypeDesc aDesc = typeDesc(VT_PTR);
+    aDesc.mpInner = std::make_shared<SnapshotTypeDesc>(rInner);
+    return aDesc;
+}
+
+static SnapshotType newType(const std::string& rName, int32_t nTypeKind, uint8_t nGuidByte)
+{
+    SnapshotType aType = {};
+    aType.msName = rName;
+    for (int i = 0; i < 16; ++i)
+        aType.maGuid[i] = (uint8_t)(nGuidByte + i);
+    aType.mnTypeKind = nTypeKind;
+    aType.mnMajorVerNum = 8;
+    aType.mnMinorVerNum = 7;
+    aType.maAlias = typeDesc(VT_EMPTY);
+    return aType;
+}
+
+static void addFunc(SnapshotType& rType, int32_t nMemberId, int32_t nFuncKind, int32_t nInvKind,
+                    const SnapshotTypeDesc& rReturn, const std::vector<SnapshotElemDesc>& rParams,
+                    const std::vector<std::string>& rNames)
+{
+    SnapshotFunc aFunc = {};
+    aFunc.mnMemberId = nMemberId;
+    aFunc.mnFuncKind = nFuncKind;
+    aFunc.mnInvKind = nInvKind;
+    aFunc.mnCallConv = CC_STDCALL;
+    aFunc.mnVft = (int16_t)rType.mnSizeVft++;
+    aFunc.maReturn.maType = rReturn;
+    aFunc.maParams = rParams;
+    rType.maFuncs.push_back(aFunc);
+
+    rType.maMembers.push_back({ nMemberId, rNames[0], rNames });
+}
+
+// What a dispinterface starts with. Their parameters are left out, genproxy does not look at them.
+static void addIDispatchFuncs(SnapshotType& rType)
+{
+    static const std::pair<int32_t, const char*> aFuncs[]
+        = { { 0x60000000, "QueryInterface" },   { 0x60000001, "AddRef" },
+            { 0x60000002, "Release" },          { 0x60010000, "GetTypeInfoCount" },
+            { 0x60010001, "GetTypeInfo" },      { 0x60010002, "GetIDsOfNames" },
+            { 0x60010003, "Invoke" } };
+    for (const auto& rFunc : aFuncs)
+        addFunc(rType, rFunc.first, FUNC_DISPATCH, INVOKE_FUNC, typeDesc(VT_VOID), {},
+                { rFunc.second });
+}
+
+static TypeLibSnapshot wordSnapshot()
+{
+    TypeLibSnapshot aSnapshot;
+
+    // 0: enum WdSaveFormat { wdFormatDocument = 0, wdFormatPDF = 17 }
+    SnapshotType aEnum = newType("WdSaveFormat", TKIND_ENUM, 0x10);
+    for (int32_t nValue : { 0, 17 })
+    {
+        SnapshotVar aVar = {};
+        aVar.mnMemberId = 0x40000000 + nValue;
+        aVar.mnVarKind = VAR_CONST;
+        aVar.mnValueType = VT_I4;
+        aVar.mnValue = (uint64_t)nValue;
+        aVar.maElem.maType = typeDesc(VT_I4);
+        aEnum.maVars.push_back(aVar);
+        const std::string sName = nValue ? "wdFormatPDF" : "wdFormatDocument";
+        aEnum.maMembers.push_back({ aVar.mnMemberId, sName, { sName } });
+    }
+    aSnapshot.maTypes.push_back(aEnum);
+
+    // 1: The vtable half of the dual interface _Document, with
+    // HRESULT Name([out, retval] BSTR* prop) and
+    // HRESULT SaveAs([in] BSTR FileName, [in] WdSaveFormat FileFormat)
+    SnapshotType aInterface = newType("_Document", TKIND_INTERFACE, 0x20);
+    aInterface.mnTypeFlags = TYPEFLAG_FDUAL | TYPEFLAG_FDISPATCHABLE;
+    // After the IDispatch methods
+    aInterface.mnSizeVft = 7;
+    addFunc(aInterface, 0, FUNC_PUREVIRTUAL, INVOKE_PROPERTYGET, typeDesc(VT_HRESULT),
+            { { pointerTo(typeDesc(VT_BSTR)), PARAMFLAG_FOUT | PARAMFLAG_FRETVAL } },
+            { "Name", "prop" });
+    addFunc(aInterface, 0x177, FUNC_PUREVIRTUAL, INVOKE_FUNC, typeDesc(VT_HRESULT),
+            { { typeDesc(VT_BSTR), PARAMFLAG_FIN },
+              { typeDesc(VT_USERDEFINED, 0x1234), PARAMFLAG_FIN } },
+            { "SaveAs", "FileName", "FileFormat" });
+    aInterface.maRefs = { { 0x1234, 0 } };
+    aSnapshot.maTypes.push_back(aInterface);
+
+    // 2: Its dispinterface, which is what the type library lists
+    SnapshotType aDispatch = newType("_Document", TKIND_DISPATCH, 0x20);
+    aDispatch.mnTypeFlags = TYPEFLAG_FDUAL | TYPEFLAG_FDISPATCHABLE;
+    addIDispatchFuncs(aDispatch);
+    addFunc(aDispatch, 0, FUNC_DISPATCH, INVOKE_PROPERTYGET, typeDesc(VT_BSTR), {}, { "Name" });
+    addFunc(aDispatch, 0x177, FUNC_DISPATCH, INVOKE_FUNC, typeDesc(VT_VOID),
+            { { typeDesc(VT_BSTR), PARAMFLAG_FIN },
+              { typeDesc(VT_USERDEFINED, 0x1234), PARAMFLAG_FIN } },
+            { "SaveAs", "FileName", "FileFormat" });
+    aDispatch.mbHasDualInterface = true;
+    aDispatch.mnDualHrefType = 0xFFFFFFFE;
+    aDispatch.maRefs = { { 0x1234, 0 }, { 0xFFFFFFFE, 1 } };
+    aSnapshot.maTypes.push_back(aDispatch);
+
+    // 3: The coclass Document, with _Document as the default interface and DocumentEvents2 as the
+    // default source interface
+    SnapshotType aCoclass = newType("Document", TKIND_COCLASS, 0x30);
+    aCoclass.maImplTypes = { { 0x100, IMPLTYPEFLAG_FDEFAULT },
+                             { 0x200, IMPLTYPEFLAG_FDEFAULT | IMPLTYPEFLAG_FSOURCE } };
+    aCoclass.maRefs = { { 0x100, 2 }, { 0x200, 4 } };
+    aCoclass.maMembers.push_back({ MEMBERID_NIL, "Document", {} });
+    aSnapshot.maTypes.push_back(aCoclass);
+
+    // 4: The event dispinterface DocumentEvents2, with void Close()
+    SnapshotType aEvents = newType("DocumentEvents2", TKIND_DISPATCH, 0x40);
+    aEvents.mnTypeFlags = TYPEFLAG_FDISPATCHABLE;
+    addIDispatchFuncs(aEvents);
+    addFunc(aEvents, 6, FUNC_DISPATCH, INVOKE_FUNC, typeDesc(VT_VOID), {}, { "Close" });
+    aSnapshot.maTypes.push_back(aEvents);
+
+    aSnapshot.maLibraries.push_back({ "MSWORD.OLB", "Word", { 0, 2, 3, 4 } });
+
+    return aSnapshot;
+}
+
+static std::string readFile(const std::string& rFileName)
+{
+    std::ifstream aFile(rFileName, std::ios::binary);
+    std::ostringstream aContents;
+    aContents << aFile.rdbuf();
+    return aContents.str();
+}
+
+static bool contains(const std::string& rText, const std::string& rPart)
+{
+    return rText.find(rPart) != std::string::npos;
+}
+
+static void testGenerated(const std::string& rFolder)
+{
+    const std::string sEnum = readFile(rFolder + "/EWord_WdSaveFormat.hxx");
+    CHECK(contains(sEnum, "enum EWord_WdSaveFormat {\n"));
+    CHECK(contains(sEnum, "    wdFormatDocument = /* int32_t*/ 0,\n"));
+    CHECK(contains(sEnum, "    wdFormatPDF = /* int32_t*/ 17,\n"));
+
+    // The proxy for the vtable half, with the IID of the interface, and its slots counted from
+    // what the snapshot has whatever the pointer size here
+    const std::string sHeader = readFile(rFolder + "/CWord__Document.hxx");
+    CHECK(contains(sHeader, "class CWord__Document"));
+    // Enum parameters are passed as their underlying type
+    CHECK(contains(sHeader, "virtual HRESULT __stdcall SaveAs(BSTR, int32_t);\n"));
+    const std::string sCode = readFile(rFolder + "/CWord__Document.cxx");
+    const std::string sIID = "{0x23222120,0x2524,0x2726,0x28,0x29,0x2A,0x2B,0x2C,0x2D,0x2E,0x2F}";
+    CHECK(contains(sCode, "CProxiedDispatch(pBaseClassUnknown, pDispatchToProxy, " + sIID));
+    CHECK(contains(sCode, "// vtbl entry 7, member id 0\n"
+                          "HRESULT __stdcall CWord__Document::getName(BSTR* prop)\n"));
+    CHECK(contains(sCode, "// vtbl entry 8, member id 375\n"
+                          "HRESULT __stdcall CWord__Document::SaveAs(BSTR FileName, "));
+    CHECK(contains(sCode, "    static const IID aIID = " + sIID + ";\n"));
+    CHECK(contains(sCode, "TraceFilter::accept(aIID, 375, true, msLibName, \"_Document\", "
+                          "\"SaveAs\")"));
+
+    const std::string sCoclass = readFile(rFolder + "/CWord_Document.hxx");
+    CHECK(contains(sCoclass, "class CWord_Document: public CWord__Document\n"));
+    CHECK(contains(sCoclass,
+                   "CWord__Document(pBaseClassUnknown, pDispatchToProxy, "
+                   "{0x33323130,0x3534,0x3736,0x38,0x39,0x3A,0x3B,0x3C,0x3D,0x3E,0x3F})"));
+
+    const std::string sEvents = readFile(rFolder + "/Word_DocumentEvents2.cxx");
+    CHECK(contains(sEvents, "HRESULT Word_DocumentEvents2CallbackInvoke("));
+    CHECK(contains(sEvents, "        case 6: // Close\n"));
+    CHECK(!contains(sEvents, "Invoke\n"));
+
+    // Only the vtable half is proxied, the dispatch one being the same interface
+    const std::string sCreator = readFile(rFolder + "/ProxyCreator.hxx");
+    CHECK(contains(sCreator, "#include \"CWord__Document.hxx\"\n"));
+    CHECK(contains(sCreator, "    " + sIID + ", // 0: Word._Document\n"));
+
+    const std::string sManifest = readFile(rFolder + "/genproxy.manifest");
+    for (const char* pFile : { "EWord_WdSaveFormat.hxx", "CWord__Document.hxx",
+                               "CWord__Document.cxx", "CWord_Document.hxx",
+                               "Word_DocumentEvents2.hxx", "Word_DocumentEvents2.cxx" })
+        CHECK(contains(sManifest, " " + rFolder + "/" + pFile + "\n"));
+}
+
+int main()
+{
+    char aFolder[] = "/tmp/coleat-genproxy-XXXXXX";
+    CHECK(mkdtemp(aFolder) != nullptr);
+    const std::string sFolder = aFolder;
+    const std::string sSnapshot = sFolder + "/word.snapshot";
+
+    std::ofstream aSnapshotFile(sSnapshot, std::ios::binary);
+    wordSnapshot().write(aSnapshotFile);
+    aSnapshotFile.close();
+    CHECK(aSnapshotFile.good());
+
+    std::vector<std::string> aArguments
+        = { "genproxy", "-d", sFolder, "-S", sSnapshot, "MSWORD.OLB" };
+    std::vector<char*> aArgv;
+    for (std::string& rArgument : aArguments)
+        aArgv.push_back(&rArgument[0]);
+    aArgv.push_back(nullptr);
+
+    // genproxy says what it generates on stdout, which is not of interest here
+    std::fflush(stdout);
+    const int nStdout = dup(1);
+    CHECK(std::freopen("/dev/null", "w", stdout) != nullptr);
+    const int nResult = genproxyMain((int)aArguments.size(), aArgv.data());
+    std::fflush(stdout);
+    dup2(nStdout, 1);
+    close(nStdout);
+
+    CHECK(nResult == 0);
+    testGenerated(sFolder);
+
+    // Only what genproxy wrote is in the manifest
+    std::istringstream aManifest(readFile(sFolder + "/genproxy.manifest"));
+    std::string sLine;
+    while (std::getline(aManifest, sLine))
+    {
+        const size_t nFile = sLine.find(sFolder + "/");
+        if (sLine[0] != '#' && nFile != std::string::npos)
+            std::remove(sLine.substr(nFile).c_str());
+    }
+    std::remove((sFolder + "/genproxy.manifest").c_str());
+    std::remove(sSnapshot.c_str());
+    CHECK(rmdir(aFolder) == 0);
+
+    return checkResult("genproxy");
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab cinoptions=b1,g0,N-s cinkeys+=0=break: */
@@ -0,0 +1,125 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of Collabora OLE Automation Translator.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+// Checks the GUID formatting and parsing against what StringFromIID() produces, and the snapshot
+// format of GuidNameTable.
+
+#include <sstream>
+#include <string>
+
+#include "check.hpp"
+#include "guidnames.hpp"
+
+// IID_IDispatch, {00020400-0000-0000-C000-000000000046}, as laid out in memory
+static const GuidBytes aIDispatch
+    = { { 0x00, 0x04, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0xC0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+          0x46 } };
+
+// Data1 0x12345678, Data2 0x9ABC, Data3 0xDEF0, Data4 0x0F 0x1E ... 0xF0
+static const GuidBytes aMixed
+    = { { 0x78, 0x56, 0x34, 0x12, 0xBC, 0x9A, 0xF0, 0xDE, 0x0F, 0x1E, 0x2D, 0x3C, 0x4B, 0x5A, 0x69,
+          0xF0 } };
+
+static std::string formatted(const GuidBytes& rGuid)
+{
+    char sGuid[GUID_STRING_LENGTH + 1];
+    formatGuid(rGuid, sGuid);
+    return sGuid;
+}
+
+static void testFormat()
+{
+    CHECK(formatted(aIDispatch) == "{00020400-0000-0000-C000-000000000046}");
+    CHECK(formatted(aMixed) == "{12345678-9ABC-DEF0-0F1E-2D3C4B5A69F0}");
+    CHECK(formatted(aMixed).size() == GUID_STRING_LENGTH);
+}
+
+static void testParse()
+{
+    GuidBytes aGuid;
+
+    CHECK(parseGuid("{12345678-9ABC-DEF0-0F1E-2D3C4B5A69F0}", aGuid));
+    CHECK(aGuid == aMixed);
+    CHECK(parseGuid("{12345678-9abc-def0-0f1e-2d3c4b5a69f0}", aGuid));
+    CHECK(aGuid == aMixed);
+
+    // Only the GUID itself is looked at
+    CHECK(parseGuid("{00020400-0000-0000-C000-000000000046} IDispatch", aGuid));
+    CHECK(aGuid == aIDispatch);
+
+    CHECK(!parseGuid("", aGuid));
+    CHECK(!parseGuid("00020400-0000-0000-C000-000000000046", aGuid));
+    CHECK(!parseGuid("{00020400-0000-0000-C000-000000000046", aGuid));
+    CHECK(!parseGuid("{00020400-0000-0000-C000000000000046}", aGuid));
+    CHECK(!parseGuid("{0002040G-0000-0000-C000-000000000046}", aGuid));
+    CHECK(!parseGuid("{00020400-0000-0000-C000-00000000004}", aGuid));
+}
+
+static void testTable()
+{
+    GuidNameTable aTable;
+    CHECK(aTable.find(aIDispatch) == nullptr);
+
+    const std::string& rName = aTable.insert(aIDispatch, "IDispatch");
+    CHECK(rName == "IDispatch");
+    CHECK(&aTable.insert(aIDispatch, "Something else") == &rName);
+    CHECK(*aTable.find(aIDispatch) == "IDispatch");
+
+    // Pointers to entries stay valid as the table grows
+    const std::string* pName = aTable.find(aIDispatch);
+    for (int i = 0; i < 1000; ++i)
+    {
+        GuidBytes aGuid = aMixed;
+        aGuid.maBytes[0] = (uint8_t)i;
+        aGuid.maBytes[1] = (uint8_t)(i >> 8);
+        aTable.insert(aGuid, "Name" + std::to_string(i));
+    }
+    CHECK(aTable.find(aIDispatch) == pName);
+    CHECK(aTable.size() == 1001);
+}
+
+static void testSnapshot()
+{
+    GuidNameTable aTable;
+    aTable.insert(aIDispatch, "IDispatch");
+    aTable.insert(aMixed, "Word.Application with spaces");
+
+    std::stringstream aStream;
+    aTable.save(aStream);
+
+    GuidNameTable aLoaded;
+    CHECK(aLoaded.load(aStream) == 2);
+    CHECK(*aLoaded.find(aIDispatch) == "IDispatch");
+    CHECK(*aLoaded.find(aMixed) == "Word.Application with spaces");
+
+    // Written on Windows, with garbage and duplicates. Existing entries are not replaced.
+    std::istringstream aWindows("{00020400-0000-0000-C000-000000000046} IDispatch again\r\n"
+                                "not a GUID at all\r\n"
+                                "{12345678-9ABC-DEF0-0F1E-2D3C4B5A69F0}\r\n"
+                                "{12345678-9ABC-DEF0-0F1E-2D3C4B5A69F1}NoSpace\r\n"
+                                "{12345678-9ABC-DEF0-0F1E-2D3C4B5A69F2} Fine\r\n");
+    CHECK(aLoaded.load(aWindows) == 1);
+    CHECK(aLoaded.size() == 3);
+    CHECK(*aLoaded.find(aIDispatch) == "IDispatch");
+
+    GuidBytes aFine;
+    CHECK(parseGuid("{12345678-9ABC-DEF0-0F1E-2D3C4B5A69F2}", aFine));
+    CHECK(aLoaded.find(aFine) != nullptr && *aLoaded.find(aFine) == "Fine");
+}
+
+int main()
+{
+    testFormat();
+    testParse();
+    testTable();
+    testSnapshot();
+    return checkResult("guidnames");
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab cinoptions=b1,g0,N-s cinkeys+=0=break: */
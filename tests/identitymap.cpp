@@ -0,0 +1,167 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of Collabora OLE Automation Translator.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+// Hammers IdentityMap from many threads the way CProxiedUnknown::get() and Release() use it, with
+// mock proxies that are freed as soon as their reference count drops to zero. Build with
+// -fsanitize=address or -fsanitize=thread to catch a proxy being handed out after it was freed.
+
+#include <atomic>
+#include <random>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+
+#include "check.hpp"
+#include "identitymap.hpp"
+
+struct MockLock
+{
+    void lockShared() { maMutex.lock_shared(); }
+    void unlockShared() { maMutex.unlock_shared(); }
+    void lockExclusive() { maMutex.lock(); }
+    void unlockExclusive() { maMutex.unlock(); }
+
+    std::shared_timed_mutex maMutex;
+};
+
+struct MockUnknown
+{
+    int mnDummy;
+};
+
+struct MockProxy
+{
+    MockUnknown* mpUnknown;
+    std::atomic<long> mnRefs;
+};
+
+typedef IdentityMap<MockUnknown, MockLock> MockMap;
+
+static const int NOBJECTS = 64;
+static const int NTHREADS = 8;
+static const int NITERATIONS = 200000;
+
+static MockUnknown aObjects[NOBJECTS];
+static std::atomic<int> nCreated(0);
+static std::atomic<int> nFreed(0);
+static std::atomic<int> nReplaced(0);
+
+// Like CProxiedUnknown::tryAddRef()
+static bool tryAddRef(void* pValue)
+{
+    MockProxy* pProxy = static_cast<MockProxy*>(pValue);
+    long nRefs = pProxy->mnRefs.load();
+    while (nRefs > 0)
+    {
+        if (pProxy->mnRefs.compare_exchange_weak(nRefs, nRefs + 1))
+            return true;
+    }
+    return false;
+}
+
+// Like CProxiedUnknown::get()
+static MockProxy* get(MockMap& rMap, MockUnknown* pUnknown)
+{
+    MockProxy* pProxy = static_cast<MockProxy*>(rMap.find(pUnknown, tryAddRef));
+    if (pProxy != nullptr)
+        return pProxy;
+
+    pProxy = new MockProxy{ pUnknown, { 1 } };
+    ++nCreated;
+    if (rMap.insert(pUnknown, pProxy) != nullptr)
+        ++nReplaced;
+    return pProxy;
+}
+
+// Like CProxiedUnknown::Release() and lastRelease()
+static void release(MockMap& rMap, MockProxy* pProxy)
+{
+    if (--pProxy->mnRefs == 0)
+    {
+        rMap.erase(pProxy->mpUnknown, pProxy);
+        delete pProxy;
+        ++nFreed;
+    }
+}
+
+static void hammer(MockMap* pMap, unsigned nSeed)
+{
+    std::mt19937 aRandom(nSeed);
+    for (int i = 0; i < NITERATIONS; ++i)
+    {
+        MockUnknown* pUnknown = &aObjects[aRandom() % NOBJECTS];
+
+        MockProxy* pProxy = get(*pMap, pUnknown);
+        CHECK(pProxy->mpUnknown == pUnknown);
+        CHECK(pProxy->mnRefs > 0);
+
+        if (aRandom() % 4 == 0)
+            std::this_thread::yield();
+
+        release(*pMap, pProxy);
+    }
+}
+
+static void testBasics()
+{
+    MockMap aMap;
+    MockUnknown aUnknown1, aUnknown2;
+    MockProxy aProxy1{ &aUnknown1, { 1 } }, aProxy2{ &aUnknown2, { 1 } },
+        aProxy3{ &aUnknown1, { 1 } };
+
+    CHECK(aMap.find(&aUnknown1) == nullptr);
+    CHECK(aMap.insert(&aUnknown1, &aProxy1) == nullptr);
+    CHECK(aMap.insert(&aUnknown2, &aProxy2) == nullptr);
+    CHECK(aMap.find(&aUnknown1) == &aProxy1);
+    CHECK(aMap.find(&aUnknown2) == &aProxy2);
+    CHECK(aMap.size() == 2);
+
+    // The accept function takes a reference, or refuses a proxy on its way out.
+    CHECK(aMap.find(&aUnknown1, tryAddRef) == &aProxy1);
+    CHECK(aProxy1.mnRefs == 2);
+    aProxy2.mnRefs = 0;
+    CHECK(aMap.find(&aUnknown2, tryAddRef) == nullptr);
+    CHECK(aProxy2.mnRefs == 0);
+
+    // Another thread created a new proxy for the object before the old one was erased.
+    CHECK(aMap.insert(&aUnknown1, &aProxy3) == &aProxy1);
+    aMap.erase(&aUnknown1, &aProxy1);
+    CHECK(aMap.find(&aUnknown1) == &aProxy3);
+
+    aMap.erase(&aUnknown1, &aProxy3);
+    aMap.erase(&aUnknown2, &aProxy2);
+    CHECK(aMap.find(&aUnknown1) == nullptr);
+    CHECK(aMap.size() == 0);
+}
+
+static void testStress()
+{
+    MockMap aMap;
+    std::vector<std::thread> aThreads;
+
+    for (int i = 0; i < NTHREADS; ++i)
+        aThreads.emplace_back(hammer, &aMap, (unsigned)i);
+    for (auto& rThread : aThreads)
+        rThread.join();
+
+    // Every proxy erases itself if it still is the one in the map when it is freed.
+    CHECK(nFreed == nCreated);
+    CHECK(aMap.size() == 0);
+    std::cout << "identitymap: " << nCreated << " proxies created, " << nReplaced
+              << " replaced by a racing thread" << std::endl;
+}
+
+int main()
+{
+    testBasics();
+    testStress();
+    return checkResult("identitymap");
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab cinoptions=b1,g0,N-s cinkeys+=0=break: */
@@ -0,0 +1,88 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of Collabora OLE Automation Translator.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+// Checks that every value goes in the bucket whose bounds contain it, that the buckets are within
+// 12.5% of the value, and the percentiles that the -c output reports.
+
+#include <cstdint>
+
+#include "check.hpp"
+#include "latencyhistogram.hpp"
+
+static void testHighestBit()
+{
+    for (int nBit = 0; nBit < 64; ++nBit)
+    {
+        CHECK(latencyHighestBit((uint64_t)1 << nBit) == nBit);
+        CHECK(latencyHighestBit(((uint64_t)1 << nBit) | 1) == nBit);
+    }
+    CHECK(latencyHighestBit(UINT64_MAX) == 63);
+    CHECK(latencyHighestBit(0x100000000ull) == 32);
+    CHECK(latencyHighestBit(0xFFFFFFFFull) == 31);
+}
+
+static void checkValue(uint64_t nValue)
+{
+    const int nBucket = latencyBucket(nValue);
+    CHECK(nBucket >= 0 && nBucket < LATENCY_BUCKETS);
+    CHECK(latencyBucketLowerBound(nBucket) <= nValue);
+    CHECK(nValue <= latencyBucketUpperBound(nBucket));
+    if (nBucket < LATENCY_BUCKETS - 1)
+        CHECK(latencyBucketUpperBound(nBucket) - latencyBucketLowerBound(nBucket)
+              <= latencyBucketLowerBound(nBucket) / LATENCY_SUB_BUCKETS);
+}
+
+static void testBuckets()
+{
+    for (uint64_t n = 0; n < 100000; ++n)
+        checkValue(n);
+    for (int nBit = 17; nBit < 64; ++nBit)
+    {
+        const uint64_t nPower = (uint64_t)1 << nBit;
+        checkValue(nPower - 1);
+        checkValue(nPower);
+        checkValue(nPower + nPower / 3);
+    }
+    checkValue(UINT64_MAX);
+
+    // The buckets are contiguous
+    for (int i = 1; i < LATENCY_BUCKETS; ++i)
+        CHECK(latencyBucketLowerBound(i) == latencyBucketUpperBound(i - 1) + 1);
+    CHECK(latencyBucket((uint64_t)1 << (LATENCY_MAX_BIT + 1)) == LATENCY_BUCKETS - 1);
+}
+
+static void testPercentiles()
+{
+    LatencyHistogram aHistogram;
+    CHECK(aHistogram.percentile(0.5, 0) == 0);
+
+    // 90 fast calls of 1000 ns and 10 slow ones of a millisecond
+    for (int i = 0; i < 90; ++i)
+        aHistogram.record(1000);
+    LatencyHistogram aSlow;
+    for (int i = 0; i < 10; ++i)
+        aSlow.record(1000000);
+    aHistogram.add(aSlow);
+
+    CHECK(aHistogram.count(latencyBucket(1000)) == 90);
+    CHECK(aHistogram.percentile(0.5, 100) == latencyBucketUpperBound(latencyBucket(1000)));
+    CHECK(aHistogram.percentile(0.9, 100) == latencyBucketUpperBound(latencyBucket(1000)));
+    CHECK(aHistogram.percentile(0.99, 100) == latencyBucketUpperBound(latencyBucket(1000000)));
+    CHECK(aHistogram.percentile(1.0, 100) == latencyBucketUpperBound(latencyBucket(1000000)));
+}
+
+int main()
+{
+    testHighestBit();
+    testBuckets();
+    testPercentiles();
+    return checkResult("latencyhistogram");
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab cinoptions=b1,g0,N-s cinkeys+=0=break: */
@@ -0,0 +1,343 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of Collabora OLE Automation Translator.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+// Builds small 32- and 64-bit PE images importing from KERNEL32.dll and OLEAUT32.dll, both as
+// files and as loaded, and checks that PEImports finds their import address tables, and that
+// broken and truncated images are rejected or cut short without reading outside the data.
+
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "check.hpp"
+#include "peimports.hpp"
+
+// The one section, .idata, and where things are in it
+static const uint32_t NSECTIONRVA = 0x2000;
+static const uint32_t NSECTIONSIZE = 0x200;
+static const uint32_t NSECTIONFILEOFFSET = 0x400;
+static const uint32_t NDESCRIPTORS = 0x2000;
+static const uint32_t NKERNEL32LOOKUP = 0x2040;
+static const uint32_t NOLEAUT32LOOKUP = 0x2060;
+static const uint32_t NKERNEL32IAT = 0x2080;
+static const uint32_t NOLEAUT32IAT = 0x20C0;
+static const uint32_t NKERNEL32NAME = 0x2100;
+static const uint32_t NOLEAUT32NAME = 0x2110;
+
+static const uint64_t aKernel32Functions[] = { 0x7FF812340010, 0x7FF812340020 };
+static const uint64_t aOleAut32Functions[] = { 0x7FF856780030 };
+
+class PEBuilder
+{
+public:
+    PEBuilder(bool b64Bit, bool bImageLayout)
+        : mb64Bit(b64Bit)
+        , mbImageLayout(bImageLayout)
+        , maData(bImageLayout ? NSECTIONRVA + NSECTIONSIZE : NSECTIONFILEOFFSET + NSECTIONSIZE)
+    {
+        // DOS header
+        put16(0, 0x5A4D);
+        put32(0x3C, NPE);
+
+        // PE signature and file header, with one section
+        put32(NPE, 0x00004550);
+        put16(NPE + 4, b64Bit ? 0x8664 : 0x014C);
+        put16(NPE + 6, 1);
+        put16(NPE + 20, (uint16_t)(optionalHeaderSize()));
+
+        // Optional header, with its 16 data directories
+        put16(NOPTIONALHEADER, b64Bit ? 0x20B : 0x10B);
+        put32(NOPTIONALHEADER + (b64Bit ? 108 : 92), 16);
+        put32(dataDirectories() + 8, NDESCRIPTORS);
+        put32(dataDirectories() + 12, 60);
+
+        // Section table
+        const size_t nSection = NOPTIONALHEADER + optionalHeaderSize();
+        std::memcpy(&maData[nSection], ".idata", 6);
+        put32(nSection + 8, NSECTIONSIZE);
+        put32(nSection + 12, NSECTIONRVA);
+        put32(nSection + 16, NSECTIONSIZE);
+        put32(nSection + 20, NSECTIONFILEOFFSET);
+
+        // Import descriptors, followed by a zero one
+        putDescriptor(NDESCRIPTORS, NKERNEL32LOOKUP, NKERNEL32NAME, NKERNEL32IAT);
+        putDescriptor(NDESCRIPTORS + 20, NOLEAUT32LOOKUP, NOLEAUT32NAME, NOLEAUT32IAT);
+
+        putString(NKERNEL32NAME, "KERNEL32.dll");
+        putString(NOLEAUT32NAME, "OLEAUT32.dll");
+
+        // The lookup tables only need to be non-zero, and the import address tables end with a
+        // zero entry
+        put32(offsetOf(NKERNEL32LOOKUP), 0x3000);
+        put32(offsetOf(NOLEAUT32LOOKUP), 0x3010);
+        for (size_t i = 0; i < 2; ++i)
+            putSlot(NKERNEL32IAT + (uint32_t)(i * slotSize()), aKernel32Functions[i]);
+        putSlot(NOLEAUT32IAT, aOleAut32Functions[0]);
+    }
+
+    size_t slotSize() const { return mb64Bit ? 8 : 4; }
+
+    size_t dataDirectories() const { return NOPTIONALHEADER + (mb64Bit ? 112 : 96); }
+
+    // Where the byte at nRVA in .idata is in the data
+    size_t offsetOf(uint32_t nRVA) const
+    {
+        return mbImageLayout ? nRVA : NSECTIONFILEOFFSET + (nRVA - NSECTIONRVA);
+    }
+
+    // What an import address table entry holds, in this image's size
+    uint64_t function(uint64_t nFunction) const
+    {
+        return mb64Bit ? nFunction : (uint32_t)nFunction;
+    }
+
+    void put16(size_t nOffset, uint16_t n)
+    {
+        maData[nOffset] = (unsigned char)n;
+        maData[nOffset + 1] = (unsigned char)(n >> 8);
+    }
+
+    void put32(size_t nOffset, uint32_t n)
+    {
+        put16(nOffset, (uint16_t)n);
+        put16(nOffset + 2, (uint16_t)(n >> 16));
+    }
+
+    void put64(size_t nOffset, uint64_t n)
+    {
+        put32(nOffset, (uint32_t)n);
+        put32(nOffset + 4, (uint32_t)(n >> 32));
+    }
+
+    void putSlot(uint32_t nRVA, uint64_t nValue)
+    {
+        if (mb64Bit)
+            put64(offsetOf(nRVA), nValue);
+        else
+            put32(offsetOf(nRVA), (uint32_t)nValue);
+    }
+
+    void putDescriptor(uint32_t nRVA, uint32_t nLookup, uint32_t nName, uint32_t nIAT)
+    {
+        put32(offsetOf(nRVA), nLookup);
+        put32(offsetOf(nRVA) + 12, nName);
+        put32(offsetOf(nRVA) + 16, nIAT);
+    }
+
+    void putString(uint32_t nRVA, const char* sString)
+    {
+        std::memcpy(&maData[offsetOf(nRVA)], sString, std::strlen(sString) + 1);
+    }
+
+    std::vector<unsigned char>& data() { return maData; }
+
+private:
+    static const size_t NPE = 0x80;
+    static const size_t NOPTIONALHEADER = NPE + 24;
+
+    size_t optionalHeaderSize() const { return (mb64Bit ? 112 : 96) + 16 * 8; }
+
+    const bool mb64Bit;
+    const bool mbImageLayout;
+    std::vector<unsigned char> maData;
+};
+
+class Recorder
+{
+public:
+    Recorder()
+        : msSkipped(nullptr)
+    {
+    }
+
+    bool dll(const char* sDll)
+    {
+        maDlls.push_back(sDll);
+        return msSkipped == nullptr || std::strcmp(sDll, msSkipped) != 0;
+    }
+
+    void slot(size_t nOffset, uint64_t nValue) { maSlots.emplace_back(nOffset, nValue); }
+
+    const char* msSkipped;
+    std::vector<std::string> maDlls;
+    std::vector<std::pair<size_t, uint64_t>> maSlots;
+};
+
+static size_t walk(const std::vector<unsigned char>& rData, bool bImageLayout, Recorder& rRecorder)
+{
+    PEImports aImports(rData.data(), rData.size(), bImageLayout);
+    return aImports.walk(rRecorder);
+}
+
+static void testImports(bool b64Bit, bool bImageLayout)
+{
+    PEBuilder aBuilder(b64Bit, bImageLayout);
+    const std::vector<unsigned char>& rData = aBuilder.data();
+
+    PEImports aImports(rData.data(), rData.size(), bImageLayout);
+    CHECK(aImports.isValid());
+    CHECK(aImports.is64Bit() == b64Bit);
+    CHECK(aImports.slotSize() == aBuilder.slotSize());
+
+    Recorder aRecorder;
+    CHECK(aImports.walk(aRecorder) == 2);
+    CHECK(aRecorder.maDlls.size() == 2);
+    CHECK(aRecorder.maDlls[0] == "KERNEL32.dll");
+    CHECK(aRecorder.maDlls[1] == "OLEAUT32.dll");
+
+    CHECK(aRecorder.maSlots.size() == 3);
+    if (aRecorder.maSlots.size() != 3)
+        return;
+    CHECK(aRecorder.maSlots[0].first == aBuilder.offsetOf(NKERNEL32IAT));
+    CHECK(aRecorder.maSlots[0].second == aBuilder.function(aKernel32Functions[0]));
+    CHECK(aRecorder.maSlots[1].first == aBuilder.offsetOf(NKERNEL32IAT) + aBuilder.slotSize());
+    CHECK(aRecorder.maSlots[1].second == aBuilder.function(aKernel32Functions[1]));
+    CHECK(aRecorder.maSlots[2].first == aBuilder.offsetOf(NOLEAUT32IAT));
+    CHECK(aRecorder.maSlots[2].second == aBuilder.function(aOleAut32Functions[0]));
+
+    // A DLL that the visitor isn't interested in still counts, but its slots aren't visited
+    Recorder aSkipping;
+    aSkipping.msSkipped = "KERNEL32.dll";
+    CHECK(aImports.walk(aSkipping) == 2);
+    CHECK(aSkipping.maSlots.size() == 1);
+    CHECK(!aSkipping.maSlots.empty()
+          && aSkipping.maSlots[0].first == aBuilder.offsetOf(NOLEAUT32IAT));
+}
+
+static void testBadHeaders()
+{
+    for (bool b64Bit : { false, true })
+    {
+        Recorder aRecorder;
+
+        PEImports aEmpty(nullptr, 0, false);
+        CHECK(!aEmpty.isValid());
+        CHECK(aEmpty.walk(aRecorder) == 0);
+
+        PEBuilder aNotMZ(b64Bit, false);
+        aNotMZ.put16(0, 0x4D5A);
+        CHECK(walk(aNotMZ.data(), false, aRecorder) == 0);
+
+        PEBuilder aNotPE(b64Bit, false);
+        aNotPE.put32(0x80, 0x00004551);
+        CHECK(walk(aNotPE.data(), false, aRecorder) == 0);
+
+        PEBuilder aFarPE(b64Bit, false);
+        aFarPE.put32(0x3C, 0xFFFFFFF0);
+        CHECK(walk(aFarPE.data(), false, aRecorder) == 0);
+
+        PEBuilder aBadMagic(b64Bit, false);
+        aBadMagic.put16(0x80 + 24, 0x107);
+        CHECK(!PEImports(aBadMagic.data().data(), aBadMagic.data().size(), false).isValid());
+
+        CHECK(aRecorder.maDlls.empty());
+
+        // Without an import directory the image is valid, but has nothing to walk
+        PEBuilder aNoImports(b64Bit, false);
+        aNoImports.put32(0x80 + 24 + (b64Bit ? 108 : 92), 1);
+        const std::vector<unsigned char>& rNoImports = aNoImports.data();
+        PEImports aImports(rNoImports.data(), rNoImports.size(), false);
+        CHECK(aImports.isValid());
+        CHECK(aImports.walk(aRecorder) == 0);
+    }
+}
+
+static void testBadImports()
+{
+    for (bool bImageLayout : { false, true })
+    {
+        // A DLL name without its terminating zero at the end of the data
+        {
+            PEBuilder aBuilder(true, bImageLayout);
+            std::vector<unsigned char>& rData = aBuilder.data();
+            const uint32_t nName = NSECTIONRVA + NSECTIONSIZE - 4;
+            std::memcpy(&rData[aBuilder.offsetOf(nName)], "OLEA", 4);
+            aBuilder.put32(aBuilder.offsetOf(NDESCRIPTORS + 20) + 12, nName);
+
+            Recorder aRecorder;
+            CHECK(walk(rData, bImageLayout, aRecorder) == 2);
+            CHECK(aRecorder.maDlls.size() == 1);
+            CHECK(aRecorder.maSlots.size() == 2);
+        }
+
+        // An import address table outside the data, or without a zero entry at its end
+        {
+            PEBuilder aBuilder(true, bImageLayout);
+            std::vector<unsigned char>& rData = aBuilder.data();
+            aBuilder.put32(aBuilder.offsetOf(NDESCRIPTORS) + 16, 0x7FFF0000);
+            const uint32_t nLastSlot = NSECTIONRVA + NSECTIONSIZE - 8;
+            aBuilder.putSlot(nLastSlot, 0x7FF8DEADBEEF);
+            aBuilder.put32(aBuilder.offsetOf(NDESCRIPTORS + 20) + 16, nLastSlot);
+
+            Recorder aRecorder;
+            CHECK(walk(rData, bImageLayout, aRecorder) == 2);
+            CHECK(aRecorder.maDlls.size() == 2);
+            CHECK(aRecorder.maSlots.size() == 1);
+            CHECK(!aRecorder.maSlots.empty()
+                  && aRecorder.maSlots[0].first == aBuilder.offsetOf(nLastSlot));
+        }
+
+        // Descriptors that run up to the end of the data without a zero one
+        {
+            PEBuilder aBuilder(false, bImageLayout);
+            std::vector<unsigned char>& rData = aBuilder.data();
+            const uint32_t nEnd = NSECTIONRVA + NSECTIONSIZE;
+            for (uint32_t nRVA = nEnd - 20 * 4; nRVA + 20 <= nEnd; nRVA += 20)
+                aBuilder.putDescriptor(nRVA, NKERNEL32LOOKUP, NKERNEL32NAME, NKERNEL32IAT);
+            aBuilder.put32(aBuilder.dataDirectories() + 8, nEnd - 20 * 4);
+
+            Recorder aRecorder;
+            CHECK(walk(rData, bImageLayout, aRecorder) == 4);
+            CHECK(aRecorder.maSlots.size() == 8);
+        }
+    }
+
+    // In a file, an import directory outside of any section
+    {
+        PEBuilder aBuilder(true, false);
+        aBuilder.put32(aBuilder.dataDirectories() + 8, NSECTIONRVA + NSECTIONSIZE);
+        Recorder aRecorder;
+        CHECK(walk(aBuilder.data(), false, aRecorder) == 0);
+    }
+}
+
+// Whatever the cut, the walk never finds more than there is, nor anything that isn't there.
+// Reading outside the data would show up when run with -fsanitize=address.
+static void testTruncated()
+{
+    for (bool b64Bit : { false, true })
+        for (bool bImageLayout : { false, true })
+        {
+            PEBuilder aBuilder(b64Bit, bImageLayout);
+            const std::vector<unsigned char>& rData = aBuilder.data();
+            for (size_t nSize = 0; nSize < rData.size(); ++nSize)
+            {
+                const std::vector<unsigned char> aTruncated(rData.begin(), rData.begin() + nSize);
+                Recorder aRecorder;
+                CHECK(walk(aTruncated, bImageLayout, aRecorder) <= 2);
+                CHECK(aRecorder.maSlots.size() <= 3);
+                for (const auto& rSlot : aRecorder.maSlots)
+                    CHECK(rSlot.first + aBuilder.slotSize() <= nSize);
+            }
+        }
+}
+
+int main()
+{
+    for (bool b64Bit : { false, true })
+        for (bool bImageLayout : { false, true })
+            testImports(b64Bit, bImageLayout);
+    testBadHeaders();
+    testBadImports();
+    testTruncated();
+    return checkResult("peimports");
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab cinoptions=b1,g0,N-s cinkeys+=0=break: */
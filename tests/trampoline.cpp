@@ -0,0 +1,142 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of Collabora OLE Automation Translator.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+// Checks the bytes of the trampolines for DllGetClassObject against what the injected DLL used to
+// generate for it, and that the encoder stays within its limits for any number of arguments.
+
+#include <cstring>
+#include <vector>
+
+#include "check.hpp"
+#include "trampoline.hpp"
+
+static std::vector<unsigned char> encoded(TrampolineArch eArch, uint64_t nCodeAddress,
+                                          uint64_t nFunction, uint64_t nId, short nArguments)
+{
+    unsigned char aBuffer[NTRAMPOLINEMAX];
+    TrampolineEncoder aEncoder(aBuffer, nCodeAddress);
+    const size_t nSize = aEncoder.encode(eArch, nFunction, nId, nArguments);
+    return std::vector<unsigned char>(aBuffer, aBuffer + nSize);
+}
+
+static uint64_t readValue(const std::vector<unsigned char>& rCode, size_t nOffset, int nBytes)
+{
+    uint64_t n = 0;
+    for (int i = nBytes - 1; i >= 0; --i)
+        n = (n << 8) | rCode[nOffset + (size_t)i];
+    return n;
+}
+
+static void testX86()
+{
+    static const unsigned char aExpected[]
+        = { 0x55, 0x8B, 0xEC, 0x83, 0xEC, 0x40, 0x53, 0x56, 0x57, 0x8B, 0x45, 0x10, 0x50,
+            0x8B, 0x4D, 0x0C, 0x51, 0x8B, 0x55, 0x08, 0x52, 0xE8, 0xE6, 0xFF, 0xFF, 0x0F,
+            0x5F, 0x5E, 0x5B, 0x8B, 0xE5, 0x5D, 0xC2, 0x0C, 0x00, 0x44, 0x33, 0x22, 0x11 };
+
+    const std::vector<unsigned char> aCode
+        = encoded(TrampolineArch::X86, 0x10000000, 0x20000000, 0x11223344, 3);
+    CHECK(aCode.size() == sizeof(aExpected));
+    CHECK(std::memcmp(aCode.data(), aExpected, sizeof(aExpected)) == 0);
+
+    // The call is relative to the address it returns to, which is where the epilogue starts
+    const size_t nReturn = aCode.size() - 4 - trampolineIdOffset(TrampolineArch::X86);
+    CHECK(aCode[nReturn - 5] == 0xE8);
+    CHECK((uint32_t)(0x10000000 + nReturn + readValue(aCode, nReturn - 4, 4)) == 0x20000000);
+
+    // Wherever the trampoline is
+    const std::vector<unsigned char> aHigh
+        = encoded(TrampolineArch::X86, 0x7FFE0000, 0x00401000, 0x11223344, 3);
+    CHECK((uint32_t)(0x7FFE0000 + nReturn + readValue(aHigh, nReturn - 4, 4)) == 0x00401000);
+}
+
+static void testX64()
+{
+    static const unsigned char aExpected[]
+        = { 0x4C, 0x89, 0x44, 0x24, 0x18, 0x48, 0x89, 0x54, 0x24, 0x10, 0x48, 0x89, 0x4C,
+            0x24, 0x08, 0x40, 0x55, 0x48, 0x83, 0xEC, 0x60, 0x48, 0x8D, 0x6C, 0x24, 0x20,
+            0x48, 0x8B, 0x4D, 0x50, 0x48, 0x8B, 0x55, 0x58, 0x4C, 0x8B, 0x45, 0x60, 0x48,
+            0xB8, 0x88, 0x77, 0x66, 0x55, 0x44, 0x33, 0x22, 0x11, 0xFF, 0xD0, 0x48, 0x8D,
+            0x65, 0x40, 0x5D, 0xC3, 0x08, 0x07, 0x06, 0x05, 0x04, 0x03, 0x02, 0x01 };
+
+    const std::vector<unsigned char> aCode = encoded(TrampolineArch::X64, 0x180000000,
+                                                     0x1122334455667788, 0x0102030405060708, 3);
+    CHECK(aCode.size() == sizeof(aExpected));
+    CHECK(std::memcmp(aCode.data(), aExpected, sizeof(aExpected)) == 0);
+}
+
+// Where the sub rsp instruction is, after the arguments in registers are saved and rbp is pushed
+static size_t x64FrameOffset(short nArguments)
+{
+    return (size_t)(nArguments < 4 ? nArguments : 4) * 5 + 2;
+}
+
+static void testArgumentCounts()
+{
+    for (TrampolineArch eArch : { TrampolineArch::X86, TrampolineArch::X64 })
+    {
+        const int nIdBytes = eArch == TrampolineArch::X86 ? 4 : 8;
+        for (short nArguments = 0; nArguments <= NTRAMPOLINEMAXARGUMENTS; ++nArguments)
+        {
+            const std::vector<unsigned char> aCode
+                = encoded(eArch, 0x10000000, 0x20000000, 0x0102030405060708, nArguments);
+            CHECK(!aCode.empty() && aCode.size() <= NTRAMPOLINEMAX);
+
+            // The id is found from the return address of the call
+            const size_t nId = aCode.size() - (size_t)nIdBytes;
+            const uint64_t nExpectedId
+                = eArch == TrampolineArch::X86 ? 0x05060708 : 0x0102030405060708;
+            CHECK(readValue(aCode, nId, nIdBytes) == nExpectedId);
+            const size_t nReturn = nId - trampolineIdOffset(eArch);
+            if (eArch == TrampolineArch::X86)
+            {
+                CHECK(aCode[nReturn - 5] == 0xE8);
+                CHECK(aCode[nId - 3] == 0xC2);
+                CHECK(readValue(aCode, nId - 2, 2) == (uint64_t)nArguments * 4);
+            }
+            else
+            {
+                CHECK(aCode[nReturn - 2] == 0xFF && aCode[nReturn - 1] == 0xD0);
+                CHECK(aCode[nId - 1] == 0xC3);
+            }
+        }
+
+        CHECK(encoded(eArch, 0, 0, 0, -1).empty());
+        CHECK(encoded(eArch, 0, 0, 0, NTRAMPOLINEMAXARGUMENTS + 1).empty());
+    }
+
+    // The frame for 7 and 8 arguments is 0x80 bytes, which doesn't fit a sign-extended imm8
+    for (short nArguments = 0; nArguments <= NTRAMPOLINEMAXARGUMENTS; ++nArguments)
+    {
+        const std::vector<unsigned char> aCode
+            = encoded(TrampolineArch::X64, 0, 0x20000000, 1, nArguments);
+        const size_t nSub = x64FrameOffset(nArguments);
+        CHECK(aCode[nSub - 2] == 0x40 && aCode[nSub - 1] == 0x55);
+        if (nArguments < 7)
+        {
+            CHECK(aCode[nSub] == 0x48 && aCode[nSub + 1] == 0x83 && aCode[nSub + 2] == 0xEC);
+            CHECK(aCode[nSub + 3] < 0x80);
+        }
+        else
+        {
+            CHECK(aCode[nSub] == 0x48 && aCode[nSub + 1] == 0x81 && aCode[nSub + 2] == 0xEC);
+            CHECK(readValue(aCode, nSub + 3, 4) == 0x80);
+        }
+    }
+}
+
+int main()
+{
+    testX86();
+    testX64();
+    testArgumentCounts();
+    return checkResult("trampoline");
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab cinoptions=b1,g0,N-s cinkeys+=0=break: */
@@ -0,0 +1,258 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of Collabora OLE Automation Translator.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+// Writes a small type library snapshot, with a dual interface, its dispinterface, an enumeration
+// and a coclass, reads it back and checks that nothing got lost, and that truncated and corrupt
+// snapshots are rejected.
+
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include "check.hpp"
+#include "typelibsnapshot.hpp"
+
+// The values of the Windows constants used here
+static const uint16_t VT_I4 = 3;
+static const uint16_t VT_BSTR = 8;
+static const uint16_t VT_DISPATCH = 9;
+static const uint16_t VT_HRESULT = 25;
+static const uint16_t VT_PTR = 26;
+static const uint16_t VT_USERDEFINED = 29;
+static const uint16_t VT_CARRAY = 28;
+static const int32_t TKIND_ENUM = 0;
+static const int32_t TKIND_INTERFACE = 3;
+static const int32_t TKIND_DISPATCH = 4;
+static const int32_t TKIND_COCLASS = 5;
+static const int32_t INVOKE_PROPERTYGET = 2;
+static const uint16_t PARAMFLAG_FIN = 1;
+static const uint16_t PARAMFLAG_FOUT = 2;
+static const uint16_t PARAMFLAG_FRETVAL = 8;
+
+static SnapshotTypeDesc typeDesc(uint16_t nVt, uint32_t nHrefType = 0)
+{
+    SnapshotTypeDesc aDesc;
+    aDesc.mnVt = nVt;
+    aDesc.mnHrefType = nHrefType;
+    return aDesc;
+}
+
+static SnapshotTypeDesc pointerTo(const SnapshotTypeDesc& rInner)
+{
+    SnapshotTypeDesc aDesc = typeDesc(VT_PTR);
+    aDesc.mpInner = std::make_shared<SnapshotTypeDesc>(rInner);
+    return aDesc;
+}
+
+static SnapshotType newType(const std::string& rName, int32_t nTypeKind, uint8_t nGuidByte)
+{
+    SnapshotType aType = {};
+    aType.msName = rName;
+    for (int i = 0; i < 16; ++i)
+        aType.maGuid[i] = (uint8_t)(nGuidByte + i);
+    aType.mnTypeKind = nTypeKind;
+    aType.mnMajorVerNum = 8;
+    aType.mnMinorVerNum = 7;
+    aType.maAlias = typeDesc(0);
+    return aType;
+}
+
+static TypeLibSnapshot sampleSnapshot()
+{
+    TypeLibSnapshot aSnapshot;
+
+    // 0: enum WdSaveFormat { wdFormatDocument = 0, wdFormatPDF = 17 }
+    SnapshotType aEnum = newType("WdSaveFormat", TKIND_ENUM, 0x10);
+    for (int32_t nValue : { 0, 17 })
+    {
+        SnapshotVar aVar = {};
+        aVar.mnMemberId = 0x40000000 + nValue;
+        aVar.mnVarKind = 2;
+        aVar.mnValueType = VT_I4;
+        aVar.mnValue = (uint64_t)nValue;
+        aVar.maElem.maType = typeDesc(VT_I4);
+        aEnum.maVars.push_back(aVar);
+        aEnum.maMembers.push_back(
+            { aVar.mnMemberId, nValue ? "wdFormatPDF" : "wdFormatDocument", {} });
+    }
+    aSnapshot.maTypes.push_back(aEnum);
+
+    // 1: The dual interface Document, with HRESULT Name([out, retval] BSTR*) and
+    // HRESULT SaveAs([in] WdSaveFormat Format, [in] long Extra[2][3])
+    SnapshotType aInterface = newType("Document", TKIND_INTERFACE, 0x20);
+    aInterface.mnTypeFlags = 0x1040;
+    aInterface.mnSizeVft = 9;
+    {
+        SnapshotFunc aName = {};
+        aName.mnMemberId = 0;
+        aName.mnFuncKind = 4;
+        aName.mnInvKind = INVOKE_PROPERTYGET;
+        aName.mnCallConv = 4;
+        aName.mnVft = 7;
+        aName.maReturn.maType = typeDesc(VT_HRESULT);
+        aName.maParams.push_back(
+            { pointerTo(typeDesc(VT_BSTR)), (uint16_t)(PARAMFLAG_FOUT | PARAMFLAG_FRETVAL) });
+        aInterface.maFuncs.push_back(aName);
+        aInterface.maMembers.push_back({ 0, "Name", { "Name" } });
+
+        SnapshotFunc aSaveAs = {};
+        aSaveAs.mnMemberId = 0x177;
+        aSaveAs.mnFuncKind = 4;
+        aSaveAs.mnInvKind = 1;
+        aSaveAs.mnCallConv = 4;
+        aSaveAs.mnParamsOpt = -1;
+        aSaveAs.mnVft = 8;
+        aSaveAs.mnFuncFlags = 0x40;
+        aSaveAs.maReturn.maType = typeDesc(VT_HRESULT);
+        aSaveAs.maParams.push_back({ typeDesc(VT_USERDEFINED, 0x1234), PARAMFLAG_FIN });
+        SnapshotTypeDesc aArray = typeDesc(VT_CARRAY);
+        aArray.maBounds = { { 0, 2 }, { -1, 3 } };
+        aArray.mpInner = std::make_shared<SnapshotTypeDesc>(typeDesc(VT_I4));
+        aSaveAs.maParams.push_back({ aArray, PARAMFLAG_FIN });
+        aInterface.maFuncs.push_back(aSaveAs);
+        aInterface.maMembers.push_back(
+            { 0x177, "SaveAs", { "SaveAs", "Format", "Extra" } });
+    }
+    aInterface.maImplTypes.push_back({ 0x5678, 0 });
+    aInterface.maRefs = { { 0x1234, 0 } };
+    aSnapshot.maTypes.push_back(aInterface);
+
+    // 2: Its dispinterface
+    SnapshotType aDispatch = aInterface;
+    aDispatch.mnTypeKind = TKIND_DISPATCH;
+    aDispatch.mbHasDualInterface = true;
+    aDispatch.mnDualHrefType = 0xFFFFFFFE;
+    aDispatch.maRefs = { { 0x1234, 0 }, { 0xFFFFFFFE, 1 } };
+    aSnapshot.maTypes.push_back(aDispatch);
+
+    // 3: A coclass with Document as the default interface and an event interface
+    SnapshotType aCoclass = newType("DocumentClass", TKIND_COCLASS, 0x30);
+    aCoclass.maImplTypes = { { 0x100, 1 }, { 0x200, 3 } };
+    aCoclass.maRefs = { { 0x100, 2 } };
+    aCoclass.maMembers.push_back({ -1, "DocumentClass", {} });
+    aSnapshot.maTypes.push_back(aCoclass);
+
+    // An unused type from another library that the first refers to
+    SnapshotType aOther = newType("IDispatch", TKIND_INTERFACE, 0x40);
+    aOther.maAlias = pointerTo(typeDesc(VT_DISPATCH));
+    aSnapshot.maTypes.push_back(aOther);
+
+    aSnapshot.maLibraries.push_back({ "C:\\Office\\MSWORD.OLB", "Word", { 0, 1, 2, 3 } });
+    aSnapshot.maLibraries.push_back({ "stdole2.tlb", "stdole", { 4 } });
+
+    return aSnapshot;
+}
+
+static std::string written(const TypeLibSnapshot& rSnapshot)
+{
+    std::ostringstream aStream;
+    rSnapshot.write(aStream);
+    return aStream.str();
+}
+
+static bool read(const std::string& rData, TypeLibSnapshot& rSnapshot, std::string& rError)
+{
+    std::istringstream aStream(rData);
+    return rSnapshot.read(aStream, rError);
+}
+
+static void testRoundTrip()
+{
+    const std::string sData = written(sampleSnapshot());
+    CHECK(sData.compare(0, 8, "COLEATTL") == 0);
+
+    TypeLibSnapshot aSnapshot;
+    std::string sError;
+    CHECK(read(sData, aSnapshot, sError));
+    CHECK(sError.empty());
+
+    // Everything that was written is read back
+    CHECK(written(aSnapshot) == sData);
+
+    CHECK(aSnapshot.maTypes.size() == 5);
+    CHECK(aSnapshot.findLibrary("stdole2.tlb") == &aSnapshot.maLibraries[1]);
+    CHECK(aSnapshot.findLibrary("MSWORD.OLB") == nullptr);
+
+    const SnapshotType& rEnum = aSnapshot.maTypes[0];
+    CHECK(rEnum.msName == "WdSaveFormat");
+    CHECK(rEnum.maVars.size() == 2 && rEnum.maVars[1].mnValue == 17);
+    CHECK(rEnum.maMembers[1].msDocName == "wdFormatPDF");
+
+    const SnapshotType& rInterface = aSnapshot.maTypes[1];
+    CHECK(rInterface.maGuid[0] == 0x20 && rInterface.maGuid[15] == 0x2F);
+    CHECK(rInterface.mnSizeVft == 9);
+    CHECK(rInterface.maFuncs.size() == 2);
+    const SnapshotFunc& rName = rInterface.maFuncs[0];
+    CHECK(rName.maParams.size() == 1);
+    CHECK(rName.maParams[0].maType.mnVt == VT_PTR);
+    CHECK(rName.maParams[0].maType.mpInner && rName.maParams[0].maType.mpInner->mnVt == VT_BSTR);
+    CHECK(rName.maParams[0].mnParamFlags == (PARAMFLAG_FOUT | PARAMFLAG_FRETVAL));
+    const SnapshotFunc& rSaveAs = rInterface.maFuncs[1];
+    CHECK(rSaveAs.mnParamsOpt == -1);
+    CHECK(rSaveAs.maParams[0].maType.mnHrefType == 0x1234);
+    CHECK(rSaveAs.maParams[1].maType.maBounds.size() == 2);
+    CHECK(rSaveAs.maParams[1].maType.maBounds[1].first == -1);
+    CHECK(rInterface.maMembers[1].maNames.size() == 3);
+    CHECK(rInterface.maMembers[1].maNames[2] == "Extra");
+
+    const SnapshotType& rDispatch = aSnapshot.maTypes[2];
+    CHECK(rDispatch.mbHasDualInterface && rDispatch.mnDualHrefType == 0xFFFFFFFE);
+    CHECK(rDispatch.maRefs.size() == 2 && rDispatch.maRefs[1].second == 1);
+
+    CHECK(aSnapshot.maTypes[3].maImplTypes[1].mnFlags == 3);
+    CHECK(aSnapshot.maTypes[4].maAlias.mpInner->mnVt == VT_DISPATCH);
+}
+
+static void testBadSnapshots()
+{
+    const std::string sData = written(sampleSnapshot());
+    TypeLibSnapshot aSnapshot;
+    std::string sError;
+
+    CHECK(!read("", aSnapshot, sError));
+    CHECK(sError == "not a type library snapshot");
+
+    std::string sBadMagic = sData;
+    sBadMagic[7] = 'X';
+    CHECK(!read(sBadMagic, aSnapshot, sError));
+    CHECK(sError == "not a type library snapshot");
+
+    std::string sNewer = sData;
+    sNewer[8] = (char)(TYPELIB_SNAPSHOT_VERSION + 1);
+    CHECK(!read(sNewer, aSnapshot, sError));
+    CHECK(sError == "snapshot of version 3, expected version 2");
+
+    // Whatever the cut, never more than "truncated"
+    for (size_t n = sizeof(TYPELIB_SNAPSHOT_MAGIC) + 4; n < sData.size(); ++n)
+    {
+        sError.clear();
+        CHECK(!read(sData.substr(0, n), aSnapshot, sError));
+        CHECK(sError == "truncated");
+    }
+
+    // A reference to a type that isn't there
+    TypeLibSnapshot aBad = sampleSnapshot();
+    aBad.maTypes[3].maRefs[0].second = 5;
+    CHECK(!read(written(aBad), aSnapshot, sError));
+    CHECK(sError == "bad type index in DocumentClass");
+
+    aBad = sampleSnapshot();
+    aBad.maLibraries[1].maTypes[0] = 99;
+    CHECK(!read(written(aBad), aSnapshot, sError));
+    CHECK(sError == "bad type index in stdole");
+}
+
+int main()
+{
+    testRoundTrip();
+    testBadSnapshots();
+    return checkResult("typelibsnapshot");
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab cinoptions=b1,g0,N-s cinkeys+=0=break: */